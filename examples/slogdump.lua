@@ -0,0 +1,19 @@
+-- 把结构化日志（配置 logbinary）解码成与文本日志相同的格式
+-- usage : 3rd/lua/lua examples/slogdump.lua skynet.slog
+package.path = "lualib/?.lua"
+
+if _VERSION ~= "Lua 5.4" then
+	error "Use lua 5.4"
+end
+
+local slogreader = require "skynet.slogreader"
+
+local filename = ...
+if not filename then
+	print "usage : lua examples/slogdump.lua <logbinary file>"
+	return
+end
+
+for ti, source, text in slogreader.records(filename) do
+	print(string.format("%s [:%08x] %s", slogreader.timestring(ti), source, text))
+end
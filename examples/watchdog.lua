@@ -42,6 +42,11 @@ function SOCKET.warning(fd, size)
 	print("socket warning", fd, size)
 end
 
+function SOCKET.writable(fd, writable)
+	-- gate 配置了 send_high 时，发送队列越过高水位 / 回落到低水位的通知
+	print("socket writable", fd, writable)
+end
+
 function SOCKET.data(fd, msg)
 end
 
@@ -5,22 +5,27 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "skynet.h"
+#include "skynet_compress.h"
 
 /*
 	uint32_t/string addr 
 	uint32_t/session session
 	lightuserdata msg
 	uint32_t sz
+	integer version (optional) : 握手协商的版本 1/2/3 ，也可以是 boolean （true 为 2）
+	integer compress (optional) : 压缩阈值，握手时协商，0 或 nil 不压缩
 
 	return 
 		string request
 		uint32_t next_session
  */
 
-#define TEMP_LENGTH 0x8200
+#define HEAD_LENGTH 0x200
 #define MULTI_PART 0x8000
+#define MULTI_PART_V2 0x800000
 
 static void
 fill_uint32(uint8_t * buf, uint32_t n) {
@@ -30,11 +35,66 @@ fill_uint32(uint8_t * buf, uint32_t n) {
 	buf[3] = (n >> 24) & 0xff;
 }
 
-static void
-fill_header(lua_State *L, uint8_t *buf, int sz) {
+static int
+fill_header(uint8_t *buf, uint32_t sz, int version) {
+	if (version >= 2) {
+		buf[0] = (sz >> 24) & 0xff;
+		buf[1] = (sz >> 16) & 0xff;
+		buf[2] = (sz >> 8) & 0xff;
+		buf[3] = sz & 0xff;
+		return 4;
+	}
 	assert(sz < 0x10000);
 	buf[0] = (sz >> 8) & 0xff;
 	buf[1] = sz & 0xff;
+	return 2;
+}
+
+static inline uint32_t
+part_size(int version) {
+	return version >= 2 ? MULTI_PART_V2 : MULTI_PART;
+}
+
+static int
+get_version(lua_State *L, int index) {
+	if (lua_isinteger(L, index)) {
+		int version = (int)lua_tointeger(L, index);
+		return version < 1 ? 1 : version;
+	}
+	return lua_toboolean(L, index) ? 2 : 1;
+}
+
+// 长度不小于阈值的消息尝试压缩，成功时返回新的缓冲（调用方释放），压不下去返回 NULL
+static void *
+compress_msg(const void *msg, uint32_t sz, lua_Integer threshold, uint32_t *csz) {
+	if (threshold <= 0 || sz < threshold)
+		return NULL;
+	void * buffer = skynet_malloc(sz);
+	size_t n = skynet_compress(msg, sz, buffer, sz);
+	if (n == 0) {
+		skynet_free(buffer);
+		return NULL;
+	}
+	*csz = (uint32_t)n;
+	return buffer;
+}
+
+// 包头 + head + msg 拼成一个 string 压栈，v3 的请求 head 放在 msg 后面
+static void
+push_package(lua_State *L, int version, const uint8_t *head, size_t headsz, const void *msg, size_t sz) {
+	luaL_Buffer b;
+	uint8_t *buf = (uint8_t *)luaL_buffinitsize(L, &b, headsz + sz + 4);
+	int h = fill_header(buf, (uint32_t)(headsz + sz), version);
+	if (version >= 3) {
+		if (sz > 0)
+			memcpy(buf + h, msg, sz);
+		memcpy(buf + h + sz, head, headsz);
+	} else {
+		memcpy(buf + h, head, headsz);
+		if (sz > 0)
+			memcpy(buf + h + headsz, msg, sz);
+	}
+	luaL_pushresultsize(&b, h + headsz + sz);
 }
 
 /*
@@ -79,34 +139,61 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 		WORD stringsz + 1
 		BYTE 4
 		STRING tag
+
+	v2 : 握手成功后的连接，包头换成 DWORD (big-endian) ，分片大小从 0x8000 提高到 0x800000 (8M) ，
+	包的内容不变。接收方在网络线程按 4 字节包头分包 (socket.frame) ，1K - 8M 的消息都只有一个包。
+
+	compressed (握手时协商) : 单包的请求 BYTE 0 / 0x80 加上 0x20 ，session 后面多一个 DWORD 原长，
+	PADDING 换成压缩后的 msg 。分片的请求不压缩。
+
+	v3 : 在 v2 的基础上，请求的 msg 放在包的开头，其余字段跟在后面，类型是最后一个字节：
+		msg addr session [rawsz] type
+		msg name namelen session [rawsz] type
+		addr session sz type / name namelen session sz type	; multi req
+		msgpart session type
+		tag type
+	接收方（service_clusteragent.c）不用拷贝就能把收到的包直接交给本地服务。回应的格式不变。
+
+	v4 : 在 v3 的基础上增加期限，与 trace 一样作用于紧跟着的下一个请求：
+		DWORD timeout DWORD clock BYTE 5
+	timeout 为剩余的毫秒数，clock 为发送方打包时的单调时钟（毫秒，取低 32 位）。
+	两边的时钟不同步，接收方只用 clock 的变化估计请求在路上和队列里等了多久，见 service_clusteragent.c 。
  */
 static int
-packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int version, lua_Integer compress) {
 	uint32_t addr = (uint32_t)lua_tointeger(L,1);
-	uint8_t buf[TEMP_LENGTH];
-	if (sz < MULTI_PART) {
-		fill_header(L, buf, sz+9);
-		buf[2] = 0;
-		fill_uint32(buf+3, addr);
-		fill_uint32(buf+7, is_push ? 0 : (uint32_t)session);
-		memcpy(buf+11,msg,sz);
-
-		lua_pushlstring(L, (const char *)buf, sz+11);
+	uint8_t head[HEAD_LENGTH];
+	int tail = version >= 3;
+	uint8_t * h = tail ? head : head + 1;
+	if (sz < part_size(version)) {
+		uint32_t csz;
+		void * cmsg = compress_msg(msg, sz, compress, &csz);
+		uint8_t type = cmsg ? 0x20 : 0;
+		fill_uint32(h, addr);
+		fill_uint32(h+4, is_push ? 0 : (uint32_t)session);
+		if (cmsg)
+			fill_uint32(h+8, sz);
+		head[tail ? (cmsg ? 12 : 8) : 0] = type;
+		if (cmsg) {
+			push_package(L, version, head, 13, cmsg, csz);
+			skynet_free(cmsg);
+		} else {
+			push_package(L, version, head, 9, msg, sz);
+		}
 		return 0;
 	} else {
-		int part = (sz - 1) / MULTI_PART + 1;
-		fill_header(L, buf, 13);
-		buf[2] = is_push ? 0x41 : 1;	// multi push or request
-		fill_uint32(buf+3, addr);
-		fill_uint32(buf+7, (uint32_t)session);
-		fill_uint32(buf+11, sz);
-		lua_pushlstring(L, (const char *)buf, 15);
+		int part = (sz - 1) / part_size(version) + 1;
+		fill_uint32(h, addr);
+		fill_uint32(h+4, (uint32_t)session);
+		fill_uint32(h+8, sz);
+		head[tail ? 12 : 0] = is_push ? 0x41 : 1;	// multi push or request
+		push_package(L, version, head, 13, NULL, 0);
 		return part;
 	}
 }
 
 static int
-packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int version, lua_Integer compress) {
 	size_t namelen = 0;
 	const char *name = lua_tolstring(L, 1, &namelen);
 	if (name == NULL || namelen < 1 || namelen > 255) {
@@ -118,50 +205,64 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 		}
 	}
 
-	uint8_t buf[TEMP_LENGTH];
-	if (sz < MULTI_PART) {
-		fill_header(L, buf, sz+6+namelen);
-		buf[2] = 0x80;
-		buf[3] = (uint8_t)namelen;
-		memcpy(buf+4, name, namelen);
-		fill_uint32(buf+4+namelen, is_push ? 0 : (uint32_t)session);
-		memcpy(buf+8+namelen,msg,sz);
-
-		lua_pushlstring(L, (const char *)buf, sz+8+namelen);
+	uint8_t head[HEAD_LENGTH];
+	int tail = version >= 3;
+	uint8_t * h;	// session 的位置
+	if (tail) {
+		memcpy(head, name, namelen);
+		head[namelen] = (uint8_t)namelen;
+		h = head + 1 + namelen;
+	} else {
+		head[1] = (uint8_t)namelen;
+		memcpy(head+2, name, namelen);
+		h = head + 2 + namelen;
+	}
+	if (sz < part_size(version)) {
+		uint32_t csz;
+		void * cmsg = compress_msg(msg, sz, compress, &csz);
+		uint8_t type = cmsg ? 0xa0 : 0x80;
+		fill_uint32(h, is_push ? 0 : (uint32_t)session);
+		if (cmsg)
+			fill_uint32(h+4, sz);
+		head[tail ? (cmsg ? 9 : 5) + namelen : 0] = type;
+		if (cmsg) {
+			push_package(L, version, head, 10+namelen, cmsg, csz);
+			skynet_free(cmsg);
+		} else {
+			push_package(L, version, head, 6+namelen, msg, sz);
+		}
 		return 0;
 	} else {
-		int part = (sz - 1) / MULTI_PART + 1;
-		fill_header(L, buf, 10+namelen);
-		buf[2] = is_push ? 0xc1 : 0x81;	// multi push or request
-		buf[3] = (uint8_t)namelen;
-		memcpy(buf+4, name, namelen);
-		fill_uint32(buf+4+namelen, (uint32_t)session);
-		fill_uint32(buf+8+namelen, sz);
-
-		lua_pushlstring(L, (const char *)buf, 12+namelen);
+		int part = (sz - 1) / part_size(version) + 1;
+		fill_uint32(h, (uint32_t)session);
+		fill_uint32(h+4, sz);
+		head[tail ? 9 + namelen : 0] = is_push ? 0xc1 : 0x81;	// multi push or request
+		push_package(L, version, head, 10+namelen, NULL, 0);
 		return part;
 	}
 }
 
 static void
-packreq_multi(lua_State *L, int session, void * msg, uint32_t sz) {
-	uint8_t buf[TEMP_LENGTH];
-	int part = (sz - 1) / MULTI_PART + 1;
+packreq_multi(lua_State *L, int session, void * msg, uint32_t sz, int version) {
+	uint8_t head[5];
+	int tail = version >= 3;
+	uint32_t partsz = part_size(version);
+	int part = (sz - 1) / partsz + 1;
 	int i;
 	char *ptr = msg;
+	fill_uint32(tail ? head : head+1, (uint32_t)session);
 	for (i=0;i<part;i++) {
 		uint32_t s;
-		if (sz > MULTI_PART) {
-			s = MULTI_PART;
-			buf[2] = 2;
+		uint8_t type;
+		if (sz > partsz) {
+			s = partsz;
+			type = 2;
 		} else {
 			s = sz;
-			buf[2] = 3;	// the last multi part
+			type = 3;	// the last multi part
 		}
-		fill_header(L, buf, s+5);
-		fill_uint32(buf+3, (uint32_t)session);
-		memcpy(buf+7, ptr, s);
-		lua_pushlstring(L, (const char *)buf, s+7);
+		head[tail ? 4 : 0] = type;
+		push_package(L, version, head, 5, ptr, s);
 		lua_rawseti(L, -2, i+1);
 		sz -= s;
 		ptr += s;
@@ -175,6 +276,8 @@ packrequest(lua_State *L, int is_push) {
 		return luaL_error(L, "Invalid request message");
 	}
 	uint32_t sz = (uint32_t)luaL_checkinteger(L,4);
+	int version = get_version(L,5);
+	lua_Integer compress = luaL_optinteger(L,6,0);
 	int session = luaL_checkinteger(L,2);
 	if (session <= 0) {
 		skynet_free(msg);
@@ -183,9 +286,9 @@ packrequest(lua_State *L, int is_push) {
 	int addr_type = lua_type(L,1);
 	int multipak;
 	if (addr_type == LUA_TNUMBER) {
-		multipak = packreq_number(L, session, msg, sz, is_push);
+		multipak = packreq_number(L, session, msg, sz, is_push, version, compress);
 	} else {
-		multipak = packreq_string(L, session, msg, sz, is_push);
+		multipak = packreq_string(L, session, msg, sz, is_push, version, compress);
 	}
 	uint32_t new_session = (uint32_t)session + 1;
 	if (new_session > INT32_MAX) {
@@ -194,7 +297,7 @@ packrequest(lua_State *L, int is_push) {
 	lua_pushinteger(L, new_session);
 	if (multipak) {
 		lua_createtable(L, multipak, 0);
-		packreq_multi(L, session, msg, sz);
+		packreq_multi(L, session, msg, sz, version);
 		skynet_free(msg);
 		return 3;
 	} else {
@@ -221,11 +324,40 @@ lpacktrace(lua_State *L) {
 	if (sz > 0x8000) {
 		return luaL_error(L, "trace tag is too long : %d", (int) sz);
 	}
-	uint8_t buf[TEMP_LENGTH];
-	buf[2] = 4;
-	fill_header(L, buf, sz+1);
-	memcpy(buf+3, tag, sz);
-	lua_pushlstring(L, (const char *)buf, sz+3);
+	uint8_t head[1] = { 4 };
+	push_package(L, get_version(L, 2), head, 1, tag, sz);
+	return 1;
+}
+
+static uint32_t
+clock_ms(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint32_t)((uint64_t)ti.tv_sec * 1000 + ti.tv_nsec / 1000000);
+}
+
+/*
+	integer timeout : 剩余的毫秒数
+	integer version
+	return string
+ */
+static int
+lpackdeadline(lua_State *L) {
+	lua_Integer timeout = luaL_checkinteger(L, 1);
+	int version = get_version(L, 2);
+	if (version < 4) {
+		return luaL_error(L, "deadline needs cluster v4 (version=%d)", version);
+	}
+	if (timeout < 0) {
+		timeout = 0;
+	} else if (timeout > INT32_MAX) {
+		timeout = INT32_MAX;
+	}
+	uint8_t head[9];
+	fill_uint32(head, (uint32_t)timeout);
+	fill_uint32(head+4, clock_ms());
+	head[8] = 5;
+	push_package(L, version, head, 9, NULL, 0);
 	return 1;
 }
 
@@ -253,8 +385,33 @@ return_buffer(lua_State *L, const char * buffer, int sz) {
 	lua_pushinteger(L, sz);
 }
 
+// 压缩的只有单包消息，原长一定小于一个分片；也不会超过压缩后长度的 COMPRESS_RATIO_MAX 倍
+static inline int
+valid_rawsz(uint32_t rawsz, int csz) {
+	return rawsz < MULTI_PART_V2 && rawsz <= (uint64_t)csz * COMPRESS_RATIO_MAX;
+}
+
+// DWORD 原长 + 压缩后的数据
+static void
+return_uncompress(lua_State *L, const char * buffer, int sz) {
+	if (sz < 4) {
+		luaL_error(L, "Invalid compressed cluster message (size=%d)", sz);
+	}
+	uint32_t rawsz = unpack_uint32((const uint8_t *)buffer);
+	if (!valid_rawsz(rawsz, sz - 4)) {
+		luaL_error(L, "Invalid compressed cluster message (rawsz=%u)", rawsz);
+	}
+	void * ptr = skynet_malloc(rawsz);
+	if (skynet_decompress(buffer + 4, sz - 4, ptr, rawsz) != (int)rawsz) {
+		skynet_free(ptr);
+		luaL_error(L, "Invalid compressed cluster message");
+	}
+	lua_pushlightuserdata(L, ptr);
+	lua_pushinteger(L, rawsz);
+}
+
 static int
-unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
+unpackreq_number(lua_State *L, const uint8_t * buf, int sz, int compressed) {
 	if (sz < 9) {
 		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
 	}
@@ -263,7 +420,11 @@ unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
 	lua_pushinteger(L, address);
 	lua_pushinteger(L, session);
 
-	return_buffer(L, (const char *)buf+9, sz-9);
+	if (compressed) {
+		return_uncompress(L, (const char *)buf+9, sz-9);
+	} else {
+		return_buffer(L, (const char *)buf+9, sz-9);
+	}
 	if (session == 0) {
 		lua_pushnil(L);
 		lua_pushboolean(L,1);	// is_push, no reponse
@@ -313,7 +474,7 @@ unpacktrace(lua_State *L, const char * buf, int sz) {
 }
 
 static int
-unpackreq_string(lua_State *L, const uint8_t * buf, int sz) {
+unpackreq_string(lua_State *L, const uint8_t * buf, int sz, int compressed) {
 	if (sz < 2) {
 		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
 	}
@@ -324,7 +485,11 @@ unpackreq_string(lua_State *L, const uint8_t * buf, int sz) {
 	lua_pushlstring(L, (const char *)buf+2, namesz);
 	uint32_t session = unpack_uint32(buf + namesz + 2);
 	lua_pushinteger(L, (uint32_t)session);
-	return_buffer(L, (const char *)buf+2+namesz+4, sz - namesz - 6);
+	if (compressed) {
+		return_uncompress(L, (const char *)buf+2+namesz+4, sz - namesz - 6);
+	} else {
+		return_buffer(L, (const char *)buf+2+namesz+4, sz - namesz - 6);
+	}
 	if (session == 0) {
 		lua_pushnil(L);
 		lua_pushboolean(L,1);	// is_push, no reponse
@@ -372,7 +537,9 @@ lunpackrequest(lua_State *L) {
 		return luaL_error(L, "Invalid req package. size == 0");
 	switch (msg[0]) {
 	case 0:
-		return unpackreq_number(L, (const uint8_t *)msg, sz);
+		return unpackreq_number(L, (const uint8_t *)msg, sz, 0);
+	case '\x20':
+		return unpackreq_number(L, (const uint8_t *)msg, sz, 1);	// compressed
 	case 1:
 		return unpackmreq_number(L, (const uint8_t *)msg, sz, 0);	// request
 	case '\x41':
@@ -383,7 +550,9 @@ lunpackrequest(lua_State *L) {
 	case 4:
 		return unpacktrace(L, msg, sz);
 	case '\x80':
-		return unpackreq_string(L, (const uint8_t *)msg, sz);
+		return unpackreq_string(L, (const uint8_t *)msg, sz, 0);
+	case '\xa0':
+		return unpackreq_string(L, (const uint8_t *)msg, sz, 1);	// compressed
 	case '\x81':
 		return unpackmreq_string(L, (const uint8_t *)msg, sz, 0 );	// request
 	case '\xc1':
@@ -403,17 +572,22 @@ lunpackrequest(lua_State *L) {
 		2: multi begin
 		3: multi part
 		4: multi end
+		5: ok (compressed)
 	PADDING msg
 		type = 0, error msg
 		type = 1, msg
 		type = 2, DWORD size
 		type = 3/4, msg
+		type = 5, DWORD size , compressed msg
+	v2 : DWORD size (big endian) , 分片大小 0x800000
  */
 /*
 	int session
 	boolean ok
 	lightuserdata msg
 	int sz
+	integer version (optional)
+	integer compress (optional)
 	return string response
  */
 static int
@@ -422,6 +596,11 @@ lpackresponse(lua_State *L) {
 	// clusterd.lua:command.socket call lpackresponse,
 	// and the msg/sz is return by skynet.rawcall , so don't free(msg)
 	int ok = lua_toboolean(L,2);
+	int version = get_version(L,5);
+	if (version > 2)
+		version = 2;	// 回应的格式 v3 没有变化
+	lua_Integer compress = luaL_optinteger(L,6,0);
+	uint32_t partsz = part_size(version);
 	void * msg;
 	size_t sz;
 	
@@ -432,41 +611,37 @@ lpackresponse(lua_State *L) {
 		sz = (size_t)luaL_checkinteger(L, 4);
 	}
 
+	uint8_t head[9];
+	fill_uint32(head, session);
 	if (!ok) {
-		if (sz > MULTI_PART) {
+		if (sz > partsz) {
 			// truncate the error msg if too long
-			sz = MULTI_PART;
+			sz = partsz;
 		}
 	} else {
-		if (sz > MULTI_PART) {
+		if (sz > partsz) {
 			// return 
-			int part = (sz - 1) / MULTI_PART + 1;
+			int part = (sz - 1) / partsz + 1;
 			lua_createtable(L, part+1, 0);
-			uint8_t buf[TEMP_LENGTH];
 
 			// multi part begin
-			fill_header(L, buf, 9);
-			fill_uint32(buf+2, session);
-			buf[6] = 2;
-			fill_uint32(buf+7, (uint32_t)sz);
-			lua_pushlstring(L, (const char *)buf, 11);
+			head[4] = 2;
+			fill_uint32(head+5, (uint32_t)sz);
+			push_package(L, version, head, 9, NULL, 0);
 			lua_rawseti(L, -2, 1);
 
 			char * ptr = msg;
 			int i;
 			for (i=0;i<part;i++) {
 				int s;
-				if (sz > MULTI_PART) {
-					s = MULTI_PART;
-					buf[6] = 3;
+				if (sz > partsz) {
+					s = partsz;
+					head[4] = 3;
 				} else {
 					s = sz;
-					buf[6] = 4;
+					head[4] = 4;
 				}
-				fill_header(L, buf, s+5);
-				fill_uint32(buf+2, session);
-				memcpy(buf+7,ptr,s);
-				lua_pushlstring(L, (const char *)buf, s+7);
+				push_package(L, version, head, 5, ptr, s);
 				lua_rawseti(L, -2, i+2);
 				sz -= s;
 				ptr += s;
@@ -475,13 +650,19 @@ lpackresponse(lua_State *L) {
 		}
 	}
 
-	uint8_t buf[TEMP_LENGTH];
-	fill_header(L, buf, sz+5);
-	fill_uint32(buf+2, session);
-	buf[6] = ok;
-	memcpy(buf+7,msg,sz);
-
-	lua_pushlstring(L, (const char *)buf, sz+7);
+	if (ok) {
+		uint32_t csz;
+		void * cmsg = compress_msg(msg, sz, compress, &csz);
+		if (cmsg) {
+			head[4] = 5;
+			fill_uint32(head+5, (uint32_t)sz);
+			push_package(L, version, head, 9, cmsg, csz);
+			skynet_free(cmsg);
+			return 1;
+		}
+	}
+	head[4] = ok;
+	push_package(L, version, head, 5, msg, sz);
 
 	return 1;
 }
@@ -526,6 +707,24 @@ lunpackresponse(lua_State *L) {
 		lua_pushlstring(L, buf+5, sz-5);
 		lua_pushboolean(L, 1);
 		return 4;
+	case 5: {	// ok (compressed)
+		if (sz < 9) {
+			return 0;
+		}
+		uint32_t rawsz = unpack_uint32((const uint8_t *)buf+5);
+		if (!valid_rawsz(rawsz, sz - 9)) {
+			return 0;
+		}
+		luaL_Buffer b;
+		char * ptr = luaL_buffinitsize(L, &b, rawsz);
+		if (skynet_decompress(buf+9, sz-9, ptr, rawsz) != (int)rawsz) {
+			return 0;
+		}
+		luaL_pushresultsize(&b, rawsz);
+		lua_pushboolean(L, 1);
+		lua_insert(L, -2);
+		return 3;
+	}
 	default:
 		return 0;
 	}
@@ -590,6 +789,27 @@ lconcat(lua_State *L) {
 	return 2;
 }
 
+// 本进程压缩的统计（cluster 和 harbor 共用）
+static int
+lcompressstat(lua_State *L) {
+	struct skynet_compress_stat stat;
+	skynet_compress_stat(&stat);
+	lua_createtable(L, 0, 6);
+	lua_pushinteger(L, stat.count);
+	lua_setfield(L, -2, "count");
+	lua_pushinteger(L, stat.raw);
+	lua_setfield(L, -2, "raw");
+	lua_pushinteger(L, stat.packed);
+	lua_setfield(L, -2, "packed");
+	lua_pushinteger(L, stat.pack_time);
+	lua_setfield(L, -2, "pack_time");
+	lua_pushinteger(L, stat.ucount);
+	lua_setfield(L, -2, "ucount");
+	lua_pushinteger(L, stat.utime);
+	lua_setfield(L, -2, "utime");
+	return 1;
+}
+
 static int
 lisname(lua_State *L) {
 	const char * name = lua_tostring(L, 1);
@@ -623,6 +843,7 @@ luaopen_skynet_cluster_core(lua_State *L) {
 		{ "packrequest", lpackrequest },
 		{ "packpush", lpackpush },
 		{ "packtrace", lpacktrace },
+		{ "packdeadline", lpackdeadline },
 		{ "unpackrequest", lunpackrequest },
 		{ "packresponse", lpackresponse },
 		{ "unpackresponse", lunpackresponse },
@@ -630,10 +851,17 @@ luaopen_skynet_cluster_core(lua_State *L) {
 		{ "concat", lconcat },
 		{ "isname", lisname },
 		{ "nodename", lnodename },
+		{ "compressstat", lcompressstat },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
 	luaL_newlib(L,l);
+	// 握手 : 用 v1 格式查询这个名字（参数为压缩阈值和支持的版本），新版本的对端回应协商的版本并切换到 v2 及以上，
+	// 旧版本的对端回应名字不存在
+	lua_pushlstring(L, "\0cluster.v2", sizeof("\0cluster.v2") - 1);
+	lua_setfield(L, -2, "hello");
+	lua_pushinteger(L, 4);
+	lua_setfield(L, -2, "version");
 
 	return 1;
 }
@@ -23,6 +23,9 @@
 #define TYPE_CLOSE 5
 #define TYPE_WARNING 6
 #define TYPE_INIT 7
+#define TYPE_WRITABLE 8
+
+#define QUEUE_METATABLE "skynet.netpack.queue"
 
 /*
 	Each package is uint16 + data , uint16 (serialized in big-endian) is the number of bytes comprising the data .
@@ -34,28 +37,44 @@ struct netpack {
 	void * buffer;
 };
 
+// 尚未收完的包，直接存放在 queue 的开放寻址表里，id 为 -1 表示空槽
 struct uncomplete {
-	struct netpack pack;
-	struct uncomplete * next;
+	int id;
 	int read;
 	int header;
+	int size;
+	void * buffer;
 };
 
+/*
+	queue 由 netpack.new 或第一次 filter 创建，userdata 本身不再搬家：
+	ring 是完整包的环形队列，容量为 2 的幂，满了原地翻倍；
+	hash 以 fd 为键保存半包，按 maxclient 预先分配，线性探测，O(1) 查找。
+ */
 struct queue {
 	int cap;
 	int head;
 	int tail;
-	struct uncomplete * hash[HASHSIZE];
-	struct netpack queue[QUEUESIZE];
+	struct netpack * ring;
+	int hash_cap;
+	int hash_n;
+	struct uncomplete * hash;
 };
 
+static int
+pow2(int n) {
+	int r = 1;
+	while (r < n)
+		r *= 2;
+	return r;
+}
+
 static void
-clear_list(struct uncomplete * uc) {
-	while (uc) {
-		skynet_free(uc->pack.buffer);
-		void * tmp = uc;
-		uc = uc->next;
-		skynet_free(tmp);
+init_hash(struct uncomplete * hash, int cap) {
+	int i;
+	for (i=0;i<cap;i++) {
+		hash[i].id = -1;
+		hash[i].buffer = NULL;
 	}
 }
 
@@ -66,118 +85,171 @@ lclear(lua_State *L) {
 		return 0;
 	}
 	int i;
-	for (i=0;i<HASHSIZE;i++) {
-		clear_list(q->hash[i]);
-		q->hash[i] = NULL;
-	}
-	if (q->head > q->tail) {
-		q->tail += q->cap;
+	for (i=0;i<q->hash_cap;i++) {
+		struct uncomplete * uc = &q->hash[i];
+		if (uc->id >= 0) {
+			skynet_free(uc->buffer);
+			uc->buffer = NULL;
+			uc->id = -1;
+		}
 	}
-	for (i=q->head;i<q->tail;i++) {
-		struct netpack *np = &q->queue[i % q->cap];
-		skynet_free(np->buffer);
+	q->hash_n = 0;
+	while (q->head != q->tail) {
+		skynet_free(q->ring[q->head].buffer);
+		q->head = (q->head + 1) & (q->cap - 1);
 	}
 	q->head = q->tail = 0;
 
 	return 0;
 }
 
-static inline int
-hash_fd(int fd) {
-	int a = fd >> 24;
-	int b = fd >> 12;
-	int c = fd;
-	return (int)(((uint32_t)(a + b + c)) % HASHSIZE);
+static int
+lqueue_gc(lua_State *L) {
+	struct queue * q = lua_touserdata(L, 1);
+	lclear(L);
+	skynet_free(q->ring);
+	skynet_free(q->hash);
+	q->ring = NULL;
+	q->hash = NULL;
+	q->cap = 0;
+	q->hash_cap = 0;
+	return 0;
+}
+
+static struct queue *
+new_queue(lua_State *L, int maxclient) {
+	struct queue *q = lua_newuserdatauv(L, sizeof(struct queue), 0);
+	q->cap = QUEUESIZE;
+	q->head = 0;
+	q->tail = 0;
+	q->ring = skynet_malloc(q->cap * sizeof(struct netpack));
+	// 负载不超过一半
+	q->hash_cap = pow2(maxclient * 2);
+	q->hash_n = 0;
+	q->hash = skynet_malloc(q->hash_cap * sizeof(struct uncomplete));
+	init_hash(q->hash, q->hash_cap);
+	luaL_setmetatable(L, QUEUE_METATABLE);
+	return q;
 }
 
 static struct uncomplete *
 find_uncomplete(struct queue *q, int fd) {
 	if (q == NULL)
 		return NULL;
-	int h = hash_fd(fd);
-	struct uncomplete * uc = q->hash[h];
-	if (uc == NULL)
-		return NULL;
-	if (uc->pack.id == fd) {
-		q->hash[h] = uc->next;
-		return uc;
-	}
-	struct uncomplete * last = uc;
-	while (last->next) {
-		uc = last->next;
-		if (uc->pack.id == fd) {
-			last->next = uc->next;
+	int mask = q->hash_cap - 1;
+	int h = fd & mask;
+	for (;;) {
+		struct uncomplete * uc = &q->hash[h];
+		if (uc->id == fd)
 			return uc;
+		if (uc->id < 0)
+			return NULL;
+		h = (h + 1) & mask;
+	}
+}
+
+// 线性探测的删除：把后面探测链上的元素往前挪，不留墓碑
+static void
+remove_uncomplete(struct queue *q, struct uncomplete * uc) {
+	int mask = q->hash_cap - 1;
+	int hole = uc - q->hash;
+	int i = hole;
+	for (;;) {
+		i = (i + 1) & mask;
+		struct uncomplete * next = &q->hash[i];
+		if (next->id < 0)
+			break;
+		int h = next->id & mask;
+		// next 的理想位置不在 (hole, i] 之间时，才能挪到 hole
+		if (((i - h) & mask) >= ((i - hole) & mask)) {
+			q->hash[hole] = *next;
+			hole = i;
+		}
+	}
+	q->hash[hole].id = -1;
+	q->hash[hole].buffer = NULL;
+	--q->hash_n;
+}
+
+static void
+expand_hash(struct queue *q) {
+	struct uncomplete * old = q->hash;
+	int old_cap = q->hash_cap;
+	q->hash_cap *= 2;
+	q->hash = skynet_malloc(q->hash_cap * sizeof(struct uncomplete));
+	init_hash(q->hash, q->hash_cap);
+	int mask = q->hash_cap - 1;
+	int i;
+	for (i=0;i<old_cap;i++) {
+		if (old[i].id >= 0) {
+			int h = old[i].id & mask;
+			while (q->hash[h].id >= 0)
+				h = (h + 1) & mask;
+			q->hash[h] = old[i];
 		}
-		last = uc;
 	}
-	return NULL;
+	skynet_free(old);
 }
 
 static struct queue *
 get_queue(lua_State *L) {
 	struct queue *q = lua_touserdata(L,1);
 	if (q == NULL) {
-		q = lua_newuserdatauv(L, sizeof(struct queue), 0);
-		q->cap = QUEUESIZE;
-		q->head = 0;
-		q->tail = 0;
-		int i;
-		for (i=0;i<HASHSIZE;i++) {
-			q->hash[i] = NULL;
-		}
+		q = new_queue(L, HASHSIZE / 2);
 		lua_replace(L, 1);
 	}
 	return q;
 }
 
 static void
-expand_queue(lua_State *L, struct queue *q) {
-	struct queue *nq = lua_newuserdatauv(L, sizeof(struct queue) + q->cap * sizeof(struct netpack), 0);
-	nq->cap = q->cap + QUEUESIZE;
-	nq->head = 0;
-	nq->tail = q->cap;
-	memcpy(nq->hash, q->hash, sizeof(nq->hash));
-	memset(q->hash, 0, sizeof(q->hash));
-	int i;
-	for (i=0;i<q->cap;i++) {
-		int idx = (q->head + i) % q->cap;
-		nq->queue[i] = q->queue[idx];
+expand_queue(struct queue *q) {
+	struct netpack * ring = skynet_malloc(q->cap * 2 * sizeof(struct netpack));
+	int n = 0;
+	while (q->head != q->tail) {
+		ring[n++] = q->ring[q->head];
+		q->head = (q->head + 1) & (q->cap - 1);
 	}
-	q->head = q->tail = 0;
-	lua_replace(L,1);
+	skynet_free(q->ring);
+	q->ring = ring;
+	q->cap *= 2;
+	q->head = 0;
+	q->tail = n;
 }
 
 static void
 push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
 	// 中文注释：当同一个 fd 在一次 epoll 事件中带来多个包时，
-	// 这里会把剩余数据全部入队，等待上层通过 netpack.pop 逐条取出。
+	// 这里会把剩余数据全部入队，等待上层通过 netpack.pop / netpack.popall 取出。
 	if (clone) {
 		void * tmp = skynet_malloc(size);
 		memcpy(tmp, buffer, size);
 		buffer = tmp;
 	}
 	struct queue *q = get_queue(L);
-	struct netpack *np = &q->queue[q->tail];
-	if (++q->tail >= q->cap)
-		q->tail -= q->cap;
+	if (((q->tail + 1) & (q->cap - 1)) == q->head) {
+		expand_queue(q);
+	}
+	struct netpack *np = &q->ring[q->tail];
+	q->tail = (q->tail + 1) & (q->cap - 1);
 	np->id = fd;
 	np->buffer = buffer;
 	np->size = size;
-	if (q->head == q->tail) {
-		expand_queue(L, q);
-	}
 }
 
 static struct uncomplete *
 save_uncomplete(lua_State *L, int fd) {
 	struct queue *q = get_queue(L);
-	int h = hash_fd(fd);
-	struct uncomplete * uc = skynet_malloc(sizeof(struct uncomplete));
+	if ((q->hash_n + 1) * 2 > q->hash_cap) {
+		expand_hash(q);
+	}
+	int mask = q->hash_cap - 1;
+	int h = fd & mask;
+	while (q->hash[h].id >= 0)
+		h = (h + 1) & mask;
+	struct uncomplete * uc = &q->hash[h];
 	memset(uc, 0, sizeof(*uc));
-	uc->next = q->hash[h];
-	uc->pack.id = fd;
-	q->hash[h] = uc;
+	uc->id = fd;
+	++q->hash_n;
 
 	return uc;
 }
@@ -203,9 +275,9 @@ push_more(lua_State *L, int fd, uint8_t *buffer, int size) {
 	if (size < pack_size) {
 		struct uncomplete * uc = save_uncomplete(L, fd);
 		uc->read = size;
-		uc->pack.size = pack_size;
-		uc->pack.buffer = skynet_malloc(pack_size);
-		memcpy(uc->pack.buffer, buffer, size);
+		uc->size = pack_size;
+		uc->buffer = skynet_malloc(pack_size);
+		memcpy(uc->buffer, buffer, size);
 		return;
 	}
 	push_data(L, fd, buffer, pack_size, 1);
@@ -222,8 +294,8 @@ close_uncomplete(lua_State *L, int fd) {
 	struct queue *q = lua_touserdata(L,1);
 	struct uncomplete * uc = find_uncomplete(q, fd);
 	if (uc) {
-		skynet_free(uc->pack.buffer);
-		skynet_free(uc);
+		skynet_free(uc->buffer);
+		remove_uncomplete(q, uc);
 	}
 }
 
@@ -242,33 +314,31 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 			pack_size |= uc->header << 8 ;
 			++buffer;
 			--size;
-			uc->pack.size = pack_size;
-			uc->pack.buffer = skynet_malloc(pack_size);
+			uc->size = pack_size;
+			uc->buffer = skynet_malloc(pack_size);
 			uc->read = 0;
 		}
-		int need = uc->pack.size - uc->read;
+		int need = uc->size - uc->read;
 		if (size < need) {
-			memcpy(uc->pack.buffer + uc->read, buffer, size);
+			memcpy((uint8_t *)uc->buffer + uc->read, buffer, size);
 			uc->read += size;
-			int h = hash_fd(fd);
-			uc->next = q->hash[h];
-			q->hash[h] = uc;
 			return 1;
 		}
-		memcpy(uc->pack.buffer + uc->read, buffer, need);
+		memcpy((uint8_t *)uc->buffer + uc->read, buffer, need);
 		buffer += need;
 		size -= need;
+		void * pack = uc->buffer;
+		int pack_size = uc->size;
+		remove_uncomplete(q, uc);
 		if (size == 0) {
 			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
 			lua_pushinteger(L, fd);
-			lua_pushlightuserdata(L, uc->pack.buffer);
-			lua_pushinteger(L, uc->pack.size);
-			skynet_free(uc);
+			lua_pushlightuserdata(L, pack);
+			lua_pushinteger(L, pack_size);
 			return 5;
 		}
 		// more data
-		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0);
-		skynet_free(uc);
+		push_data(L, fd, pack, pack_size, 0);
 		push_more(L, fd, buffer, size);
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
@@ -287,9 +357,9 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		if (size < pack_size) {
 			struct uncomplete * uc = save_uncomplete(L, fd);
 			uc->read = size;
-			uc->pack.size = pack_size;
-			uc->pack.buffer = skynet_malloc(pack_size);
-			memcpy(uc->pack.buffer, buffer, size);
+			uc->size = pack_size;
+			uc->buffer = skynet_malloc(pack_size);
+			memcpy(uc->buffer, buffer, size);
 			return 1;
 		}
 		if (size == pack_size) {
@@ -321,6 +391,22 @@ filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
 	return ret;
 }
 
+// 分帧模式（socket.frame(fd, 2)）：buffer 中都是完整的包，不会产生 uncomplete
+static int
+filter_frame(lua_State *L, int fd, uint8_t * buffer, int size) {
+	int pack_size = read_size(buffer);
+	if (pack_size + 2 == size) {
+		// just one package, remove the header and reuse the buffer
+		memmove(buffer, buffer + 2, pack_size);
+		lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
+		lua_pushinteger(L, fd);
+		lua_pushlightuserdata(L, buffer);
+		lua_pushinteger(L, pack_size);
+		return 5;
+	}
+	return filter_data(L, fd, buffer, size);
+}
+
 static void
 pushstring(lua_State *L, const char * msg, int size) {
 	if (msg) {
@@ -359,6 +445,8 @@ lfilter(lua_State *L) {
 		// ignore listen id (message->id)
 		assert(size == -1);	// never padding string
 		return filter_data(L, message->id, (uint8_t *)buffer, message->ud);
+	case SKYNET_SOCKET_TYPE_FRAME:
+		return filter_frame(L, message->id, (uint8_t *)buffer, message->ud);
 	case SKYNET_SOCKET_TYPE_CONNECT:
 		lua_pushvalue(L, lua_upvalueindex(TYPE_INIT));
 		lua_pushinteger(L, message->id);
@@ -389,6 +477,11 @@ lfilter(lua_State *L) {
 		lua_pushinteger(L, message->id);
 		lua_pushinteger(L, message->ud);
 		return 4;
+	case SKYNET_SOCKET_TYPE_WRITABLE:
+		lua_pushvalue(L, lua_upvalueindex(TYPE_WRITABLE));
+		lua_pushinteger(L, message->id);
+		lua_pushboolean(L, message->ud);
+		return 4;
 	default:
 		// never get here
 		return 1;
@@ -407,10 +500,8 @@ lpop(lua_State *L) {
 	struct queue * q = lua_touserdata(L, 1);
 	if (q == NULL || q->head == q->tail)
 		return 0;
-	struct netpack *np = &q->queue[q->head];
-	if (++q->head >= q->cap) {
-		q->head = 0;
-	}
+	struct netpack *np = &q->ring[q->head];
+	q->head = (q->head + 1) & (q->cap - 1);
 	lua_pushinteger(L, np->id);
 	lua_pushlightuserdata(L, np->buffer);
 	lua_pushinteger(L, np->size);
@@ -418,6 +509,48 @@ lpop(lua_State *L) {
 	return 3;
 }
 
+/*
+	userdata queue
+	table batch
+	return
+		integer n	(batch[3*i-2], batch[3*i-1], batch[3*i] are fd, msg, size of i-th package)
+ */
+static int
+lpopall(lua_State *L) {
+	struct queue * q = lua_touserdata(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int n = 0;
+	if (q) {
+		while (q->head != q->tail) {
+			struct netpack *np = &q->ring[q->head];
+			q->head = (q->head + 1) & (q->cap - 1);
+			lua_pushinteger(L, np->id);
+			lua_rawseti(L, 2, n * 3 + 1);
+			lua_pushlightuserdata(L, np->buffer);
+			lua_rawseti(L, 2, n * 3 + 2);
+			lua_pushinteger(L, np->size);
+			lua_rawseti(L, 2, n * 3 + 3);
+			++n;
+		}
+	}
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+/*
+	integer maxclient
+	return
+		userdata queue
+ */
+static int
+lnew(lua_State *L) {
+	int maxclient = luaL_optinteger(L, 1, HASHSIZE / 2);
+	if (maxclient <= 0)
+		maxclient = HASHSIZE / 2;
+	new_queue(L, maxclient);
+	return 1;
+}
+
 /*
 	string msg | lightuserdata/integer
 
@@ -477,12 +610,19 @@ LUAMOD_API int
 luaopen_skynet_netpack(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg l[] = {
+		{ "new", lnew },
 		{ "pop", lpop },
+		{ "popall", lpopall },
 		{ "pack", lpack },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
 		{ NULL, NULL },
 	};
+	if (luaL_newmetatable(L, QUEUE_METATABLE)) {
+		lua_pushcfunction(L, lqueue_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_pop(L, 1);
 	luaL_newlib(L,l);
 
 	// the order is same with macros : TYPE_* (defined top)
@@ -493,8 +633,9 @@ luaopen_skynet_netpack(lua_State *L) {
 	lua_pushliteral(L, "close");
 	lua_pushliteral(L, "warning");
 	lua_pushliteral(L, "init");
+	lua_pushliteral(L, "writable");
 
-	lua_pushcclosure(L, lfilter, 7);
+	lua_pushcclosure(L, lfilter, 8);
 	lua_setfield(L, -2, "filter");
 
 	return 1;
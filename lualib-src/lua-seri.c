@@ -5,6 +5,7 @@
 #define LUA_LIB
 
 #include "skynet_malloc.h"
+#include "atomic.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -30,90 +31,210 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_SCHEMA 7
+// 按 schema 打包的表：整数 schema id，4 字节 schema 指纹，字段存在位图，然后按字段顺序写不带类型标记的值
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define BUFFER_SIZE 1024	// 线程缓冲区的初始大小
+#define BUFFER_KEEP (1024 * 1024)	// 打包结束后超过这个大小的线程缓冲区会被释放
 #define MAX_DEPTH 32
 
-// 块结构
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];  // 128 字节
+// 每个工作线程一块可增长的连续缓冲区，打包时直接写入，结束后只需一次 malloc + memcpy
+// （packstring 则不需要 malloc）。__pairs 元方法里可能再次调用 pack，此时线程缓冲区正在使用，
+// 改用临时分配的缓冲区
+struct thread_buffer {
+	char * buffer;
+	int cap;
+	int busy;
 };
 
-// 写入块结构
+static __thread struct thread_buffer T;
+
+// 写入缓冲区
 struct write_block {
-	struct block * head;     // 块链表头
-	struct block * current;  // 当前块
-	int len;                 // 总长度
-	int ptr;                 // 当前位置
-	int ptr;
+	char * buffer;
+	int len;                 // 已写入长度
+	int cap;
+	int shared;              // buffer 是否为线程缓冲区
+};
+
+// 解包时的键缓存，每个 lua_State 一份（放在注册表里）：
+//  - 哈希区的短字符串键按内容映射到已经驻留的 lua string，命中时不必再 lua_pushlstring
+//  - 同时记下以这个键开头的纯哈希表上次有多少个键值对，用作下次 lua_createtable 的预分配大小
+// 缓存的字符串放在 userdata 的 uservalue 表里，保证 str 指针一直有效
+#define KEY_CACHE_SIZE 256
+#define KEY_CACHE_MINLEN 64
+
+struct key_slot {
+	const char * str;
+	int len;
+	int hint;
+};
+
+struct key_cache {
+	struct key_slot slot[KEY_CACHE_SIZE];
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	struct key_cache * cache;
+	int anchor;	// 缓存字符串所在表的栈位置
+	int meta;	// 预留的栈位置，第一次遇到 schema 时放入 schema 元表的总表
+	int meta_ready;
+};
+
+// schema：启动时由 skynet.schema 注册，编译成下面的字段描述，进程内所有服务共享，只增不删。
+// schema id 只在本进程内有效，所以消息里同时带上由名字和布局算出的指纹：解包时 id 对应的指纹不符
+// （消息来自其他节点或写进了文件）就按指纹查找，找不到则报错，不会按错误的布局解析
+#define MAX_SCHEMA 4096
+
+enum {
+	FIELD_INTEGER,	// zigzag varint
+	FIELD_REAL,	// double
+	FIELD_BOOLEAN,	// 1 字节
+	FIELD_STRING,	// varint 长度 + 内容
+	FIELD_ANY,	// 普通的 seri 值
+	FIELD_SCHEMA,	// 嵌套的 schema，不带 id
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+struct schema_field {
+	char * name;
+	int len;
+	int type;
+	int array;	// 数组：varint 个数 + 各个元素
+	int sub;	// FIELD_SCHEMA 的 schema id
+};
+
+struct schema {
+	char * name;
+	uint32_t fingerprint;
+	int n;
+	struct schema_field field[1];
+};
+
+static struct {
+	ATOM_INT lock;
+	ATOM_INT n;
+	struct schema * s[MAX_SCHEMA];
+} S;
+
+static inline struct schema *
+schema_get(int id) {
+	if (id < 0 || id >= ATOM_LOAD(&S.n))
+		return NULL;
+	return S.s[id];
+}
+
+// 按 id 和指纹找 schema，返回本进程的 id ，没有时返回 -1
+static int
+schema_find(int id, uint32_t fingerprint) {
+	const struct schema * s = schema_get(id);
+	if (s && s->fingerprint == fingerprint)
+		return id;
+	int n = ATOM_LOAD(&S.n);
+	int i;
+	for (i=0;i<n;i++) {
+		if (S.s[i]->fingerprint == fingerprint)
+			return i;
+	}
+	return -1;
 }
 
-// 高效写入
+static void
+wb_grow(struct write_block *b, int sz) {
+	int cap = b->cap;
+	while (cap - b->len < sz) {
+		cap *= 2;
+	}
+	b->buffer = skynet_realloc(b->buffer, cap);
+	b->cap = cap;
+	if (b->shared) {
+		T.buffer = b->buffer;
+		T.cap = cap;
+	}
+}
+
+// 高效写入：容量不够时按 2 倍扩容
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-        // 分配新块
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-        // 单块写入
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-        // 跨块写入
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-        // 继续到下一块
-		goto _again;
+	if (b->cap - b->len < sz) {
+		wb_grow(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb) {
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	if (T.busy) {
+		wb->buffer = skynet_malloc(BUFFER_SIZE);
+		wb->cap = BUFFER_SIZE;
+		wb->shared = 0;
+		return;
+	}
+	if (T.buffer == NULL) {
+		T.buffer = skynet_malloc(BUFFER_SIZE);
+		T.cap = BUFFER_SIZE;
+	}
+	T.busy = 1;
+	wb->buffer = T.buffer;
+	wb->cap = T.cap;
+	wb->shared = 1;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	if (wb->shared) {
+		T.busy = 0;
+		if (T.cap > BUFFER_KEEP) {
+			// 偶尔打包的大消息不长期占用内存
+			skynet_free(T.buffer);
+			T.buffer = NULL;
+			T.cap = 0;
+		}
+	} else {
+		skynet_free(wb->buffer);
+	}
+	wb->buffer = NULL;
 	wb->len = 0;
+	wb->cap = 0;
+}
+
+// 打包出错时（__pairs 或元方法报错、内存不足）不一定经过 wb_free ，
+// 用 to-be-closed 变量在出错展开时归还线程缓冲区
+static int
+wb_close(lua_State *L) {
+	if (T.busy) {
+		struct write_block wb = { T.buffer, 0, T.cap, 1 };
+		wb_free(&wb);
+	}
+	return 0;
+}
+
+// 将要占用线程缓冲区时（在 wb_init 之前调用）把关闭器插到栈底，返回参数的起始偏移
+static int
+wb_guard(lua_State *L) {
+	if (T.busy)
+		return 0;
+	static int key;
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &key) == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_newuserdatauv(L, 0, 0);
+		lua_createtable(L, 0, 1);
+		lua_pushcfunction(L, wb_close);
+		lua_setfield(L, -2, "__close");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &key);
+	}
+	lua_insert(L, 1);
+	lua_toclose(L, 1);
+	return 1;
 }
 
 static void
@@ -121,6 +242,10 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->cache = NULL;
+	rb->anchor = 0;
+	rb->meta = 0;
+	rb->meta_ready = 0;
 }
 
 static const void *
@@ -298,7 +423,7 @@ wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 }
 
 static int
-wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
+wb_table(lua_State *L, struct write_block *wb, int index, int depth, int metapairs) {
 	if (!lua_checkstack(L, LUA_MINSTACK)) {
 		lua_pushstring(L, "out of memory");
 		return 1;
@@ -306,7 +431,7 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (index < 0) {
 		index = lua_gettop(L) + index + 1;
 	}
-	if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
+	if (metapairs && luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
 		return wb_table_metapairs(L, wb, index, depth);
 	} else {
 		int array_size = wb_table_array(L, wb, index, depth);
@@ -315,6 +440,172 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	}
 }
 
+static inline void
+wb_varint(struct write_block *wb, uint64_t v) {
+	uint8_t buf[10];
+	int n = 0;
+	while (v >= 0x80) {
+		buf[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (uint8_t)v;
+	wb_push(wb, buf, n);
+}
+
+// 表的元表中 __schema 字段给出的 schema id，没有时返回 -1
+static int
+schema_id(lua_State *L, int index) {
+	if (!lua_getmetatable(L, index))
+		return -1;
+	int id = -1;
+	if (lua_getfield(L, -1, "__schema") == LUA_TNUMBER) {
+		id = (int)lua_tointeger(L, -1);
+	}
+	lua_pop(L, 2);
+	return id;
+}
+
+static inline int
+field_index(const struct schema *s, const char * key, size_t sz, int guess) {
+	// 同样构造的表遍历顺序一般相同，先猜上一个字段的下一个
+	if (guess < s->n && s->field[guess].len == (int)sz && memcmp(s->field[guess].name, key, sz) == 0)
+		return guess;
+	int i;
+	for (i=0;i<s->n;i++) {
+		if (s->field[i].len == (int)sz && memcmp(s->field[i].name, key, sz) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int pack_schema(lua_State *L, struct write_block *wb, int index, const struct schema *s, int depth);
+
+// 按字段类型写一个值，类型不符返回 1
+static int
+pack_field_value(lua_State *L, struct write_block *wb, const struct schema_field *f, int index, int depth) {
+	switch (f->type) {
+	case FIELD_INTEGER: {
+		if (!lua_isinteger(L, index))
+			return 1;
+		lua_Integer v = lua_tointeger(L, index);
+		wb_varint(wb, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+		break;
+	}
+	case FIELD_REAL: {
+		if (lua_type(L, index) != LUA_TNUMBER)
+			return 1;
+		double v = lua_tonumber(L, index);
+		wb_push(wb, &v, sizeof(v));
+		break;
+	}
+	case FIELD_BOOLEAN: {
+		if (lua_type(L, index) != LUA_TBOOLEAN)
+			return 1;
+		uint8_t v = lua_toboolean(L, index);
+		wb_push(wb, &v, 1);
+		break;
+	}
+	case FIELD_STRING: {
+		if (lua_type(L, index) != LUA_TSTRING)
+			return 1;
+		size_t sz;
+		const char * str = lua_tolstring(L, index, &sz);
+		wb_varint(wb, sz);
+		wb_push(wb, str, (int)sz);
+		break;
+	}
+	case FIELD_ANY:
+		pack_one(L, wb, index, depth);
+		break;
+	case FIELD_SCHEMA:
+		if (lua_type(L, index) != LUA_TTABLE)
+			return 1;
+		return pack_schema(L, wb, index, S.s[f->sub], depth + 1);
+	}
+	return 0;
+}
+
+// 数组只接受 1..n 连续的整数键，遍历时顺带检查
+static int
+pack_field_array(lua_State *L, struct write_block *wb, const struct schema_field *f, int index, int depth) {
+	if (lua_type(L, index) != LUA_TTABLE)
+		return 1;
+	int n = lua_rawlen(L, index);
+	wb_varint(wb, n);
+	int i = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		++i;
+		if (!lua_isinteger(L, -2) || lua_tointeger(L, -2) != i || i > n)
+			return 1;
+		if (pack_field_value(L, wb, f, lua_gettop(L), depth + 1))
+			return 1;
+		lua_pop(L, 1);
+	}
+	return i != n;
+}
+
+// 按 schema 写出表的内容（不含 id），表里有 schema 之外的键或类型不符时返回 1，由调用方退回动态打包。
+// 只遍历一次表：把各字段的值按字段顺序放到栈上，再依次写出
+static int
+pack_schema(lua_State *L, struct write_block *wb, int index, const struct schema *s, int depth) {
+	if (depth > MAX_DEPTH || !lua_checkstack(L, s->n + LUA_MINSTACK))
+		return 1;
+	int base = lua_gettop(L);
+	lua_settop(L, base + s->n);
+	int guess = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		if (lua_type(L, -2) != LUA_TSTRING)
+			return 1;
+		size_t sz;
+		const char * key = lua_tolstring(L, -2, &sz);
+		int i = field_index(s, key, sz, guess);
+		if (i < 0)
+			return 1;
+		lua_replace(L, base + 1 + i);
+		guess = i + 1;
+	}
+	int bitmap = wb->len;
+	int bytes = (s->n + 7) / 8;
+	uint64_t zero = 0;
+	int i;
+	for (i=0;i<bytes;i+=sizeof(zero)) {
+		int n = bytes - i;
+		wb_push(wb, &zero, n < (int)sizeof(zero) ? n : (int)sizeof(zero));
+	}
+	for (i=0;i<s->n;i++) {
+		int value = base + 1 + i;
+		if (lua_isnil(L, value))
+			continue;
+		const struct schema_field *f = &s->field[i];
+		if (f->array ? pack_field_array(L, wb, f, value, depth) : pack_field_value(L, wb, f, value, depth))
+			return 1;
+		wb->buffer[bitmap + i / 8] |= 1 << (i % 8);
+	}
+	lua_settop(L, base);
+	return 0;
+}
+
+static int
+wb_schema(lua_State *L, struct write_block *wb, int index, int id, int depth) {
+	const struct schema * s = schema_get(id);
+	if (s == NULL)
+		return 1;
+	int top = lua_gettop(L);
+	int len = wb->len;
+	uint8_t n = COMBINE_TYPE(TYPE_SCHEMA, 0);
+	wb_push(wb, &n, 1);
+	wb_integer(wb, id);
+	wb_push(wb, &s->fingerprint, sizeof(s->fingerprint));
+	if (pack_schema(L, wb, index, s, depth)) {
+		lua_settop(L, top);
+		wb->len = len;
+		return 1;
+	}
+	return 0;
+}
+
 static void
 pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	if (depth > MAX_DEPTH) {
@@ -352,7 +643,12 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 		if (index < 0) {
 			index = lua_gettop(L) + index + 1;
 		}
-		if (wb_table(L, b, index, depth+1)) {
+		int id = schema_id(L, index);
+		if (id >= 0 && wb_schema(L, b, index, id, depth+1) == 0) {
+			break;
+		}
+		// 没有 schema 或不符合 schema 时动态打包
+		if (wb_table(L, b, index, depth+1, id < 0)) {
 			wb_free(b);
 			lua_error(L);
 		}
@@ -455,6 +751,82 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 }
 
 static void unpack_one(lua_State *L, struct read_block *rb);
+static void push_value(lua_State *L, struct read_block *rb, int type, int cookie);
+
+static inline int
+key_hash(const char * str, int len) {
+	// 键不长于 31 字节，只取长度和首尾几个字节，冲突只会导致缓存替换
+	uint32_t h = len;
+	if (len >= 4) {
+		uint32_t head, tail;
+		memcpy(&head, str, 4);
+		memcpy(&tail, str + len - 4, 4);
+		h ^= head * 0x9e3779b1u ^ tail * 0x85ebca77u;
+	} else {
+		int i;
+		for (i=0;i<len;i++) {
+			h = h * 31 + (uint8_t)str[i];
+		}
+	}
+	h ^= h >> 16;
+	return (h ^ (h >> 8)) & (KEY_CACHE_SIZE - 1);
+}
+
+// 在缓存中查找短字符串，返回命中的槽位，没有命中返回 -1
+static inline int
+key_find(struct key_cache * cache, const char * str, int len) {
+	int h = key_hash(str, len);
+	struct key_slot * s = &cache->slot[h];
+	if (s->len == len && s->str && memcmp(s->str, str, len) == 0)
+		return h;
+	return -1;
+}
+
+// 解出哈希区的一个键，返回所在的缓存槽位（不是可缓存的短字符串时返回 -1）
+static int
+unpack_key(lua_State *L, struct read_block *rb) {
+	const uint8_t * t = (const uint8_t *)rb_read(rb, 1);
+	if (t==NULL) {
+		invalid_stream(L, rb);
+	}
+	int type = *t & 0x7;
+	int len = *t >> 3;
+	if (type != TYPE_SHORT_STRING || len == 0 || rb->cache == NULL) {
+		push_value(L, rb, type, len);
+		return -1;
+	}
+	const char * str = (const char *)rb_read(rb, len);
+	if (str == NULL) {
+		invalid_stream(L, rb);
+	}
+	int h = key_find(rb->cache, str, len);
+	if (h >= 0) {
+		lua_rawgeti(L, rb->anchor, h + 1);
+		return h;
+	}
+	h = key_hash(str, len);
+	lua_pushlstring(L, str, len);
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, rb->anchor, h + 1);
+	struct key_slot * s = &rb->cache->slot[h];
+	s->str = lua_tostring(L, -1);
+	s->len = len;
+	s->hint = 0;
+	return h;
+}
+
+// 纯哈希表：看一眼第一个键，若在缓存中，返回上次同样开头的表的大小
+static int
+table_hint(struct read_block *rb) {
+	if (rb->cache == NULL || rb->len < 1)
+		return 0;
+	uint8_t t = (uint8_t)rb->buffer[rb->ptr];
+	int len = t >> 3;
+	if ((t & 0x7) != TYPE_SHORT_STRING || len == 0 || rb->len < 1 + len)
+		return 0;
+	int h = key_find(rb->cache, rb->buffer + rb->ptr + 1, len);
+	return h >= 0 ? rb->cache->slot[h].hint : 0;
+}
 
 static void
 unpack_table(lua_State *L, struct read_block *rb, int array_size) {
@@ -472,21 +844,157 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		array_size = get_integer(L,rb,cookie);
 	}
 	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	lua_createtable(L,array_size,array_size == 0 ? table_hint(rb) : 0);
 	int i;
 	for (i=1;i<=array_size;i++) {
 		unpack_one(L,rb);
 		lua_rawseti(L,-2,i);
 	}
+	int first = -1;
+	int n = 0;
 	for (;;) {
-		unpack_one(L,rb);
+		int h = unpack_key(L,rb);
 		if (lua_isnil(L,-1)) {
 			lua_pop(L,1);
-			return;
+			break;
 		}
+		if (n == 0)
+			first = h;
 		unpack_one(L,rb);
 		lua_rawset(L,-3);
+		++n;
+	}
+	if (array_size == 0 && first >= 0) {
+		rb->cache->slot[first].hint = n;
+	}
+}
+
+static uint64_t
+get_varint(lua_State *L, struct read_block *rb) {
+	uint64_t v = 0;
+	int shift;
+	for (shift=0;shift<64;shift+=7) {
+		const uint8_t * b = (const uint8_t *)rb_read(rb, 1);
+		if (b == NULL)
+			break;
+		v |= (uint64_t)(*b & 0x7f) << shift;
+		if (!(*b & 0x80))
+			return v;
 	}
+	invalid_stream(L, rb);
+	return 0;
+}
+
+// 每个 lua_State 在注册表的 skynet.schema 表里为每个 schema 记一个元表：
+// __schema 为 id，[1..n] 为各字段名（解包时直接取用已驻留的字符串）
+static void
+schema_registry(lua_State *L) {
+	if (lua_getfield(L, LUA_REGISTRYINDEX, "skynet.schema") != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, "skynet.schema");
+	}
+}
+
+// 把 id 对应的元表压栈，registry 为 skynet.schema 表的栈位置
+static void
+schema_meta(lua_State *L, int registry, int id) {
+	if (lua_rawgeti(L, registry, id) == LUA_TTABLE)
+		return;
+	lua_pop(L, 1);
+	const struct schema * s = S.s[id];
+	lua_createtable(L, s->n, 2);
+	lua_pushinteger(L, id);
+	lua_setfield(L, -2, "__schema");
+	lua_pushstring(L, s->name);
+	lua_setfield(L, -2, "__name");
+	int i;
+	for (i=0;i<s->n;i++) {
+		lua_pushstring(L, s->field[i].name);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, registry, id);
+}
+
+static void unpack_schema(lua_State *L, struct read_block *rb, int id);
+
+static void
+unpack_field_value(lua_State *L, struct read_block *rb, const struct schema_field *f) {
+	switch (f->type) {
+	case FIELD_INTEGER: {
+		uint64_t v = get_varint(L, rb);
+		lua_pushinteger(L, (lua_Integer)((v >> 1) ^ (~(v & 1) + 1)));
+		break;
+	}
+	case FIELD_REAL:
+		lua_pushnumber(L, get_real(L, rb));
+		break;
+	case FIELD_BOOLEAN: {
+		const uint8_t * b = (const uint8_t *)rb_read(rb, 1);
+		if (b == NULL)
+			invalid_stream(L, rb);
+		lua_pushboolean(L, *b);
+		break;
+	}
+	case FIELD_STRING: {
+		uint64_t sz = get_varint(L, rb);
+		if (sz > (uint64_t)rb->len)
+			invalid_stream(L, rb);
+		get_buffer(L, rb, (int)sz);
+		break;
+	}
+	case FIELD_ANY:
+		unpack_one(L, rb);
+		break;
+	case FIELD_SCHEMA:
+		unpack_schema(L, rb, f->sub);
+		break;
+	}
+}
+
+static void
+unpack_schema(lua_State *L, struct read_block *rb, int id) {
+	const struct schema * s = schema_get(id);
+	if (s == NULL)
+		invalid_stream(L, rb);
+	luaL_checkstack(L, LUA_MINSTACK, NULL);
+	if (!rb->meta_ready) {
+		schema_registry(L);
+		lua_replace(L, rb->meta);
+		rb->meta_ready = 1;
+	}
+	schema_meta(L, rb->meta, id);
+	int meta = lua_gettop(L);
+	lua_createtable(L, 0, s->n);
+	const uint8_t * bitmap = (const uint8_t *)rb_read(rb, (s->n + 7) / 8);
+	if (bitmap == NULL)
+		invalid_stream(L, rb);
+	int i;
+	for (i=0;i<s->n;i++) {
+		if (!(bitmap[i / 8] & (1 << (i % 8))))
+			continue;
+		const struct schema_field *f = &s->field[i];
+		lua_rawgeti(L, meta, i + 1);
+		if (f->array) {
+			uint64_t n = get_varint(L, rb);
+			if (n > (uint64_t)rb->len)
+				invalid_stream(L, rb);
+			lua_createtable(L, (int)n, 0);
+			int j;
+			for (j=1;j<=(int)n;j++) {
+				unpack_field_value(L, rb, f);
+				lua_rawseti(L, -2, j);
+			}
+		} else {
+			unpack_field_value(L, rb, f);
+		}
+		lua_rawset(L, -3);
+	}
+	lua_pushvalue(L, meta);
+	lua_setmetatable(L, -2);
+	lua_remove(L, meta);
 }
 
 static void
@@ -538,6 +1046,23 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		unpack_table(L,rb,cookie);
 		break;
 	}
+	case TYPE_SCHEMA: {
+		const uint8_t * t = (const uint8_t *)rb_read(rb, 1);
+		if (t == NULL || (*t & 7) != TYPE_NUMBER || (*t >> 3) == TYPE_NUMBER_REAL) {
+			invalid_stream(L,rb);
+		}
+		int id = (int)get_integer(L, rb, *t >> 3);
+		const void * fp = rb_read(rb, sizeof(uint32_t));
+		if (fp == NULL)
+			invalid_stream(L,rb);
+		uint32_t fingerprint;
+		memcpy(&fingerprint, fp, sizeof(fingerprint));
+		int local = schema_find(id, fingerprint);
+		if (local < 0)
+			luaL_error(L, "Unknown schema %d (fingerprint %08x) in serialize stream", id, fingerprint);
+		unpack_schema(L, rb, local);
+		break;
+	}
 	default: {
 		invalid_stream(L,rb);
 		break;
@@ -557,24 +1082,28 @@ unpack_one(lua_State *L, struct read_block *rb) {
 }
 
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
-		}
-	}
-	
+seri(lua_State *L, struct write_block *wb) {
+	uint8_t * buffer = skynet_malloc(wb->len);
+	memcpy(buffer, wb->buffer, wb->len);
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	lua_pushinteger(L, wb->len);
+}
+
+static void
+key_cache_init(lua_State *L, struct read_block *rb) {
+	static int key = 0;
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &key) != LUA_TUSERDATA) {
+		lua_pop(L, 1);
+		struct key_cache * cache = lua_newuserdatauv(L, sizeof(*cache), 1);
+		memset(cache, 0, sizeof(*cache));
+		lua_createtable(L, KEY_CACHE_SIZE, 0);
+		lua_setiuservalue(L, -2, 1);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &key);
+	}
+	rb->cache = lua_touserdata(L, -1);
+	lua_getiuservalue(L, -1, 1);
+	rb->anchor = lua_gettop(L);
 }
 
 int
@@ -602,6 +1131,15 @@ luaseri_unpack(lua_State *L) {
 	lua_settop(L,1);
 	struct read_block rb;
 	rball_init(&rb, buffer, len);
+	if (len >= KEY_CACHE_MINLEN) {
+		key_cache_init(L, &rb);
+	} else {
+		// 小消息不值得查注册表，占住同样的两个栈位
+		lua_pushnil(L);
+		lua_pushnil(L);
+	}
+	lua_pushnil(L);
+	rb.meta = lua_gettop(L);
 
 	int i;
 	for (i=0;;i++) {
@@ -618,20 +1156,205 @@ luaseri_unpack(lua_State *L) {
 
 	// Need not free buffer
 
-	return lua_gettop(L) - 1;
+	return lua_gettop(L) - 4;
 }
 
 LUAMOD_API int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
 	struct write_block wb;
-	wb_init(&wb, &temp);
-	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+	int from = wb_guard(L);
+	wb_init(&wb);
+	pack_from(L,&wb,from);
+	seri(L, &wb);
+
+	wb_free(&wb);
+
+	return 2;
+}
+
+// 打包成 lua string，直接从线程缓冲区构造，不经过 malloc
+LUAMOD_API int
+luaseri_packstring(lua_State *L) {
+	struct write_block wb;
+	int from = wb_guard(L);
+	wb_init(&wb);
+	pack_from(L,&wb,from);
+	lua_pushlstring(L, wb.buffer, wb.len);
 
 	wb_free(&wb);
 
+	return 1;
+}
+
+static int
+field_type(const char * type, const char * name, int *sub) {
+	static const char * names[] = { "integer", "number", "boolean", "string", "any" };
+	int i;
+	for (i=0;i<(int)(sizeof(names)/sizeof(names[0]));i++) {
+		if (strcmp(type, names[i]) == 0)
+			return i;
+	}
+	int n = ATOM_LOAD(&S.n);
+	for (i=0;i<n;i++) {
+		if (strcmp(type, S.s[i]->name) == 0) {
+			*sub = i;
+			return FIELD_SCHEMA;
+		}
+	}
+	if (strcmp(type, name) == 0) {
+		// 引用自身
+		*sub = n;
+		return FIELD_SCHEMA;
+	}
+	return -1;
+}
+
+static char *
+strcopy(const char * str) {
+	size_t sz = strlen(str) + 1;
+	char * r = skynet_malloc(sz);
+	memcpy(r, str, sz);
+	return r;
+}
+
+static int
+schema_equal(const struct schema *a, const struct schema *b) {
+	if (a->n != b->n)
+		return 0;
+	int i;
+	for (i=0;i<a->n;i++) {
+		const struct schema_field *x = &a->field[i];
+		const struct schema_field *y = &b->field[i];
+		if (strcmp(x->name, y->name) != 0 || x->type != y->type || x->array != y->array
+			|| (x->type == FIELD_SCHEMA && x->sub != y->sub))
+			return 0;
+	}
+	return 1;
+}
+
+static uint32_t
+fnv1a(uint32_t h, const void *buf, size_t sz) {
+	const uint8_t * p = (const uint8_t *)buf;
+	size_t i;
+	for (i=0;i<sz;i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+// 指纹覆盖名字、各字段的名字类型，以及嵌套 schema 的指纹（引用自身时用名字）
+static uint32_t
+schema_fingerprint(const struct schema *s, int id) {
+	uint32_t h = fnv1a(2166136261u, s->name, strlen(s->name) + 1);
+	int i;
+	for (i=0;i<s->n;i++) {
+		const struct schema_field *f = &s->field[i];
+		uint8_t t[2] = { (uint8_t)f->type, (uint8_t)f->array };
+		h = fnv1a(h, f->name, f->len + 1);
+		h = fnv1a(h, t, sizeof(t));
+		if (f->type == FIELD_SCHEMA) {
+			if (f->sub == id) {
+				h = fnv1a(h, s->name, strlen(s->name) + 1);
+			} else {
+				h = fnv1a(h, &S.s[f->sub]->fingerprint, sizeof(uint32_t));
+			}
+		}
+	}
+	return h;
+}
+
+static void
+schema_free(struct schema *s) {
+	int i;
+	for (i=0;i<s->n;i++) {
+		skynet_free(s->field[i].name);
+	}
+	skynet_free(s->name);
+	skynet_free(s);
+}
+
+// 注册 schema：name, { 字段名, 类型, 字段名, 类型, ... }，类型前加 '*' 表示数组
+// 同名同布局的重复注册返回同一个 id（各服务启动时各自注册），返回这个 schema 的元表和指纹
+// 先在锁外从 lua 表里取出并复制字段，锁内只解析类型、比较和发布，不调用 lua api
+LUAMOD_API int
+luaseri_schema(lua_State *L) {
+	const char * name = luaL_checkstring(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int n = lua_rawlen(L, 2) / 2;
+	int i;
+	for (i=0;i<n*2;i++) {
+		int t = lua_rawgeti(L, 2, i + 1);
+		if (t != LUA_TSTRING && t != LUA_TNUMBER) {
+			return luaL_error(L, "schema %s : invalid field", name);
+		}
+		lua_pop(L, 1);
+	}
+	struct schema * s = skynet_malloc(sizeof(*s) + (n > 0 ? n - 1 : 0) * sizeof(struct schema_field));
+	char ** types = skynet_malloc((n > 0 ? n : 1) * sizeof(char *));
+	s->name = strcopy(name);
+	s->n = n;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, 2, i * 2 + 1);
+		lua_rawgeti(L, 2, i * 2 + 2);
+		struct schema_field *f = &s->field[i];
+		f->name = strcopy(lua_tostring(L, -2));
+		f->len = strlen(f->name);
+		types[i] = strcopy(lua_tostring(L, -1));
+		f->array = (types[i][0] == '*');
+		f->sub = 0;
+		lua_pop(L, 2);
+	}
+	const char * err = NULL;
+	int id = -1;
+	while (!ATOM_CAS(&S.lock, 0, 1)) {}
+	for (i=0;i<n;i++) {
+		struct schema_field *f = &s->field[i];
+		f->type = field_type(types[i] + f->array, name, &f->sub);
+		if (f->type < 0) {
+			err = types[i];
+			break;
+		}
+	}
+	if (err == NULL) {
+		int count = ATOM_LOAD(&S.n);
+		for (i=0;i<count;i++) {
+			if (strcmp(S.s[i]->name, name) == 0) {
+				if (schema_equal(S.s[i], s)) {
+					id = i;
+				} else {
+					err = "redefined";
+				}
+				break;
+			}
+		}
+		if (err == NULL && id < 0) {
+			if (count >= MAX_SCHEMA) {
+				err = "too many schemas";
+			} else {
+				s->fingerprint = schema_fingerprint(s, count);
+				S.s[count] = s;
+				id = count;
+				s = NULL;
+				ATOM_STORE(&S.n, count + 1);
+			}
+		}
+	}
+	ATOM_STORE(&S.lock, 0);
+	if (err) {
+		lua_pushfstring(L, "schema %s : %s", name, err);
+	}
+	for (i=0;i<n;i++) {
+		skynet_free(types[i]);
+	}
+	skynet_free(types);
+	if (s) {
+		schema_free(s);
+	}
+	if (err) {
+		return lua_error(L);
+	}
+	schema_registry(L);
+	schema_meta(L, lua_gettop(L), id);
+	lua_pushinteger(L, S.s[id]->fingerprint);
 	return 2;
 }
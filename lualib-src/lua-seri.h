@@ -5,5 +5,7 @@
 
 int luaseri_pack(lua_State *L);
 int luaseri_unpack(lua_State *L);
+int luaseri_packstring(lua_State *L);
+int luaseri_schema(lua_State *L);
 
 #endif
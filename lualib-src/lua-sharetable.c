@@ -5,6 +5,8 @@
 #include <lualib.h>
 
 #include "lgc.h"
+#include "skynet_malloc.h"
+#include "atomic.h"
 
 #ifdef makeshared
 
@@ -254,6 +256,220 @@ luaopen_skynet_sharetable_core(lua_State *L) {
 	return 1;
 }
 
+// 共享不可变值（skynet.sharevalue）：把一张表深拷贝进独立的 lua_State 并标记为共享，
+// 同进程的其他服务用 lua_clonetable 直接读，不需要序列化。
+// box 用引用计数管理：每个句柄、每个在途的 token 各持有一个引用，归零时关闭那个 lua_State。
+
+#define SHAREVALUE_MAXDEPTH 32
+
+struct sharevalue_box {
+	ATOM_INT ref;
+	lua_State *L;
+	const void * table;
+};
+
+struct sharevalue_ud {
+	struct sharevalue_box *box;
+};
+
+static ATOM_INT box_count;	// 存活的 box 数
+
+static void
+box_release(struct sharevalue_box *b) {
+	if (ATOM_FDEC(&b->ref) == 1) {
+		lua_close(b->L);
+		skynet_free(b);
+		ATOM_FDEC(&box_count);
+	}
+}
+
+static void copy_table(lua_State *L, int index, lua_State *mL, int depth);
+
+// 错误都抛在 mL 上，由 lnew 里 mL 的 pcall 接住
+static void
+copy_value(lua_State *L, int index, lua_State *mL, int depth) {
+	int t = lua_type(L, index);
+	switch (t) {
+	case LUA_TBOOLEAN:
+		lua_pushboolean(mL, lua_toboolean(L, index));
+		break;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, index)) {
+			lua_pushinteger(mL, lua_tointeger(L, index));
+		} else {
+			lua_pushnumber(mL, lua_tonumber(L, index));
+		}
+		break;
+	case LUA_TSTRING: {
+		size_t sz;
+		const char * str = lua_tolstring(L, index, &sz);
+		lua_pushlstring(mL, str, sz);
+		break;
+	}
+	case LUA_TLIGHTUSERDATA:
+		lua_pushlightuserdata(mL, lua_touserdata(L, index));
+		break;
+	case LUA_TTABLE:
+		copy_table(L, index, mL, depth + 1);
+		break;
+	default:
+		luaL_error(mL, "Invalid type [%s]", lua_typename(L, t));
+	}
+}
+
+static void
+copy_table(lua_State *L, int index, lua_State *mL, int depth) {
+	if (depth > SHAREVALUE_MAXDEPTH)
+		luaL_error(mL, "Table is too deep (loop?)");
+	if (!lua_checkstack(L, 4))
+		luaL_error(mL, "Stack overflow");
+	luaL_checkstack(mL, 4, NULL);
+	lua_createtable(mL, lua_rawlen(L, index), 0);
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		int top = lua_gettop(L);
+		copy_value(L, top - 1, mL, depth);
+		copy_value(L, top, mL, depth);
+		lua_rawset(mL, -3);
+		lua_pop(L, 1);
+	}
+}
+
+static int
+build_box(lua_State *mL) {
+	lua_State *L = (lua_State *)lua_touserdata(mL, 1);
+	int index = (int)lua_tointeger(mL, 2);
+	lua_settop(mL, 0);
+	copy_table(L, index, mL, 0);
+	// 同 make_matrix ，标记共享后不能再 gc
+	lua_gc(mL, LUA_GCSTOP, 0);
+	mark_shared(mL);
+	return 1;
+}
+
+static struct sharevalue_ud *
+sharevalue_ud(lua_State *L, struct sharevalue_box *box) {
+	struct sharevalue_ud *ud = (struct sharevalue_ud *)lua_newuserdatauv(L, sizeof(*ud), 0);
+	ud->box = box;
+	luaL_setmetatable(L, "SHAREVALUE");
+	return ud;
+}
+
+static struct sharevalue_box *
+check_box(lua_State *L) {
+	struct sharevalue_ud *ud = (struct sharevalue_ud *)luaL_checkudata(L, 1, "SHAREVALUE");
+	if (ud->box == NULL)
+		luaL_error(L, "sharevalue is released");
+	return ud->box;
+}
+
+// 拷贝一张表，返回持有它的句柄
+static int
+lsharevalue_new(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+	lua_State *mL = luaL_newstate();
+	if (mL == NULL)
+		return luaL_error(L, "luaL_newstate failed");
+	lua_pushcfunction(mL, build_box);
+	lua_pushlightuserdata(mL, L);
+	lua_pushinteger(mL, 1);
+	if (lua_pcall(mL, 2, 1, 0) != LUA_OK) {
+		lua_settop(L, 1);
+		lua_pushstring(L, lua_tostring(mL, -1));
+		lua_close(mL);
+		return lua_error(L);
+	}
+	lua_settop(L, 1);
+	struct sharevalue_box *box = (struct sharevalue_box *)skynet_malloc(sizeof(*box));
+	ATOM_INIT(&box->ref, 1);
+	box->L = mL;
+	box->table = lua_topointer(mL, -1);
+	ATOM_FINC(&box_count);
+	sharevalue_ud(L, box);
+	return 1;
+}
+
+// 为一条消息取一个 token（lightuserdata），token 持有一个引用，由接收方 open 接管
+static int
+lsharevalue_token(lua_State *L) {
+	struct sharevalue_box *box = check_box(L);
+	ATOM_FINC(&box->ref);
+	lua_pushlightuserdata(L, box);
+	return 1;
+}
+
+static int
+lsharevalue_open(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	sharevalue_ud(L, (struct sharevalue_box *)lua_touserdata(L, 1));
+	return 1;
+}
+
+// 没有被 open 的 token（例如发送失败）
+static int
+lsharevalue_drop(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	box_release((struct sharevalue_box *)lua_touserdata(L, 1));
+	return 0;
+}
+
+static int
+lsharevalue_table(lua_State *L) {
+	struct sharevalue_box *box = check_box(L);
+	lua_clonetable(L, box->table);
+	return 1;
+}
+
+static int
+lsharevalue_release(lua_State *L) {
+	struct sharevalue_ud *ud = (struct sharevalue_ud *)luaL_checkudata(L, 1, "SHAREVALUE");
+	if (ud->box) {
+		box_release(ud->box);
+		ud->box = NULL;
+	}
+	return 0;
+}
+
+static int
+lsharevalue_size(lua_State *L) {
+	struct sharevalue_box *box = check_box(L);
+	lua_Integer sz = lua_gc(box->L, LUA_GCCOUNT, 0);
+	sz *= 1024;
+	sz += lua_gc(box->L, LUA_GCCOUNTB, 0);
+	lua_pushinteger(L, sz);
+	return 1;
+}
+
+static int
+lsharevalue_count(lua_State *L) {
+	lua_pushinteger(L, ATOM_LOAD(&box_count));
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_skynet_sharevalue_core(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "new", lsharevalue_new },
+		{ "token", lsharevalue_token },
+		{ "open", lsharevalue_open },
+		{ "drop", lsharevalue_drop },
+		{ "table", lsharevalue_table },
+		{ "release", lsharevalue_release },
+		{ "size", lsharevalue_size },
+		{ "count", lsharevalue_count },
+		{ NULL, NULL },
+	};
+	if (luaL_newmetatable(L, "SHAREVALUE")) {
+		lua_pushcfunction(L, lsharevalue_release);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_pop(L, 1);
+	luaL_newlib(L, l);
+	return 1;
+}
+
 #else
 
 LUAMOD_API int
@@ -261,4 +477,9 @@ luaopen_skynet_sharetable_core(lua_State *L) {
 	return luaL_error(L, "No share string table support");
 }
 
+LUAMOD_API int
+luaopen_skynet_sharevalue_core(lua_State *L) {
+	return luaL_error(L, "No share string table support");
+}
+
 #endif
\ No newline at end of file
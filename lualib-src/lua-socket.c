@@ -616,6 +616,34 @@ lsendlow(lua_State *L) {
 	return 1;
 }
 
+static int
+lsendzerocopy(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	struct socket_sendbuffer buf;
+	buf.id = id;
+	get_buffer(L, 2, &buf);
+	int err = skynet_socket_sendbuffer_zerocopy(ctx, &buf);
+	lua_pushboolean(L, !err);
+	return 1;
+}
+
+static int
+lsendfile(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	const char * filename = luaL_checkstring(L, 2);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	lua_Integer sz = luaL_optinteger(L, 4, -1);
+	int64_t n = skynet_socket_sendfile(ctx, id, filename, offset, sz);
+	if (n < 0) {
+		lua_pushboolean(L, 0);
+	} else {
+		lua_pushinteger(L, n);
+	}
+	return 1;
+}
+
 static int
 lbind(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -649,6 +677,76 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+/*
+	integer id
+	integer high (0 for disable)
+	integer low
+	integer limit (optional, 0 for unlimited)
+	boolean droplow (optional, drop send_lowpriority data above high)
+ */
+static int
+lwatermark(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_Integer high = luaL_checkinteger(L, 2);
+	lua_Integer low = luaL_optinteger(L, 3, high / 2);
+	lua_Integer limit = luaL_optinteger(L, 4, 0);
+	int droplow = lua_toboolean(L, 5);
+	skynet_socket_watermark(ctx, id, high, low, limit, droplow);
+	return 0;
+}
+
+/*
+	integer id
+	integer header (2 or 4, 0 for disable)
+	integer max (optional)
+ */
+static int
+lframe(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int header = luaL_checkinteger(L, 2);
+	int max = luaL_optinteger(L, 3, 0);
+	if (header != 0 && header != 2 && header != 4) {
+		return luaL_error(L, "Invalid frame header %d", header);
+	}
+	skynet_socket_frame(ctx, id, header, max);
+	return 0;
+}
+
+/*
+	integer id
+	integer agent (0 for disable)
+ */
+static int
+lredirect(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	uint32_t agent = (uint32_t)luaL_checkinteger(L, 2);
+	skynet_socket_redirect(ctx, id, agent);
+	return 0;
+}
+
+/*
+	integer id
+	string name
+	integer size (optional) : create the shared memory, open the one created by the peer when absent
+	string greeting (optional) : written to the connection before switching
+	return true, or false when failed
+ */
+static int
+lshm(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	const char * name = luaL_checkstring(L, 2);
+	lua_Integer size = luaL_optinteger(L, 3, 0);
+	luaL_argcheck(L, size >= 0, 3, "invalid size");
+	size_t sz = 0;
+	const char * greeting = luaL_optlstring(L, 4, NULL, &sz);
+	lua_pushboolean(L, skynet_socket_shm(ctx, id, name, (size_t)size, greeting, sz) == 0);
+	return 1;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -768,6 +866,49 @@ ludp_address(lua_State *L) {
 	return 2;
 }
 
+/*
+	lightuserdata msg
+	integer size
+
+	return str1, address1, str2, address2, ...
+	see SOCKET_UDP_BATCH in socket_server.c : each record is [int size][payload][address]
+ */
+static int
+ludp_batch(lua_State *L) {
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	const uint8_t * end = ptr + size;
+	int n = 0;
+	while (ptr < end) {
+		int sz;
+		if (end - ptr < (ptrdiff_t)sizeof(int)) {
+			return luaL_error(L, "Invalid udp batch");
+		}
+		memcpy(&sz, ptr, sizeof(int));
+		ptr += sizeof(int);
+		if (sz < 0 || end - ptr <= sz) {
+			return luaL_error(L, "Invalid udp batch");
+		}
+		// 每个记录的地址与 SOCKET_UDP 消息一样跟在 payload 后面，交给同一个解析函数
+		struct skynet_socket_message m;
+		m.type = SKYNET_SOCKET_TYPE_UDP;
+		m.id = 0;
+		m.ud = sz;
+		m.buffer = (char *)ptr;
+		int addrsz = 0;
+		const char * address = skynet_socket_udp_address(&m, &addrsz);
+		if (address == NULL || end - (const uint8_t *)address < addrsz) {
+			return luaL_error(L, "Invalid udp batch address");
+		}
+		luaL_checkstack(L, 2, NULL);
+		lua_pushlstring(L, (const char *)ptr, sz);
+		lua_pushlstring(L, address, addrsz);
+		ptr = (const uint8_t *)address + addrsz;
+		n += 2;
+	}
+	return n;
+}
+
 static void
 getinfo(lua_State *L, struct socket_info *si) {
 	lua_newtable(L);
@@ -820,6 +961,18 @@ getinfo(lua_State *L, struct socket_info *si) {
 	lua_setfield(L, -2, "reading");
 	lua_pushboolean(L, si->writing);
 	lua_setfield(L, -2, "writing");
+	if (si->whigh > 0 || si->wlimit > 0) {
+		lua_pushinteger(L, si->whigh);
+		lua_setfield(L, -2, "whigh");
+		lua_pushinteger(L, si->wlow);
+		lua_setfield(L, -2, "wlow");
+		lua_pushinteger(L, si->wlimit);
+		lua_setfield(L, -2, "wlimit");
+		lua_pushinteger(L, si->wdrop);
+		lua_setfield(L, -2, "wdrop");
+		lua_pushboolean(L, si->wblocked);
+		lua_setfield(L, -2, "blocked");
+	}
 	if (si->name[0]) {
 		lua_pushstring(L, si->name);
 		lua_setfield(L, -2, "peer");
@@ -885,6 +1038,7 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "info", linfo },
 
 		{ "unpack", lunpack },
+		{ "udp_batch", ludp_batch },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -895,10 +1049,16 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "zsend", lsendzerocopy },
+		{ "sendfile", lsendfile },
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "pause", lpause },
 		{ "nodelay", lnodelay },
+		{ "watermark", lwatermark },
+		{ "frame", lframe },
+		{ "redirect", lredirect },
+		{ "shm", lshm },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_dial", ludp_dial},
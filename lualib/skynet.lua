@@ -50,6 +50,7 @@ local skynet = {
 	PTYPE_LUA = 10,       -- Lua 协议（最常用）
 	PTYPE_SNAX = 11,      -- SNAX 协议
 	PTYPE_TRACE = 12,     -- use for debug trace Trace 跟踪
+	PTYPE_LOG = 13,       -- 结构化日志，见 skynet.slog
 }
 
 -- code cache
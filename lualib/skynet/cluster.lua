@@ -11,24 +11,92 @@
 --      → request_sender 调 clusterd("sender") 建立/获取 sender
 --      → 处理排队项：字符串类型表示已序列化的 push 请求，其它为等待的协程句柄
 --      → 唤醒等待者，大家通过 q.sender 取得 sender 并继续
+--  连接池（clusterd 配置 __connections > 1）：
+--    - call 选本服务在途请求最少的连接，大回应不会堵住其它调用
+--    - send 按地址固定到同一条连接，保证同一地址的消息有序；__sticky = false 时也按负载选
+--  期限（cluster.calltimeout）：
+--    - 到期还没有回应时本地立即失败，sender 收回 session ，迟到的回应被丢掉
+--    - 期限随请求发给对端（v4），对端收到时已经过期的请求不再交给目标服务
 local skynet = require "skynet"
 
 local clusterd
 local cluster = {}
 local sender = {}
+local pool = {}	-- node -> { sender, ..., inflight = { n, ... }, sticky = true|false }
 local task_queue = {}
 
 local function repack(address, ...)
 	return address, skynet.pack(...)
 end
 
+-- 选在途请求最少的连接
+local function pool_select(p)
+	local inflight = p.inflight
+	local index, n = 1, inflight[1]
+	for i = 2, #p do
+		if inflight[i] < n then
+			index, n = i, inflight[i]
+		end
+	end
+	return index
+end
+
+local function pool_return(inflight, index, ok, ...)
+	inflight[index] = inflight[index] - 1
+	if not ok then
+		error((...), 0)
+	end
+	return ...
+end
+
+local function pool_call(p, address, ...)
+	local index = pool_select(p)
+	local inflight = p.inflight
+	inflight[index] = inflight[index] + 1
+	return pool_return(inflight, index, pcall(skynet.call, p[index], "lua", "req", address, ...))
+end
+
+-- 地址的哈希：数字地址直接用，字符串地址用 fnv1a
+local function address_hash(address)
+	if type(address) == "number" then
+		return math.tointeger(address) or 0
+	end
+	local h = 2166136261
+	for i = 1, #address do
+		h = ((h ~ address:byte(i)) * 16777619) & 0xffffffff
+	end
+	return h
+end
+
+-- 同一地址的 send 固定走同一条连接：按地址哈希选，不用记录
+local function pool_sender(p, address)
+	if not p.sticky then
+		return p[pool_select(p)]
+	end
+	return p[address_hash(address) % #p + 1]
+end
+
+local function new_pool(list, sticky)
+	if list == nil or #list < 2 then
+		return
+	end
+	local p = { inflight = {}, sticky = sticky ~= false }
+	for i, s in ipairs(list) do
+		p[i] = s
+		p.inflight[i] = 0
+	end
+	return p
+end
+
 -- 在后台线程中请求 clusterd 建立到 node 的 sender，期间执行排队任务
 -- 后台任务：请求 clusterd 建立/获取 sender，并处理等待队列
 local function request_sender(q, node)
-	local ok, c = pcall(skynet.call, clusterd, "lua", "sender", node)
+	local ok, c, list, sticky = pcall(skynet.call, clusterd, "lua", "sender", node)
 	if not ok then
 		skynet.error(c)
 		c = nil
+	elseif c then
+		pool[node] = new_pool(list, sticky)
 	end
 	-- run tasks in queue
 	local confirm = coroutine.running()
@@ -37,7 +105,9 @@ local function request_sender(q, node)
 	for _, task in ipairs(q) do
 		if type(task) == "string" then
 			if c then
-				skynet.send(c, "lua", "push", repack(skynet.unpack(task)))
+				local address = skynet.unpack(task)
+				local s = pool[node] and pool_sender(pool[node], address) or c
+				skynet.send(s, "lua", "push", repack(skynet.unpack(task)))
 			end
 		else
 			skynet.wakeup(task)
@@ -76,16 +146,45 @@ end
 
 cluster.get_sender = get_sender
 
--- 远程调用：cluster.call("node", ":addr" or ".name", ...)
--- 远程调用：失败由 clusterd/senders 抛出错误信息；address 可为 name 或 ":xxxx" 地址
-function cluster.call(node, address, ...)
+-- deadline 为 skynet.now() 的时间，nil 表示不限
+local function call(node, deadline, address, ...)
 	-- skynet.pack(...) will free by cluster.core.packrequest
 	local s = sender[node]
+	local msg, sz
 	if not s then
 		local task = skynet.packstring(address, ...)
-		return skynet.call(get_sender(node), "lua", "req", repack(skynet.unpack(task)))
+		s = get_sender(node)
+		address, msg, sz = repack(skynet.unpack(task))
+	else
+		msg, sz = skynet.pack(...)
+	end
+	local p = pool[node]
+	if p then
+		return pool_call(p, address, msg, sz, deadline)
 	end
-	return skynet.call(s, "lua", "req", address, skynet.pack(...))
+	return skynet.call(s, "lua", "req", address, msg, sz, deadline)
+end
+
+-- 远程调用：cluster.call("node", ":addr" or ".name", ...)
+-- 远程调用：失败由 clusterd/senders 抛出错误信息；address 可为 name 或 ":xxxx" 地址
+function cluster.call(node, address, ...)
+	return call(node, nil, address, ...)
+end
+
+local function timeout_return(node, deadline, ok, ...)
+	if ok then
+		return ...
+	end
+	if skynet.now() >= deadline then
+		error(string.format("cluster call [%s] timeout", node), 0)
+	end
+	error((...), 0)
+end
+
+-- 带期限的远程调用：ti 为超时（1/100 秒），到期还没有回应时抛出 timeout 错误
+function cluster.calltimeout(node, ti, address, ...)
+	local deadline = skynet.now() + ti
+	return timeout_return(node, deadline, pcall(call, node, deadline, address, ...))
 end
 
 -- 远程发送（无回复）：cluster.send("node", ":addr" or ".name", ...)
@@ -96,7 +195,11 @@ function cluster.send(node, address, ...)
 	if not s then
 		table.insert(task_queue[node], skynet.packstring(address, ...))
 	else
-		skynet.send(sender[node], "lua", "push", address, skynet.pack(...))
+		local p = pool[node]
+		if p then
+			s = pool_sender(p, address)
+		end
+		skynet.send(s, "lua", "push", address, skynet.pack(...))
 	end
 end
 
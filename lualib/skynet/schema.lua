@@ -0,0 +1,50 @@
+-- 说明：
+--  按 schema 打包：为固定结构的表注册 schema，skynet.pack 遇到带这个元表的表时只按字段顺序写值，
+--  不写键名和类型标记；表里有 schema 之外的键或类型不符时自动退回普通的动态打包。
+--  用法：
+--    local schema = require "skynet.schema"
+--    local S = schema.register [[
+--      Pos { x : number  y : number }
+--      Player { id : integer  name : string  pos : Pos  bag : *integer  extra : any }
+--    ]]
+--    skynet.send(addr, "lua", "update", setmetatable(player, S.Player))
+--  约定：
+--    - 字段类型：integer number boolean string any，或已注册（含自身）的 schema 名，前加 * 表示数组
+--    - number 字段解包后总是浮点数；数组不能有空洞
+--    - 每个服务启动时各自 register 同样的定义，同名同布局得到同一个 id；解包出的表带同样的元表
+--    - 消息里带 schema 的指纹，发往其他节点（cluster/harbor）或写进文件后，对方注册了同样的定义即可解包，
+--      没有注册或布局不同时解包报错
+local c = require "skynet.core"
+
+local schema = {}
+
+local metas = {}
+
+-- 本服务注册过的定义，按注册顺序：{ fingerprint, name, fields } ，skynet.slog 把它们写进结构化日志
+schema.defines = {}
+
+-- 注册文本中的全部 schema，按出现顺序注册，返回 名字 -> 元表
+function schema.register(text)
+	text = text:gsub("#[^\n]*", "")	-- 注释
+	local result = {}
+	for name, body in text:gmatch "([%w_]+)%s*(%b{})" do
+		local fields = {}
+		for fname, ftype in body:gmatch "([%w_]+)%s*:%s*(%*?[%w_]+)" do
+			table.insert(fields, fname)
+			table.insert(fields, ftype)
+		end
+		local meta, fingerprint = c.schema(name, fields)
+		if metas[name] == nil then
+			table.insert(schema.defines, { fingerprint, name, fields })
+		end
+		metas[name] = meta
+		result[name] = meta
+	end
+	return result
+end
+
+function schema.get(name)
+	return metas[name]
+end
+
+return schema
@@ -0,0 +1,79 @@
+-- 说明：
+--  同进程服务之间传递大的只读表而不序列化：
+--   - 发送方 sharevalue.new(t) 把 t 深拷贝进独立的 lua_State 并冻结（与 sharetable 的 matrix 相同的共享机制）
+--   - 每条消息带一个 token（lightuserdata），接收方 sharevalue.open(token) 直接得到这张共享表，
+--     按需读取字段，没有 unpack
+--  用法：
+--    -- 发送方
+--    local v = sharevalue.new(result)
+--    skynet.call(addr, "lua", "result", sharevalue.token(v))
+--    sharevalue.release(v)	-- 或等 gc
+--    -- 接收方
+--    local t = sharevalue.open(token)
+--    print(t.list[1].name)
+--    sharevalue.release(t)	-- 用完释放，服务退出时也会释放
+--  注意：
+--   - 只支持 nil/boolean/number/string/lightuserdata 和嵌套表，不带元表；表是只读的
+--   - 从表里取出的子表、字符串在 release 之后不能再用
+--   - token 只能 open 一次；没有被 open 的 token（例如对方已经退出）会一直占着内存，可以用 sharevalue.drop 释放
+--   - 只在同一进程内有效，不要经 cluster/harbor 发往其他节点
+local core = require "skynet.sharevalue.core"
+
+local sharevalue = {}
+
+local handles = setmetatable({}, { __mode = "k" })	-- 句柄 -> true，用于区分句柄和表
+local opened = {}	-- open 得到的表 -> 句柄
+
+function sharevalue.new(t)
+	local h = core.new(t)
+	handles[h] = true
+	return h
+end
+
+function sharevalue.token(h)
+	return core.token(h)
+end
+
+-- 直接为一张表生成一次性的 token
+function sharevalue.share(t)
+	local h = core.new(t)
+	local token = core.token(h)
+	core.release(h)
+	return token
+end
+
+function sharevalue.open(token)
+	local h = core.open(token)
+	local t = core.table(h)
+	local old = opened[t]
+	if old then
+		-- 同一个值被 open 了多次，只保留一个引用
+		core.release(h)
+	else
+		opened[t] = h
+	end
+	return t
+end
+
+sharevalue.drop = core.drop
+
+-- 释放句柄（new 的返回值）或 open 得到的表
+function sharevalue.release(v)
+	if handles[v] then
+		core.release(v)
+		handles[v] = nil
+		return
+	end
+	local h = opened[v]
+	if h then
+		opened[v] = nil
+		core.release(h)
+	end
+end
+
+-- 句柄所持有数据占的内存（字节）
+sharevalue.size = core.size
+-- 进程内存活的共享值个数
+sharevalue.count = core.count
+
+return sharevalue
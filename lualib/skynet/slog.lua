@@ -0,0 +1,77 @@
+-- 说明：
+--  结构化日志：只把“格式 id + seri 打包的参数”发给 logger 服务，格式化推迟到读日志的时候。
+--  用法：
+--    local slog = require "skynet.slog"
+--    slog.log("player %d login from %s", uid, addr)
+--  约定：
+--    - 需要在配置中设置 logbinary = "/path/to/skynet.slog"，否则退化为 skynet.error(string.format(...))
+--    - 格式 id 是格式串的 32 位 FNV-1a 哈希，各服务独立计算也一致；每个服务首次使用某个格式时
+--      先发一条定义 (0, id, 格式串)，logger 去重后写入文件
+--    - 哈希冲突时服务内顺序探测下一个 id；不同服务之间的冲突由 logger 改写（见 service_logger.c）
+--    - 参数只能是 seri 支持的类型（nil/boolean/number/string/table），按 string.format 的规则解码
+--    - 带 schema 的表按 schema 打包：服务注册过新的 schema 后，下一条日志之前先发定义 (0, 0, 指纹, 名字, 字段表)
+--    - 用 examples/slogdump.lua 把二进制日志还原成文本
+local skynet = require "skynet"
+local c = require "skynet.core"
+local schema = require "skynet.schema"
+
+local pack = skynet.pack
+local send = c.send
+local PTYPE_LOG = skynet.PTYPE_LOG
+
+local slog = {}
+
+local enable = skynet.getenv "logbinary" ~= nil
+local logger
+local format_id = {}	-- 格式串 -> id
+local id_format = {}	-- id -> 格式串
+local schema_defines = schema.defines
+local schema_sent = 0	-- 已经发给 logger 的 schema 定义个数
+
+local function hash(fmt)
+	local h = 0x811c9dc5
+	for i = 1, #fmt do
+		h = ((h ~ fmt:byte(i)) * 16777619) & 0xffffffff
+	end
+	if h == 0 then
+		h = 1	-- 0 留给格式定义
+	end
+	return h
+end
+
+local function define(fmt)
+	local id = hash(fmt)
+	while id_format[id] do
+		id = (id + 1) & 0xffffffff
+		if id == 0 then
+			id = 1
+		end
+	end
+	format_id[fmt] = id
+	id_format[id] = fmt
+	send(logger, PTYPE_LOG, 0, pack(0, id, fmt))
+	return id
+end
+
+function slog.log(fmt, ...)
+	if not enable then
+		skynet.error(string.format(fmt, ...))
+		return
+	end
+	if not logger then
+		logger = skynet.localname ".logger"
+	end
+	if schema_defines[schema_sent + 1] then
+		repeat
+			schema_sent = schema_sent + 1
+			local d = schema_defines[schema_sent]
+			send(logger, PTYPE_LOG, 0, pack(0, 0, d[1], d[2], d[3]))
+		until schema_defines[schema_sent + 1] == nil
+	end
+	local id = format_id[fmt] or define(fmt)
+	send(logger, PTYPE_LOG, 0, pack(id, ...))
+end
+
+slog.hash = hash
+
+return slog
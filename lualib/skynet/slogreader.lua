@@ -0,0 +1,263 @@
+-- 说明：
+--  结构化日志（logbinary）的离线解码，纯 Lua 实现，不依赖 skynet，可直接用 lua 5.4 运行。
+--  文件格式见 service-src/service_logger.c：
+--    "SKYLOG1\0" 之后是若干条记录：u32 长度、u32 来源、u64 时间（厘秒）、seri 数据
+--    seri 数据为 (格式 id, 参数...)；格式 id 为 0 时是格式定义 (0, id, 格式串)，
+--    或者 schema 定义 (0, 0, 指纹, 名字, 字段表)，用来解开按 schema 打包的参数（见 lualib-src/lua-seri.c）
+--  用法：
+--    local slogreader = require "skynet.slogreader"
+--    for ti, source, text in slogreader.records(filename) do ... end
+local string = string
+local sunpack = string.unpack
+
+local slogreader = {}
+
+local MAGIC = "SKYLOG1\0"
+local HEADER = "=I4I4I8"
+local HEADER_SIZE = string.packsize(HEADER)
+
+local NUMBER = {
+	[1] = "=I1",
+	[2] = "=I2",
+	[4] = "=i4",
+	[6] = "=i8",
+	[8] = "=d",
+}
+
+local unpack_one
+
+local function varint(data, pos)
+	local v = 0
+	local shift = 0
+	while true do
+		local b = data:byte(pos)
+		pos = pos + 1
+		v = v | ((b & 0x7f) << shift)
+		if b < 0x80 then
+			return v, pos
+		end
+		shift = shift + 7
+	end
+end
+
+local unpack_schema
+
+local FIELD = {
+	integer = function(data, pos)
+		local v
+		v, pos = varint(data, pos)
+		return (v >> 1) ~ -(v & 1), pos
+	end,
+	number = function(data, pos)
+		return sunpack("=d", data, pos)
+	end,
+	boolean = function(data, pos)
+		return data:byte(pos) ~= 0, pos + 1
+	end,
+	string = function(data, pos)
+		local len
+		len, pos = varint(data, pos)
+		return data:sub(pos, pos + len - 1), pos + len
+	end,
+	any = function(data, pos, schemas)
+		return unpack_one(data, pos, schemas)
+	end,
+}
+
+local function unpack_field(data, pos, schemas, ftype)
+	local f = FIELD[ftype]
+	if f then
+		return f(data, pos, schemas)
+	end
+	return unpack_schema(data, pos, schemas, assert(schemas.name[ftype], ftype))
+end
+
+-- 字段表为 { 字段名, 类型, ... }，类型前的 '*' 表示数组
+function unpack_schema(data, pos, schemas, s)
+	local fields = s[3]
+	local n = #fields // 2
+	local bitmap = pos
+	pos = pos + (n + 7) // 8
+	local tbl = {}
+	for i = 0, n - 1 do
+		if data:byte(bitmap + i // 8) & (1 << (i % 8)) ~= 0 then
+			local name, ftype = fields[i*2+1], fields[i*2+2]
+			if ftype:byte() == 42 then	-- '*'
+				ftype = ftype:sub(2)
+				local count
+				count, pos = varint(data, pos)
+				local array = {}
+				for j = 1, count do
+					array[j], pos = unpack_field(data, pos, schemas, ftype)
+				end
+				tbl[name] = array
+			else
+				tbl[name], pos = unpack_field(data, pos, schemas, ftype)
+			end
+		end
+	end
+	return tbl, pos
+end
+
+local function unpack_value(data, pos, b, schemas)
+	local t = b & 7
+	local cookie = b >> 3
+	if t == 0 then
+		return nil, pos
+	elseif t == 1 then
+		return cookie ~= 0, pos
+	elseif t == 2 then
+		if cookie == 0 then
+			return 0, pos
+		end
+		return sunpack(assert(NUMBER[cookie], "invalid number"), data, pos)
+	elseif t == 3 then
+		local p
+		p, pos = sunpack("=J", data, pos)
+		return string.format("userdata: 0x%x", p), pos
+	elseif t == 4 then
+		return data:sub(pos, pos + cookie - 1), pos + cookie
+	elseif t == 5 then
+		local len
+		len, pos = sunpack(cookie == 2 and "=I2" or "=I4", data, pos)
+		return data:sub(pos, pos + len - 1), pos + len
+	elseif t == 6 then
+		local n = cookie
+		if n == 31 then
+			n, pos = unpack_one(data, pos, schemas)
+		end
+		local tbl = {}
+		for i = 1, n do
+			tbl[i], pos = unpack_one(data, pos, schemas)
+		end
+		while true do
+			local k
+			k, pos = unpack_one(data, pos, schemas)
+			if k == nil then
+				break
+			end
+			tbl[k], pos = unpack_one(data, pos, schemas)
+		end
+		return tbl, pos
+	elseif t == 7 then
+		-- schema id（只在写日志的进程里有意义），指纹，然后是 schema 的内容
+		local _, fingerprint
+		_, pos = unpack_one(data, pos)
+		fingerprint, pos = sunpack("=I4", data, pos)
+		local s = schemas and schemas.fingerprint[fingerprint]
+		if not s then
+			error(string.format("unknown schema %08x", fingerprint))
+		end
+		return unpack_schema(data, pos, schemas, s)
+	end
+	error("invalid serialize type " .. t)
+end
+
+function unpack_one(data, pos, schemas)
+	return unpack_value(data, pos + 1, data:byte(pos), schemas)
+end
+
+-- 解出 seri 数据中的全部值，返回值的个数和数组。schemas 为 slogreader.schemas() 的结果，可省略
+function slogreader.unpack(data, schemas)
+	local list = {}
+	local n = 0
+	local pos = 1
+	while pos <= #data do
+		n = n + 1
+		list[n], pos = unpack_one(data, pos, schemas)
+	end
+	return n, list
+end
+
+-- 按指纹和名字索引的 schema 定义
+function slogreader.schemas()
+	return { fingerprint = {}, name = {} }
+end
+
+-- 记下 schema 定义记录 (0, 0, 指纹, 名字, 字段表) 的内容
+function slogreader.define_schema(schemas, list)
+	local s = { list[3], list[4], list[5] }
+	schemas.fingerprint[s[1]] = s
+	schemas.name[s[2]] = s
+end
+
+local function repr(v)
+	if type(v) ~= "table" then
+		return tostring(v)
+	end
+	local s = {}
+	for i = 1, #v do
+		s[i] = repr(v[i])
+	end
+	for k, x in pairs(v) do
+		if math.type(k) ~= "integer" or k < 1 or k > #v then
+			table.insert(s, repr(k) .. "=" .. repr(x))
+		end
+	end
+	return "{" .. table.concat(s, ",") .. "}"
+end
+
+-- 按格式串还原文本；参数与格式对不上时原样列出
+function slogreader.format(fmt, n, args)
+	for i = 1, n do
+		if type(args[i]) == "table" then
+			args[i] = repr(args[i])
+		end
+	end
+	local ok, text = pcall(string.format, fmt, table.unpack(args, 1, n))
+	if ok then
+		return text
+	end
+	local s = { fmt }
+	for i = 1, n do
+		s[i+1] = tostring(args[i])
+	end
+	return table.concat(s, " ")
+end
+
+-- 与文本日志一致的时间戳：日/月/年 时:分:秒.厘秒
+function slogreader.timestring(ti)
+	return os.date("%d/%m/%y %H:%M:%S", ti // 100) .. string.format(".%02d", ti % 100)
+end
+
+-- 逐条返回 (时间, 来源, 文本)，格式定义记录会被跳过
+function slogreader.records(filename)
+	local f = assert(io.open(filename, "rb"))
+	local data = f:read "a"
+	f:close()
+	assert(data:sub(1, #MAGIC) == MAGIC, "not a skynet binary log")
+	local formats = {}
+	local schemas = slogreader.schemas()
+	local pos = #MAGIC + 1
+	return function()
+		while pos + HEADER_SIZE - 1 <= #data do
+			local sz, source, ti, start = sunpack(HEADER, data, pos)
+			pos = start + sz
+			if pos - 1 > #data then
+				return	-- 未写完的最后一条
+			end
+			local ok, n, list = pcall(slogreader.unpack, data:sub(start, pos - 1), schemas)
+			local id = ok and list[1]
+			if not ok then
+				return ti, source, "[invalid record : " .. tostring(n) .. "]"
+			elseif id == 0 then
+				if list[2] == 0 then
+					slogreader.define_schema(schemas, list)
+				else
+					formats[list[2]] = list[3]
+				end
+			else
+				local fmt = formats[id]
+				local text
+				if fmt then
+					text = slogreader.format(fmt, n - 1, { table.unpack(list, 2, n) })
+				else
+					text = string.format("[unknown format %08x]", id)
+				end
+				return ti, source, text
+			end
+		end
+	end
+end
+
+return slogreader
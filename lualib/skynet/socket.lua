@@ -149,6 +149,9 @@ socket_message[2] = function(id, ud , addr)
 		end
 		s.connected = true
 		wakeup(s)
+	elseif addr == "redirect" and s.pause == nil then
+		-- socket.redirect 暂停了读取，之前的数据都已收到，恢复读取
+		driver.start(id)
 	end
 end
 
@@ -235,6 +238,40 @@ socket_message[7] = function(id, size)
 	end
 end
 
+-- SKYNET_SOCKET_TYPE_UDP_BATCH = 8
+socket_message[8] = function(id, size, data)
+	-- 批量 UDP 数据（recvmmsg 一次读到多个 datagram）：拆开后逐个回调
+	local s = socket_pool[id]
+	if s == nil or s.callback == nil then
+		skynet.error("socket: drop udp package from " .. id)
+		driver.drop(data, size)
+		return
+	end
+	local batch = { driver.udp_batch(data, size) }
+	skynet_core.trash(data, size)
+	local callback = s.callback
+	for i = 1, #batch, 2 do
+		callback(batch[i], batch[i+1])
+	end
+end
+
+-- SKYNET_SOCKET_TYPE_WRITABLE = 9
+socket_message[9] = function(id, writable)
+	-- 发送队列越过高水位（writable == 0）或回落到低水位（writable == 1）
+	local s = socket_pool[id]
+	if s then
+		writable = writable ~= 0
+		s.blocked = not writable
+		if s.on_writable then
+			s.on_writable(id, writable)
+		end
+	end
+end
+
+-- SKYNET_SOCKET_TYPE_FRAME = 10
+-- 分帧模式下 data 只含完整的包（包头原样保留），字节流与 SKYNET_SOCKET_TYPE_DATA 相同
+socket_message[10] = socket_message[1]
+
 skynet.register_protocol {
 	name = "socket",
 	id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
@@ -441,6 +478,10 @@ end
 
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
+-- 大块数据（>=16K）在 Linux 下以 MSG_ZEROCOPY 发送；socket.sendfile(id, filename, offset, size) 由网络线程 sendfile 发送文件，
+-- 返回将发送的字节数，失败返回 false
+socket.zwrite = assert(driver.zsend)
+socket.sendfile = assert(driver.sendfile)
 socket.header = assert(driver.header)
 
 function socket.invalid(id)
@@ -551,6 +592,41 @@ function socket.warning(id, callback)
 	obj.on_warning = callback
 end
 
+-- 设置发送队列水位：socket.watermark(id, high [, low, limit, droplow])
+--  - 队列越过 high 时回调 onwritable(id, false)，回落到 low 以下时回调 onwritable(id, true)
+--  - limit 为硬上限，超过后直接关闭连接；droplow 为 true 时越过 high 后丢弃 lwrite 的数据
+--  - high 为 0 关闭水位通知；监听 socket 上的设置会被 accept 的新连接继承
+socket.watermark = assert(driver.watermark)
+
+-- 在网络线程按长度头分包：socket.frame(id, header [, max])
+--  - header 为 2 或 4（大端包长），0 关闭；max 为单包最大长度，超过时关闭连接
+--  - 之后收到的每条数据消息都只含完整的包；监听 socket 上的设置会被 accept 的新连接继承
+socket.frame = assert(driver.frame)
+
+-- 分帧模式下把完整的包直接交给 agent：socket.redirect(id, agent)
+--  - 每个包（不含包头）是一条 PTYPE_CLIENT 消息，session 为 id，不再经过 socket 的属主服务
+--  - 连接关闭等其它事件仍然通知属主；agent 为 0 时取消
+--  - 已经在读的 socket 先暂停，属主收完之前的数据后自动恢复，包的顺序不变
+socket.redirect = assert(driver.redirect)
+
+-- 同机进程之间改用共享内存传输：之后数据走两个方向的共享内存环，TCP 连接只传唤醒和发现对端关闭
+--  - socket.shm(id, name, size [, greeting]) 创建共享内存（名字由调用者保证唯一，size 为每个方向的环大小），
+--    greeting 在切换前原样写到连接上，通常是告诉对端名字的握手回应
+--  - socket.shm(id, name) 打开对端创建的共享内存；失败返回 false
+--  - 切换时不能有没发完的数据或没分完的包，否则关闭连接
+socket.shm = assert(driver.shm)
+
+function socket.onwritable(id, callback)
+	local obj = socket_pool[id]
+	assert(obj)
+	obj.on_writable = callback
+end
+
+function socket.blocked(id)
+	local obj = socket_pool[id]
+	return obj ~= nil and obj.blocked == true
+end
+
 function socket.onclose(id, callback)
     -- 注册连接关闭回调：当 SOCKET_TYPE_CLOSE 触发时回调
 	socket_onclose[id] = callback
@@ -38,6 +38,8 @@ local channel_socket_meta = {
 
 local socket_error = setmetatable({}, {__tostring = function() return "[Error: socket]" end })	-- alias for error object
 socket_channel.error = socket_error
+local socket_timeout = setmetatable({}, {__tostring = function() return "[Error: timeout]" end })
+socket_channel.timeout = socket_timeout
 
 function socket_channel.channel(desc)
 	-- 创建一个 channel：
@@ -96,9 +98,11 @@ local function wakeup_all(self, errmsg)
 	if self.__response then
 		for k,co in pairs(self.__thread) do
 			self.__thread[k] = nil
-			self.__result[co] = socket_error
-			self.__result_data[co] = errmsg
-			skynet.wakeup(co)
+			if co then	-- ignore the timeout session
+				self.__result[co] = socket_error
+				self.__result_data[co] = errmsg
+				skynet.wakeup(co)
+			end
 		end
 	else
 		for i = 1, #self.__request do
@@ -146,6 +150,11 @@ local function dispatch_by_session(self)
 					wakeup_all(self, "channel_closed")
 					break
 				end
+			elseif co == false then
+				-- 已经超时放弃的请求：丢掉迟到的回应，收完最后一段再删掉标记
+				if not (padding and result_ok) then
+					self.__thread[session] = nil
+				end
 			else
 				self.__thread[session] = nil
 				skynet.error("socket: unknown session :", session)
@@ -530,11 +539,28 @@ function channel:connect(once)
 	return block_connect(self, once)
 end
 
-local function wait_for_response(self, response)
+function channel:ready()
+	-- 等待连接（含 auth）完成，必要时连接一次；不会重新打开已 close 的 channel
+	return block_connect(self, true)
+end
+
+local function wait_for_response(self, response, timeout)
 	-- 将当前协程压入等待队列，等待响应解析流程唤醒
 	-- 会话模式：response=会话号；顺序模式：response=解析函数
+	-- timeout（1/100 秒，只用于会话模式）：到时还没有回应就放弃，session 标记为 false ，迟到的回应被丢掉
 	local co = coroutine.running()
 	push_response(self, response, co)
+	if timeout then
+		assert(self.__response, "timeout needs session mode")
+		skynet.timeout(timeout, function()
+			if self.__thread[response] == co then
+				self.__thread[response] = false
+				self.__result[co] = socket_timeout
+				self.__result_data[co] = nil
+				skynet.wakeup(co)
+			end
+		end)
+	end
 	skynet.wait(co)
 
 	local result = self.__result[co]
@@ -548,6 +574,8 @@ local function wait_for_response(self, response)
 		else
 			error(socket_error)
 		end
+	elseif result == socket_timeout then
+		error(socket_timeout)
 	else
 		assert(result, result_data)
 		return result_data
@@ -594,10 +622,10 @@ function channel:request(request, response, padding)
 	return wait_for_response(self, response)
 end
 
-function channel:response(response)
+function channel:response(response, timeout)
 	assert(block_connect(self))
 
-	return wait_for_response(self, response)
+	return wait_for_response(self, response, timeout)
 end
 
 function channel:close()
@@ -42,7 +42,7 @@ end
 function gateserver.start(handler)
 	-- 启动 gateserver，并将网络事件转发给 handler：
 	--   必须实现：handler.message(fd, msg, sz), handler.connect(fd, msg)
-	--   可选实现：handler.open/close/disconnect/error/warning/command/embed
+	--   可选实现：handler.open/close/disconnect/error/warning/writable/command/embed
 	assert(handler.message)
 	assert(handler.connect)
 
@@ -55,8 +55,18 @@ function gateserver.start(handler)
 		local port = assert(conf.port)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
+		-- 半包表按 maxclient 预先分配
+		queue = queue or netpack.new(maxclient)
 		skynet.error(string.format("Listen on %s:%d", address, port))
 		socket = socketdriver.listen(address, port, conf.backlog)
+		if conf.frame then
+			-- 在网络线程按 2 字节包头分包，netpack 不再需要拼接半包
+			socketdriver.frame(socket, 2)
+		end
+		if conf.send_high or conf.send_limit then
+			-- 发送队列水位设置在监听 socket 上，accept 的连接会继承
+			socketdriver.watermark(socket, conf.send_high or 0, conf.send_low, conf.send_limit, conf.droplow)
+		end
 		listen_context.co = coroutine.running()
 		listen_context.fd = socket
 		skynet.wait(listen_context.co)
@@ -87,19 +97,32 @@ function gateserver.start(handler)
 
 	MSG.data = dispatch_msg
 
+	-- netpack.popall 一次取出的一批包：batch[3*i-2], batch[3*i-1], batch[3*i] 为 fd, msg, sz
+	local batch = {}
+	local batch_n = 0
+	local batch_i = 0
+
 	local function dispatch_queue()
 		-- 从 netpack 队列批量弹出数据并分发（避免 handler.block 导致收包阻塞）
-		local fd, msg, sz = netpack.pop(queue)
-		if fd then
-			-- may dispatch even the handler.message blocked
-			-- If the handler.message never block, the queue should be empty, so only fork once and then exit.
-			skynet.fork(dispatch_queue)
-			dispatch_msg(fd, msg, sz)
-
-			for fd, msg, sz in netpack.pop, queue do
-				dispatch_msg(fd, msg, sz)
+		if batch_i >= batch_n then
+			batch_n = netpack.popall(queue, batch)
+			batch_i = 0
+			if batch_n == 0 then
+				return
 			end
 		end
+		-- may dispatch even the handler.message blocked
+		-- If the handler.message never block, the queue should be empty, so only fork once and then exit.
+		skynet.fork(dispatch_queue)
+		repeat
+			while batch_i < batch_n do
+				local i = batch_i * 3
+				batch_i = batch_i + 1
+				dispatch_msg(batch[i+1], batch[i+2], batch[i+3])
+			end
+			batch_n = netpack.popall(queue, batch)
+			batch_i = 0
+		until batch_n == 0
 	end
 
 	MSG.more = dispatch_queue
@@ -152,7 +175,21 @@ function gateserver.start(handler)
 		end
 	end
 
+	function MSG.writable(fd, writable)
+		-- 发送队列越过高水位（false）或回落到低水位（true），需要 conf.send_high
+		if handler.writable then
+			handler.writable(fd, writable)
+		end
+	end
+
 	function MSG.init(id, addr, port)
+		if addr == "redirect" then
+			-- socket.redirect 暂停了已经在读的连接，之前的包都已处理，恢复读取
+			if connection[id] then
+				socketdriver.start(id)
+			end
+			return
+		end
 		if listen_context then
 			local co = listen_context.co
 			if co then
@@ -0,0 +1,1048 @@
+#include "skynet.h"
+#include "skynet_socket.h"
+#include "skynet_compress.h"
+
+/*
+	clusteragent 处理一个入站的 cluster 连接（clusterd 为每个 fd 启动一个），参数为 fd 。
+	包格式见 lualib-src/lua-cluster.c ，这里只做接收方：拆请求、寻址、转发给本地服务、把回应打包写回 fd 。
+
+	PTYPE_CLIENT : 一个请求包（不含包头），握手前由 gate 转发，握手切换到 v2 后由网络线程直接投递。
+		v3 的请求 msg 在包的开头，单包的请求不拷贝，把收到的包直接交给本地服务（PTYPE_TAG_DONTCOPY）
+	PTYPE_RESPONSE / PTYPE_ERROR : 转发出去的 call 的回应
+	PTYPE_TEXT : clusterd 的管理命令
+		R handle name : 注册名字（cluster.register），handle 为十进制
+		U name : 取消注册
+		exit : 关闭 fd 并退出
+
+	单包的回应先攒在写缓冲里，消息队列空了、攒够 BATCH_MAX 字节或者有数据后又处理了 BATCH_COUNT 条消息，再合成一次 socket 写；
+	分片的大回应不进写缓冲，各段低优先级写出。
+	分片的大请求按收到的分片增长缓冲，声明的长度超过配置 cluster_large_max（字节，默认 LARGE_MAX）时断开连接。
+	同一台机器上的对端在握手时可以要求改用共享内存，见 shm_response 。
+	v4 的请求可以带期限，到这里已经过期的请求不再交给本地服务，直接回应错误，见 set_deadline 。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define PTYPE_LUA 10
+#define PTYPE_TRACE 12
+
+#define MULTI_PART 0x8000
+#define MULTI_PART_V2 0x800000
+#define BATCH_MAX 0x10000
+#define BATCH_COUNT 64	// 队列一直不空时，写缓冲最多等这么多条消息
+#define LARGE_MAX 0x10000000
+#define LARGE_PREALLOC 0x10000
+#define NAME_HASH 64
+#define CALL_HASH 1024
+#define DELAY_WINDOW 60000	// 估计延迟的基准每分钟更新一次（毫秒）
+
+// 握手 : 用 v1 格式查询这个名字，回应协商的版本后切换到 v2 及以上
+#define HELLO "\0cluster.v2"
+#define HELLO_LENGTH (sizeof(HELLO) - 1)
+#define VERSION 4
+
+// lua-seri 的类型，名字查询和握手只用到 string 和 integer
+#define TYPE_NUMBER 2
+#define TYPE_NUMBER_ZERO 0
+#define TYPE_NUMBER_BYTE 1
+#define TYPE_NUMBER_WORD 2
+#define TYPE_NUMBER_DWORD 4
+#define TYPE_NUMBER_QWORD 6
+#define TYPE_SHORT_STRING 4
+#define TYPE_LONG_STRING 5
+#define COMBINE_TYPE(t,v) ((t) | (v) << 3)
+
+#define SHM_NAME 32	// 共享内存的名字，作为 short string 放在握手回应里
+
+struct name {
+	struct name * next;
+	uint32_t handle;
+	size_t sz;
+	char str[1];
+};
+
+// 转发出去等待回应的 call ：本地 session -> 远端 session
+struct call {
+	struct call * next;
+	int session;
+	uint32_t remote;
+	uint64_t deadline;	// 本地时钟（毫秒），0 表示没有期限
+};
+
+// 分片传输中的大请求
+struct large_request {
+	struct large_request * next;
+	uint32_t session;
+	uint32_t addr;
+	char * name;		// 按名字寻址时非 NULL
+	bool push;
+	char * tracetag;
+	uint64_t deadline;
+	char * buffer;		// 随分片增长，最多 size
+	uint32_t size;
+	uint32_t cap;
+	uint32_t offset;
+	bool invalid;		// 分片超过了声明的长度
+};
+
+struct clusteragent {
+	struct skynet_context * ctx;
+	uint32_t self;
+	int fd;
+	int version;		// 1 : 2 字节包头，2 : 4 字节包头，3 : 请求的包头在 msg 后面
+	uint32_t compress;	// 握手时对端要求的压缩阈值，0 不压缩
+	uint32_t large_max;	// 分片请求的最大长度
+	char * tracetag;	// 下一个请求的 trace 标签
+	uint64_t deadline;	// 下一个请求的期限
+	uint64_t window;	// 当前估计窗口的开始时间
+	uint32_t base;		// 本地时钟与对端时钟之差的最小值，即没有排队时的单向延迟（加上两边时钟的差）
+	uint32_t next_base;	// 当前窗口里的最小值，窗口结束时成为新的基准
+	struct name * names[NAME_HASH];
+	struct call * calls[CALL_HASH];
+	struct call * freelist;
+	struct large_request * large;
+	uint8_t * wbuffer;
+	size_t wsize;
+	size_t wcap;
+	int batch;		// 写缓冲有数据以后处理过的消息数
+};
+
+struct clusteragent *
+clusteragent_create(void) {
+	struct clusteragent * a = skynet_malloc(sizeof(*a));
+	memset(a, 0, sizeof(*a));
+	a->fd = -1;
+	a->version = 1;
+	return a;
+}
+
+static void
+free_large(struct large_request *req) {
+	skynet_free(req->name);
+	skynet_free(req->tracetag);
+	skynet_free(req->buffer);
+	skynet_free(req);
+}
+
+void
+clusteragent_release(struct clusteragent *a) {
+	int i;
+	for (i=0;i<NAME_HASH;i++) {
+		struct name * n = a->names[i];
+		while (n) {
+			struct name * next = n->next;
+			skynet_free(n);
+			n = next;
+		}
+	}
+	for (i=0;i<CALL_HASH;i++) {
+		struct call * c = a->calls[i];
+		while (c) {
+			struct call * next = c->next;
+			skynet_free(c);
+			c = next;
+		}
+	}
+	struct call * c = a->freelist;
+	while (c) {
+		struct call * next = c->next;
+		skynet_free(c);
+		c = next;
+	}
+	struct large_request * req = a->large;
+	while (req) {
+		struct large_request * next = req->next;
+		free_large(req);
+		req = next;
+	}
+	skynet_free(a->tracetag);
+	skynet_free(a->wbuffer);
+	skynet_free(a);
+}
+
+// name table
+
+static uint32_t
+name_hash(const char *str, size_t sz) {
+	uint32_t h = (uint32_t)sz;
+	size_t i;
+	for (i=0;i<sz;i++) {
+		h = h ^ ((h<<5)+(h>>2)+(uint8_t)str[i]);
+	}
+	return h;
+}
+
+static struct name **
+name_search(struct clusteragent *a, const char *str, size_t sz) {
+	struct name ** p = &a->names[name_hash(str, sz) % NAME_HASH];
+	while (*p) {
+		struct name * n = *p;
+		if (n->sz == sz && memcmp(n->str, str, sz) == 0) {
+			break;
+		}
+		p = &n->next;
+	}
+	return p;
+}
+
+static uint32_t
+name_query(struct clusteragent *a, const char *str, size_t sz) {
+	struct name * n = *name_search(a, str, sz);
+	return n ? n->handle : 0;
+}
+
+static void
+name_update(struct clusteragent *a, const char *str, size_t sz, uint32_t handle) {
+	struct name ** p = name_search(a, str, sz);
+	struct name * n = *p;
+	if (handle == 0) {
+		if (n) {
+			*p = n->next;
+			skynet_free(n);
+		}
+		return;
+	}
+	if (n == NULL) {
+		n = skynet_malloc(sizeof(*n) + sz);
+		n->next = NULL;
+		n->sz = sz;
+		memcpy(n->str, str, sz);
+		n->str[sz] = '\0';
+		*p = n;
+	}
+	n->handle = handle;
+}
+
+// pending calls
+
+static void
+call_insert(struct clusteragent *a, int session, uint32_t remote, uint64_t deadline) {
+	struct call * c = a->freelist;
+	if (c) {
+		a->freelist = c->next;
+	} else {
+		c = skynet_malloc(sizeof(*c));
+	}
+	struct call ** slot = &a->calls[(unsigned)session % CALL_HASH];
+	c->session = session;
+	c->remote = remote;
+	c->deadline = deadline;
+	c->next = *slot;
+	*slot = c;
+}
+
+// 找到并移除 session 对应的 call ，返回远端 session 和期限
+static bool
+call_remove(struct clusteragent *a, int session, uint32_t *remote, uint64_t *deadline) {
+	struct call ** p = &a->calls[(unsigned)session % CALL_HASH];
+	while (*p) {
+		struct call * c = *p;
+		if (c->session == session) {
+			*p = c->next;
+			*remote = c->remote;
+			*deadline = c->deadline;
+			c->next = a->freelist;
+			a->freelist = c;
+			return true;
+		}
+		p = &c->next;
+	}
+	return false;
+}
+
+// write buffer
+
+static inline void
+fill_uint32(uint8_t * buf, uint32_t n) {
+	buf[0] = n & 0xff;
+	buf[1] = (n >> 8) & 0xff;
+	buf[2] = (n >> 16) & 0xff;
+	buf[3] = (n >> 24) & 0xff;
+}
+
+static inline uint32_t
+unpack_uint32(const uint8_t * buf) {
+	return buf[0] | buf[1]<<8 | buf[2]<<16 | (uint32_t)buf[3]<<24;
+}
+
+static inline uint32_t
+part_size(struct clusteragent *a) {
+	return a->version >= 2 ? MULTI_PART_V2 : MULTI_PART;
+}
+
+static uint8_t *
+wb_reserve(struct clusteragent *a, size_t sz) {
+	if (a->wsize + sz > a->wcap) {
+		size_t cap = a->wcap ? a->wcap : 4096;
+		while (cap < a->wsize + sz) {
+			cap *= 2;
+		}
+		uint8_t * buffer = skynet_malloc(cap);
+		if (a->wsize > 0) {
+			memcpy(buffer, a->wbuffer, a->wsize);
+		}
+		skynet_free(a->wbuffer);
+		a->wbuffer = buffer;
+		a->wcap = cap;
+	}
+	return a->wbuffer + a->wsize;
+}
+
+// 写包头，返回包头长度
+static int
+fill_header(struct clusteragent *a, uint8_t *buf, size_t len) {
+	if (a->version >= 2) {
+		buf[0] = (len >> 24) & 0xff;
+		buf[1] = (len >> 16) & 0xff;
+		buf[2] = (len >> 8) & 0xff;
+		buf[3] = len & 0xff;
+		return 4;
+	} else {
+		buf[0] = (len >> 8) & 0xff;
+		buf[1] = len & 0xff;
+		return 2;
+	}
+}
+
+// 包头 + head + msg 追加到写缓冲
+static void
+wb_package(struct clusteragent *a, const uint8_t *head, size_t headsz, const void *msg, size_t sz) {
+	size_t len = headsz + sz;
+	uint8_t * buf = wb_reserve(a, len + 4);
+	int h = fill_header(a, buf, len);
+	memcpy(buf + h, head, headsz);
+	if (sz > 0) {
+		memcpy(buf + h + headsz, msg, sz);
+	}
+	a->wsize += h + len;
+}
+
+// 大回应的分片不进写缓冲，和原来一样低优先级单独写出，不挡住后面的小回应
+static void
+send_part(struct clusteragent *a, const uint8_t *head, size_t headsz, const void *msg, size_t sz) {
+	size_t len = headsz + sz;
+	uint8_t * buf = skynet_malloc(len + 4);
+	int h = fill_header(a, buf, len);
+	memcpy(buf + h, head, headsz);
+	if (sz > 0) {
+		memcpy(buf + h + headsz, msg, sz);
+	}
+	skynet_socket_send_lowpriority(a->ctx, a->fd, buf, (int)(h + len));
+}
+
+static void
+flush(struct clusteragent *a) {
+	if (a->wsize == 0)
+		return;
+	// 缓冲交给 socket ，失败时由 socket 释放
+	skynet_socket_send(a->ctx, a->fd, a->wbuffer, (int)a->wsize);
+	a->wbuffer = NULL;
+	a->wsize = 0;
+	a->wcap = 0;
+	a->batch = 0;
+}
+
+// 与 lua-cluster.c 的 packresponse 相同
+static void
+response(struct clusteragent *a, uint32_t session, bool ok, const void *msg, size_t sz) {
+	uint32_t partsz = part_size(a);
+	uint8_t head[9];
+	fill_uint32(head, session);
+	if (!ok) {
+		if (sz > partsz) {
+			// truncate the error msg if too long
+			sz = partsz;
+		}
+		head[4] = 0;
+		wb_package(a, head, 5, msg, sz);
+		return;
+	}
+	if (sz > partsz) {
+		head[4] = 2;	// multi part begin
+		fill_uint32(head+5, (uint32_t)sz);
+		send_part(a, head, 9, NULL, 0);
+		const char * ptr = msg;
+		while (sz > 0) {
+			size_t s;
+			if (sz > partsz) {
+				s = partsz;
+				head[4] = 3;
+			} else {
+				s = sz;
+				head[4] = 4;
+			}
+			send_part(a, head, 5, ptr, s);
+			sz -= s;
+			ptr += s;
+		}
+		return;
+	}
+	if (a->compress > 0 && sz >= a->compress) {
+		void * cmsg = skynet_malloc(sz);
+		size_t csz = skynet_compress(msg, sz, cmsg, sz);
+		if (csz > 0) {
+			head[4] = 5;
+			fill_uint32(head+5, (uint32_t)sz);
+			wb_package(a, head, 9, cmsg, csz);
+			skynet_free(cmsg);
+			return;
+		}
+		skynet_free(cmsg);
+	}
+	head[4] = 1;
+	wb_package(a, head, 5, msg, sz);
+}
+
+static void
+response_error(struct clusteragent *a, uint32_t session, const char *err) {
+	response(a, session, false, err, strlen(err));
+}
+
+// lua-seri
+
+static size_t
+seri_integer(uint8_t *buf, int64_t v) {
+	if (v == 0) {
+		buf[0] = COMBINE_TYPE(TYPE_NUMBER, TYPE_NUMBER_ZERO);
+		return 1;
+	} else if (v != (int32_t)v) {
+		buf[0] = COMBINE_TYPE(TYPE_NUMBER, TYPE_NUMBER_QWORD);
+		memcpy(buf+1, &v, 8);
+		return 9;
+	} else if (v < 0) {
+		int32_t v32 = (int32_t)v;
+		buf[0] = COMBINE_TYPE(TYPE_NUMBER, TYPE_NUMBER_DWORD);
+		memcpy(buf+1, &v32, 4);
+		return 5;
+	} else if (v < 0x100) {
+		buf[0] = COMBINE_TYPE(TYPE_NUMBER, TYPE_NUMBER_BYTE);
+		buf[1] = (uint8_t)v;
+		return 2;
+	} else if (v < 0x10000) {
+		uint16_t v16 = (uint16_t)v;
+		buf[0] = COMBINE_TYPE(TYPE_NUMBER, TYPE_NUMBER_WORD);
+		memcpy(buf+1, &v16, 2);
+		return 3;
+	} else {
+		uint32_t v32 = (uint32_t)v;
+		buf[0] = COMBINE_TYPE(TYPE_NUMBER, TYPE_NUMBER_DWORD);
+		memcpy(buf+1, &v32, 4);
+		return 5;
+	}
+}
+
+// 读一个 integer ，返回读过的字节数，类型不对返回 0
+static size_t
+seri_read_integer(const uint8_t *buf, size_t sz, int64_t *v) {
+	if (sz < 1 || (buf[0] & 7) != TYPE_NUMBER)
+		return 0;
+	switch (buf[0] >> 3) {
+	case TYPE_NUMBER_ZERO:
+		*v = 0;
+		return 1;
+	case TYPE_NUMBER_BYTE:
+		if (sz < 2)
+			return 0;
+		*v = buf[1];
+		return 2;
+	case TYPE_NUMBER_WORD: {
+		uint16_t v16;
+		if (sz < 3)
+			return 0;
+		memcpy(&v16, buf+1, 2);
+		*v = v16;
+		return 3;
+	}
+	case TYPE_NUMBER_DWORD: {
+		int32_t v32;
+		if (sz < 5)
+			return 0;
+		memcpy(&v32, buf+1, 4);
+		*v = v32;
+		return 5;
+	}
+	case TYPE_NUMBER_QWORD:
+		if (sz < 9)
+			return 0;
+		memcpy(v, buf+1, 8);
+		return 9;
+	default:
+		return 0;
+	}
+}
+
+// 读一个 string ，返回读过的字节数，类型不对返回 0
+static size_t
+seri_read_string(const uint8_t *buf, size_t sz, const char **str, size_t *len) {
+	if (sz < 1)
+		return 0;
+	int cookie = buf[0] >> 3;
+	size_t h = 1;
+	switch (buf[0] & 7) {
+	case TYPE_SHORT_STRING:
+		*len = cookie;
+		break;
+	case TYPE_LONG_STRING:
+		if (cookie == 2 && sz >= 3) {
+			uint16_t n;
+			memcpy(&n, buf+1, 2);
+			*len = n;
+			h = 3;
+		} else if (cookie == 4 && sz >= 5) {
+			uint32_t n;
+			memcpy(&n, buf+1, 4);
+			*len = n;
+			h = 5;
+		} else {
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+	if (sz - h < *len)
+		return 0;
+	*str = (const char *)buf + h;
+	return h + *len;
+}
+
+/*
+	握手时对端要求改用共享内存（同一台机器上的进程）：创建共享内存，回应里再带上它的名字。
+	回应原样写到 TCP 上之后这条连接就切换到共享内存，对端读到回应后打开它，见 socket_server_shm 。
+	失败时返回 false ，照常回应，连接保持 TCP 。
+ */
+static bool
+shm_response(struct clusteragent *a, uint32_t session, uint8_t *ret, size_t retsz, size_t size) {
+	char name[SHM_NAME];
+	int n = snprintf(name, sizeof(name), "/skynet.%d.%x.%d", (int)getpid(), a->self, a->fd);
+	if (n <= 0 || n >= (int)sizeof(name))
+		return false;
+	ret[retsz] = COMBINE_TYPE(TYPE_SHORT_STRING, n);
+	memcpy(ret + retsz + 1, name, n);
+	response(a, session, true, ret, retsz + 1 + n);
+	int err = skynet_socket_shm(a->ctx, a->fd, name, size, a->wbuffer, a->wsize);
+	a->wsize = 0;
+	if (err) {
+		skynet_error(a->ctx, "Can't create shared memory %s for fd %d, use tcp", name, a->fd);
+		return false;
+	}
+	return true;
+}
+
+// 名字查询（地址为 0 的请求），参数为 skynet.pack(name) ；查询 HELLO 是握手
+static void
+query_name(struct clusteragent *a, uint32_t session, const uint8_t *msg, size_t sz) {
+	const char * name;
+	size_t len;
+	size_t n = seri_read_string(msg, sz, &name, &len);
+	if (n == 0) {
+		response_error(a, session, "Invalid name query");
+		return;
+	}
+	uint8_t ret[18 + SHM_NAME];
+	if (len == HELLO_LENGTH && memcmp(name, HELLO, len) == 0 && a->version == 1) {
+		// 参数 : 压缩阈值，对端支持的版本（只支持 v2 的对端不带），同机的对端要求的共享内存环大小（可选）
+		int64_t compress = 0;
+		int64_t version = 2;
+		int64_t shm = 0;
+		size_t c = seri_read_integer(msg + n, sz - n, &compress);
+		if (c > 0) {
+			n += c;
+			c = seri_read_integer(msg + n, sz - n, &version);
+			if (c > 0) {
+				n += c;
+				seri_read_integer(msg + n, sz - n, &shm);
+			}
+		}
+		a->compress = compress > 0 && compress < 0x7fffffff ? (uint32_t)compress : 0;
+		if (version > VERSION) {
+			version = VERSION;
+		} else if (version < 2) {
+			version = 2;
+		}
+		// 对端在收到回应之前不会再发包，此时切换分包方式不会切乱数据流
+		skynet_socket_frame(a->ctx, a->fd, 4, 0);
+		skynet_socket_redirect(a->ctx, a->fd, a->self);
+		size_t retsz = seri_integer(ret, version);
+		retsz += seri_integer(ret + retsz, a->compress);
+		if (shm <= 0 || !shm_response(a, session, ret, retsz, (size_t)shm)) {
+			response(a, session, true, ret, retsz);
+			flush(a);
+		}
+		a->version = (int)version;
+		return;
+	}
+	uint32_t handle = name_query(a, name, len);
+	if (handle) {
+		response(a, session, true, ret, seri_integer(ret, handle));
+	} else {
+		response_error(a, session, "name not found");
+	}
+}
+
+static uint64_t
+now_ms(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000 + ti.tv_nsec / 1000000;
+}
+
+static inline bool
+expired(uint64_t deadline) {
+	return deadline != 0 && now_ms() >= deadline;
+}
+
+// 把一个完整的请求交给本地服务 : msg 与 tracetag 的所有权随之转移
+static void
+forward_request(struct clusteragent *a, uint32_t addr, const char *name, size_t namesz, uint32_t session, bool push, char *tracetag, uint64_t deadline, void *msg, size_t sz) {
+	if (addr == 0 && name == NULL) {
+		query_name(a, session, msg, sz);
+		skynet_free(msg);
+		skynet_free(tracetag);
+		return;
+	}
+	if (!push && expired(deadline)) {
+		// 对端已经放弃了这个请求，执行了也没人要结果
+		skynet_free(msg);
+		skynet_free(tracetag);
+		response_error(a, session, "deadline exceeded");
+		return;
+	}
+	char local[256];
+	const char * dest = NULL;
+	if (name) {
+		if (name[0] == '@') {
+			addr = name_query(a, name + 1, namesz - 1);
+		} else {
+			// 本地名字（.name 或 :handle），交给 skynet_sendname
+			memcpy(local, name, namesz);
+			local[namesz] = '\0';
+			dest = local;
+		}
+		if (addr == 0 && dest == NULL) {
+			skynet_free(msg);
+			skynet_free(tracetag);
+			if (!push) {
+				response_error(a, session, "Invalid name");
+			}
+			return;
+		}
+	}
+	int type = PTYPE_LUA | PTYPE_TAG_DONTCOPY;
+	if (!push) {
+		type |= PTYPE_TAG_ALLOCSESSION;
+		if (tracetag) {
+			if (dest) {
+				skynet_sendname(a->ctx, 0, dest, PTYPE_TRACE, 0, tracetag, strlen(tracetag));
+			} else {
+				skynet_send(a->ctx, 0, addr, PTYPE_TRACE, 0, tracetag, strlen(tracetag));
+			}
+		}
+	}
+	skynet_free(tracetag);
+	int s = dest ? skynet_sendname(a->ctx, 0, dest, type, 0, msg, sz)
+		: skynet_send(a->ctx, 0, addr, type, 0, msg, sz);
+	if (push)
+		return;
+	if (s < 0) {
+		response_error(a, session, "call to invalid address");
+	} else {
+		call_insert(a, s, session, deadline);
+	}
+}
+
+static void *
+copy_msg(const uint8_t *buf, size_t sz) {
+	void * msg = skynet_malloc(sz);
+	memcpy(msg, buf, sz);
+	return msg;
+}
+
+// 解压失败返回 NULL ；原长超过 cluster_large_max 或压缩比例不可能达到时不分配，也返回 NULL
+static void *
+uncompress_msg(struct clusteragent *a, const uint8_t *buf, size_t sz, uint32_t rawsz) {
+	if (rawsz > a->large_max || rawsz > (uint64_t)sz * COMPRESS_RATIO_MAX) {
+		return NULL;
+	}
+	void * msg = skynet_malloc(rawsz);
+	if (skynet_decompress(buf, sz, msg, rawsz) != (int)rawsz) {
+		skynet_free(msg);
+		return NULL;
+	}
+	return msg;
+}
+
+static char *
+take_tracetag(struct clusteragent *a) {
+	char * tag = a->tracetag;
+	a->tracetag = NULL;
+	return tag;
+}
+
+static void
+set_tracetag(struct clusteragent *a, const uint8_t *tag, size_t sz) {
+	skynet_free(a->tracetag);
+	a->tracetag = skynet_malloc(sz + 1);
+	memcpy(a->tracetag, tag, sz);
+	a->tracetag[sz] = '\0';
+}
+
+static uint64_t
+take_deadline(struct clusteragent *a) {
+	uint64_t deadline = a->deadline;
+	a->deadline = 0;
+	return deadline;
+}
+
+/*
+	期限包 : timeout 是对端打包时剩下的毫秒数，clock 是对端打包时的时钟。
+	两边的时钟不同步，但 本地时钟 - clock 减去它的最小值（没有排队时的样子），就是这个请求在对端的批量、
+	socket 缓冲和这里的消息队列里多等的时间，从 timeout 里扣掉。最小值每个窗口重新取，时钟的漂移不会一直累积。
+ */
+static void
+set_deadline(struct clusteragent *a, uint32_t timeout, uint32_t clock) {
+	uint64_t now = now_ms();
+	uint32_t d = (uint32_t)now - clock;
+	if (a->window == 0 || now - a->window >= DELAY_WINDOW) {
+		a->base = a->window == 0 ? d : a->next_base;
+		a->next_base = d;
+		a->window = now;
+	}
+	if ((int32_t)(d - a->base) < 0)
+		a->base = d;
+	if ((int32_t)(d - a->next_base) < 0)
+		a->next_base = d;
+	uint32_t delay = d - a->base;
+	// 已经过期的记成 1 ，不和 0 （没有期限）混淆
+	a->deadline = delay >= timeout ? 1 : now + (timeout - delay);
+}
+
+// 单包的请求 : msg 的所有权随之转移，NULL 表示解压失败
+static void
+single_request(struct clusteragent *a, uint32_t addr, const char *name, size_t namesz, uint32_t session, void *msg, size_t sz) {
+	char * tag = take_tracetag(a);
+	uint64_t deadline = take_deadline(a);
+	if (msg == NULL) {
+		skynet_free(tag);
+		skynet_error(a->ctx, "Invalid compressed cluster message from fd %d", a->fd);
+		if (session) {
+			response_error(a, session, "Invalid compressed message");
+		}
+		return;
+	}
+	forward_request(a, addr, name, namesz, session, session == 0, tag, deadline, msg, sz);
+}
+
+static void
+large_begin(struct clusteragent *a, uint32_t addr, const char *name, size_t namesz, uint32_t session, uint32_t size, bool push) {
+	if (size > a->large_max) {
+		// 长度来自对端，不能照着分配；这条连接上的数据已经不可信，断开
+		skynet_error(a->ctx, "Large request (%u bytes) from fd %d exceeds cluster_large_max (%u), close it", size, a->fd, a->large_max);
+		skynet_free(take_tracetag(a));
+		take_deadline(a);
+		skynet_socket_close(a->ctx, a->fd);
+		return;
+	}
+	struct large_request * req = skynet_malloc(sizeof(*req));
+	req->session = session;
+	req->size = size;
+	req->addr = addr;
+	req->name = NULL;
+	if (name) {
+		req->name = skynet_malloc(namesz + 1);
+		memcpy(req->name, name, namesz);
+		req->name[namesz] = '\0';
+	}
+	req->push = push;
+	req->tracetag = take_tracetag(a);
+	req->deadline = take_deadline(a);
+	req->buffer = NULL;
+	req->cap = 0;
+	req->offset = 0;
+	req->invalid = false;
+	req->next = a->large;
+	a->large = req;
+}
+
+static void
+large_part(struct clusteragent *a, uint32_t session, const uint8_t *part, size_t sz, bool last) {
+	struct large_request ** p = &a->large;
+	while (*p && (*p)->session != session) {
+		p = &(*p)->next;
+	}
+	struct large_request * req = *p;
+	if (req && !req->invalid) {
+		if (req->size - req->offset < sz) {
+			req->invalid = true;
+			skynet_free(req->buffer);
+			req->buffer = NULL;
+		} else {
+			if (req->offset + sz > req->cap) {
+				size_t cap = req->cap ? req->cap : LARGE_PREALLOC;
+				while (cap < req->offset + sz) {
+					cap *= 2;
+				}
+				req->cap = cap < req->size ? (uint32_t)cap : req->size;
+				req->buffer = skynet_realloc(req->buffer, req->cap);
+			}
+			if (sz > 0) {
+				memcpy(req->buffer + req->offset, part, sz);
+			}
+			req->offset += sz;
+		}
+	}
+	if (!last)
+		return;
+	if (req == NULL || req->invalid || req->offset != req->size) {
+		if (req) {
+			*p = req->next;
+			free_large(req);
+		}
+		response_error(a, session, "Invalid large req");
+		return;
+	}
+	*p = req->next;
+	forward_request(a, req->addr, req->name, req->name ? strlen(req->name) : 0, session, req->push, req->tracetag, req->deadline, req->buffer, req->size);
+	skynet_free(req->name);
+	skynet_free(req);
+}
+
+static void
+invalid_request(struct clusteragent *a, int type, size_t sz) {
+	skynet_error(a->ctx, "Invalid cluster request from fd %d (type=%d, size=%d)", a->fd, type, (int)sz);
+}
+
+// v1/v2 : 类型在第一个字节，msg 在最后
+static void
+dispatch_request(struct clusteragent *a, const uint8_t *buf, size_t sz) {
+	if (sz == 0) {
+		invalid_request(a, -1, sz);
+		return;
+	}
+	switch (buf[0]) {
+	case 0:
+		if (sz < 9)
+			break;
+		single_request(a, unpack_uint32(buf+1), NULL, 0, unpack_uint32(buf+5), copy_msg(buf+9, sz-9), sz-9);
+		return;
+	case 0x20: {	// compressed
+		if (sz < 13)
+			break;
+		uint32_t rawsz = unpack_uint32(buf+9);
+		single_request(a, unpack_uint32(buf+1), NULL, 0, unpack_uint32(buf+5), uncompress_msg(a, buf+13, sz-13, rawsz), rawsz);
+		return;
+	}
+	case 1:
+	case 0x41:	// multi push
+		if (sz != 13)
+			break;
+		large_begin(a, unpack_uint32(buf+1), NULL, 0, unpack_uint32(buf+5), unpack_uint32(buf+9), buf[0] == 0x41);
+		return;
+	case 2:
+	case 3:		// the last multi part
+		if (sz < 5)
+			break;
+		large_part(a, unpack_uint32(buf+1), buf+5, sz-5, buf[0] == 3);
+		return;
+	case 4:		// trace
+		set_tracetag(a, buf+1, sz-1);
+		return;
+	case 0x80:
+	case 0xa0: {	// compressed
+		size_t namesz = sz < 2 ? 0 : buf[1];
+		size_t h = namesz + (buf[0] == 0xa0 ? 10 : 6);
+		if (namesz == 0 || sz < h)
+			break;
+		const char * name = (const char *)buf+2;
+		uint32_t session = unpack_uint32(buf+2+namesz);
+		if (buf[0] == 0x80) {
+			single_request(a, 0, name, namesz, session, copy_msg(buf+h, sz-h), sz-h);
+		} else {
+			uint32_t rawsz = unpack_uint32(buf+6+namesz);
+			single_request(a, 0, name, namesz, session, uncompress_msg(a, buf+h, sz-h, rawsz), rawsz);
+		}
+		return;
+	}
+	case 0x81:
+	case 0xc1: {	// multi push
+		size_t namesz = sz < 2 ? 0 : buf[1];
+		if (namesz == 0 || sz != namesz + 10)
+			break;
+		large_begin(a, 0, (const char *)buf+2, namesz, unpack_uint32(buf+2+namesz), unpack_uint32(buf+6+namesz), buf[0] == 0xc1);
+		return;
+	}
+	}
+	invalid_request(a, buf[0], sz);
+}
+
+// v3 : 类型在最后一个字节，msg 在开头。返回 1 表示 buf 的所有权已经转移
+static int
+dispatch_tail(struct clusteragent *a, uint8_t *buf, size_t sz) {
+	if (sz == 0) {
+		invalid_request(a, -1, sz);
+		return 0;
+	}
+	uint8_t type = buf[sz-1];
+	switch (type) {
+	case 0:
+	case 0x20: {	// msg addr session [rawsz] type
+		size_t h = type ? 13 : 9;
+		if (sz < h)
+			break;
+		const uint8_t * t = buf + sz - h;
+		uint32_t addr = unpack_uint32(t);
+		uint32_t session = unpack_uint32(t+4);
+		if (type) {
+			uint32_t rawsz = unpack_uint32(t+8);
+			single_request(a, addr, NULL, 0, session, uncompress_msg(a, buf, sz-h, rawsz), rawsz);
+			return 0;
+		}
+		single_request(a, addr, NULL, 0, session, buf, sz-h);
+		return 1;
+	}
+	case 0x80:
+	case 0xa0: {	// msg name namelen session [rawsz] type
+		size_t h = type == 0xa0 ? 9 : 5;
+		if (sz < h + 2)
+			break;
+		size_t namesz = buf[sz-h-1];
+		if (namesz == 0 || sz < h + 1 + namesz)
+			break;
+		size_t msgsz = sz - h - 1 - namesz;
+		const uint8_t * t = buf + sz - h;
+		// name 在 buf 里，forward_request 用完 name 才交出 buf
+		const char * name = (const char *)buf + msgsz;
+		uint32_t session = unpack_uint32(t);
+		if (type == 0xa0) {
+			uint32_t rawsz = unpack_uint32(t+4);
+			single_request(a, 0, name, namesz, session, uncompress_msg(a, buf, msgsz, rawsz), rawsz);
+			return 0;
+		}
+		single_request(a, 0, name, namesz, session, buf, msgsz);
+		return 1;
+	}
+	case 1:
+	case 0x41:	// addr session sz type
+		if (sz != 13)
+			break;
+		large_begin(a, unpack_uint32(buf), NULL, 0, unpack_uint32(buf+4), unpack_uint32(buf+8), type == 0x41);
+		return 0;
+	case 2:
+	case 3:		// msgpart session type
+		if (sz < 5)
+			break;
+		large_part(a, unpack_uint32(buf+sz-5), buf, sz-5, type == 3);
+		return 0;
+	case 4:		// tag type
+		set_tracetag(a, buf, sz-1);
+		return 0;
+	case 5:		// timeout clock type
+		if (sz != 9)
+			break;
+		set_deadline(a, unpack_uint32(buf), unpack_uint32(buf+4));
+		return 0;
+	case 0x81:
+	case 0xc1: {	// name namelen session sz type
+		if (sz < 11)
+			break;
+		size_t namesz = buf[sz-10];
+		if (namesz == 0 || sz != namesz + 10)
+			break;
+		large_begin(a, 0, (const char *)buf, namesz, unpack_uint32(buf+namesz+1), unpack_uint32(buf+namesz+5), type == 0xc1);
+		return 0;
+	}
+	}
+	invalid_request(a, type, sz);
+	return 0;
+}
+
+static void
+command(struct clusteragent *a, const char *msg, size_t sz) {
+	if (sz >= 2 && msg[0] == 'R' && msg[1] == ' ') {
+		char * name;
+		uint32_t handle = strtoul(msg + 2, &name, 10);
+		if (*name == ' ') {
+			++name;
+			name_update(a, name, sz - (name - msg), handle);
+			return;
+		}
+	} else if (sz >= 2 && msg[0] == 'U' && msg[1] == ' ') {
+		name_update(a, msg + 2, sz - 2, 0);
+		return;
+	} else if (sz == 4 && memcmp(msg, "exit", 4) == 0) {
+		flush(a);
+		skynet_socket_close(a->ctx, a->fd);
+		skynet_command(a->ctx, "EXIT", NULL);
+		return;
+	}
+	skynet_error(a->ctx, "Invalid command %.*s", (int)sz, msg);
+}
+
+static int
+_cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
+	struct clusteragent * a = ud;
+	int reserve = 0;
+	switch (type) {
+	case PTYPE_CLIENT:
+		if (a->version >= 3) {
+			reserve = dispatch_tail(a, (uint8_t *)msg, sz);
+		} else {
+			dispatch_request(a, msg, sz);
+		}
+		break;
+	case PTYPE_RESPONSE:
+	case PTYPE_ERROR: {
+		uint32_t remote;
+		uint64_t deadline;
+		if (!call_remove(a, session, &remote, &deadline)) {
+			skynet_error(ctx, "Unknown response session %d from %x", session, source);
+			break;
+		}
+		if (type == PTYPE_RESPONSE && expired(deadline)) {
+			// 对端已经不等了，只回一个短的错误让它收回 session
+			response_error(a, remote, "deadline exceeded");
+		} else if (type == PTYPE_RESPONSE) {
+			response(a, remote, true, msg, sz);
+		} else {
+			response_error(a, remote, "call failed");
+		}
+		break;
+	}
+	case PTYPE_TEXT:
+		command(a, msg, sz);
+		break;
+	default:
+		skynet_error(ctx, "Invalid message from %x, type = %d", source, type);
+		if (session != 0 && type != PTYPE_ERROR) {
+			skynet_send(ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+		}
+		break;
+	}
+	// 队列里还有消息（多半是后续的请求或回应）时先不写，让它们的回应一起写出；
+	// 队列一直不空时也不能一直攒着，处理 BATCH_COUNT 条消息后写出
+	if (a->wsize > 0 && (a->wsize >= BATCH_MAX || ++a->batch >= BATCH_COUNT || skynet_mqlen(ctx) == 0)) {
+		flush(a);
+	}
+	return reserve;
+}
+
+int
+clusteragent_init(struct clusteragent *a, struct skynet_context *ctx, const char * parm) {
+	if (parm == NULL || sscanf(parm, "%d", &a->fd) != 1) {
+		skynet_error(ctx, "clusteragent need a fd");
+		return 1;
+	}
+	a->ctx = ctx;
+	const char * large = skynet_command(ctx, "GETENV", "cluster_large_max");
+	a->large_max = large ? strtoul(large, NULL, 10) : LARGE_MAX;
+	const char * self = skynet_command(ctx, "REG", NULL);
+	a->self = strtoul(self+1, NULL, 16);
+	skynet_callback(ctx, a, _cb);
+	return 0;
+}
@@ -10,6 +10,12 @@
 //  - forward 仅建立 fd→agent 映射，不启动读取；需配合 "start <fd>" 显式开启
 //  - watchdog 文本通告格式："<fd> open <fd> <ip>:0"、"<fd> close"
 //  - PTYPE_CLIENT 方向（向客户端写）通过在消息末尾附加 4 字节 uid（见 _cb）
+//
+// 分片模式（参数末尾给出分片数 N > 1）：
+//  - 本服务成为前端：只负责 listen/accept，另启动 N 个分片 gate，新连接交给连接数最少的分片
+//  - 分片收到 "accept <fd> <addr>" 后接管连接，之后该连接的数据由分片直接处理和转发
+//  - 前端记录 fd→分片，watchdog 仍只和前端打交道：kick/forward/start 按 fd 转给所属分片，broker 广播
+//  - 连接关闭时分片向 watchdog 报告 close，并通知前端 "closed <fd>"
 
 #include "skynet.h"
 #include "skynet_socket.h"
@@ -32,6 +38,8 @@ struct connection {
     uint32_t client;           // 客户端服务句柄
     char remote_name[32];      // 远程地址
     struct databuffer buffer;   // 数据缓冲区
+    int shard;                 // 前端：连接所属的分片
+    uint32_t redirect;         // 网络线程直接把包交给这个 agent，0 表示经过 gate 转发
 };
 
 // Gate 服务结构
@@ -47,6 +55,10 @@ struct gate {
 	struct connection *conn;    // 连接数组
 	// todo: save message pool ptr for release
 	struct messagepool mp;      // 消息池
+	uint32_t front;             // 分片：所属前端 gate 的句柄，0 表示不是分片
+	int shard_n;                // 前端：分片数量，0 表示未分片
+	uint32_t *shard;            // 前端：各分片句柄
+	int *shard_load;            // 前端：各分片当前的连接数
 };
 
 struct gate *
@@ -70,12 +82,111 @@ gate_release(struct gate *g) {
 	if (g->listen_id >= 0) {
 		skynet_socket_close(ctx, g->listen_id);
 	}
+	for (i=0;i<g->shard_n;i++) {
+		char name[16];
+		snprintf(name, sizeof(name), ":%x", g->shard[i]);
+		skynet_command(ctx, "KILL", name);
+	}
+	skynet_free(g->shard);
+	skynet_free(g->shard_load);
 	messagepool_free(&g->mp);
 	hashid_clear(&g->hash);
 	skynet_free(g->conn);
 	skynet_free(g);
 }
 
+static void
+_text(struct gate *g, uint32_t dest, const char * data, ...) {
+	va_list ap;
+	va_start(ap, data);
+	char tmp[1024];
+	int n = vsnprintf(tmp, sizeof(tmp), data, ap);
+	va_end(ap);
+	skynet_send(g->ctx, 0, dest, PTYPE_TEXT, 0, tmp, n);
+}
+
+static void _report(struct gate * g, const char * data, ...);
+
+// 接入一个连接（accept 消息或前端交来的连接），并通知 watchdog
+static void
+_open_connection(struct gate *g, int fd, const char *addr, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	if (hashid_full(&g->hash)) {
+		skynet_socket_close(ctx, fd);
+		if (g->front) {
+			_text(g, g->front, "closed %d", fd);
+		}
+		return;
+	}
+	struct connection *c = &g->conn[hashid_insert(&g->hash, fd)];
+	if (sz >= sizeof(c->remote_name)) {
+		sz = sizeof(c->remote_name) - 1;
+	}
+	c->id = fd;
+	memcpy(c->remote_name, addr, sz);
+	c->remote_name[sz] = '\0';
+	_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
+	skynet_error(ctx, "socket open: %x", c->id);
+}
+
+static void
+_close_connection(struct gate *g, int fd) {
+	int id = hashid_remove(&g->hash, fd);
+	if (id>=0) {
+		struct connection *c = &g->conn[id];
+		databuffer_clear(&c->buffer,&g->mp);
+		memset(c, 0, sizeof(*c));
+		c->id = -1;
+		_report(g, "%d close", fd);
+		skynet_socket_close(g->ctx, fd);
+		if (g->front) {
+			_text(g, g->front, "closed %d", fd);
+		}
+	}
+}
+
+// 前端：把新连接交给连接数最少的分片
+static void
+_shard_accept(struct gate *g, int fd, const char *addr, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	if (hashid_full(&g->hash)) {
+		skynet_socket_close(ctx, fd);
+		return;
+	}
+	int i;
+	int shard = 0;
+	for (i=1;i<g->shard_n;i++) {
+		if (g->shard_load[i] < g->shard_load[shard])
+			shard = i;
+	}
+	struct connection *c = &g->conn[hashid_insert(&g->hash, fd)];
+	c->id = fd;
+	c->shard = shard;
+	++g->shard_load[shard];
+	_text(g, g->shard[shard], "accept %d %.*s", fd, sz, addr);
+}
+
+// 前端：分片报告连接已关闭
+static void
+_shard_closed(struct gate *g, int fd) {
+	int id = hashid_remove(&g->hash, fd);
+	if (id>=0) {
+		struct connection *c = &g->conn[id];
+		--g->shard_load[c->shard];
+		memset(c, 0, sizeof(*c));
+		c->id = -1;
+	}
+}
+
+// 前端：按 fd 把命令转给所属分片
+static void
+_shard_route(struct gate *g, int fd, const void * msg, int sz) {
+	int id = hashid_lookup(&g->hash, fd);
+	if (id>=0) {
+		skynet_send(g->ctx, 0, g->shard[g->conn[id].shard], PTYPE_TEXT, 0, (void *)msg, sz);
+	}
+}
+
 static void
 _parm(char *msg, int sz, int command_sz) {
 	while (command_sz < sz) {
@@ -90,6 +201,24 @@ _parm(char *msg, int sz, int command_sz) {
 	msg[i-command_sz] = '\0';
 }
 
+// 连接交给 agent 后，网络线程可以把分帧好的包直接推给 agent，省掉 gate 这一跳。
+// 只在消息格式和经过 gate 时一致（PTYPE_CLIENT，source 为 0）才这样做。
+// 已经 start 的连接 gate 队列里可能还有旧包：网络线程会暂停读并回一条 "redirect" 的 CONNECT，
+// gate 处理到它时旧包都已转发，再 start 恢复读取，见 dispatch_socket_message。
+static void
+_redirect_agent(struct gate * g, struct connection * c) {
+	uint32_t agent = 0;
+	if (g->broker == 0 && g->client_tag == PTYPE_CLIENT && c->client == 0) {
+		if (c->redirect || c->buffer.size == 0) {
+			agent = c->agent;
+		}
+	}
+	if (agent != c->redirect) {
+		c->redirect = agent;
+		skynet_socket_redirect(g->ctx, c->id, agent);
+	}
+}
+
 static void
 _forward_agent(struct gate * g, int fd, uint32_t agentaddr, uint32_t clientaddr) {
 	int id = hashid_lookup(&g->hash, fd);
@@ -97,6 +226,7 @@ _forward_agent(struct gate * g, int fd, uint32_t agentaddr, uint32_t clientaddr)
 		struct connection * agent = &g->conn[id];
 		agent->agent = agentaddr;
 		agent->client = clientaddr;
+		_redirect_agent(g, agent);
 	}
 }
 
@@ -115,6 +245,39 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 			break;
 		}
 	}
+	if (g->shard_n > 0) {
+		// 前端：kick/forward/start 转给连接所属的分片，broker 广播给所有分片
+		if (memcmp(command,"kick",i)==0 || memcmp(command,"forward",i)==0 || memcmp(command,"start",i)==0) {
+			int fd = strtol(tmp+i, NULL, 10);
+			_shard_route(g, fd, msg, sz);
+			return;
+		}
+		if (memcmp(command,"broker",i)==0) {
+			int j;
+			for (j=0;j<g->shard_n;j++) {
+				skynet_send(ctx, 0, g->shard[j], PTYPE_TEXT, 0, (void *)msg, sz);
+			}
+			return;
+		}
+		if (i == 6 && memcmp(command,"closed",i)==0) {
+			_shard_closed(g, strtol(tmp+i, NULL, 10));
+			return;
+		}
+	} else if (g->front) {
+		// 分片：接管前端交来的连接，或前端发现它在 start 之前已经关闭
+		if (memcmp(command,"accept",i)==0) {
+			char * addr = NULL;
+			int fd = strtol(tmp+i, &addr, 10);
+			while (*addr == ' ')
+				++addr;
+			_open_connection(g, fd, addr, strlen(addr));
+			return;
+		}
+		if (memcmp(command,"drop",i)==0) {
+			_close_connection(g, strtol(tmp+i, NULL, 10));
+			return;
+		}
+	}
 	if (memcmp(command,"kick",i)==0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
@@ -145,6 +308,13 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	if (memcmp(command,"broker",i)==0) {
 		_parm(tmp, sz, i);
 		g->broker = skynet_queryname(ctx, command);
+		// broker 模式下所有包都要交给 broker，取消已有的直接转交
+		int j;
+		for (j=0;j<g->max_connection;j++) {
+			if (g->conn[j].id >= 0) {
+				_redirect_agent(g, &g->conn[j]);
+			}
+		}
 		return;
 	}
 	if (memcmp(command,"start",i) == 0) {
@@ -211,6 +381,55 @@ _forward(struct gate *g, struct connection * c, int size) {
 	}
 }
 
+// 把一个完整的包（data 的所有权一并转交）发给 broker/agent/watchdog
+static void
+_forward_buffer(struct gate *g, struct connection * c, void * data, int size) {
+	struct skynet_context * ctx = g->ctx;
+	int fd = c->id;
+	if (fd <= 0) {
+		skynet_free(data);
+		return;
+	}
+	if (g->broker) {
+		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, fd, data, size);
+	} else if (c->agent) {
+		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, fd , data, size);
+	} else if (g->watchdog) {
+		char * tmp = skynet_malloc(size + 32);
+		int n = snprintf(tmp,32,"%d data ",c->id);
+		memcpy(tmp+n, data, size);
+		skynet_free(data);
+		skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, fd, tmp, size + n);
+	} else {
+		skynet_free(data);
+	}
+}
+
+// 分帧模式：socket 线程已经按包头切好，data 中都是完整的包
+static void
+dispatch_frame(struct gate *g, struct connection *c, char * data, int sz) {
+	int header = g->header_size;
+	int pos = 0;
+	while (pos + header <= sz) {
+		const uint8_t * p = (const uint8_t *)data + pos;
+		int size = header == 2 ? (p[0] << 8 | p[1]) : (p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+		pos += header;
+		if (size > 0) {
+			if (pos == header && pos + size == sz) {
+				// just one package, reuse the buffer
+				memmove(data, data + header, size);
+				_forward_buffer(g, c, data, size);
+				return;
+			}
+			void * temp = skynet_malloc(size);
+			memcpy(temp, data + pos, size);
+			_forward_buffer(g, c, temp, size);
+		}
+		pos += size;
+	}
+	skynet_free(data);
+}
+
 static void
 dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
 	// 将数据推入缓冲区
@@ -253,6 +472,18 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		}
 		break;
 	}
+	case SKYNET_SOCKET_TYPE_FRAME: {
+		int id = hashid_lookup(&g->hash, message->id);
+		if (id>=0) {
+			struct connection *c = &g->conn[id];
+			dispatch_frame(g, c, message->buffer, message->ud);
+		} else {
+			skynet_error(ctx, "Drop unknown connection %d message", message->id);
+			skynet_socket_close(ctx, message->id);
+			skynet_free(message->buffer);
+		}
+		break;
+	}
 	case SKYNET_SOCKET_TYPE_CONNECT: {
 		// 连接建立确认：监听 fd 会首先收到 CONNECT，忽略即可
 		if (message->id == g->listen_id) {
@@ -263,39 +494,34 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		if (id<0) {
 			skynet_error(ctx, "Close unknown connection %d", message->id);
 			skynet_socket_close(ctx, message->id);
+		} else if (sz == 8 && memcmp(message+1, "redirect", 8) == 0) {
+			// 之前的包都已转发，恢复读取，之后的包由网络线程直接交给 agent
+			skynet_socket_start(ctx, message->id);
 		}
 		break;
 	}
 	case SKYNET_SOCKET_TYPE_CLOSE:
 	case SKYNET_SOCKET_TYPE_ERROR: {
 		// 连接关闭/错误：移除映射，清理缓冲，并通知 watchdog
-		int id = hashid_remove(&g->hash, message->id);
-		if (id>=0) {
-			struct connection *c = &g->conn[id];
-			databuffer_clear(&c->buffer,&g->mp);
-			memset(c, 0, sizeof(*c));
-			c->id = -1;
-			_report(g, "%d close", message->id);
-			skynet_socket_close(ctx, message->id);
+		if (g->shard_n > 0) {
+			// 前端：连接在分片 start 之前就被关闭，事件仍发给前端，转告分片清理
+			int id = hashid_lookup(&g->hash, message->id);
+			if (id>=0) {
+				_text(g, g->shard[g->conn[id].shard], "drop %d", message->id);
+			}
+			break;
 		}
+		_close_connection(g, message->id);
 		break;
 	}
 	case SKYNET_SOCKET_TYPE_ACCEPT:
 		// report accept, then it will be get a SKYNET_SOCKET_TYPE_CONNECT message
 		// 新连接：插入映射并上报 open 文本；随后会收到 CONNECT 确认
 		assert(g->listen_id == message->id);
-		if (hashid_full(&g->hash)) {
-			skynet_socket_close(ctx, message->ud);
+		if (g->shard_n > 0) {
+			_shard_accept(g, message->ud, (const char *)(message+1), sz);
 		} else {
-			struct connection *c = &g->conn[hashid_insert(&g->hash, message->ud)];
-			if (sz >= sizeof(c->remote_name)) {
-				sz = sizeof(c->remote_name) - 1;
-			}
-			c->id = message->ud;
-			memcpy(c->remote_name, message+1, sz);
-			c->remote_name[sz] = '\0';
-			_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
-			skynet_error(ctx, "socket open: %x", c->id);
+			_open_connection(g, message->ud, (const char *)(message+1), sz);
 		}
 		break;
 	case SKYNET_SOCKET_TYPE_WARNING:
@@ -364,6 +590,8 @@ start_listen(struct gate *g, char * listen_addr) {
 	if (g->listen_id < 0) {
 		return 1;
 	}
+	// 在网络线程分包（accept 的连接继承此设置），与 dispatch_message 一样限制单包 16M
+	skynet_socket_frame(ctx, g->listen_id, g->header_size, 0xffffff);
 	skynet_socket_start(ctx, g->listen_id);
 	return 0;
 }
@@ -373,13 +601,15 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	if (parm == NULL)
 		return 1;
 	int max = 0;
+	int shard_n = 0;
 	int sz = strlen(parm)+1;
 	char watchdog[sz];
 	char binding[sz];
 	int client_tag = 0;
 	char header;
-	// 参数格式："<header> <watchdog> <host:port> <client_tag> <max>"
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max);
+	// 参数格式："<header> <watchdog> <host:port> <client_tag> <max> [shards]"
+	// 分片由前端启动，binding 为 "@<前端句柄>"
+	int n = sscanf(parm, "%c %s %s %d %d %d", &header, watchdog, binding, &client_tag, &max, &shard_n);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -423,5 +653,33 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 
 	skynet_callback(ctx,g,_cb);
 
+	if (binding[0] == '@') {
+		g->front = strtoul(binding+1, NULL, 16);
+		return 0;
+	}
+	if (shard_n > 1) {
+		g->shard = skynet_malloc(shard_n * sizeof(uint32_t));
+		g->shard_load = skynet_malloc(shard_n * sizeof(int));
+		for (i=0;i<shard_n;i++) {
+			// 分片与前端共用同一个 watchdog；连接总数由前端限制，每个分片按 max 分配即可
+			char shard_parm[64];
+			if (g->watchdog) {
+				snprintf(shard_parm, sizeof(shard_parm), "gate %c :%x @%x %d %d", header, g->watchdog,
+					skynet_current_handle(), client_tag, max);
+			} else {
+				snprintf(shard_parm, sizeof(shard_parm), "gate %c ! @%x %d %d", header,
+					skynet_current_handle(), client_tag, max);
+			}
+			const char * addr = skynet_command(ctx, "LAUNCH", shard_parm);
+			if (addr == NULL) {
+				skynet_error(ctx, "Launch gate shard failed");
+				return 1;
+			}
+			g->shard[i] = strtoul(addr+1, NULL, 16);
+			g->shard_load[i] = 0;
+			++g->shard_n;
+		}
+	}
+
 	return start_listen(g,binding);
 }
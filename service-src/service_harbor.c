@@ -2,15 +2,20 @@
 #include "skynet_harbor.h"
 #include "skynet_socket.h"
 #include "skynet_handle.h"
+#include "skynet_compress.h"
 
 /*
 	harbor listen the PTYPE_HARBOR (in text)
 	N name : update the global name
-	S fd id: connect to new harbor , we should send self_id to fd first , and then recv a id (check it), and at last send queue.
-	A fd id: accept new harbor , we should send self_id to fd , and then send queue.
+	S fd id [compress]: connect to new harbor , we should send self_id to fd first , and then recv a id (check it), and at last send queue.
+	A fd id [compress]: accept new harbor , we should send self_id to fd , and then send queue.
+	compress 为 1 表示对端能解压（由 master 转告），本节点配置了 harbor_compress 时就压缩发往它的大消息。
 
 	If the fd is disconnected, send message to slave in PTYPE_TEXT.  D id
 	If we don't known a globalname, send message to slave in PTYPE_TEXT. Q name
+
+	发往同一个 harbor 的消息先攒在该连接的写缓冲里，消息队列空了、攒够 BATCH_MAX 字节或者有数据后又处理了
+	BATCH_COUNT 条消息，再合成一次 socket 写。
  */
 
 #include <stdio.h>
@@ -26,6 +31,14 @@
 
 // 12 is sizeof(struct remote_message_header)
 #define HEADER_COOKIE_LENGTH 12
+// 包长最高字节的标记：[4字节长度][4字节原长][压缩后的 payload][12字节header]
+#define COMPRESSED_PACKAGE 0x80
+// 写缓冲攒到这么大就立刻发出
+#define BATCH_MAX 0x10000
+// 队列一直不空时，写缓冲最多等这么多条消息
+#define BATCH_COUNT 64
+// 发完后写缓冲超过这么大就释放，不长期占着大块内存
+#define WBUFFER_KEEP 0x100000
 
 /*
 	message type (8bits) is encoded into the high 8 bits of destination.
@@ -75,19 +88,29 @@ struct slave {
 	int fd;                           // Socket文件描述符
 	struct harbor_msg_queue *queue;   // 消息队列
 	int status;                        // 连接状态
+	int compress;                      // 发往对端的压缩阈值，0 不压缩
+	bool compressed;                   // 当前读取的包是压缩的
 	int length;                        // 当前消息长度
 	int read;                          // 已读取字节数
 	uint8_t size[4];                   // 消息长度缓冲
 	char * recv_buffer;                // 接收缓冲区
+	bool dirty;                        // 已在 harbor 的待写列表中
+	uint8_t * wbuffer;                 // 待写出的包，发送后复用
+	size_t wsize;                      // 待写字节数
+	size_t wcap;                       // 写缓冲容量
 };
 
 // Harbor主结构，本服务状态
 struct harbor {
 	struct skynet_context *ctx;       // 关联的Skynet上下文
 	int id;                           // 本节点Harbor ID
+	int compress;                     // 配置 harbor_compress ，对端能解压时使用
 	uint32_t slave;                   // Slave服务句柄
 	struct hashmap * map;             // 全局名字表
 	struct slave s[REMOTE_MAX];       // 所有远程节点连接（最多256个）
+	int ndirty;                       // 写缓冲里有数据的连接数
+	int dirty[REMOTE_MAX];            // 写缓冲里有数据的连接 id
+	int batch;                        // 有连接待写以后处理过的消息数
 };
 
 // hash table
@@ -244,6 +267,11 @@ close_harbor(struct harbor *h, int id) {
 		release_queue(s->queue);
 		s->queue = NULL;
 	}
+	// 还没写出的包随连接一起丢弃
+	skynet_free(s->wbuffer);
+	s->wbuffer = NULL;
+	s->wsize = 0;
+	s->wcap = 0;
 }
 
 static void
@@ -338,29 +366,124 @@ forward_local_messsage(struct harbor *h, void *msg, int sz) {
 	}
 }
 
-// 发送远程消息
-static void
-send_remote(struct skynet_context * ctx, int fd, const char * buffer, size_t sz, struct remote_message_header * cookie) {
-	size_t sz_header = sz+sizeof(*cookie);
-	if (sz_header > UINT32_MAX) {
-		skynet_error(ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
-		return;
+// 解压后转发，msg 由这里接管；数据损坏时返回 1
+static int
+forward_compressed_message(struct harbor *h, void *msg, int sz) {
+	const uint8_t * buffer = msg;
+	if (sz < 4 + HEADER_COOKIE_LENGTH) {
+		skynet_free(msg);
+		return 1;
 	}
-	// REMOTE 报文格式：
-	// [4字节长度(大端)][消息体payload][12字节remote_message_header]
-	uint8_t sendbuf[sz_header+4];
-	to_bigendian(sendbuf, (uint32_t)sz_header);
-	memcpy(sendbuf+4, buffer, sz);
-	header_to_message(cookie, sendbuf+4+sz);
+	uint32_t rawsz = buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+	int csz = sz - 4 - HEADER_COOKIE_LENGTH;
+	if (rawsz > (uint64_t)csz * COMPRESS_RATIO_MAX || rawsz > UINT32_MAX - HEADER_COOKIE_LENGTH) {
+		skynet_free(msg);
+		return 1;
+	}
+	char * raw = skynet_malloc(rawsz + HEADER_COOKIE_LENGTH);
+	if (skynet_decompress(buffer + 4, csz, raw, rawsz) != (int)rawsz) {
+		skynet_free(raw);
+		skynet_free(msg);
+		return 1;
+	}
+	memcpy(raw + rawsz, buffer + 4 + csz, HEADER_COOKIE_LENGTH);
+	skynet_free(msg);
+	forward_local_messsage(h, raw, rawsz + HEADER_COOKIE_LENGTH);
+	return 0;
+}
 
+static uint8_t *
+wb_reserve(struct slave *s, size_t sz) {
+	if (s->wsize + sz > s->wcap) {
+		size_t cap = s->wcap ? s->wcap : 4096;
+		while (cap < s->wsize + sz) {
+			cap *= 2;
+		}
+		uint8_t * buffer = skynet_malloc(cap);
+		if (s->wsize > 0) {
+			memcpy(buffer, s->wbuffer, s->wsize);
+		}
+		skynet_free(s->wbuffer);
+		s->wbuffer = buffer;
+		s->wcap = cap;
+	}
+	return s->wbuffer + s->wsize;
+}
+
+// 写缓冲一次写出；socket 能直接写时不复制，缓冲留给下一批
+static void
+flush(struct harbor *h, int id) {
+	struct slave *s = &h->s[id];
+	if (s->wsize == 0)
+		return;
 	struct socket_sendbuffer tmp;
-	tmp.id = fd;
+	tmp.id = s->fd;
 	tmp.type = SOCKET_BUFFER_RAWPOINTER;
-	tmp.buffer = sendbuf;
-	tmp.sz = sz_header+4;
-
+	tmp.buffer = s->wbuffer;
+	tmp.sz = s->wsize;
 	// ignore send error, because if the connection is broken, the mainloop will recv a message.
-	skynet_socket_sendbuffer(ctx, &tmp);
+	skynet_socket_sendbuffer(h->ctx, &tmp);
+	s->wsize = 0;
+	if (s->wcap > WBUFFER_KEEP) {
+		skynet_free(s->wbuffer);
+		s->wbuffer = NULL;
+		s->wcap = 0;
+	}
+}
+
+static void
+flush_all(struct harbor *h) {
+	int i;
+	for (i=0;i<h->ndirty;i++) {
+		int id = h->dirty[i];
+		struct slave *s = &h->s[id];
+		s->dirty = false;
+		if (s->fd != 0) {
+			flush(h, id);
+		}
+	}
+	h->ndirty = 0;
+	h->batch = 0;
+}
+
+// 发送远程消息：打包进连接 id 的写缓冲
+static void
+send_remote(struct harbor *h, int id, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+	struct slave *s = &h->s[id];
+	size_t sz_header = sz+sizeof(*cookie);
+	if (sz_header > UINT32_MAX) {
+		skynet_error(h->ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+		return;
+	}
+	// 压缩包比原包多 4 字节原长，按它预留
+	uint8_t * sendbuf = wb_reserve(s, sz_header + 8);
+	size_t len = 0;
+	if (s->compress > 0 && sz >= (size_t)s->compress) {
+		size_t csz = skynet_compress(buffer, sz, sendbuf + 8, sz);
+		// 包长只有 24 bits ，最高字节留给标记
+		if (csz > 0 && csz + 4 + sizeof(*cookie) < 0x1000000) {
+			to_bigendian(sendbuf, (uint32_t)(csz + 4 + sizeof(*cookie)));
+			sendbuf[0] = COMPRESSED_PACKAGE;
+			to_bigendian(sendbuf + 4, (uint32_t)sz);
+			header_to_message(cookie, sendbuf + 8 + csz);
+			len = csz + 8 + sizeof(*cookie);
+		}
+	}
+	if (len == 0) {
+		// REMOTE 报文格式：
+		// [4字节长度(大端)][消息体payload][12字节remote_message_header]
+		to_bigendian(sendbuf, (uint32_t)sz_header);
+		memcpy(sendbuf+4, buffer, sz);
+		header_to_message(cookie, sendbuf+4+sz);
+		len = sz_header+4;
+	}
+	s->wsize += len;
+	if (s->wsize >= BATCH_MAX) {
+		flush(h, id);
+	} else if (!s->dirty) {
+		s->dirty = true;
+		h->dirty[h->ndirty++] = id;
+	}
 }
 
 static void
@@ -404,7 +527,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
 		m->header.destination |= (handle & HANDLE_MASK);
-		send_remote(context, fd, m->buffer, m->size, &m->header);
+		send_remote(h, harbor_id, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 }
@@ -413,8 +536,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 static void
 dispatch_queue(struct harbor *h, int id) {
 	struct slave *s = &h->s[id];
-	int fd = s->fd;
-	assert(fd != 0);
+	assert(s->fd != 0);
 
 	struct harbor_msg_queue *queue = s->queue;
 	if (queue == NULL)
@@ -422,7 +544,7 @@ dispatch_queue(struct harbor *h, int id) {
 
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
-		send_remote(h->ctx, fd, m->buffer, m->size, &m->header);
+		send_remote(h, id, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 	release_queue(queue);
@@ -485,7 +607,8 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 				buffer += need;
 				size -= need;
 
-				if (s->size[0] != 0) {
+				s->compressed = s->size[0] == COMPRESSED_PACKAGE;
+				if (s->size[0] != 0 && !s->compressed) {
 					skynet_error(h->ctx, "Message is too long from harbor %d", id);
 					close_harbor(h,id);
 					return;
@@ -509,7 +632,16 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 				return;
 			}
 			memcpy(s->recv_buffer + s->read, buffer, need);
-			forward_local_messsage(h, s->recv_buffer, s->length);
+			if (s->compressed) {
+				if (forward_compressed_message(h, s->recv_buffer, s->length)) {
+					skynet_error(h->ctx, "Invalid compressed message from harbor %d", id);
+					s->recv_buffer = NULL;
+					close_harbor(h,id);
+					return;
+				}
+			} else {
+				forward_local_messsage(h, s->recv_buffer, s->length);
+			}
 			s->length = 0;
 			s->read = 0;
 			s->recv_buffer = NULL;
@@ -538,6 +670,9 @@ update_name(struct harbor *h, const char name[GLOBALNAME_LENGTH], uint32_t handl
 		release_queue(node->queue);
 		node->queue = NULL;
 	}
+	// 之后按名字发的消息由 skynet_sendname 直接查缓存，不再经过这里。
+	// 先送出排队的消息再公布：目标在本节点时，公布后的消息会直接投递，可能赶在排队的前面
+	skynet_harbor_updatename(name, handle);
 }
 
 // 句柄路由
@@ -580,7 +715,7 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 		// 将消息类型编码到高位，保持与排队时的格式一致
 		cookie.destination = (destination & HANDLE_MASK) | ((uint32_t)type << HANDLE_REMOTE_SHIFT);
 		cookie.session = (uint32_t)session;
-		send_remote(context, s->fd, msg,sz,&cookie);
+		send_remote(h, harbor_id, msg, sz, &cookie);
 	}
 
 	return 0;
@@ -648,8 +783,8 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 		char buffer[s+1];
 		memcpy(buffer, name, s);
 		buffer[s] = 0;
-		int fd=0, id=0;
-		sscanf(buffer, "%d %d",&fd,&id);
+		int fd=0, id=0, compress=0;
+		sscanf(buffer, "%d %d %d",&fd,&id,&compress);
 		if (fd == 0 || id <= 0 || id>=REMOTE_MAX) {
 			skynet_error(h->ctx, "Invalid command %c %s", msg[0], buffer);
 			return;
@@ -660,6 +795,7 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 			return;
 		}
 		slave->fd = fd;
+		slave->compress = compress ? h->compress : 0;
 
 		// 将 fd 纳入 socket 事件循环并发出本节点 harbor id 完成双向握手
 		skynet_socket_start(h->ctx, fd);
@@ -692,8 +828,8 @@ harbor_id(struct harbor *h, int fd) {
 }
 
 static int
-mainloop(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
-	struct harbor * h = ud;
+dispatch(struct harbor *h, int type, int session, uint32_t source, const void * msg, size_t sz) {
+	struct skynet_context * context = h->ctx;
 	switch (type) {
 	case PTYPE_SOCKET: {
 		// 接收远端
@@ -760,18 +896,32 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 	}
 }
 
+static int
+mainloop(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
+	struct harbor * h = ud;
+	int r = dispatch(h, type, session, source, msg, sz);
+	// 队列里还有消息（多半是发往同一批 harbor 的）时先不写，让它们一起写出；
+	// 队列一直不空时也不能一直攒着，处理 BATCH_COUNT 条消息后写出
+	if (h->ndirty > 0 && (++h->batch >= BATCH_COUNT || skynet_mqlen(context) == 0)) {
+		flush_all(h);
+	}
+	return r;
+}
+
 int
 harbor_init(struct harbor *h, struct skynet_context *ctx, const char * args) {
 	h->ctx = ctx;
 	int harbor_id = 0;
 	uint32_t slave = 0;
-	sscanf(args,"%d %u", &harbor_id, &slave);
+	int compress = 0;
+	sscanf(args,"%d %u %d", &harbor_id, &slave, &compress);
 	if (slave == 0) {
 		// Lua 层必须传入 .cslave 句柄，否则直接报错终止
 		return 1;
 	}
 	h->id = harbor_id;
 	h->slave = slave;
+	h->compress = compress;
 	if (harbor_id == 0) {
 		close_all_remotes(h);
 	}
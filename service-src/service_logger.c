@@ -14,54 +14,625 @@
 //  - PTYPE_SYSTEM ：收到后若设置了文件路径，则通过 freopen 以追加模式重新打开文件
 //
 // 关键点：
-//  - timestring() 基于 skynet 启动时间与当前厘秒合成“日期.厘秒”时间戳
+//  - timestring() 基于 skynet 启动时间与当前厘秒合成“日期.厘秒”时间戳，日期部分每秒只格式化一次
 //  - logger_cb() 为回调入口，根据消息类型分类处理
+//
+// 异步模式（配置 logbuffer = <KB>，大于 0 时开启）：
+//  - logger_cb 只把整行追加进环形缓冲区，不做 IO；缓冲区满时丢弃并计数
+//  - 独立的写线程把缓冲区里积攒的内容一次性 write 出去，并写出丢弃条数
+//  - 写日志文件时支持轮转：logrotate_size = <MB>（按大小）、logrotate_time = <秒>（按时间），
+//    旧文件改名为 "<文件名>.<年月日-时分秒>"
+//  - 缓冲区只有 logger 服务一个写者、写线程一个读者，head/tail 各由一方推进，不需要锁
+//
+// 二进制结构化日志（配置 logbinary = "/path/to/skynet.slog"）：
+//  - PTYPE_LOG ：消息体是 lua-seri 打包的 (格式 id, 参数...)，由 skynet.slog 发出，logger 不做格式化
+//  - 格式 id 为 0 的消息是格式定义 (0, id, 格式串)，logger 记下来去重，重新打开文件后再写一遍，
+//    保证每个文件都能独立解码；(0, 0, 指纹, 名字, 字段表) 是 schema 定义，同样去重后写进每个文件
+//  - 不同格式串的 id 相同（哈希冲突）时，logger 为后来者顺序探测一个空闲 id 写进文件，
+//    并记下 (来源, 原 id) -> 新 id，之后这个来源的记录改写成新 id
+//  - 文件以 "SKYLOG1\0" 开头，之后每条记录为 u32 长度、u32 来源、u64 时间（厘秒，绝对时间）、
+//    seri 数据，整数都是本机字节序；离线用 examples/slogdump.lua 解码
+//  - 写入走大块 stdio 缓冲，由定时器每秒 flush 一次
 
 #include "skynet.h"
+#include "atomic.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define SIZETIMEFMT	250
+#define LOGGER_INTERVAL 10000	// 写线程两次写出之间的间隔（微秒），期间日志在缓冲区里攒成一批
+#define SLOG_MAGIC "SKYLOG1"	// 连同结尾的 '\0' 共 8 字节
+#define SLOG_BUFFER (256 * 1024)
+
+struct slog_define {
+	uint32_t id;
+	size_t sz;
+	void * data;                // 定义消息的 seri 数据，重写时原样写出
+	size_t fmt;                 // data 中格式串的偏移，之后的内容相同即为同一个格式
+};
+
+// 某个来源的格式 id 与别的格式冲突，文件里改用 to 。按 (source, id) 散列
+struct slog_alias {
+	struct slog_alias * next;
+	uint32_t source;
+	uint32_t id;
+	uint32_t to;
+};
 
 struct logger {
 	FILE * handle;              // 当前写入目标（文件或 stdout）
 	char * filename;            // 当写入文件时保存路径
 	uint32_t starttime;         // skynet 启动时间（秒），与 now/100 相加得到当前绝对时间
 	int close;                  // 是否需要在释放时关闭句柄
+	uint64_t time_sec;          // time_str 对应的秒数
+	char time_str[SIZETIMEFMT]; // 缓存的“日期 时:分:秒”
+	// 异步模式
+	int async;
+	int fd;                     // 写线程使用的文件描述符
+	char * ring;                // 环形缓冲区，容量为 2 的幂
+	size_t ring_cap;
+	ATOM_SIZET ring_head;       // 写线程已写出的位置，只由写线程推进
+	ATOM_SIZET ring_tail;       // 已追加到的位置，只由 logger 服务推进
+	ATOM_SIZET dropped;         // 缓冲区满时丢弃的条数
+	ATOM_INT reopen;            // 请求写线程重新打开文件
+	ATOM_INT quit;
+	pthread_t thread;
+	size_t rotate_size;         // 文件超过这个大小时轮转，0 表示不按大小轮转
+	uint32_t rotate_time;       // 每隔这么多秒轮转，0 表示不按时间轮转
+	size_t file_size;
+	uint64_t rotate_last;       // 上次轮转（或打开）的时间，秒
+	// 二进制日志
+	struct skynet_context * ctx;
+	FILE * binary;
+	char * binary_name;
+	char * binary_buffer;
+	int flush_pending;          // 已注册 flush 定时器
+	int define_n;
+	int define_cap;
+	struct slog_define * define;
+	int alias_n;
+	int alias_cap;              // 桶数，2 的幂
+	struct slog_alias ** alias;
 };
 
 struct logger *
 logger_create(void) {
 	struct logger * inst = skynet_malloc(sizeof(*inst));
+	memset(inst, 0, sizeof(*inst));
 	inst->handle = NULL;
 	inst->close = 0;
 	inst->filename = NULL;
+	inst->fd = -1;
 
 	return inst;
 }
 
 void
 logger_release(struct logger * inst) {
-	if (inst->close) {
+	if (inst->async) {
+		// 让写线程写完缓冲区里剩下的日志再退出
+		ATOM_STORE(&inst->quit, 1);
+		pthread_join(inst->thread, NULL);
+		if (inst->filename) {
+			close(inst->fd);
+		}
+		skynet_free(inst->ring);
+	} else if (inst->close) {
 		fclose(inst->handle);
 	}
+	if (inst->binary) {
+		fclose(inst->binary);
+		skynet_free(inst->binary_buffer);
+	}
+	int i;
+	for (i=0;i<inst->define_n;i++) {
+		skynet_free(inst->define[i].data);
+	}
+	skynet_free(inst->define);
+	for (i=0;i<inst->alias_cap;i++) {
+		struct slog_alias * a = inst->alias[i];
+		while (a) {
+			struct slog_alias * next = a->next;
+			skynet_free(a);
+			a = next;
+		}
+	}
+	skynet_free(inst->alias);
+	skynet_free(inst->binary_name);
 	skynet_free(inst->filename);
 	skynet_free(inst);
 }
 
-#define SIZETIMEFMT	250
+static const char *
+timestring(struct logger *inst, int *csec) {
+	// 将当前厘秒时间换算为绝对时间（秒），并格式化为可读字符串；同一秒内复用上次的结果
+	uint64_t now = skynet_now();          // 当前时间（厘秒）
+	uint64_t sec = now/100;
+	if (sec != inst->time_sec || inst->time_str[0] == '\0') {
+		time_t ti = sec + inst->starttime; // 折算到绝对秒
+		struct tm info;
+		(void)localtime_r(&ti,&info);
+		strftime(inst->time_str, SIZETIMEFMT, "%d/%m/%y %H:%M:%S", &info);
+		inst->time_sec = sec;
+	}
+	*csec = now % 100;  // 厘秒小数部分（0-99），用于拼接成 xx.xx 的形式
+	return inst->time_str;
+}
+
+static uint64_t
+now_sec(struct logger *inst) {
+	return skynet_now()/100 + inst->starttime;
+}
+
+static void
+write_all(int fd, const char * buffer, size_t sz) {
+	while (sz > 0) {
+		ssize_t n = write(fd, buffer, sz);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			// 写失败（磁盘满等）只能丢掉，不能卡住写线程
+			return;
+		}
+		buffer += n;
+		sz -= n;
+	}
+}
 
 static int
-timestring(struct logger *inst, char tmp[SIZETIMEFMT]) {
-	// 将当前厘秒时间换算为绝对时间（秒），并格式化为可读字符串
-	uint64_t now = skynet_now();          // 当前时间（厘秒）
-	time_t ti = now/100 + inst->starttime; // 折算到绝对秒
+open_file(struct logger *inst) {
+	int fd = open(inst->filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return 1;
+	struct stat st;
+	inst->file_size = fstat(fd, &st) == 0 ? st.st_size : 0;
+	if (inst->fd >= 0) {
+		close(inst->fd);
+	}
+	inst->fd = fd;
+	inst->rotate_last = now_sec(inst);
+	return 0;
+}
+
+// 写线程：把当前文件改名为 "<文件名>.<年月日-时分秒>"，再打开一个新文件
+static void
+rotate_file(struct logger *inst) {
+	time_t ti = now_sec(inst);
 	struct tm info;
 	(void)localtime_r(&ti,&info);
-	strftime(tmp, SIZETIMEFMT, "%d/%m/%y %H:%M:%S", &info);
-	return now % 100;  // 返回厘秒小数部分（0-99），用于拼接成 xx.xx 的形式
+	char suffix[32];
+	strftime(suffix, sizeof(suffix), "%Y%m%d-%H%M%S", &info);
+	size_t sz = strlen(inst->filename) + sizeof(suffix) + 16;
+	char name[sz];
+	snprintf(name, sz, "%s.%s", inst->filename, suffix);
+	int i;
+	for (i=1; access(name, F_OK) == 0; i++) {
+		// 同一秒内多次轮转
+		snprintf(name, sz, "%s.%s-%d", inst->filename, suffix, i);
+	}
+	if (rename(inst->filename, name) == 0) {
+		open_file(inst);
+	}
+}
+
+static void
+check_rotate(struct logger *inst) {
+	if (inst->filename == NULL || inst->file_size == 0)
+		return;
+	if ((inst->rotate_size > 0 && inst->file_size >= inst->rotate_size)
+		|| (inst->rotate_time > 0 && now_sec(inst) - inst->rotate_last >= inst->rotate_time)) {
+		rotate_file(inst);
+	}
+}
+
+static void
+report_dropped(struct logger *inst) {
+	size_t dropped = ATOM_LOAD(&inst->dropped);
+	if (dropped == 0)
+		return;
+	ATOM_FSUB(&inst->dropped, dropped);
+	char tmp[SIZETIMEFMT + 128];
+	int n = 0;
+	if (inst->filename) {
+		// 写线程不能用 logger 服务的时间缓存
+		uint64_t now = skynet_now();
+		time_t ti = now/100 + inst->starttime;
+		struct tm info;
+		(void)localtime_r(&ti,&info);
+		n = strftime(tmp, SIZETIMEFMT, "%d/%m/%y %H:%M:%S", &info);
+		n += snprintf(tmp + n, sizeof(tmp) - n, ".%02d ", (int)(now % 100));
+	}
+	n += snprintf(tmp + n, sizeof(tmp) - n, "[logger] %zu messages dropped, logbuffer is full\n", dropped);
+	write_all(inst->fd, tmp, n);
+	inst->file_size += n;
+}
+
+static void *
+thread_writer(void *p) {
+	struct logger * inst = p;
+	size_t mask = inst->ring_cap - 1;
+	for (;;) {
+		int quit = ATOM_LOAD(&inst->quit);
+		if (ATOM_LOAD(&inst->reopen)) {
+			ATOM_STORE(&inst->reopen, 0);
+			open_file(inst);
+		}
+		report_dropped(inst);
+		size_t head = ATOM_LOAD(&inst->ring_head);
+		size_t tail = ATOM_LOAD(&inst->ring_tail);
+		size_t n = tail - head;
+		if (n > 0) {
+			size_t offset = head & mask;
+			size_t part = inst->ring_cap - offset;
+			if (part >= n) {
+				write_all(inst->fd, inst->ring + offset, n);
+			} else {
+				write_all(inst->fd, inst->ring + offset, part);
+				write_all(inst->fd, inst->ring, n - part);
+			}
+			inst->file_size += n;
+			ATOM_STORE(&inst->ring_head, tail);
+			check_rotate(inst);
+			if (n >= inst->ring_cap / 2) {
+				// 积压较多，不等待，马上写下一批
+				continue;
+			}
+		} else {
+			if (quit)
+				break;
+			check_rotate(inst);
+		}
+		usleep(LOGGER_INTERVAL);
+	}
+	return NULL;
+}
+
+static inline void
+ring_write(struct logger *inst, size_t pos, const void * data, size_t sz) {
+	size_t offset = pos & (inst->ring_cap - 1);
+	size_t part = inst->ring_cap - offset;
+	if (part >= sz) {
+		memcpy(inst->ring + offset, data, sz);
+	} else {
+		memcpy(inst->ring + offset, data, part);
+		memcpy(inst->ring, (const char *)data + part, sz - part);
+	}
+}
+
+// logger 服务：把一行日志追加进缓冲区，空间不够时丢弃
+static void
+async_log(struct logger *inst, uint32_t source, const void * msg, size_t sz) {
+	char header[SIZETIMEFMT + 32];
+	int n = 0;
+	if (inst->filename) {
+		int csec;
+		const char * ts = timestring(inst, &csec);
+		n = snprintf(header, sizeof(header), "%s.%02d ", ts, csec);
+	}
+	n += snprintf(header + n, sizeof(header) - n, "[:%08x] ", source);
+	size_t need = n + sz + 1;
+	size_t tail = ATOM_LOAD(&inst->ring_tail);
+	size_t head = ATOM_LOAD(&inst->ring_head);
+	if (need > inst->ring_cap - (tail - head)) {
+		ATOM_FINC(&inst->dropped);
+		return;
+	}
+	ring_write(inst, tail, header, n);
+	ring_write(inst, tail + n, msg, sz);
+	ring_write(inst, tail + n + sz, "\n", 1);
+	ATOM_STORE(&inst->ring_tail, tail + need);
+}
+
+// 读出 seri 数据中的一个整数（格式 id），返回占用的字节数，不是整数时返回 0
+static size_t
+seri_integer(const uint8_t * p, size_t sz, uint32_t *v) {
+	if (sz == 0 || (p[0] & 7) != 2)	// TYPE_NUMBER
+		return 0;
+	int cookie = p[0] >> 3;
+	switch (cookie) {
+	case 0:	// TYPE_NUMBER_ZERO
+		*v = 0;
+		return 1;
+	case 1:	// TYPE_NUMBER_BYTE
+		if (sz < 2)
+			return 0;
+		*v = p[1];
+		return 2;
+	case 2: {	// TYPE_NUMBER_WORD
+		uint16_t w;
+		if (sz < 3)
+			return 0;
+		memcpy(&w, p+1, sizeof(w));
+		*v = w;
+		return 3;
+	}
+	case 4: {	// TYPE_NUMBER_DWORD
+		int32_t d;
+		if (sz < 5)
+			return 0;
+		memcpy(&d, p+1, sizeof(d));
+		*v = (uint32_t)d;
+		return 5;
+	}
+	case 6: {	// TYPE_NUMBER_QWORD
+		int64_t q;
+		if (sz < 9)
+			return 0;
+		memcpy(&q, p+1, sizeof(q));
+		*v = (uint32_t)q;
+		return 9;
+	}
+	}
+	return 0;
+}
+
+// 按 lua-seri 的规则写一个非负整数，返回字节数
+static size_t
+seri_put_integer(uint8_t p[9], uint32_t v) {
+	if (v == 0) {
+		p[0] = 2;	// TYPE_NUMBER | TYPE_NUMBER_ZERO << 3
+		return 1;
+	} else if (v < 0x100) {
+		p[0] = 2 | 1 << 3;
+		p[1] = (uint8_t)v;
+		return 2;
+	} else if (v < 0x10000) {
+		uint16_t w = (uint16_t)v;
+		p[0] = 2 | 2 << 3;
+		memcpy(p+1, &w, sizeof(w));
+		return 3;
+	} else if (v < 0x80000000u) {
+		p[0] = 2 | 4 << 3;
+		memcpy(p+1, &v, sizeof(v));
+		return 5;
+	} else {
+		int64_t q = v;
+		p[0] = 2 | 6 << 3;
+		memcpy(p+1, &q, sizeof(q));
+		return 9;
+	}
+}
+
+static void
+binary_record(struct logger *inst, uint32_t source, uint64_t ti, const void * msg, size_t sz) {
+	struct {
+		uint32_t size;
+		uint32_t source;
+		uint64_t time;
+	} header = { (uint32_t)sz, source, ti };
+	fwrite(&header, sizeof(header), 1, inst->binary);
+	fwrite(msg, sz, 1, inst->binary);
+	if (!inst->flush_pending) {
+		inst->flush_pending = 1;
+		skynet_command(inst->ctx, "TIMEOUT", "100");
+	}
+}
+
+static uint64_t
+binary_now(struct logger *inst) {
+	return skynet_now() + (uint64_t)inst->starttime * 100;
+}
+
+// 新文件（或轮转后的空文件）先写文件头和全部已知的格式定义
+static void
+binary_begin(struct logger *inst) {
+	fseek(inst->binary, 0, SEEK_END);
+	if (ftell(inst->binary) != 0)
+		return;
+	fwrite(SLOG_MAGIC, sizeof(SLOG_MAGIC), 1, inst->binary);
+	uint64_t ti = binary_now(inst);
+	int i;
+	for (i=0;i<inst->define_n;i++) {
+		struct slog_define * d = &inst->define[i];
+		binary_record(inst, 0, ti, d->data, d->sz);
+	}
+}
+
+static struct slog_define *
+define_find(struct logger *inst, uint32_t id) {
+	int i;
+	for (i=0;i<inst->define_n;i++) {
+		if (inst->define[i].id == id)
+			return &inst->define[i];
+	}
+	return NULL;
+}
+
+static inline uint32_t
+alias_hash(uint32_t source, uint32_t id) {
+	return (source * 2654435761u) ^ id;
+}
+
+static struct slog_alias **
+alias_slot(struct logger *inst, uint32_t source, uint32_t id) {
+	struct slog_alias ** p = &inst->alias[alias_hash(source, id) & (inst->alias_cap - 1)];
+	while (*p) {
+		struct slog_alias * a = *p;
+		if (a->source == source && a->id == id)
+			break;
+		p = &a->next;
+	}
+	return p;
+}
+
+static struct slog_alias *
+alias_find(struct logger *inst, uint32_t source, uint32_t id) {
+	if (inst->alias_n == 0)
+		return NULL;
+	return *alias_slot(inst, source, id);
+}
+
+static void
+alias_grow(struct logger *inst) {
+	int cap = inst->alias_cap ? inst->alias_cap * 2 : 16;
+	struct slog_alias ** slot = skynet_malloc(cap * sizeof(*slot));
+	memset(slot, 0, cap * sizeof(*slot));
+	int i;
+	for (i=0;i<inst->alias_cap;i++) {
+		struct slog_alias * a = inst->alias[i];
+		while (a) {
+			struct slog_alias * next = a->next;
+			struct slog_alias ** p = &slot[alias_hash(a->source, a->id) & (cap - 1)];
+			a->next = *p;
+			*p = a;
+			a = next;
+		}
+	}
+	skynet_free(inst->alias);
+	inst->alias = slot;
+	inst->alias_cap = cap;
+}
+
+static void
+alias_set(struct logger *inst, uint32_t source, uint32_t id, uint32_t to) {
+	if (id == to) {
+		// 来源地址被新服务复用，之前的改写不再适用
+		if (inst->alias_n > 0) {
+			struct slog_alias ** p = alias_slot(inst, source, id);
+			struct slog_alias * a = *p;
+			if (a) {
+				*p = a->next;
+				skynet_free(a);
+				--inst->alias_n;
+			}
+		}
+		return;
+	}
+	if (inst->alias_n >= inst->alias_cap) {
+		alias_grow(inst);
+	}
+	struct slog_alias ** p = alias_slot(inst, source, id);
+	struct slog_alias * a = *p;
+	if (a == NULL) {
+		a = skynet_malloc(sizeof(*a));
+		a->next = NULL;
+		a->source = source;
+		a->id = id;
+		*p = a;
+		++inst->alias_n;
+	}
+	a->to = to;
+}
+
+/*
+ * 格式定义 (0, id, 格式串)：fmt 为格式串在 msg 中的偏移。
+ * id 已被同一个格式串占用时去重；被别的格式串占用时顺序探测，找到同一个格式串或空闲的 id 为止。
+ */
+static void
+binary_define(struct logger *inst, uint32_t source, uint32_t id, const uint8_t * msg, size_t sz, size_t fmt) {
+	uint32_t to = id;
+	struct slog_define * d;
+	while ((d = define_find(inst, to))) {
+		if (d->sz - d->fmt == sz - fmt && memcmp((const uint8_t *)d->data + d->fmt, msg + fmt, sz - fmt) == 0) {
+			alias_set(inst, source, id, to);
+			return;
+		}
+		if (++to == 0)
+			to = 1;
+	}
+	alias_set(inst, source, id, to);
+	if (inst->define_n >= inst->define_cap) {
+		inst->define_cap = inst->define_cap ? inst->define_cap * 2 : 64;
+		inst->define = skynet_realloc(inst->define, inst->define_cap * sizeof(struct slog_define));
+	}
+	d = &inst->define[inst->define_n++];
+	uint8_t head[10];
+	size_t n = seri_put_integer(head, 0);
+	n += seri_put_integer(head + n, to);
+	d->id = to;
+	d->fmt = n;
+	d->sz = n + sz - fmt;
+	d->data = skynet_malloc(d->sz);
+	memcpy(d->data, head, n);
+	memcpy((uint8_t *)d->data + n, msg + fmt, sz - fmt);
+	binary_record(inst, 0, binary_now(inst), d->data, d->sz);
+}
+
+/*
+ * schema 定义 (0, 0, 指纹, 名字, 字段表)，由 slog 在服务注册了新的 schema 后发来，
+ * 读日志时用来解开按 schema 打包的参数。各服务发来的相同定义只记一次，id 为 0 不参与格式 id 的查找。
+ */
+static void
+binary_schema(struct logger *inst, const void * msg, size_t sz) {
+	int i;
+	for (i=0;i<inst->define_n;i++) {
+		struct slog_define * d = &inst->define[i];
+		if (d->id == 0 && d->sz == sz && memcmp(d->data, msg, sz) == 0)
+			return;
+	}
+	if (inst->define_n >= inst->define_cap) {
+		inst->define_cap = inst->define_cap ? inst->define_cap * 2 : 64;
+		inst->define = skynet_realloc(inst->define, inst->define_cap * sizeof(struct slog_define));
+	}
+	struct slog_define * d = &inst->define[inst->define_n++];
+	d->id = 0;
+	d->fmt = 0;
+	d->sz = sz;
+	d->data = skynet_malloc(sz);
+	memcpy(d->data, msg, sz);
+	binary_record(inst, 0, binary_now(inst), d->data, d->sz);
+}
+
+static void
+binary_log(struct logger *inst, uint32_t source, const void * msg, size_t sz) {
+	uint32_t id;
+	size_t n = seri_integer(msg, sz, &id);
+	if (n == 0)
+		return;
+	if (id == 0) {
+		size_t n2 = seri_integer((const uint8_t *)msg + n, sz - n, &id);
+		if (n2 == 0)
+			return;
+		if (id == 0) {
+			binary_schema(inst, msg, sz);
+			return;
+		}
+		binary_define(inst, source, id, msg, sz, n + n2);
+		return;
+	}
+	struct slog_alias * a = alias_find(inst, source, id);
+	if (a == NULL) {
+		binary_record(inst, source, binary_now(inst), msg, sz);
+		return;
+	}
+	// 冲突的格式：换成文件里的 id
+	uint8_t head[9];
+	size_t hn = seri_put_integer(head, a->to);
+	size_t rsz = hn + sz - n;
+	uint8_t * tmp = skynet_malloc(rsz);
+	memcpy(tmp, head, hn);
+	memcpy(tmp + hn, (const uint8_t *)msg + n, sz - n);
+	binary_record(inst, source, binary_now(inst), tmp, rsz);
+	skynet_free(tmp);
+}
+
+// 轮转后重新打开二进制日志；失败时关掉二进制日志并报错，下次轮转再试
+static void
+binary_reopen(struct logger *inst) {
+	if (inst->binary) {
+		inst->binary = freopen(inst->binary_name, "ab", inst->binary);
+	} else {
+		inst->binary = fopen(inst->binary_name, "ab");
+	}
+	if (inst->binary == NULL) {
+		skynet_free(inst->binary_buffer);
+		inst->binary_buffer = NULL;
+		skynet_error(inst->ctx, "Reopen logbinary %s failed : %s", inst->binary_name, strerror(errno));
+		return;
+	}
+	if (inst->binary_buffer == NULL)
+		inst->binary_buffer = skynet_malloc(SLOG_BUFFER);
+	setvbuf(inst->binary, inst->binary_buffer, _IOFBF, SLOG_BUFFER);
+	binary_begin(inst);
 }
 
 static int
@@ -72,15 +643,38 @@ logger_cb(struct skynet_context * context, void *ud, int type, int session, uint
 	case PTYPE_SYSTEM:
         // 系统消息：触发日志轮转。若指定了文件名，则重新以追加模式打开
 		if (inst->filename) {
-			inst->handle = freopen(inst->filename, "a", inst->handle);
+			if (inst->async) {
+				ATOM_STORE(&inst->reopen, 1);
+			} else {
+				inst->handle = freopen(inst->filename, "a", inst->handle);
+			}
+		}
+		if (inst->binary_name) {
+			binary_reopen(inst);
+		}
+		break;
+	case PTYPE_RESPONSE:
+		// flush 定时器
+		inst->flush_pending = 0;
+		if (inst->binary) {
+			fflush(inst->binary);
+		}
+		break;
+	case PTYPE_LOG:
+		if (inst->binary) {
+			binary_log(inst, source, msg, sz);
 		}
 		break;
 	case PTYPE_TEXT:
+		if (inst->async) {
+			async_log(inst, source, msg, sz);
+			break;
+		}
 		// 文本日志：按格式输出（可选时间戳 + 源服务地址 + 文本 + 换行）
 		if (inst->filename) {
-			char tmp[SIZETIMEFMT];
-			int csec = timestring(ud, tmp);
-			fprintf(inst->handle, "%s.%02d ", tmp, csec);
+			int csec;
+			const char * ts = timestring(inst, &csec);
+			fprintf(inst->handle, "%s.%02d ", ts, csec);
 		}
 		fprintf(inst->handle, "[:%08x] ", source);
 		fwrite(msg, sz , 1, inst->handle);
@@ -92,10 +686,72 @@ logger_cb(struct skynet_context * context, void *ud, int type, int session, uint
 	return 0;
 }
 
+static int
+optenv(struct skynet_context *ctx, const char *key) {
+	const char * v = skynet_command(ctx, "GETENV", key);
+	return v ? strtol(v, NULL, 10) : 0;
+}
+
+static int
+binary_init(struct logger * inst, const char * filename) {
+	inst->binary = fopen(filename, "ab");
+	if (inst->binary == NULL)
+		return 1;
+	inst->binary_name = skynet_malloc(strlen(filename)+1);
+	strcpy(inst->binary_name, filename);
+	inst->binary_buffer = skynet_malloc(SLOG_BUFFER);
+	setvbuf(inst->binary, inst->binary_buffer, _IOFBF, SLOG_BUFFER);
+	binary_begin(inst);
+	return 0;
+}
+
+static int
+async_init(struct logger * inst, struct skynet_context *ctx, const char * parm, int kb) {
+	size_t cap = 4096;
+	while (cap < (size_t)kb * 1024)
+		cap *= 2;
+	if (parm) {
+		inst->filename = skynet_malloc(strlen(parm)+1);
+		strcpy(inst->filename, parm);
+		if (open_file(inst)) {
+			return 1;
+		}
+		inst->rotate_size = (size_t)optenv(ctx, "logrotate_size") * 1024 * 1024;
+		inst->rotate_time = optenv(ctx, "logrotate_time");
+	} else {
+		inst->fd = STDOUT_FILENO;
+	}
+	inst->ring = skynet_malloc(cap);
+	inst->ring_cap = cap;
+	ATOM_INIT(&inst->ring_head, 0);
+	ATOM_INIT(&inst->ring_tail, 0);
+	ATOM_INIT(&inst->dropped, 0);
+	ATOM_INIT(&inst->reopen, 0);
+	ATOM_INIT(&inst->quit, 0);
+	if (pthread_create(&inst->thread, NULL, thread_writer, inst)) {
+		if (inst->filename) {
+			close(inst->fd);
+		}
+		return 1;
+	}
+	inst->async = 1;
+	skynet_callback(ctx, inst, logger_cb);
+	return 0;
+}
+
 int
 logger_init(struct logger * inst, struct skynet_context *ctx, const char * parm) {
 	const char * r = skynet_command(ctx, "STARTTIME", NULL);
 	inst->starttime = strtoul(r, NULL, 10);
+	inst->ctx = ctx;
+	const char * binary = skynet_command(ctx, "GETENV", "logbinary");
+	if (binary && binary_init(inst, binary)) {
+		return 1;
+	}
+	int kb = optenv(ctx, "logbuffer");
+	if (kb > 0) {
+		return async_init(inst, ctx, parm, kb);
+	}
 	// 若配置中提供了日志文件路径（parm），则以追加模式写入文件；否则输出到 stdout
 	if (parm) {
 		inst->handle = fopen(parm,"a");
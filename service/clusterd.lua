@@ -2,14 +2,21 @@
 --  clusterd 是集群管理服务：
 --   - 维护 node->address 映射与 sender 的生命周期
 --   - 提供 sender/proxy/listen/register/queryname 等接口
---   - 监听 socket 连接，接入 clusteragent 为每个 fd 提供协议处理
+--   - 监听 socket 连接，接入 clusteragent（C 服务，见 service-src/service_clusteragent.c）为每个 fd 提供协议处理
 --  流程要点：
 --   - open_channel(name)：按需创建/切换 sender（clustersender 服务）
 --     • address=nil 且 nowaiting=false：等待配置；true：不等待（直接缺席）
 --     • address=false：关闭 sender（节点下线）
 --     • address=host:port：changenode -> connect
 --   - reload(config)：重载 cluster 配置，触发增删改并唤醒等待者
+--   - 连接池：配置 __connections = n（默认 1）时每个节点开 n 个 clustersender（各自一条连接），
+--     sender 返回第一个 sender 和整个池；池的大小在第一次连接该节点时确定。
+--     __sticky = false 时 cluster.send 也按负载分散（默认按地址固定连接，保证同一地址的 send 有序）
+--   - 压缩：__compress = n 时不小于 n 字节的请求/回应在握手同意后压缩；同样在第一次连接该节点时确定
+--   - 共享内存：__shm = { node = true 或环大小 } 中的节点在同一台机器上，连接握手后数据改走共享内存；
+--     同样在第一次连接该节点时确定
 --   - listen(addr,port)：启动 gate 监听，为每个入站 fd 启动 clusteragent
+--   - 注册名：clusteragent 不回头查询，启动时和每次变化时由 clusterd 用 text 命令（R handle name / U name）推给它
 local skynet = require "skynet"
 require "skynet.manager"
 local cluster = require "skynet.cluster.core"
@@ -18,12 +25,30 @@ local config_name = skynet.getenv "cluster"
 local node_address = {}
 local node_sender = {}
 local node_sender_closed = {}
+local node_pool = {}	-- node -> { sender, ... }
 local command = {}
 local config = {}
 local nodename = cluster.nodename()
 
 local connecting = {}
 
+local SHM_DEFAULT = 1024 * 1024	-- __shm 中节点的值为 true 时每个方向的环大小
+
+local function shm_size(key)
+	local size = config.shm and config.shm[key]
+	if size == true then
+		return SHM_DEFAULT
+	end
+	return math.tointeger(size) or 0
+end
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(...) return ... end,
+	unpack = skynet.tostring,
+}
+
 -- 按需建立/切换到 node 的 sender：
 --  - 支持等待 node 地址解析（config.nowaiting 可跳过）
 --  - changenode(host,port|false) 切换/关闭 sender
@@ -59,17 +84,26 @@ local function open_channel(t, key)
 		local host, port = string.match(address, "([^:]+):(.*)$")
 		c = node_sender[key]
 		if c == nil then
-			c = skynet.newservice("clustersender", key, nodename, host, port)
+			local pool = {}
+			for i = 1, config.connections or 1 do
+				pool[i] = skynet.newservice("clustersender", key, nodename, host, port, config.compress or 0, shm_size(key))
+			end
 			if node_sender[key] then
 				-- double check
-				skynet.kill(c)
-				c = node_sender[key]
+				for _, s in ipairs(pool) do
+					skynet.kill(s)
+				end
 			else
-				node_sender[key] = c
+				node_sender[key] = pool[1]
+				node_pool[key] = pool
 			end
+			c = node_sender[key]
 		end
 
-		succ = pcall(skynet.call, c, "lua", "changenode", host, port)
+		succ = true
+		for _, s in ipairs(node_pool[key]) do
+			succ = pcall(skynet.call, s, "lua", "changenode", host, port) and succ
+		end
 
 		if succ then
 			t[key] = c
@@ -87,7 +121,13 @@ local function open_channel(t, key)
 		else
 			-- trun off the sender
 			-- 关闭 sender（待下一次 changenode 重连）
-			succ, err = pcall(skynet.call, c, "lua", "changenode", false)
+			succ = true
+			for _, s in ipairs(node_pool[key]) do
+				local ok, e = pcall(skynet.call, s, "lua", "changenode", false)
+				if not ok then
+					succ, err = false, e
+				end
+			end
                         if succ then --trun off failed, wait next index todo turn off
                                 node_sender_closed[key] = true
                         end
@@ -182,9 +222,10 @@ function command.listen(source, addr, port, maxclient)
 	end
 end
 
--- 返回某个 node 的 sender（必要时触发连接）
+-- 返回某个 node 的 sender（必要时触发连接）及它所在的连接池
 function command.sender(source, node)
-	skynet.ret(skynet.pack(node_channel[node]))
+	local c = node_channel[node]
+	skynet.ret(skynet.pack(c, node_pool[node], config.sticky))
 end
 
 function command.senders(source)
@@ -219,10 +260,12 @@ end
 local cluster_agent = {}	-- fd:service
 local register_name = {}
 
-local function clearnamecache()
+-- 把名字的变化推给所有 clusteragent ，addr 为 nil 表示取消注册
+local function updatename(name, addr)
+	local cmd = addr and string.format("R %d %s", addr, name) or "U " .. name
 	for fd, service in pairs(cluster_agent) do
 		if type(service) == "number" then
-			skynet.send(service, "lua", "namechange")
+			skynet.send(service, "text", cmd)
 		end
 	end
 end
@@ -234,10 +277,11 @@ function command.register(source, name, addr)
 	local old_name = register_name[addr]
 	if old_name then
 		register_name[old_name] = nil
-		clearnamecache()
+		updatename(old_name)
 	end
 	register_name[addr] = name
 	register_name[name] = addr
+	updatename(name, addr)
 	skynet.ret(nil)
 	skynet.error(string.format("Register [%s] :%08x", name, addr))
 end
@@ -250,7 +294,7 @@ function command.unregister(_, name)
 	local addr = register_name[name]
 	register_name[addr] = nil
 	register_name[name] = nil
-	clearnamecache()
+	updatename(name)
 	skynet.ret(nil)
 	skynet.error(string.format("Unregister [%s] :%08x", name, addr))
 end
@@ -266,11 +310,19 @@ function command.socket(source, subcmd, fd, msg)
 		skynet.error(string.format("socket accept from %s", msg))
 		-- new cluster agent
 		cluster_agent[fd] = false
-		local agent = skynet.newservice("clusteragent", skynet.self(), source, fd)
+		local agent = assert(skynet.launch("clusteragent", fd))
+		for name, addr in pairs(register_name) do
+			if type(name) == "string" then
+				skynet.send(agent, "text", string.format("R %d %s", addr, name))
+			end
+		end
+		-- fd 只负责写：数据包读取由 gate 接管并通过 client 协议转发给 agent
+		-- 注意：转发可能失败（参阅 https://github.com/cloudwu/skynet/issues/1958）
+		pcall(skynet.call, source, "lua", "forward", fd, 0, agent)
 		local closed = cluster_agent[fd]
 		cluster_agent[fd] = agent
 		if closed then
-			skynet.send(agent, "lua", "exit")
+			skynet.send(agent, "text", "exit")
 			cluster_agent[fd] = nil
 		end
 	else
@@ -280,7 +332,7 @@ function command.socket(source, subcmd, fd, msg)
 			if type(agent) == "boolean" then
 				cluster_agent[fd] = true
 			elseif agent then
-				skynet.send(agent, "lua", "exit")
+				skynet.send(agent, "text", "exit")
 				cluster_agent[fd] = nil
 			end
 		else
@@ -9,6 +9,14 @@
 --       • 支持 trace：通过 packtrace 预置一条“trace 指令”在请求前发送
 --       • 返回值：可能是多段（table），由 clusterd/cluster.lua 上层 concat
 --   - push(addr,msg,sz)：cluster.packpush → channel:request(request, nil, padding)
+--   - 握手（auth）：每次连上后用 v1 格式查询 cluster.hello，对端回应 version 则双方改用 v2（4 字节包头、8M 分片），
+--     对端回应 3 时请求改用 v3（包头放在 msg 后面，对端零拷贝转发），
+--     旧版本的对端回应名字不存在，连接保持 v1。打包前先等连接就绪，保证包头与连接协商的版本一致
+--   - 压缩：握手时带上压缩阈值（clusterd 的 __compress），对端同意后双方都压缩不小于阈值的单包消息
+--   - 共享内存：节点配置在 clusterd 的 __shm 里时，握手时带上环大小，对端在回应里给出共享内存的名字，
+--     双方之后的数据都走共享内存（socket.shm），TCP 连接只传唤醒；打不开（不在同一台机器上）时断开，以后不再要求
+--   - 批量写：req/push 打好的单包先放进 batch，本次 dispatch 结束后由 flush 合成一次 socket 写；
+--     若消息队列里还有消息（多半是后续请求），先 yield 让它们也进 batch，再一起写出；多段的包照旧低优先级写
 local skynet = require "skynet"
 local sc = require "skynet.socketchannel"
 local socket = require "skynet.socket"
@@ -16,15 +24,78 @@ local cluster = require "skynet.cluster.core"
 
 local channel
 local session = 1
-local node, nodename, init_host, init_port = ...
+local header = 2	-- 2 : v1, 4 : v2 及以上
+local version = 1	-- 握手协商的版本，打包请求时用
+local hello_session
+local batch	-- 等待一起写出的包
+local batch_size = 0
+local BATCH_MAX = 0x10000	-- 超过后不再等后续请求
+local node, nodename, init_host, init_port, compress, shm = ...
+compress = math.tointeger(compress) or 0
+shm = math.tointeger(shm) or 0	-- 要求的共享内存环大小，0 不用
+local link_compress = 0	-- 握手同意后的压缩阈值
 
 local command = {}
 
+-- 协商出的版本决定包头，所以打包前要等连接就绪；失败时释放 msg
+local function wait_ready(msg, sz)
+	local ok, err = pcall(channel.ready, channel)
+	if not ok then
+		skynet.trash(msg, sz)
+		error(err)
+	end
+end
+
+local function flush()
+	if batch_size < BATCH_MAX and skynet.mqlen() > 0 then
+		skynet.yield()
+	end
+	local list = batch
+	if not list then
+		return	-- 已经被多段请求提前写出
+	end
+	batch = nil
+	batch_size = 0
+	-- 写失败时 socketchannel 会唤醒所有等待回应的请求
+	pcall(channel.request, channel, list)
+end
+
+-- 只有单包的请求进 batch；多段请求先把 batch（含它前面的 trace 等指令）写出，
+-- 再和原来一样由 channel:request 用低优先级写出各段
+local function queue(request, padding)
+	if padding then
+		local list = batch
+		if list then
+			batch = nil
+			batch_size = 0
+			channel:request(list)
+		end
+		channel:request(request, nil, padding)
+		return
+	end
+	if not batch then
+		batch = {}
+		skynet.fork(flush)
+	end
+	table.insert(batch, request)
+	batch_size = batch_size + #request
+end
+
 -- 序列化并发送请求：支持 trace id 透传
-local function send_request(addr, msg, sz)
+-- deadline（skynet.now() 的时间，可选）：过期前没有回应就放弃，session 回收，对端（v4）收到时已经过期的请求不再执行
+local function send_request(addr, msg, sz, deadline)
 	-- msg is a local pointer, cluster.packrequest will free it
+	wait_ready(msg, sz)
+	local timeout
+	if deadline then
+		timeout = deadline - skynet.now()
+		if timeout <= 0 then
+			skynet.trash(msg, sz)
+			error(sc.timeout)
+		end
+	end
 	local current_session = session
-	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz)
+	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz, version, link_compress)
 	session = new_session
 
     -- 透传 trace：若存在 tracetag，先发送一条 trace 指令
@@ -37,10 +108,14 @@ local function send_request(addr, msg, sz)
 			tracetag = newtag
 		end
 		skynet.tracelog(tracetag, string.format("cluster %s", node))
-		channel:request(cluster.packtrace(tracetag))
+		queue(cluster.packtrace(tracetag, version))
 	end
+	if timeout and version >= 4 then
+		queue(cluster.packdeadline(timeout * 10, version))
+	end
+	queue(request, padding)
     -- 有响应的请求：response 由 read_response 解析 session/ok/data/padding
-	return channel:request(request, current_session, padding)
+	return channel:response(current_session, timeout)
 end
 
 function command.req(...)
@@ -53,27 +128,68 @@ function command.req(...)
 			skynet.ret(msg)
 		end
 	else
-		skynet.error(msg)
+		if msg ~= sc.timeout then
+			skynet.error(msg)
+		end
 		skynet.response()(false)
 	end
 end
 
 function command.push(addr, msg, sz)
     -- 无响应 push（可能为多段请求）：padding 表示 multi push
-	local request, new_session, padding = cluster.packpush(addr, session, msg, sz)
+	wait_ready(msg, sz)
+	local request, new_session, padding = cluster.packpush(addr, session, msg, sz, version, link_compress)
 	if padding then	-- is multi push
 		session = new_session
 	end
 
-	channel:request(request, nil, padding)
+	queue(request, padding)
 end
 
 -- socketchannel 的 response 解析函数
 local function read_response(sock)
-    -- 解析一条响应帧：大端 2 字节长度 + 数据；交给 core 解包
-	local sz = socket.header(sock:read(2))
+    -- 解析一条响应帧：大端 2 字节（v2 为 4 字节）长度 + 数据；交给 core 解包
+	local sz = socket.header(sock:read(header))
 	local msg = sock:read(sz)
-	return cluster.unpackresponse(msg)	-- session, ok, data, padding
+	local s, ok, data, padding = cluster.unpackresponse(msg)
+	if s and s == hello_session then
+		-- 握手的回应：在读下一个包之前切换包头
+		hello_session = nil
+		if ok then
+			local v, c, name = skynet.unpack(data)
+			if math.type(v) == "integer" and v >= 2 then
+				-- 只支持 v2 的对端回应 2
+				version = math.min(v, cluster.version)
+				header = 4
+				link_compress = c or 0
+			end
+			if name then
+				-- 对端已经切换到共享内存，在发出下一个请求之前切换
+				if not socket.shm(sock[1], name) then
+					skynet.error(string.format("Cluster node [%s] can't open shared memory %s, use tcp", node, name))
+					shm = 0
+					error(sc.error)
+				end
+			end
+		end
+	end
+	return s, ok, data, padding	-- session, ok, data, padding
+end
+
+-- socketchannel 的 auth：每次连上后协商协议版本
+local function handshake(channel)
+	header = 2
+	version = 1
+	link_compress = 0
+	hello_session = session
+	local request, new_session = cluster.packrequest(0, session, skynet.pack(cluster.hello, compress, cluster.version, shm))
+	session = new_session
+	local ok, err = pcall(channel.request, channel, request, hello_session)
+	if not ok and not channel.__sock then
+		error(err)	-- disconnected
+	end
+	-- 旧版本的对端回应 name not found ，保持 v1
+	return true
 end
 
 -- 切换/关闭连接：host=nil/false 表示关闭
@@ -93,6 +209,7 @@ skynet.start(function()
 			host = init_host,
 			port = tonumber(init_port),
 			response = read_response,
+			auth = handshake,
 			nodelay = true,
 		}
 	skynet.dispatch("lua", function(session , source, cmd, ...)
@@ -9,12 +9,12 @@
 	协议（与 Slave 的双向消息）：
 	- 封包：1 字节长度 + packstring 内容（read_package/pack_package）。
 	- Slave -> Master：
-	  H id, addr    握手（上报自身 id 与监听地址）
+	  H id, addr, compress    握手（上报自身 id 与监听地址，compress 为 true 表示能解压）
 	  R name, addr  注册全局名字（name -> address）
 	  Q name        查询 name
 	- Master -> Slave：
-	  W n           返回当前需要等待的其它 harbor 数量（用于 Slave 监听接入）
-	  C id, addr    广播新节点信息
+	  W n, bitmap   返回当前需要等待的其它 harbor 数量（用于 Slave 监听接入），bitmap 为其中能解压的节点
+	  C id, addr, compress    广播新节点信息
 	  N name, addr  广播名字表更新
 	  D id          广播节点下线
 ]]
@@ -69,31 +69,40 @@ end
 -- 新上线的 slave：
 -- 1) 广播给所有在线节点（C id addr）
 -- 2) 回给当前 fd 一个 'W n'，告知需要等待的其它 harbor 数量
-local function report_slave(fd, slave_id, slave_addr)
-	local message = pack_package("C", slave_id, slave_addr)
+local function report_slave(fd, slave_id, slave_addr, compress)
+	local message = pack_package("C", slave_id, slave_addr, compress)
 	local n = 0
+	local bitmap = {}
+	for i = 1, 32 do
+		bitmap[i] = 0
+	end
 	for k,v in pairs(slave_node) do
 		if v.fd ~= 0 then
 			socket.write(v.fd, message)
 			n = n + 1
+			if v.compress then
+				local i = k // 8 + 1
+				bitmap[i] = bitmap[i] | (1 << (k % 8))
+			end
 		end
 	end
-	socket.write(fd, pack_package("W", n))
+	socket.write(fd, pack_package("W", n, string.char(table.unpack(bitmap))))
 end
 
 -- 握手：读取 'H id addr'，校验重复；广播拓扑并记录节点信息
 local function handshake(fd)
-	local t, slave_id, slave_addr = read_package(fd)
+	local t, slave_id, slave_addr, compress = read_package(fd)
 	assert(t=='H', "Invalid handshake type " .. t)
 	assert(slave_id ~= 0 , "Invalid slave id 0")
 	if slave_node[slave_id] then
 		error(string.format("Slave %d already register on %s", slave_id, slave_node[slave_id].addr))
 	end
-	report_slave(fd, slave_id, slave_addr)
+	report_slave(fd, slave_id, slave_addr, compress)
 	slave_node[slave_id] = {
 		fd = fd,
 		id = slave_id,
 		addr = slave_addr,
+		compress = compress,
 	}
 	return slave_id , slave_addr
 end
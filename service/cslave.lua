@@ -10,12 +10,12 @@
 	协议约定（slave <-> master）：
 	- 封包：1 字节长度 + packstring 内容（见 read_package/pack_package）。
 	- 从 slave 发往 master：
-	  H harbor_id, slave_address    -- 握手
+	  H harbor_id, slave_address, compress    -- 握手，compress 为 true 表示能解压
 	  R name, address               -- 注册全局名
 	  Q name                        -- 查询全局名
 	- 从 master 发往 slave：
-	  W n                           -- 需等待的其它 harbor 数量
-	  C id, addr                    -- 新节点连接信息
+	  W n, bitmap                   -- 需等待的其它 harbor 数量，bitmap 为已有节点中能解压的（32 字节，按 id 置位）
+	  C id, addr, compress          -- 新节点连接信息
 	  N name, address               -- 名字广播
 	  D id                          -- 节点下线
 ]]
@@ -28,6 +28,8 @@ local table = table
 
 -- 远端节点表：harbor_id -> fd
 local slaves = {}
+-- 能解压的远端节点：harbor_id -> true ，配置 harbor_compress 时发往它们的大消息会压缩
+local peer_compress = {}
 -- 启动早期暂存的“待连接”节点，ready() 后会被消化并置 nil
 local connect_queue = {}
 -- 全局名字缓存：name -> handle（含 harbor 高位）
@@ -81,7 +83,7 @@ local function connect_slave(slave_id, address)
 			slaves[slave_id] = fd
 			monitor_clear(slave_id)  -- 唤醒等待该节点的请求
 			socket.abandon(fd)        -- 交给 C 层 harbor 接管该 fd 的收发
-			skynet.send(harbor_service, "harbor", string.format("S %d %d",fd,slave_id)) -- 主动连接路径
+			skynet.send(harbor_service, "harbor", string.format("S %d %d %d",fd,slave_id, peer_compress[slave_id] and 1 or 0)) -- 主动连接路径
 		end
 	end)
 	if not ok then
@@ -118,9 +120,10 @@ end
 -- 监听来自 Master 的广播（C/N/D）与响应（N），保持与 Master 的长期连接
 local function monitor_master(master_fd)
 	while true do
-		local ok, t, id_name, address = pcall(read_package,master_fd)
+		local ok, t, id_name, address, compress = pcall(read_package,master_fd)
 		if ok then
 			if t == 'C' then
+				peer_compress[id_name] = compress
 				if connect_queue then
 					connect_queue[id_name] = address
 				else
@@ -170,7 +173,7 @@ local function accept_slave(fd)
 	monitor_clear(id)               -- 唤醒等待该节点
 	socket.abandon(fd)              -- 交由 C 层 harbor 接管该 fd
 	skynet.error(string.format("Harbor %d connected (fd = %d)", id, fd))
-	skynet.send(harbor_service, "harbor", string.format("A %d %d", fd, id)) -- 被动接入路径
+	skynet.send(harbor_service, "harbor", string.format("A %d %d %d", fd, id, peer_compress[id] and 1 or 0)) -- 被动接入路径
 end
 
 -- 注册协议：harbor（纯文本透传，用于与 C 层 harbor 的内部控制转发）
@@ -292,13 +295,20 @@ skynet.start(function()
 	skynet.dispatch("text", monitor_harbor(master_fd))
 
 	-- 启动 C 层 harbor 服务（参数：本 harbor_id 与 .cslave 句柄）
-	harbor_service = assert(skynet.launch("harbor", harbor_id, skynet.self()))
+	harbor_service = assert(skynet.launch("harbor", harbor_id, skynet.self(), tonumber(skynet.getenv "harbor_compress") or 0))
 
 	-- 向 Master 发送握手包 'H', harbor_id, address，并读回 'W', n
-	local hs_message = pack_package("H", harbor_id, slave_address)
+	local hs_message = pack_package("H", harbor_id, slave_address, true)
 	socket.write(master_fd, hs_message)
-	local t, n = read_package(master_fd)
+	local t, n, bitmap = read_package(master_fd)
 	assert(t == "W" and type(n) == "number", "slave shakehand failed")
+	if bitmap then
+		for id = 1, 255 do
+			if bitmap:byte(id // 8 + 1) & (1 << (id % 8)) ~= 0 then
+				peer_compress[id] = true
+			end
+		end
+	end
 	skynet.error(string.format("Waiting for %d harbors", n))
 	skynet.fork(monitor_master, master_fd)
 	if n > 0 then
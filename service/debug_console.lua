@@ -476,6 +476,12 @@ local function convert_stat(info)
 	info.read = bytes(info.read)
 	info.write = bytes(info.write)
 	info.wbuffer = bytes(info.wbuffer)
+	if info.wdrop then
+		info.whigh = bytes(info.whigh)
+		info.wlow = bytes(info.wlow)
+		info.wlimit = bytes(info.wlimit)
+		info.wdrop = bytes(info.wdrop)
+	end
 	info.rtime = time(info.rtime)
 	info.wtime = time(info.wtime)
 end
@@ -84,6 +84,10 @@ function handler.warning(fd, size)
 	skynet.send(watchdog, "lua", "socket", "warning", fd, size)
 end
 
+function handler.writable(fd, writable)
+	skynet.send(watchdog, "lua", "socket", "writable", fd, writable)
+end
+
 local CMD = {}
 
 function CMD.forward(source, fd, client, address)
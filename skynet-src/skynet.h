@@ -20,6 +20,8 @@
 #define PTYPE_RESERVED_DEBUG 9  // 调试
 #define PTYPE_RESERVED_LUA 10   // Lua消息
 #define PTYPE_RESERVED_SNAX 11  // SNAX框架消息
+// read lualib/skynet/slog.lua
+#define PTYPE_LOG 13            // 结构化日志（格式 id + seri 参数）
 
 #define PTYPE_TAG_DONTCOPY 0x10000
 #define PTYPE_TAG_ALLOCSESSION 0x20000
@@ -33,6 +35,7 @@ int skynet_send(struct skynet_context * context, uint32_t source, uint32_t desti
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
 
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
+int skynet_mqlen(struct skynet_context * context);	// 服务消息队列里还没处理的消息数
 
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
@@ -0,0 +1,229 @@
+#include "skynet_compress.h"
+#include "atomic.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+	LZ4 block 格式：
+		sequence := token [literal length] literals offset [match length]
+		token 高 4 位是字面量长度，低 4 位是匹配长度 - 4 ，值为 15 时后面跟若干字节（255 表示继续）累加；
+		offset 是 2 字节小端，指向已输出数据中的匹配位置；
+		最后一个 sequence 只有字面量，且最后 5 个字节总是字面量。
+	压缩用单层哈希表的贪心匹配，找不到匹配时步长逐渐变大，不可压缩的数据很快放弃。
+ */
+
+#define HASH_LOG 12
+#define MINMATCH 4
+#define MFLIMIT 12
+#define LASTLITERALS 5
+#define MAX_DISTANCE 0xffff
+#define SKIP_TRIGGER 6
+
+static struct {
+	ATOM_SIZET count;
+	ATOM_SIZET raw;
+	ATOM_SIZET packed;
+	ATOM_SIZET pack_time;
+	ATOM_SIZET ucount;
+	ATOM_SIZET utime;
+} S;
+
+static inline uint64_t
+now_ns(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000000000 + ti.tv_nsec;
+}
+
+static inline uint32_t
+read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+hash32(uint32_t v) {
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static inline uint8_t *
+write_length(uint8_t *op, size_t len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+size_t
+skynet_compress_bound(size_t sz) {
+	return sz + sz / 255 + 16;
+}
+
+static size_t
+compress_block(const uint8_t *base, size_t sz, uint8_t *dst, size_t cap) {
+	const uint8_t *ip = base;
+	const uint8_t *anchor = base;
+	const uint8_t *iend = base + sz;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + cap;
+	if (sz > MFLIMIT) {
+		const uint8_t *mflimit = iend - MFLIMIT;
+		const uint8_t *matchlimit = iend - LASTLITERALS;
+		uint32_t table[1 << HASH_LOG];
+		memset(table, 0, sizeof(table));
+		++ip;
+		while (ip < mflimit) {
+			uint32_t seq = read32(ip);
+			uint32_t h = hash32(seq);
+			const uint8_t *ref = base + table[h];
+			table[h] = (uint32_t)(ip - base);
+			if (ref >= ip || ip - ref > MAX_DISTANCE || read32(ref) != seq) {
+				ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+				continue;
+			}
+			while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+				--ip;
+				--ref;
+			}
+			const uint8_t *p = ip + MINMATCH;
+			const uint8_t *r = ref + MINMATCH;
+			while (p < matchlimit && *p == *r) {
+				++p;
+				++r;
+			}
+			size_t lit = ip - anchor;
+			size_t mlen = p - ip - MINMATCH;
+			if ((size_t)(oend - op) < lit + lit / 255 + mlen / 255 + 8)
+				return 0;
+			uint8_t *token = op++;
+			if (lit >= 15) {
+				*token = 15 << 4;
+				op = write_length(op, lit - 15);
+			} else {
+				*token = (uint8_t)(lit << 4);
+			}
+			memcpy(op, anchor, lit);
+			op += lit;
+			size_t offset = ip - ref;
+			op[0] = offset & 0xff;
+			op[1] = (offset >> 8) & 0xff;
+			op += 2;
+			if (mlen >= 15) {
+				*token |= 15;
+				op = write_length(op, mlen - 15);
+			} else {
+				*token |= (uint8_t)mlen;
+			}
+			ip = anchor = p;
+			if (ip < mflimit) {
+				table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+			}
+		}
+	}
+	size_t lit = iend - anchor;
+	if ((size_t)(oend - op) < lit + lit / 255 + 2)
+		return 0;
+	if (lit >= 15) {
+		*op++ = 15 << 4;
+		op = write_length(op, lit - 15);
+	} else {
+		*op++ = (uint8_t)(lit << 4);
+	}
+	memcpy(op, anchor, lit);
+	op += lit;
+	return op - dst;
+}
+
+size_t
+skynet_compress(const void *src, size_t sz, void *dst, size_t cap) {
+	uint64_t start = now_ns();
+	if (cap >= sz)
+		cap = sz - 1;	// 不比原文短就没有意义
+	size_t n = (sz > 0 && sz <= UINT32_MAX) ? compress_block(src, sz, dst, cap) : 0;
+	ATOM_FINC(&S.count);
+	ATOM_FADD(&S.raw, sz);
+	ATOM_FADD(&S.packed, n ? n : sz);
+	ATOM_FADD(&S.pack_time, now_ns() - start);
+	return n;
+}
+
+static inline int
+read_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+	const uint8_t *p = *ip;
+	unsigned s;
+	do {
+		if (p >= iend)
+			return -1;
+		s = *p++;
+		*len += s;
+	} while (s == 255);
+	*ip = p;
+	return 0;
+}
+
+static int
+decompress_block(const uint8_t *ip, size_t sz, uint8_t *dst, size_t dstsz) {
+	const uint8_t *iend = ip + sz;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + dstsz;
+	while (ip < iend) {
+		unsigned token = *ip++;
+		size_t lit = token >> 4;
+		if (lit == 15 && read_length(&ip, iend, &lit))
+			return -1;
+		if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit)
+			return -1;
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip == iend)
+			break;	// the last sequence
+		if (iend - ip < 2)
+			return -1;
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return -1;
+		size_t mlen = token & 15;
+		if (mlen == 15 && read_length(&ip, iend, &mlen))
+			return -1;
+		mlen += MINMATCH;
+		if ((size_t)(oend - op) < mlen)
+			return -1;
+		const uint8_t *match = op - offset;
+		if (offset >= mlen) {
+			memcpy(op, match, mlen);
+			op += mlen;
+		} else {
+			// 重叠的匹配，逐字节复制
+			size_t i;
+			for (i = 0; i < mlen; i++)
+				op[i] = match[i];
+			op += mlen;
+		}
+	}
+	return (int)(op - dst);
+}
+
+int
+skynet_decompress(const void *src, size_t sz, void *dst, size_t dstsz) {
+	uint64_t start = now_ns();
+	int n = decompress_block(src, sz, dst, dstsz);
+	ATOM_FINC(&S.ucount);
+	ATOM_FADD(&S.utime, now_ns() - start);
+	return n;
+}
+
+void
+skynet_compress_stat(struct skynet_compress_stat *stat) {
+	stat->count = ATOM_LOAD(&S.count);
+	stat->raw = ATOM_LOAD(&S.raw);
+	stat->packed = ATOM_LOAD(&S.packed);
+	stat->pack_time = ATOM_LOAD(&S.pack_time);
+	stat->ucount = ATOM_LOAD(&S.ucount);
+	stat->utime = ATOM_LOAD(&S.utime);
+}
@@ -0,0 +1,28 @@
+#ifndef skynet_compress_h
+#define skynet_compress_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LZ4 block 格式的压缩/解压，给 cluster 和 harbor 的链路压缩用
+
+// LZ4 每个压缩后的字节最多还原出 255 字节，声明的原长超过这个比例的包一定是坏的，不按它分配内存
+#define COMPRESS_RATIO_MAX 255
+
+struct skynet_compress_stat {
+	uint64_t count;		// 压缩次数（含压不下去而放弃的）
+	uint64_t raw;		// 压缩前字节数
+	uint64_t packed;	// 压缩后字节数（放弃的按原长计）
+	uint64_t pack_time;	// 压缩耗时，纳秒
+	uint64_t ucount;	// 解压次数
+	uint64_t utime;		// 解压耗时，纳秒
+};
+
+size_t skynet_compress_bound(size_t sz);
+// 返回压缩后的长度；压不到原长以下或 cap 不够时返回 0 ，调用方应发送原文
+size_t skynet_compress(const void *src, size_t sz, void *dst, size_t cap);
+// 返回解压后的长度，数据损坏或 dstsz 不够时返回 -1
+int skynet_decompress(const void *src, size_t sz, void *dst, size_t dstsz);
+void skynet_compress_stat(struct skynet_compress_stat *stat);
+
+#endif
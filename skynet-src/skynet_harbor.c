@@ -3,13 +3,36 @@
 #include "skynet_server.h"
 #include "skynet_mq.h"
 #include "skynet_handle.h"
+#include "rwlock.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
 
+#define NAME_CACHE_SIZE 4096
+
+// 全局名字缓存：harbor 服务收到 N 命令时写入，skynet_sendname 直接查，读多写少
+struct name_node {
+	struct name_node * next;
+	char name[GLOBALNAME_LENGTH];
+	uint32_t handle;
+};
+
+struct name_cache {
+	struct rwlock lock;
+	struct name_node * slot[NAME_CACHE_SIZE];
+};
+
 static struct skynet_context * REMOTE = 0;
 static unsigned int HARBOR = ~0;
+static struct name_cache * NAMES = NULL;
+
+static inline uint32_t
+name_hash(const char name[GLOBALNAME_LENGTH]) {
+	uint32_t w[4];
+	memcpy(w, name, sizeof(w));
+	return (w[0] ^ w[1] ^ w[2] ^ w[3]) % NAME_CACHE_SIZE;
+}
 
 static inline int
 invalid_type(int type) {
@@ -34,6 +57,49 @@ void
 skynet_harbor_init(int harbor) {
     // 设置本地Harbor ID（左移24位存储在高8位）
 	HARBOR = (unsigned int)harbor << HANDLE_REMOTE_SHIFT;
+	struct name_cache * c = skynet_malloc(sizeof(*c));
+	memset(c, 0, sizeof(*c));
+	rwlock_init(&c->lock);
+	NAMES = c;
+}
+
+void
+skynet_harbor_updatename(const char name[GLOBALNAME_LENGTH], uint32_t handle) {
+	struct name_cache * c = NAMES;
+	uint32_t h = name_hash(name);
+	rwlock_wlock(&c->lock);
+	struct name_node * node = c->slot[h];
+	while (node) {
+		if (memcmp(node->name, name, GLOBALNAME_LENGTH) == 0)
+			break;
+		node = node->next;
+	}
+	if (node == NULL) {
+		node = skynet_malloc(sizeof(*node));
+		memcpy(node->name, name, GLOBALNAME_LENGTH);
+		node->next = c->slot[h];
+		c->slot[h] = node;
+	}
+	node->handle = handle;
+	rwlock_wunlock(&c->lock);
+}
+
+uint32_t
+skynet_harbor_findname(const char name[GLOBALNAME_LENGTH]) {
+	struct name_cache * c = NAMES;
+	uint32_t h = name_hash(name);
+	uint32_t handle = 0;
+	rwlock_rlock(&c->lock);
+	struct name_node * node = c->slot[h];
+	while (node) {
+		if (memcmp(node->name, name, GLOBALNAME_LENGTH) == 0) {
+			handle = node->handle;
+			break;
+		}
+		node = node->next;
+	}
+	rwlock_runlock(&c->lock);
+	return handle;
 }
 
 void
@@ -52,4 +118,19 @@ skynet_harbor_exit() {
 	if (ctx) {
 		skynet_context_release(ctx);
 	}
+	// 工作线程都已退出，不会再有人查缓存
+	struct name_cache * c = NAMES;
+	NAMES = NULL;
+	if (c) {
+		int i;
+		for (i=0;i<NAME_CACHE_SIZE;i++) {
+			struct name_node * node = c->slot[i];
+			while (node) {
+				struct name_node * next = node->next;
+				skynet_free(node);
+				node = next;
+			}
+		}
+		skynet_free(c);
+	}
 }
@@ -31,6 +31,9 @@ void skynet_harbor_send(struct remote_message *rmsg, uint32_t source, int sessio
 int skynet_harbor_message_isremote(uint32_t handle);
 void skynet_harbor_init(int harbor);
 void skynet_harbor_start(void * ctx);
+// 全局名字缓存：harbor 服务收到 cslave 转来的 N 命令时覆盖，查不到返回 0
+void skynet_harbor_updatename(const char name[GLOBALNAME_LENGTH], uint32_t handle);
+uint32_t skynet_harbor_findname(const char name[GLOBALNAME_LENGTH]);
 void skynet_harbor_exit();
 
 #endif
@@ -7,6 +7,8 @@ struct skynet_config {
 	int thread;              // 工作线程数量
 	int harbor;              // 集群节点 ID (1-255)
 	int profile;             // 是否开启性能分析
+	int accept_budget;       // 监听 socket 每次就绪最多连续 accept 的连接数
+	int max_socket;          // 最大 socket 数量（向上取 2 的幂）
 	const char * daemon;     // 守护进程 PID 文件路径
 	const char * module_path; // C 服务模块搜索路径
 	const char * bootstrap;  // 启动命令（通常是 "snlua bootstrap"）
@@ -171,6 +171,8 @@ main(int argc, char *argv[]) {
 	config.logger = optstring("logger", NULL);	// 日志文件路径，NULL 表示输出到标准输出
 	config.logservice = optstring("logservice", "logger");			// 日志服务名称
 	config.profile = optboolean("profile", 1);	// 是否开启性能分析
+	config.accept_budget = optint("accept_budget", 16);	// 每次监听事件最多连续 accept 的连接数
+	config.max_socket = optint("max_socket", 65536);	// 最大 socket 数量，槽位表按需分段增长
 
     // 6. 启动系统
 	skynet_start(&config);
@@ -280,6 +280,12 @@ skynet_isremote(struct skynet_context * ctx, uint32_t handle, int * harbor) {
 	return ret;
 }
 
+// 直接读队列长度，不经过 skynet_command 的字符串结果
+int
+skynet_mqlen(struct skynet_context * ctx) {
+	return skynet_mq_length(ctx->queue);
+}
+
 static void
 dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	assert(ctx->init);  // 确保服务已初始化
@@ -590,7 +596,7 @@ cmd_monitor(struct skynet_context * context, const char * param) {
 static const char *
 cmd_stat(struct skynet_context * context, const char * param) {
 	if (strcmp(param, "mqlen") == 0) {
-		int len = skynet_mq_length(context->queue);
+		int len = skynet_mqlen(context);
 		sprintf(context->result, "%d", len);
 	} else if (strcmp(param, "endless") == 0) {
 		if (context->endless) {
@@ -804,6 +810,13 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 			return -1;
 		}
 	} else {
+		char name[GLOBALNAME_LENGTH];
+		copy_name(name, addr);
+		des = skynet_harbor_findname(name);
+		if (des != 0) {
+			// 名字已知：本地服务直接投递，远端走 harbor 的句柄路由，都不用 harbor 再查名字
+			return skynet_send(context, source, des, type, session, data, sz);
+		}
 		if ((sz & MESSAGE_TYPE_MASK) != sz) {
 			skynet_error(context, "error: The message to %s is too large", addr);
 			if (type & PTYPE_TAG_DONTCOPY) {
@@ -814,7 +827,7 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 		_filter_args(context, type, &session, (void **)&data, &sz);
 
 		struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
-		copy_name(rmsg->destination.name, addr);
+		memcpy(rmsg->destination.name, name, GLOBALNAME_LENGTH);
 		rmsg->destination.handle = 0;
 		rmsg->message = data;
 		rmsg->sz = sz & MESSAGE_TYPE_MASK;
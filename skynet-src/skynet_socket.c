@@ -14,8 +14,8 @@
 static struct socket_server * SOCKET_SERVER = NULL;
 
 void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create(skynet_now());
+skynet_socket_init(int max_socket) {
+	SOCKET_SERVER = socket_server_create(skynet_now(), max_socket);
 }
 
 void
@@ -34,6 +34,11 @@ skynet_socket_updatetime() {
 	socket_server_updatetime(SOCKET_SERVER, skynet_now());
 }
 
+void
+skynet_socket_accept_budget(int budget) {
+	socket_server_accept_budget(SOCKET_SERVER, budget);
+}
+
 // mainloop thread
 static void
 forward_message(int type, bool padding, struct socket_message * result) {
@@ -75,6 +80,56 @@ forward_message(int type, bool padding, struct socket_message * result) {
 	}
 }
 
+static int
+redirect_push(uint32_t agent, int id, void * data, int sz) {
+	struct skynet_message message;
+	message.source = 0;
+	message.session = id;
+	message.data = data;
+	message.sz = (size_t)sz | ((size_t)PTYPE_CLIENT << MESSAGE_TYPE_SHIFT);
+	return skynet_context_push(agent, &message);
+}
+
+// mainloop thread
+// 分帧数据直接交给 agent：每个包去掉包头后作为一条 PTYPE_CLIENT 消息，session 为 socket id
+// 最后一个包挪到缓冲开头，缓冲本身交给 agent；只有一个包时（最常见）不再分配和拷贝
+static void
+forward_redirect(struct socket_message * result) {
+	uint32_t agent = (uint32_t)result->opaque;
+	int header = socket_server_frame_header(SOCKET_SERVER, result->id);
+	uint8_t * p = (uint8_t *)result->data;
+	int pos = 0;
+	while (header > 0 && pos + header <= result->ud) {
+		int sz = header == 2 ? (p[pos] << 8 | p[pos+1])
+			: (p[pos] << 24 | p[pos+1] << 16 | p[pos+2] << 8 | p[pos+3]);
+		pos += header;
+		if (pos + sz >= result->ud) {
+			memmove(p, p + pos, sz);
+			if (redirect_push(agent, result->id, p, sz)) {
+				break;
+			}
+			return;
+		}
+		void * data = skynet_malloc(sz);
+		memcpy(data, p + pos, sz);
+		pos += sz;
+		if (redirect_push(agent, result->id, data, sz)) {
+			// agent 已经退出，丢弃剩下的包
+			skynet_free(data);
+			break;
+		}
+	}
+	skynet_free(result->data);
+}
+
+// 单独读进来的大包，缓冲原样交给 agent
+static void
+forward_redirect_body(struct socket_message * result) {
+	if (redirect_push((uint32_t)result->opaque, result->id, result->data, result->ud)) {
+		skynet_free(result->data);
+	}
+}
+
 int 
 skynet_socket_poll() {
 	struct socket_server *ss = SOCKET_SERVER;
@@ -107,6 +162,21 @@ skynet_socket_poll() {
 	case SOCKET_WARNING:
 		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
 		break;
+	case SOCKET_UDP_BATCH:
+		forward_message(SKYNET_SOCKET_TYPE_UDP_BATCH, false, &result);
+		break;
+	case SOCKET_WRITABLE:
+		forward_message(SKYNET_SOCKET_TYPE_WRITABLE, false, &result);
+		break;
+	case SOCKET_FRAME:
+		forward_message(SKYNET_SOCKET_TYPE_FRAME, false, &result);
+		break;
+	case SOCKET_REDIRECT:
+		forward_redirect(&result);
+		break;
+	case SOCKET_REDIRECT_BODY:
+		forward_redirect_body(&result);
+		break;
 	default:
 		skynet_error(NULL, "error: Unknown socket message type %d.",type);
 		return -1;
@@ -127,6 +197,16 @@ skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_s
 	return socket_server_send_lowpriority(SOCKET_SERVER, buffer);
 }
 
+int
+skynet_socket_sendbuffer_zerocopy(struct skynet_context *ctx, struct socket_sendbuffer *buffer) {
+	return socket_server_send_zerocopy(SOCKET_SERVER, buffer);
+}
+
+int64_t
+skynet_socket_sendfile(struct skynet_context *ctx, int id, const char *filename, int64_t offset, int64_t sz) {
+	return socket_server_sendfile(SOCKET_SERVER, id, filename, offset, sz);
+}
+
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -175,6 +255,26 @@ skynet_socket_nodelay(struct skynet_context *ctx, int id) {
 	socket_server_nodelay(SOCKET_SERVER, id);
 }
 
+void
+skynet_socket_watermark(struct skynet_context *ctx, int id, int64_t high, int64_t low, int64_t limit, int droplow) {
+	socket_server_watermark(SOCKET_SERVER, id, high, low, limit, droplow);
+}
+
+void
+skynet_socket_frame(struct skynet_context *ctx, int id, int header, int max) {
+	socket_server_frame(SOCKET_SERVER, id, header, max);
+}
+
+void
+skynet_socket_redirect(struct skynet_context *ctx, int id, uint32_t agent) {
+	socket_server_redirect(SOCKET_SERVER, id, agent);
+}
+
+int
+skynet_socket_shm(struct skynet_context *ctx, int id, const char *name, size_t size, const void *greeting, size_t sz) {
+	return socket_server_shm(SOCKET_SERVER, id, name, size, greeting, sz);
+}
+
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
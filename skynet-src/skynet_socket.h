@@ -4,6 +4,8 @@
 #include "socket_info.h"
 #include "socket_buffer.h"
 
+#include <stdint.h>
+
 struct skynet_context;
 
 #define SKYNET_SOCKET_TYPE_DATA 1
@@ -13,6 +15,9 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ERROR 5
 #define SKYNET_SOCKET_TYPE_UDP 6
 #define SKYNET_SOCKET_TYPE_WARNING 7
+#define SKYNET_SOCKET_TYPE_UDP_BATCH 8
+#define SKYNET_SOCKET_TYPE_WRITABLE 9
+#define SKYNET_SOCKET_TYPE_FRAME 10
 
 struct skynet_socket_message {
 	int type;        // 消息类型（数据/连接/关闭等）
@@ -21,14 +26,17 @@ struct skynet_socket_message {
 	char * buffer;   // 数据缓冲区
 };
 
-void skynet_socket_init();
+void skynet_socket_init(int max_socket);
 void skynet_socket_exit();
 void skynet_socket_free();
 int skynet_socket_poll();
 void skynet_socket_updatetime();
+void skynet_socket_accept_budget(int budget);
 
 int skynet_socket_sendbuffer(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
 int skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
+int skynet_socket_sendbuffer_zerocopy(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
+int64_t skynet_socket_sendfile(struct skynet_context *ctx, int id, const char *filename, int64_t offset, int64_t sz);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
@@ -37,6 +45,11 @@ void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
 void skynet_socket_pause(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_watermark(struct skynet_context *ctx, int id, int64_t high, int64_t low, int64_t limit, int droplow);
+void skynet_socket_frame(struct skynet_context *ctx, int id, int header, int max);
+void skynet_socket_redirect(struct skynet_context *ctx, int id, uint32_t agent);
+// 同机进程之间改用共享内存传输，见 socket_server_shm
+int skynet_socket_shm(struct skynet_context *ctx, int id, const char *name, size_t size, const void *greeting, size_t sz);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
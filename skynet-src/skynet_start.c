@@ -293,7 +293,8 @@ skynet_start(struct skynet_config * config) {
 	skynet_mq_init();							// 消息队列系统
 	skynet_module_init(config->module_path);	// C 服务模块加载器
 	skynet_timer_init();     					// 定时器系统
-	skynet_socket_init();    					// 网络子系统
+	skynet_socket_init(config->max_socket);	// 网络子系统
+	skynet_socket_accept_budget(config->accept_budget);
 	skynet_profile_enable(config->profile); 	// 性能分析（可选）
 
     // 4. 创建日志服务（名称固定为 "logger"，供 skynet_error 查找）
@@ -19,6 +19,11 @@ struct socket_info {
 	uint64_t rtime;
 	uint64_t wtime;
 	int64_t wbuffer;
+	int64_t whigh;
+	int64_t wlow;
+	int64_t wlimit;
+	uint64_t wdrop;
+	uint8_t wblocked;
 	uint8_t reading;
 	uint8_t writing;
 	char name[128];
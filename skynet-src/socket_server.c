@@ -1,3 +1,8 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+// for accept4, recvmmsg, sendmmsg and sendfile
+#define _GNU_SOURCE
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -11,10 +16,14 @@
 #include "socket_poll.h"
 #include "atomic.h"
 #include "spinlock.h"
+#include "socket_shm.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -26,10 +35,20 @@
 
 /* ---- 常量定义：与 socket 状态管理与缓冲池容量相关 ---- */
 #define MAX_INFO 128			// 临时字符串缓冲区大小
-// MAX_SOCKET will be 2^MAX_SOCKET_P
-#define MAX_SOCKET_P 16			// 支持的最大 socket 数量（65536）
+// max socket will be 2^socket_p, socket_p in [MIN_SOCKET_P, MAX_SOCKET_P]
+#define DEFAULT_SOCKET_P 16		// 默认最大 socket 数量（65536）
+#define MIN_SOCKET_P 12
+#define MAX_SOCKET_P 24			// 支持的最大 socket 数量上限（16M）
+#define SOCKET_SEGMENT_P 12		// 槽位表按段分配，每段 4096 个 socket
+#define SOCKET_SEGMENT (1<<SOCKET_SEGMENT_P)
+#define MAX_SEGMENT (1<<(MAX_SOCKET_P-SOCKET_SEGMENT_P))
+#define RESERVE_PROBE 64		// reserve_id 连续遇到这么多已占用槽位时扩展新段
 #define MAX_EVENT 64			// 单次 epoll/kqueue 等待的最大事件数
 #define MIN_READ_BUFFER 64		// TCP 读缓冲的最小起始值
+#define FRAME_MAX_DEFAULT (16*1024*1024-1)	// 4 字节包头默认的最大包长
+#define FRAME_PREALLOC (64*1024)	// 大包不按包头声明的长度预分配，先分配这么多，随数据到达倍增
+#define DEFAULT_ACCEPT_BUDGET 16	// 单个监听 socket 每次就绪事件最多连续 accept 的连接数
+#define ZEROCOPY_ORPHAN_DRAIN 8	// 每轮事件循环最多检查这么多个等待 MSG_ZEROCOPY 完成通知的已关闭连接
 #define SOCKET_TYPE_INVALID 0		// 未使用槽位
 #define SOCKET_TYPE_RESERVE 1		// 已被 reserve_id 占用，但尚未 new_fd
 #define SOCKET_TYPE_PLISTEN 2		// 监听 socket，等待 START 命令
@@ -41,13 +60,11 @@
 #define SOCKET_TYPE_PACCEPT 8		// accept 刚创建，尚未反馈给上层
 #define SOCKET_TYPE_BIND 9		// UDP 绑定 socket
 
-#define MAX_SOCKET (1<<MAX_SOCKET_P)
-
 #define PRIORITY_HIGH 0
 #define PRIORITY_LOW 1
 
-#define HASH_ID(id) (((unsigned)id) % MAX_SOCKET)
-#define ID_TAG16(id) ((id>>MAX_SOCKET_P) & 0xffff)
+#define HASH_ID(ss, id) (((unsigned)id) & ((ss)->max_socket - 1))
+#define ID_TAG16(ss, id) ((id>>(ss)->socket_p) & 0xffff)
 
 #define PROTOCOL_TCP 0
 #define PROTOCOL_UDP 1
@@ -58,6 +75,29 @@
 
 #define MAX_UDP_PACKAGE 65535
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+// 使用 recvmmsg/sendmmsg 批量收发 UDP
+#define USE_MMSG
+#endif
+
+#define UDP_BATCH 16		// recvmmsg/sendmmsg 单次最多处理的 datagram 数
+#define UDP_SENDV 64		// sendmmsg 单次最多提交的写缓冲节点数（GSO 时多个节点合并为一个 datagram）
+#define UDP_GSO_SEGMENTS 32	// 单个 GSO datagram 最多包含的分段数
+#define MAX_UDP_PAYLOAD (MAX_UDP_PACKAGE - 8 - 40)	// 扣除 UDP 头与 IPv6 头后 GSO 合并的上限
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+// 大块数据用 MSG_ZEROCOPY 发送，内核直接引用用户内存
+#define USE_ZEROCOPY
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define ZEROCOPY_MIN (16*1024)	// 小于此大小时拷贝比 pin 页面 + 完成通知更便宜，退回普通 write
+#define SENDFILE_CHUNK (1024*1024)	// 非 Linux 平台 sendfile 退化为 pread + write 时每次读取的大小
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -76,6 +116,16 @@ struct write_buffer {
 	char *ptr;                    // 当前写位置
 	size_t sz;                    // 剩余大小
 	bool userobject;              // 是否为用户对象
+	bool zerocopy;                // 以 MSG_ZEROCOPY 发送，发完后等内核完成通知再释放
+	bool sendfile;                // 文件节点（struct write_buffer_file），sz 为文件剩余字节
+	uint32_t zc_id;               // 最后一次引用此缓冲的 MSG_ZEROCOPY 调用序号 + 1，0 表示未被内核引用
+};
+
+/* sendfile 的写缓冲：数据留在文件里，由网络线程用 sendfile 直接送入 socket。 */
+struct write_buffer_file {
+	struct write_buffer buffer;
+	int fd;
+	int64_t offset;
 };
 
 /* UDP 的写缓冲在节点尾部多保存一个目标地址。 */
@@ -90,6 +140,19 @@ struct wb_list {
 	struct write_buffer * tail;
 };
 
+#ifdef USE_ZEROCOPY
+/*
+ * 关闭时仍有 MSG_ZEROCOPY 缓冲未完成的连接：内核可能还在（重）发这些页面，
+ * 所以 fd 不关闭、缓冲不释放，留到完成通知到齐后再一起释放。
+ */
+struct zerocopy_orphan {
+	struct zerocopy_orphan * next;
+	int fd;
+	uint32_t zc_done;
+	struct wb_list pending;
+};
+#endif
+
 struct socket_stat {
 	uint64_t rtime;
 	uint64_t wtime;
@@ -114,6 +177,24 @@ struct socket {
 	bool closing;                  // 是否正在关闭
 	ATOM_INT udpconnecting;        // UDP连接计数
 	int64_t warn_size;             // 警告阈值大小
+	int64_t wb_high;               // 发送队列高水位，0 表示不启用水位通知
+	int64_t wb_low;                // 发送队列低水位，越过高水位后回落到此值以下时通知可写
+	int64_t wb_limit;              // 发送队列硬上限，超过后直接关闭连接，0 表示不限制
+	uint64_t wb_drop;              // 越过高水位后丢弃的低优先级数据字节数
+	bool wb_blocked;               // 已越过高水位，尚未回落到低水位
+	bool wb_droplow;               // 越过高水位后丢弃低优先级数据
+	uint8_t frame_header;          // 分帧模式的包头长度（2/4 字节大端），0 表示不分帧
+	int frame_max;                 // 分帧模式允许的最大包长
+	int frame_size;                // frame_buffer 中尚未凑成完整包的字节数
+	int frame_cap;                 // frame_buffer 的容量
+	char * frame_buffer;           // 未完成的包，下次读到它后面
+	int frame_body;                // 非 0 时 frame_buffer 只含一个大包的包体（redirect 时直接读进去），值为包长
+	uintptr_t redirect;            // 分帧模式下完整的包直接交给它，而不是 opaque；0 表示不转交
+	struct wb_list zc_pending;     // 已发出、等待 MSG_ZEROCOPY 完成通知的缓冲
+	uint32_t zc_seq;               // 下一次 MSG_ZEROCOPY 调用的序号
+	uint32_t zc_done;              // 序号小于此值的 MSG_ZEROCOPY 调用均已完成
+	int8_t zc_state;               // SO_ZEROCOPY：0 未设置，1 已开启，-1 不支持
+	bool udp_gro;                  // 已开启 UDP_GRO：一次 recvmmsg 读到多个 datagram 后才开启
 	union {
 		int size;                  // TCP读缓冲区大小
 		uint8_t udp_address[UDP_ADDRESS_SIZE]; // UDP地址
@@ -122,6 +203,7 @@ struct socket {
 	int dw_offset;                 // 直写偏移量
 	const void * dw_buffer;        // 直写缓冲区
 	size_t dw_size;                // 直写大小
+	struct shm_link * shm;         // 同机共享内存传输，NULL 表示数据走 TCP
 };
 
 /* socket_server：网络线程运行期的核心上下文。 */
@@ -135,11 +217,28 @@ struct socket_server {
 	ATOM_INT alloc_id;             // 原子变量：ID分配器
 	int event_n;                   // 事件数量
 	int event_index;               // 当前事件索引
+	int accept_budget;             // 每个监听事件最多连续 accept 的次数
+	int accept_count;              // 当前监听事件已 accept 的次数
 	struct socket_object_interface soi; // 对象接口回调
 	struct event ev[MAX_EVENT];    // 事件数组
-	struct socket slot[MAX_SOCKET]; // socket池 (65536个槽位)
+	int socket_p;                  // 最大 socket 数量为 2^socket_p
+	int max_socket;                // 槽位总数，HASH_ID 按它取模
+	ATOM_INT nseg;                 // 已分配的段数，段只增不减
+	struct spinlock seg_lock;      // 扩展新段时加锁
+	struct socket invalid_slot;    // 未分配段上的 id 都映射到这里，type 永远为 INVALID
+	ATOM_POINTER slot[MAX_SEGMENT]; // socket池：按段分配，段地址一经分配就不再变化
 	char buffer[MAX_INFO];         // 信息缓冲区
+#ifdef USE_ZEROCOPY
+	struct zerocopy_orphan *zc_orphan; // 已关闭、等待 MSG_ZEROCOPY 完成通知的连接，按关闭顺序排列
+	struct zerocopy_orphan *zc_orphan_tail;
+	int zc_orphan_n;
+#endif
+#ifdef USE_MMSG
+	struct udp_recvbatch *udpbatch; // recvmmsg 接收区，首次读 UDP 时分配
+	bool udp_gso;                  // 内核是否支持 UDP_SEGMENT，发送失败后关闭
+#else
 	uint8_t udpbuffer[MAX_UDP_PACKAGE]; // UDP数据包缓冲区
+#endif
 	fd_set rfds;                   // select用的文件描述符集合
 };
 
@@ -161,6 +260,13 @@ struct request_send_udp {
 	uint8_t address[UDP_ADDRESS_SIZE];
 };
 
+struct request_sendfile {
+	int id;
+	int fd;
+	int64_t offset;
+	int64_t sz;
+};
+
 struct request_setudp {
 	int id;
 	uint8_t address[UDP_ADDRESS_SIZE];
@@ -210,6 +316,32 @@ struct request_dial_udp {
 	uint8_t address[UDP_ADDRESS_SIZE];
 };
 
+struct request_watermark {
+	int id;
+	int droplow;
+	int64_t high;
+	int64_t low;
+	int64_t limit;
+};
+
+struct request_frame {
+	int id;
+	int header;
+	int max;
+};
+
+struct request_redirect {
+	int id;
+	uintptr_t opaque;
+};
+
+struct request_shm {
+	int id;
+	struct shm_link *link;
+	void *greeting;
+	size_t sz;
+};
+
 /*
 	The first byte is TYPE
 	R Resume socket
@@ -222,11 +354,17 @@ struct request_dial_udp {
 	W Enable write
 	D Send package (high)
 	P Send package (low)
+	Z Send package (high, MSG_ZEROCOPY)
+	F Send file
 	A Send UDP package
 	C set udp address
 	N client dial to UDP host port
 	T Set opt
 	U Create UDP socket
+	M Set send buffer watermark
+	H Set packet framing (length header)
+	G Redirect framed packets
+	Y Switch to shared memory transport
  */
 
 struct request_package {
@@ -236,6 +374,7 @@ struct request_package {
 		struct request_open open;
 		struct request_send send;
 		struct request_send_udp send_udp;
+		struct request_sendfile sendfile;
 		struct request_close close;
 		struct request_listen listen;
 		struct request_bind bind;
@@ -244,6 +383,10 @@ struct request_package {
 		struct request_udp udp;
 		struct request_setudp set_udp;
 		struct request_dial_udp dial_udp;
+		struct request_watermark watermark;
+		struct request_frame frame;
+		struct request_redirect redirect;
+		struct request_shm shm;
 	} u;
 	uint8_t dummy[256];
 };
@@ -254,6 +397,17 @@ union sockaddr_all {
 	struct sockaddr_in6 v6;
 };
 
+#ifdef USE_MMSG
+/* recvmmsg 的接收区：每个 datagram 一块 64K 缓冲（开启 GRO 后一块可能含多个分段）。 */
+struct udp_recvbatch {
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all sa[UDP_BATCH];
+	char control[UDP_BATCH][CMSG_SPACE(sizeof(int))];
+	uint8_t buffer[UDP_BATCH][MAX_UDP_PACKAGE];
+};
+#endif
+
 struct send_object {
 	const void * buffer;
 	size_t sz;
@@ -351,7 +505,9 @@ send_object_init_from_sendbuffer(struct socket_server *ss, struct send_object *s
 
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
-	if (wb->userobject) {
+	if (wb->sendfile) {
+		close(((struct write_buffer_file *)wb)->fd);
+	} else if (wb->userobject) {
 		ss->soi.free((void *)wb->buffer);
 	} else {
 		FREE((void *)wb->buffer);
@@ -365,22 +521,101 @@ socket_keepalive(int fd) {
 	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepalive , sizeof(keepalive));
 }
 
+static inline void
+clear_wb_list(struct wb_list *list) {
+	list->head = NULL;
+	list->tail = NULL;
+}
+
+static void
+init_slot(struct socket *s) {
+	ATOM_INIT(&s->type, SOCKET_TYPE_INVALID);
+	s->id = -1;
+	s->protocol = PROTOCOL_UNKNOWN;
+	clear_wb_list(&s->high);
+	clear_wb_list(&s->low);
+	clear_wb_list(&s->zc_pending);
+	s->frame_buffer = NULL;
+	s->shm = NULL;
+	spinlock_init(&s->dw_lock);
+}
+
+/*
+ * 按槽位下标取 socket。
+ *   段地址一经发布就不再改变，所以其它线程可以不加锁读取；
+ *   尚未分配的段返回 invalid_slot，调用者照常用 socket_invalid 判断即可。
+ */
+static inline struct socket *
+socket_at(struct socket_server *ss, unsigned index) {
+	struct socket *seg = (struct socket *)ATOM_LOAD(&ss->slot[index >> SOCKET_SEGMENT_P]);
+	if (seg == NULL)
+		return &ss->invalid_slot;
+	return &seg[index & (SOCKET_SEGMENT - 1)];
+}
+
+static inline struct socket *
+get_socket(struct socket_server *ss, int id) {
+	return socket_at(ss, HASH_ID(ss, id));
+}
+
+// 分配第 n 段，返回 false 表示已到 max_socket 上限
+static bool
+expand_slot(struct socket_server *ss, int n) {
+	if (n >= (ss->max_socket >> SOCKET_SEGMENT_P))
+		return false;
+	spinlock_lock(&ss->seg_lock);
+	if (ATOM_LOAD(&ss->nseg) == n) {
+		struct socket *seg = MALLOC(SOCKET_SEGMENT * sizeof(struct socket));
+		int i;
+		for (i=0;i<SOCKET_SEGMENT;i++) {
+			init_slot(&seg[i]);
+		}
+		// 先发布段地址，再增加段数
+		ATOM_STORE(&ss->slot[n], (uintptr_t)seg);
+		ATOM_STORE(&ss->nseg, n + 1);
+	}
+	spinlock_unlock(&ss->seg_lock);
+	return true;
+}
+
+// 把 alloc_id 挪到 id 之后，下一次分配得到 next
+static inline void
+skip_id(struct socket_server *ss, int id, unsigned next) {
+	ATOM_CAS(&ss->alloc_id, id, (int)((next - 1) & 0x7fffffff));
+}
+
 /* 
  * reserve_id：
  *   - 为新 socket 分配唯一 id，并占用槽位。
  *   - 利用自增计数和取模避免频繁遍历空槽。
  *   - 引入 CAS 防止多线程竞争造成重复占用。
+ *   - 槽位只在已分配的段里找：走到段尾时回绕到 0 号槽位（id 的 tag 加一），
+ *     已分配的段太满（连续遇到 RESERVE_PROBE 个占用的槽位）时才扩展新段。
  */
 static int
 reserve_id(struct socket_server *ss) {
 	int i;
-	for (i=0;i<MAX_SOCKET;i++) {
+	int busy = 0;
+	for (i=0;i<ss->max_socket;i++) {
 		int id = ATOM_FINC(&(ss->alloc_id))+1;
 		if (id < 0) {
 			id = ATOM_FAND(&(ss->alloc_id), 0x7fffffff) & 0x7fffffff;
 		}
+		unsigned hash = HASH_ID(ss, id);
+		int nseg = ATOM_LOAD(&ss->nseg);
+		if ((hash >> SOCKET_SEGMENT_P) >= nseg) {
+			unsigned tag = (unsigned)id & ~(unsigned)(ss->max_socket - 1);
+			if (busy >= RESERVE_PROBE && expand_slot(ss, nseg)) {
+				// 直接跳到新段的开头
+				skip_id(ss, id, tag | (unsigned)nseg << SOCKET_SEGMENT_P);
+			} else {
+				// 回绕到 0 号槽位
+				skip_id(ss, id, tag + ss->max_socket);
+			}
+			continue;
+		}
 		// 使用hash查找空闲槽位
-		struct socket *s = &ss->slot[HASH_ID(id)];
+		struct socket *s = socket_at(ss, hash);
 		int type_invalid = ATOM_LOAD(&s->type);
 		if (type_invalid == SOCKET_TYPE_INVALID) {
 			if (ATOM_CAS(&s->type, type_invalid, SOCKET_TYPE_RESERVE)) {
@@ -395,27 +630,30 @@ reserve_id(struct socket_server *ss) {
 				// retry
 				--i;
 			}
+		} else {
+			++busy;
 		}
 	}
 	return -1;
 }
 
-static inline void
-clear_wb_list(struct wb_list *list) {
-	list->head = NULL;
-	list->tail = NULL;
-}
-
 /*
  * 初始化网络线程：
  *   1. 创建 epoll/kqueue 实例与控制管道。
  *   2. 预留一个额外 fd，用于处理 EMFILE 时的“解锁”策略。
- *   3. 重置所有槽位，等待 reserve_id/new_fd 使用。
+ *   3. 分配第一段槽位，其余的段由 reserve_id 按需分配。
+ *   max_socket 向上取 2 的幂，限制在 [2^MIN_SOCKET_P, 2^MAX_SOCKET_P]，0 表示默认值。
  */
 struct socket_server *
-socket_server_create(uint64_t time) {
+socket_server_create(uint64_t time, int max_socket) {
 	int i;
 	int fd[2];
+	int socket_p = DEFAULT_SOCKET_P;
+	if (max_socket > 0) {
+		socket_p = MIN_SOCKET_P;
+		while (socket_p < MAX_SOCKET_P && (1 << socket_p) < max_socket)
+			++socket_p;
+	}
 	poll_fd efd = sp_create();
 	if (sp_invalid(efd)) {
 		skynet_error(NULL, "socket-server error: create event pool failed.");
@@ -443,16 +681,33 @@ socket_server_create(uint64_t time) {
 	ss->checkctrl = 1;
 	ss->reserve_fd = dup(1);	// reserve an extra fd for EMFILE
 
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
-		ATOM_INIT(&s->type, SOCKET_TYPE_INVALID);
-		clear_wb_list(&s->high);
-		clear_wb_list(&s->low);
-		spinlock_init(&s->dw_lock);
+	ss->socket_p = socket_p;
+	ss->max_socket = 1 << socket_p;
+	ATOM_INIT(&ss->nseg, 0);
+	spinlock_init(&ss->seg_lock);
+	init_slot(&ss->invalid_slot);
+	for (i=0;i<MAX_SEGMENT;i++) {
+		ATOM_INIT(&ss->slot[i], (uintptr_t)NULL);
 	}
+	expand_slot(ss, 0);
 	ATOM_INIT(&ss->alloc_id , 0);
 	ss->event_n = 0;
 	ss->event_index = 0;
+	ss->accept_budget = DEFAULT_ACCEPT_BUDGET;
+	ss->accept_count = 0;
+#ifdef USE_MMSG
+	ss->udpbatch = NULL;
+#ifdef UDP_SEGMENT
+	ss->udp_gso = true;
+#else
+	ss->udp_gso = false;
+#endif
+#endif
+#ifdef USE_ZEROCOPY
+	ss->zc_orphan = NULL;
+	ss->zc_orphan_tail = NULL;
+	ss->zc_orphan_n = 0;
+#endif
 	memset(&ss->soi, 0, sizeof(ss->soi));
 	FD_ZERO(&ss->rfds);
 	assert(ss->recvctrl_fd < FD_SETSIZE);
@@ -513,6 +768,10 @@ clone_buffer(struct socket_sendbuffer *buf, size_t *sz) {
 	return NULL;
 }
 
+#ifdef USE_ZEROCOPY
+static bool zerocopy_orphan(struct socket_server *ss, struct socket *s);
+#endif
+
 static void
 force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	result->id = s->id;
@@ -526,14 +785,28 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	assert(type != SOCKET_TYPE_RESERVE);
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
+	FREE(s->frame_buffer);
+	s->frame_buffer = NULL;
+	s->frame_size = 0;
+	s->frame_cap = 0;
+	s->frame_body = 0;
 	sp_del(ss->event_fd, s->fd);
 	socket_lock(l);
-	if (type != SOCKET_TYPE_BIND) {
+	bool orphan = false;
+#ifdef USE_ZEROCOPY
+	// 内核可能仍引用 zc_pending 里的页面，fd 与缓冲交给 zc_orphan，完成后再释放
+	orphan = zerocopy_orphan(ss, s);
+#endif
+	if (type != SOCKET_TYPE_BIND && !orphan) {
 		if (close(s->fd) < 0) {
 			perror("close socket:");
 		}
 	}
 	ATOM_STORE(&s->type, SOCKET_TYPE_INVALID);
+	if (s->shm) {
+		shm_release(s->shm);
+		s->shm = NULL;
+	}
 	if (s->dw_buffer) {
 		struct socket_sendbuffer tmp;
 		tmp.buffer = s->dw_buffer;
@@ -548,22 +821,41 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 
 void
 socket_server_release(struct socket_server *ss) {
-	int i;
+	int i,j;
 	struct socket_message dummy;
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
-		struct socket_lock l;
-		socket_lock_init(s, &l);
-		if (ATOM_LOAD(&s->type) != SOCKET_TYPE_RESERVE) {
-			force_close(ss, s, &l, &dummy);
+	int nseg = ATOM_LOAD(&ss->nseg);
+	for (i=0;i<nseg;i++) {
+		struct socket *seg = (struct socket *)ATOM_LOAD(&ss->slot[i]);
+		for (j=0;j<SOCKET_SEGMENT;j++) {
+			struct socket *s = &seg[j];
+			struct socket_lock l;
+			socket_lock_init(s, &l);
+			if (ATOM_LOAD(&s->type) != SOCKET_TYPE_RESERVE) {
+				force_close(ss, s, &l, &dummy);
+			}
+			spinlock_destroy(&s->dw_lock);
 		}
-		spinlock_destroy(&s->dw_lock);
+		FREE(seg);
 	}
+	spinlock_destroy(&ss->invalid_slot.dw_lock);
+	spinlock_destroy(&ss->seg_lock);
 	close(ss->sendctrl_fd);
 	close(ss->recvctrl_fd);
 	sp_release(ss->event_fd);
 	if (ss->reserve_fd >= 0)
 		close(ss->reserve_fd);
+#ifdef USE_ZEROCOPY
+	while (ss->zc_orphan) {
+		struct zerocopy_orphan *o = ss->zc_orphan;
+		ss->zc_orphan = o->next;
+		close(o->fd);
+		free_wb_list(ss, &o->pending);
+		FREE(o);
+	}
+#endif
+#ifdef USE_MMSG
+	FREE(ss->udpbatch);
+#endif
 	FREE(ss);
 }
 
@@ -573,11 +865,17 @@ check_wb_list(struct wb_list *s) {
 	assert(s->tail == NULL);
 }
 
+// 共享内存 socket 不读数据时（暂停或正在关闭）也要收门铃，对端读走数据后等待的写才能继续；对端关闭后就不用了
+static inline bool
+watch_read(struct socket *s) {
+	return s->reading || (s->shm && !s->shm->eof);
+}
+
 static inline int
 enable_write(struct socket_server *ss, struct socket *s, bool enable) {
 	if (s->writing != enable) {
 		s->writing = enable;
-		return sp_enable(ss->event_fd, s->fd, s, s->reading, enable);
+		return sp_enable(ss->event_fd, s->fd, s, watch_read(s), enable);
 	}
 	return 0;
 }
@@ -586,7 +884,7 @@ static inline int
 enable_read(struct socket_server *ss, struct socket *s, bool enable) {
 	if (s->reading != enable) {
 		s->reading = enable;
-		return sp_enable(ss->event_fd, s->fd, s, enable, s->writing);
+		return sp_enable(ss->event_fd, s->fd, s, watch_read(s), s->writing);
 	}
 	return 0;
 }
@@ -599,7 +897,7 @@ enable_read(struct socket_server *ss, struct socket *s, bool enable) {
  */
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool reading) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	assert(ATOM_LOAD(&s->type) == SOCKET_TYPE_RESERVE);
 
 	if (sp_add(ss->event_fd, fd, s)) {
@@ -612,16 +910,35 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->reading = true;
 	s->writing = false;
 	s->closing = false;
-	ATOM_INIT(&s->sending , ID_TAG16(id) << 16 | 0);
+	ATOM_INIT(&s->sending , ID_TAG16(ss, id) << 16 | 0);
 	s->protocol = protocol;
 	s->p.size = MIN_READ_BUFFER;
 	s->opaque = opaque;
 	s->wb_size = 0;
 	s->warn_size = 0;
+	s->wb_high = 0;
+	s->wb_low = 0;
+	s->wb_limit = 0;
+	s->wb_drop = 0;
+	s->wb_blocked = false;
+	s->wb_droplow = false;
+	s->frame_header = 0;
+	s->frame_max = 0;
+	s->redirect = 0;
+	assert(s->frame_buffer == NULL);
+	s->frame_size = 0;
+	s->frame_cap = 0;
+	s->frame_body = 0;
 	check_wb_list(&s->high);
 	check_wb_list(&s->low);
+	check_wb_list(&s->zc_pending);
+	s->zc_seq = 0;
+	s->zc_done = 0;
+	s->zc_state = 0;
+	s->udp_gro = false;
 	s->dw_buffer = NULL;
 	s->dw_size = 0;
+	assert(s->shm == NULL);
 	memset(&s->stat, 0, sizeof(s->stat));
 	if (enable_read(ss, s, reading)) {
 		ATOM_STORE(&s->type , SOCKET_TYPE_INVALID);
@@ -725,7 +1042,7 @@ _failed:
 		close(sock);
 	freeaddrinfo( ai_list );
 _failed_getaddrinfo:
-	ATOM_STORE(&ss->slot[HASH_ID(id)].type, SOCKET_TYPE_INVALID);
+	ATOM_STORE(&get_socket(ss, id)->type, SOCKET_TYPE_INVALID);
 	return SOCKET_ERR;
 }
 
@@ -738,6 +1055,36 @@ report_error(struct socket *s, struct socket_message *result, const char *err) {
 	return SOCKET_ERR;
 }
 
+static int
+report_writable(struct socket *s, struct socket_message *result, bool writable) {
+	s->wb_blocked = !writable;
+	result->id = s->id;
+	result->ud = writable;
+	result->opaque = s->opaque;
+	result->data = NULL;
+	return SOCKET_WRITABLE;
+}
+
+/*
+ * 发送队列增长后检查水位：
+ *   - 超过 wb_limit 直接关闭连接并报告错误（慢连接不能无限占用内存）。
+ *   - 首次越过 wb_high 时通知上层暂停写入。
+ */
+static int
+check_watermark(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	if (s->wb_limit > 0 && s->wb_size > s->wb_limit) {
+		struct socket_lock l;
+		socket_lock_init(s, &l);
+		force_close(ss, s, &l, result);
+		result->data = "send buffer overflow";
+		return SOCKET_ERR;
+	}
+	if (s->wb_high > 0 && !s->wb_blocked && s->wb_size >= s->wb_high) {
+		return report_writable(s, result, false);
+	}
+	return -1;
+}
+
 static int
 close_write(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	if (s->closing) {
@@ -761,32 +1108,225 @@ close_write(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	}
 }
 
+static inline ssize_t
+socket_write(struct socket *s, const void *buffer, size_t sz) {
+	if (s->shm)
+		return shm_write(s->shm, s->fd, buffer, sz);
+	return write(s->fd, buffer, sz);
+}
+
+static ssize_t
+sendfile_buffer(struct socket *s, struct write_buffer_file *f) {
+#ifdef __linux__
+	if (s->shm == NULL) {
+		off_t offset = f->offset;
+		ssize_t n = sendfile(s->fd, f->fd, &offset, f->buffer.sz);
+		if (n > 0)
+			f->offset = offset;
+		return n;
+	}
+#endif
+	size_t sz = f->buffer.sz < SENDFILE_CHUNK ? f->buffer.sz : SENDFILE_CHUNK;
+	char * tmp = MALLOC(sz);
+	ssize_t n = pread(f->fd, tmp, sz, f->offset);
+	if (n <= 0) {
+		// treat read error as eof, the socket is still writable.
+		FREE(tmp);
+		return 0;
+	}
+	n = socket_write(s, tmp, n);
+	FREE(tmp);
+	if (n > 0)
+		f->offset += n;
+	return n;
+}
+
+static ssize_t
+write_buffer_send(struct socket *s, struct write_buffer *wb) {
+	if (wb->sendfile) {
+		return sendfile_buffer(s, (struct write_buffer_file *)wb);
+	}
+#ifdef USE_ZEROCOPY
+	if (wb->zerocopy && s->shm == NULL) {
+		ssize_t n = send(s->fd, wb->ptr, wb->sz, MSG_ZEROCOPY);
+		if (n >= 0) {
+			wb->zc_id = ++s->zc_seq;
+			return n;
+		}
+		if (errno != ENOBUFS)
+			return n;
+		// optmem limit reached, send the rest by copy.
+		wb->zerocopy = false;
+	}
+#endif
+	return socket_write(s, wb->ptr, wb->sz);
+}
+
+#ifdef USE_ZEROCOPY
+
+/*
+ * 读取 fd 错误队列中的 MSG_ZEROCOPY 完成通知，释放 list 中内核已不再引用的缓冲。
+ * TCP 的完成通知按序到达，[ee_info, ee_data] 为本次完成的调用序号区间。
+ * 返回读到的通知数量。
+ */
+static int
+zerocopy_drain(struct socket_server *ss, int fd, uint32_t *zc_done, struct wb_list *list) {
+	int n = 0;
+	for (;;) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+			break;
+		struct cmsghdr *cm;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if ((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR)
+				|| (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+				struct sock_extended_err ee;
+				memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+				if (ee.ee_errno == 0 && ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+					uint32_t done = ee.ee_data + 1;
+					if ((int32_t)(done - *zc_done) > 0)
+						*zc_done = done;
+					++n;
+				}
+			}
+		}
+	}
+	while (list->head && (int32_t)(*zc_done - list->head->zc_id) >= 0) {
+		struct write_buffer *tmp = list->head;
+		list->head = tmp->next;
+		write_buffer_free(ss, tmp);
+	}
+	if (list->head == NULL)
+		list->tail = NULL;
+	return n;
+}
+
+static inline int
+zerocopy_complete(struct socket_server *ss, struct socket *s) {
+	return zerocopy_drain(ss, s->fd, &s->zc_done, &s->zc_pending);
+}
+
+/*
+ * force_close 时调用（持有 dw_lock）：先收一次完成通知，仍有未完成的缓冲时
+ * 把 fd 与 zc_pending 挂到 ss->zc_orphan，返回 true，调用者不再关闭 fd。
+ * shutdown 代替 close 把连接关掉，已排队的数据照常发完，完成通知随后到达。
+ */
+static inline void
+zerocopy_orphan_push(struct socket_server *ss, struct zerocopy_orphan *o) {
+	o->next = NULL;
+	if (ss->zc_orphan_tail) {
+		ss->zc_orphan_tail->next = o;
+	} else {
+		ss->zc_orphan = o;
+	}
+	ss->zc_orphan_tail = o;
+}
+
+static bool
+zerocopy_orphan(struct socket_server *ss, struct socket *s) {
+	if (s->zc_pending.head)
+		zerocopy_complete(ss, s);
+	if (s->zc_pending.head == NULL)
+		return false;
+	struct zerocopy_orphan *o = MALLOC(sizeof(*o));
+	o->fd = s->fd;
+	o->zc_done = s->zc_done;
+	o->pending = s->zc_pending;
+	clear_wb_list(&s->zc_pending);
+	shutdown(o->fd, SHUT_RDWR);
+	zerocopy_orphan_push(ss, o);
+	++ss->zc_orphan_n;
+	return true;
+}
+
+/*
+ * 网络线程每次等待事件前调用：从队头起最多检查 ZEROCOPY_ORPHAN_DRAIN 个 zc_orphan ，
+ * 收齐完成通知的释放，其余移到队尾下次再看。每个要一次 recvmsg ，孤儿很多时不让它们占满一轮循环。
+ */
+static void
+zerocopy_orphan_drain(struct socket_server *ss) {
+	int n = ss->zc_orphan_n < ZEROCOPY_ORPHAN_DRAIN ? ss->zc_orphan_n : ZEROCOPY_ORPHAN_DRAIN;
+	while (n-- > 0) {
+		struct zerocopy_orphan *o = ss->zc_orphan;
+		ss->zc_orphan = o->next;
+		if (ss->zc_orphan == NULL)
+			ss->zc_orphan_tail = NULL;
+		zerocopy_drain(ss, o->fd, &o->zc_done, &o->pending);
+		if (o->pending.head) {
+			zerocopy_orphan_push(ss, o);
+		} else {
+			--ss->zc_orphan_n;
+			close(o->fd);
+			FREE(o);
+		}
+	}
+}
+
+#endif
+
+/* 写完的缓冲：若曾被 MSG_ZEROCOPY 引用，挂到 zc_pending 等待完成通知，否则直接释放。 */
+static inline void
+write_buffer_done(struct socket_server *ss, struct socket *s, struct write_buffer *wb) {
+	if (wb->zc_id == 0) {
+		write_buffer_free(ss, wb);
+		return;
+	}
+	struct wb_list *list = &s->zc_pending;
+	wb->next = NULL;
+	if (list->head == NULL) {
+		list->head = list->tail = wb;
+	} else {
+		list->tail->next = wb;
+		list->tail = wb;
+	}
+}
+
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
 	while (list->head) {
 		struct write_buffer * tmp = list->head;
 		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
+			ssize_t sz = write_buffer_send(s, tmp);
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
 					continue;
 				case AGAIN_WOULDBLOCK:
+					if (s->shm) {
+						// 共享内存的环满了：TCP 总是可写，不能等 EPOLLOUT ，等对端读走数据后的门铃
+						enable_write(ss, s, false);
+					}
 					return -1;
 				}
 				return close_write(ss, s, l, result);
 			}
 			stat_write(ss,s,(int)sz);
-			s->wb_size -= sz;
+			if (tmp->sendfile) {
+				if (sz == 0) {
+					// the file is shorter than expected
+					break;
+				}
+			} else {
+				s->wb_size -= sz;
+			}
 			if (sz != tmp->sz) {
-				tmp->ptr += sz;
+				if (!tmp->sendfile)
+					tmp->ptr += sz;
 				tmp->sz -= sz;
+				if (s->shm && !tmp->sendfile) {
+					// 同上，没写完说明环满了
+					enable_write(ss, s, false);
+				}
 				return -1;
 			}
 			break;
 		}
 		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		write_buffer_done(ss, s, tmp);
 	}
 	list->tail = NULL;
 
@@ -826,6 +1366,137 @@ drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struc
 	write_buffer_free(ss,tmp);
 }
 
+#ifdef USE_MMSG
+
+static inline int
+udp_address_equal(const uint8_t a[UDP_ADDRESS_SIZE], const uint8_t b[UDP_ADDRESS_SIZE]) {
+	int sz = (a[0] == PROTOCOL_UDP) ? 1+2+4 : 1+2+16;
+	return memcmp(a, b, sz) == 0;
+}
+
+/*
+ * sendmmsg 版本：一次系统调用提交写队列头部的多个 datagram。
+ *   - 支持 UDP_SEGMENT (GSO) 时，把发往同一地址、大小相同的连续 datagram
+ *     （最后一个可以更小）合并成一个 msghdr，由内核负责切分。
+ *   - sendmmsg 只发送了一部分时，剩余的留在队列里下一轮重试；
+ *     一个 msghdr 只发出了一部分分段时，按 msg_len 只释放已发出的分段。
+ *   - 合并后的 msghdr 发送失败时，本轮改为每个 msghdr 一个 datagram 重试，
+ *     不会因为一个分段出错而丢掉同组的其它 datagram。
+ */
+static int
+send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_SENDV];
+	union sockaddr_all sa[UDP_BATCH];
+	char control[UDP_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+	int count[UDP_BATCH];
+	bool nogso = false;
+	while (list->head) {
+		struct write_buffer * tmp = list->head;
+		int n = 0;
+		int niov = 0;
+		while (tmp && n < UDP_BATCH && niov < UDP_SENDV) {
+			struct write_buffer_udp * udp = (struct write_buffer_udp *)tmp;
+			socklen_t sasz = udp_socket_address(s, udp->udp_address, &sa[n]);
+			if (sasz == 0)
+				break;
+			struct msghdr *h = &msg[n].msg_hdr;
+			memset(&msg[n], 0, sizeof(msg[n]));
+			h->msg_name = &sa[n];
+			h->msg_namelen = sasz;
+			h->msg_iov = &iov[niov];
+			size_t segment = tmp->sz;
+			size_t last = segment;
+			size_t total = 0;
+			int k = 0;
+			for (;;) {
+				iov[niov].iov_base = tmp->ptr;
+				iov[niov].iov_len = tmp->sz;
+				++niov;
+				++k;
+				total += tmp->sz;
+				last = tmp->sz;
+				tmp = tmp->next;
+				if (!ss->udp_gso || nogso || tmp == NULL || niov >= UDP_SENDV || k >= UDP_GSO_SEGMENTS
+					|| last != segment || segment == 0
+					|| tmp->sz == 0 || tmp->sz > segment || total + tmp->sz > MAX_UDP_PAYLOAD
+					|| !udp_address_equal(((struct write_buffer_udp *)tmp)->udp_address, udp->udp_address))
+					break;
+			}
+			h->msg_iovlen = k;
+#ifdef UDP_SEGMENT
+			if (k > 1) {
+				uint16_t gso = (uint16_t)segment;
+				h->msg_control = control[n];
+				h->msg_controllen = sizeof(control[n]);
+				struct cmsghdr *cm = CMSG_FIRSTHDR(h);
+				cm->cmsg_level = SOL_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				memcpy(CMSG_DATA(cm), &gso, sizeof(gso));
+			}
+#endif
+			count[n] = k;
+			++n;
+		}
+		if (n == 0) {
+			skynet_error(NULL, "socket-server : udp (%d) error: type mismatch.", s->id);
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int sent = sendmmsg(s->fd, msg, n, 0);
+		if (sent < 0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			case EIO:
+			case EINVAL:
+			case ENOPROTOOPT:
+				if (count[0] > 1) {
+					// kernel or nic doesn't support UDP GSO, fallback to one datagram per msghdr.
+					skynet_error(NULL, "socket-server : udp (%d) disable gso : %s.", s->id, strerror(errno));
+					ss->udp_gso = false;
+					continue;
+				}
+				break;
+			default:
+				if (count[0] > 1) {
+					// retry the group one datagram per msghdr, so only the bad one is dropped.
+					nogso = true;
+					continue;
+				}
+				break;
+			}
+			skynet_error(NULL, "socket-server : udp (%d) sendmmsg error %s.",s->id, strerror(errno));
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int i;
+		for (i=0;i<sent;i++) {
+			size_t len = msg[i].msg_len;
+			int k;
+			for (k=0;k<count[i];k++) {
+				tmp = list->head;
+				if (tmp->sz > len)
+					break;	// the rest of this msghdr is not sent, retry it
+				len -= tmp->sz;
+				stat_write(ss,s,tmp->sz);
+				s->wb_size -= tmp->sz;
+				list->head = tmp->next;
+				write_buffer_free(ss,tmp);
+			}
+			if (k < count[i])
+				break;
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+}
+
+#else
+
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
@@ -859,6 +1530,8 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 	return -1;
 }
 
+#endif
+
 static int
 send_list(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
 	if (s->protocol == PROTOCOL_TCP) {
@@ -957,6 +1630,10 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 
 		if(s->warn_size > 0){
 			s->warn_size = 0;
+			if (s->wb_blocked) {
+				// 由 send_buffer 报告可写，它已经说明队列清空了
+				return -1;
+			}
 			result->opaque = s->opaque;
 			result->id = s->id;
 			result->ud = 0;
@@ -968,15 +1645,17 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 	return -1;
 }
 
-static int
-send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
-	if (!socket_trylock(l))
-		return -1;	// blocked by direct write, send later.
+/* 把工作线程直写剩下的部分（s->dw_*）放到 high 队列最前面，调用者持有 dw_lock。 */
+static void
+take_direct_write(struct socket_server *ss, struct socket *s) {
 	if (s->dw_buffer) {
 		// add direct write buffer before high.head
 		struct write_buffer * buf = MALLOC(sizeof(*buf));
 		struct send_object so;
 		buf->userobject = send_object_init(ss, &so, (void *)s->dw_buffer, s->dw_size);
+		buf->zerocopy = false;
+		buf->sendfile = false;
+		buf->zc_id = 0;
 		buf->ptr = (char*)so.buffer+s->dw_offset;
 		buf->sz = so.sz - s->dw_offset;
 		buf->buffer = (void *)s->dw_buffer;
@@ -990,8 +1669,19 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		}
 		s->dw_buffer = NULL;
 	}
+}
+
+static int
+send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+	if (!socket_trylock(l))
+		return -1;	// blocked by direct write, send later.
+	take_direct_write(ss, s);
 	int r = send_buffer_(ss,s,l,result);
 	socket_unlock(l);
+	if (r == -1 && s->wb_blocked && s->wb_size <= s->wb_low
+		&& ATOM_LOAD(&s->type) != SOCKET_TYPE_INVALID) {
+		return report_writable(s, result, true);
+	}
 
 	return r;
 }
@@ -1001,6 +1691,9 @@ append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_s
 	struct write_buffer * buf = MALLOC(size);
 	struct send_object so;
 	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
+	buf->zerocopy = false;
+	buf->sendfile = false;
+	buf->zc_id = 0;
 	buf->ptr = (char*)so.buffer;
 	buf->sz = so.sz;
 	buf->buffer = request->buffer;
@@ -1039,13 +1732,19 @@ append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_
 static int
 trigger_write(struct socket_server *ss, struct request_send * request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (socket_invalid(s, id))
 		return -1;
+	// 直写剩下的部分入队后与 send_socket 一样检查水位
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	take_direct_write(ss, s);
+	socket_unlock(&l);
 	if (enable_write(ss, s, true)) {
 		return report_error(s, result, "enable write failed");
 	}
-	return -1;
+	return check_watermark(ss, s, result);
 }
 
 /*
@@ -1058,7 +1757,7 @@ trigger_write(struct socket_server *ss, struct request_send * request, struct so
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	struct send_object so;
 	send_object_init(ss, &so, request->buffer, request->sz);
 	uint8_t type = ATOM_LOAD(&s->type);
@@ -1074,6 +1773,12 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 		so.free_func((void *)request->buffer);
 		return -1;
 	}
+	if (priority == PRIORITY_LOW && s->wb_droplow && s->wb_blocked) {
+		// 越过高水位后丢弃低优先级数据
+		s->wb_drop += so.sz;
+		so.free_func((void *)request->buffer);
+		return -1;
+	}
 	if (send_buffer_empty(s)) {
 		if (s->protocol == PROTOCOL_TCP) {
 			append_sendbuffer(ss, s, request);	// add to high priority list, even priority == PRIORITY_LOW
@@ -1116,6 +1821,9 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 	}
+	int r = check_watermark(ss, s, result);
+	if (r != -1)
+		return r;
 	if (s->wb_size >= WARNING_SIZE && s->wb_size >= s->warn_size) {
 		s->warn_size = s->warn_size == 0 ? WARNING_SIZE *2 : s->warn_size*2;
 		result->opaque = s->opaque;
@@ -1127,13 +1835,85 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 	return -1;
 }
 
-static int
-listen_socket(struct socket_server *ss, struct request_listen * request, struct socket_message *result) {
-	int id = request->id;
-	int listen_fd = request->fd;
-	struct socket *s = new_fd(ss, id, listen_fd, PROTOCOL_TCP, request->opaque, false);
-	if (s == NULL) {
-		goto _failed;
+static inline int
+zerocopy_enable(struct socket *s) {
+#ifdef USE_ZEROCOPY
+	if (s->zc_state == 0) {
+		int enable = 1;
+		s->zc_state = (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0) ? 1 : -1;
+	}
+	return s->zc_state > 0;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * 'Z' 命令：与高优先级发送相同，但新追加的大块缓冲标记为 MSG_ZEROCOPY。
+ * 不支持 SO_ZEROCOPY 的内核（或 UDP）退回普通发送。
+ */
+static int
+send_socket_zerocopy(struct socket_server *ss, struct request_send * request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = get_socket(ss, id);
+	struct write_buffer * tail = s->high.tail;
+	int r = send_socket(ss, request, result, PRIORITY_HIGH, NULL);
+	if (s->id == id && s->protocol == PROTOCOL_TCP && s->high.tail != tail && s->high.tail) {
+		struct write_buffer * buf = s->high.tail;
+		if (!buf->userobject && buf->sz >= ZEROCOPY_MIN && zerocopy_enable(s)) {
+			buf->zerocopy = true;
+		}
+	}
+	return r;
+}
+
+static int
+sendfile_socket(struct socket_server *ss, struct request_sendfile * request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = get_socket(ss, id);
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (type == SOCKET_TYPE_INVALID || s->id != id
+		|| type == SOCKET_TYPE_HALFCLOSE_WRITE
+		|| type == SOCKET_TYPE_PACCEPT
+		|| type == SOCKET_TYPE_PLISTEN
+		|| type == SOCKET_TYPE_LISTEN
+		|| s->protocol != PROTOCOL_TCP
+		|| s->closing) {
+		close(request->fd);
+		return -1;
+	}
+	struct write_buffer_file * buf = MALLOC(sizeof(*buf));
+	buf->buffer.next = NULL;
+	buf->buffer.buffer = NULL;
+	buf->buffer.ptr = NULL;
+	buf->buffer.sz = (size_t)request->sz;
+	buf->buffer.userobject = false;
+	buf->buffer.zerocopy = false;
+	buf->buffer.sendfile = true;
+	buf->buffer.zc_id = 0;
+	buf->fd = request->fd;
+	buf->offset = request->offset;
+	// 文件数据不占用内存，不计入 wb_size
+	struct wb_list *list = &s->high;
+	if (list->head == NULL) {
+		list->head = list->tail = &buf->buffer;
+	} else {
+		list->tail->next = &buf->buffer;
+		list->tail = &buf->buffer;
+	}
+	if (enable_write(ss, s, true)) {
+		return report_error(s, result, "enable write failed");
+	}
+	return -1;
+}
+
+static int
+listen_socket(struct socket_server *ss, struct request_listen * request, struct socket_message *result) {
+	int id = request->id;
+	int listen_fd = request->fd;
+	struct socket *s = new_fd(ss, id, listen_fd, PROTOCOL_TCP, request->opaque, false);
+	if (s == NULL) {
+		goto _failed;
 	}
 	ATOM_STORE(&s->type , SOCKET_TYPE_PLISTEN);
 	result->opaque = request->opaque;
@@ -1164,7 +1944,7 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = "reach skynet socket number limit";
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	get_socket(ss, id)->type = SOCKET_TYPE_INVALID;
 
 	return SOCKET_ERR;
 }
@@ -1180,7 +1960,10 @@ close_read(struct socket_server *ss, struct socket * s, struct socket_message *r
 	// Don't read socket later
 	ATOM_STORE(&s->type , SOCKET_TYPE_HALFCLOSE_READ);
 	enable_read(ss,s,false);
-	shutdown(s->fd, SHUT_RD);
+	if (s->shm == NULL) {
+		// 共享内存 socket 还要在这条连接上收门铃
+		shutdown(s->fd, SHUT_RD);
+	}
 	result->id = s->id;
 	result->ud = 0;
 	result->data = NULL;
@@ -1200,7 +1983,7 @@ halfclose_read(struct socket *s) {
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		// The socket is closed, ignore
 		return -1;
@@ -1250,7 +2033,7 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 	result->opaque = request->opaque;
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		result->data = "invalid socket";
 		return SOCKET_ERR;
@@ -1266,6 +2049,11 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 		result->data = "enable read failed";
 		return SOCKET_ERR;
 	}
+	if (s->shm && enable_write(ss, s, true)) {
+		// 暂停时环里积下的数据没有门铃，借一次 EPOLLOUT 回来读，见 socket_server_poll
+		result->data = "enable write failed";
+		return SOCKET_ERR;
+	}
 	uint8_t type = ATOM_LOAD(&s->type);
 	if (type == SOCKET_TYPE_PACCEPT || type == SOCKET_TYPE_PLISTEN) {
 		ATOM_STORE(&s->type , (type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN);
@@ -1285,7 +2073,7 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 static int
 pause_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -1295,10 +2083,170 @@ pause_socket(struct socket_server *ss, struct request_resumepause *request, stru
 	return -1;
 }
 
+static int
+watermark_socket(struct socket_server *ss, struct request_watermark *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (socket_invalid(s, id)) {
+		return -1;
+	}
+	s->wb_high = request->high > 0 ? request->high : 0;
+	s->wb_low = request->low < s->wb_high ? request->low : s->wb_high;
+	if (s->wb_low < 0)
+		s->wb_low = 0;
+	s->wb_limit = request->limit > 0 ? request->limit : 0;
+	s->wb_droplow = request->droplow;
+	// 新的水位可能让当前状态立即翻转
+	if (s->wb_blocked) {
+		if (s->wb_high == 0 || s->wb_size <= s->wb_low)
+			return report_writable(s, result, true);
+	} else if (s->wb_high > 0 && s->wb_size >= s->wb_high) {
+		return report_writable(s, result, false);
+	}
+	return -1;
+}
+
+// 把只含包体的 frame_buffer 恢复成带包头的形式
+static void
+frame_unbody(struct socket *s) {
+	int header = s->frame_header;
+	uint32_t len = (uint32_t)s->frame_body;
+	char * buffer = MALLOC(header + s->frame_size);
+	if (header == 2) {
+		buffer[0] = (len >> 8) & 0xff;
+		buffer[1] = len & 0xff;
+	} else {
+		buffer[0] = (len >> 24) & 0xff;
+		buffer[1] = (len >> 16) & 0xff;
+		buffer[2] = (len >> 8) & 0xff;
+		buffer[3] = len & 0xff;
+	}
+	memcpy(buffer + header, s->frame_buffer, s->frame_size);
+	FREE(s->frame_buffer);
+	s->frame_buffer = buffer;
+	s->frame_size += header;
+	s->frame_cap = s->frame_size;
+	s->frame_body = 0;
+}
+
+static int
+frame_socket(struct socket_server *ss, struct request_frame *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (socket_invalid(s, id) || s->protocol != PROTOCOL_TCP) {
+		return -1;
+	}
+	int header = request->header;
+	if (header != 2 && header != 4) {
+		header = 0;
+	}
+	int max = header == 2 ? 0xffff : FRAME_MAX_DEFAULT;
+	if (request->max > 0 && request->max < max) {
+		max = request->max;
+	}
+	if (header != 0 && s->frame_header != 0 && header != s->frame_header
+		&& (s->frame_size > 0 || s->frame_body)) {
+		// 不完整的包是按旧的包头长度读的，换包头长度会把它解错
+		skynet_error(NULL, "socket-server : frame (%d) header can't change in the middle of a packet.", id);
+		return -1;
+	}
+	if (s->frame_body) {
+		frame_unbody(s);
+	}
+	s->frame_header = header;
+	s->frame_max = max;
+	if (header == 0 && s->frame_buffer) {
+		// 关闭分帧时，把手上不完整的数据原样交出去
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = s->frame_size;
+		result->data = s->frame_buffer;
+		s->frame_buffer = NULL;
+		s->frame_size = 0;
+		s->frame_cap = 0;
+		if (result->ud > 0)
+			return SOCKET_DATA;
+		FREE(result->data);
+	}
+	return -1;
+}
+
+/*
+ * 设置 redirect。socket 已经在读时，属主手上可能还有没处理完的包，
+ * 直接改道会让新包先于它们到达 agent：此时先暂停读，给属主发一条 SOCKET_OPEN（"redirect"），
+ * 属主处理完之前的包后 start 恢复读取，之后的包才直接交给 agent。
+ */
+static int
+redirect_socket(struct socket_server *ss, struct request_redirect *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (socket_invalid(s, id) || s->protocol != PROTOCOL_TCP) {
+		return -1;
+	}
+	uintptr_t last = s->redirect;
+	s->redirect = request->opaque;
+	if (last == 0 && s->redirect && s->reading && ATOM_LOAD(&s->type) == SOCKET_TYPE_CONNECTED) {
+		if (enable_read(ss, s, false)) {
+			return report_error(s, result, "disable read failed");
+		}
+		result->opaque = s->opaque;
+		result->id = id;
+		result->ud = 0;
+		result->data = "redirect";
+		return SOCKET_OPEN;
+	}
+	return -1;
+}
+
+/*
+ * 切换到共享内存传输：此后数据都走共享内存，TCP 连接只传门铃。
+ * 切换前先把 greeting 原样写到 TCP 上（握手的回应），对端读到它之后才会改用共享内存。
+ * 要求没有还没发出去的数据，也没有没分完的包，否则数据流会被切乱，此时关闭连接。
+ */
+static int
+shm_socket(struct socket_server *ss, struct request_shm *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	struct shm_link *link = request->link;
+	if (socket_invalid(s, id) || s->protocol != PROTOCOL_TCP || s->shm) {
+		shm_release(link);
+		FREE(request->greeting);
+		return -1;
+	}
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	const char * err = NULL;
+	if (ATOM_LOAD(&s->type) != SOCKET_TYPE_CONNECTED || s->closing) {
+		err = "shm : socket is closing";
+	} else if (!send_buffer_empty(s) || s->dw_buffer || s->frame_size > 0 || s->frame_body) {
+		err = "shm : socket is busy";
+	} else if (request->sz > 0 && write(s->fd, request->greeting, request->sz) != (ssize_t)request->sz) {
+		err = "shm : write greeting failed";
+	}
+	FREE(request->greeting);
+	if (err) {
+		shm_release(link);
+		force_close(ss, s, &l, result);
+		result->data = (char *)err;
+		return SOCKET_ERR;
+	}
+	// 之后连接上只有 1 字节的门铃，不能等 Nagle 攒包（配合对端的延迟 ACK 每次会卡 40ms）
+	int nodelay = 1;
+	setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	socket_lock(&l);
+	s->shm = link;
+	socket_unlock(&l);
+	// 接上之前对端可能已经写了数据，借一次 EPOLLOUT 回来读
+	if (enable_write(ss, s, true)) {
+		return report_error(s, result, "enable write failed");
+	}
+	return -1;
+}
+
 static void
 setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		return;
 	}
@@ -1336,6 +2284,15 @@ has_cmd(struct socket_server *ss) {
 	return 0;
 }
 
+static void
+udp_enable_gro(int fd) {
+#if defined(USE_MMSG) && defined(UDP_GRO)
+	// GRO 是可选的：旧内核不支持时忽略错误，按普通 datagram 接收
+	int enable = 1;
+	setsockopt(fd, SOL_UDP, UDP_GRO, &enable, sizeof(enable));
+#endif
+}
+
 static void
 add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	int id = udp->id;
@@ -1348,7 +2305,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		get_socket(ss, id)->type = SOCKET_TYPE_INVALID;
 		return;
 	}
 	ATOM_STORE(&ns->type , SOCKET_TYPE_CONNECTED);
@@ -1358,7 +2315,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -1384,7 +2341,7 @@ dial_udp_socket(struct socket_server *ss, struct request_dial_udp *request, stru
 	struct socket *ns = new_fd(ss, id, request->fd, protocol, request->opaque, true);
 	if (ns == NULL){
 		close(request->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		get_socket(ss, id)->type = SOCKET_TYPE_INVALID;
 		return -1;
 	}
 
@@ -1401,12 +2358,12 @@ dial_udp_socket(struct socket_server *ss, struct request_dial_udp *request, stru
 }
 
 static inline void
-inc_sending_ref(struct socket *s, int id) {
+inc_sending_ref(struct socket_server *ss, struct socket *s, int id) {
 	if (s->protocol != PROTOCOL_TCP)
 		return;
 	for (;;) {
 		unsigned long sending = ATOM_LOAD(&s->sending);
-		if ((sending >> 16) == ID_TAG16(id)) {
+		if ((sending >> 16) == ID_TAG16(ss, id)) {
 			if ((sending & 0xffff) == 0xffff) {
 				// s->sending may overflow (rarely), so busy waiting here for socket thread dec it. see issue #794
 				continue;
@@ -1424,7 +2381,7 @@ inc_sending_ref(struct socket *s, int id) {
 
 static inline void
 dec_sending_ref(struct socket_server *ss, int id) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	// Notice: udp may inc sending while type == SOCKET_TYPE_RESERVE
 	if (s->id == id && s->protocol == PROTOCOL_TCP) {
 		assert((ATOM_LOAD(&s->sending) & 0xffff) != 0);
@@ -1479,6 +2436,18 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 		dec_sending_ref(ss, request->id);
 		return ret;
 	}
+	case 'Z': {
+		struct request_send * request = (struct request_send *) buffer;
+		int ret = send_socket_zerocopy(ss, request, result);
+		dec_sending_ref(ss, request->id);
+		return ret;
+	}
+	case 'F': {
+		struct request_sendfile * request = (struct request_sendfile *) buffer;
+		int ret = sendfile_socket(ss, request, result);
+		dec_sending_ref(ss, request->id);
+		return ret;
+	}
 	case 'A': {
 		struct request_send_udp * rsu = (struct request_send_udp *)buffer;
 		return send_socket(ss, &rsu->send, result, PRIORITY_HIGH, rsu->address);
@@ -1493,6 +2462,18 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
+	case 'M':
+		return watermark_socket(ss, (struct request_watermark *)buffer, result);
+	case 'H':
+		return frame_socket(ss, (struct request_frame *)buffer, result);
+	case 'G':
+		return redirect_socket(ss, (struct request_redirect *)buffer, result);
+	case 'Y': {
+		struct request_shm * request = (struct request_shm *) buffer;
+		int ret = shm_socket(ss, request, result);
+		dec_sending_ref(ss, request->id);
+		return ret;
+	}
 	default:
 		skynet_error(NULL, "socket-server error: Unknown ctrl %c.",type);
 		return -1;
@@ -1508,13 +2489,147 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
  *   - 若本次读取恰好填满缓冲，返回 SOCKET_MORE，提示上层继续拉取。
  *   - return -1 (ignore) when error
  */
+static inline uint32_t
+frame_length(const char *buffer, int header) {
+	const uint8_t *p = (const uint8_t *)buffer;
+	if (header == 2)
+		return p[0] << 8 | p[1];
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// 大包的缓冲容量：不超过 limit，已读到的数据越多一次扩得越多（倍增），至少 FRAME_PREALLOC
+static inline int
+frame_grow(int size, int limit) {
+	int cap = size < FRAME_PREALLOC ? FRAME_PREALLOC : size * 2;
+	return (cap < limit && cap > 0) ? cap : limit;
+}
+
+/*
+ * 分帧模式下准备读缓冲：不完整的包留在 frame_buffer 开头，这次读到它的后面。
+ * 已经知道当前包的长度时，按已读到的数据倍增缓冲，大包不会被切成许多次小读；
+ * 包头声明的长度来自对端，不按它一次分配，超过 frame_max 的包不扩缓冲（forward_frame_tcp 会关闭连接）。
+ * 要交给 redirect 的大包，包体单独读进一块缓冲（frame_body），读完时容量正好是包长，原样交出去，不再拷贝。
+ */
+static char *
+frame_prepare(struct socket *s, int *sz) {
+	if (s->frame_body) {
+		if (s->frame_size == s->frame_cap) {
+			s->frame_cap = frame_grow(s->frame_size, s->frame_body);
+			s->frame_buffer = skynet_realloc(s->frame_buffer, s->frame_cap);
+		}
+		*sz = s->frame_cap - s->frame_size;
+		return s->frame_buffer + s->frame_size;
+	}
+	int need = *sz;
+	if (s->frame_size >= s->frame_header) {
+		uint32_t len = frame_length(s->frame_buffer, s->frame_header);
+		if (len <= (uint32_t)s->frame_max) {
+			int total = s->frame_header + (int)len;
+			int rest = total - s->frame_size;
+			if (rest > need && s->redirect) {
+				int got = s->frame_size - s->frame_header;
+				int cap = frame_grow(got, (int)len);
+				char * body = MALLOC(cap);
+				memcpy(body, s->frame_buffer + s->frame_header, got);
+				FREE(s->frame_buffer);
+				s->frame_buffer = body;
+				s->frame_size = got;
+				s->frame_cap = cap;
+				s->frame_body = (int)len;
+				*sz = cap - got;
+				return body + got;
+			}
+			if (rest > need) {
+				int grow = frame_grow(s->frame_size, total) - s->frame_size;
+				if (grow > need)
+					need = grow;
+			}
+		}
+	}
+	if (s->frame_size + need > s->frame_cap) {
+		s->frame_cap = s->frame_size + need;
+		s->frame_buffer = skynet_realloc(s->frame_buffer, s->frame_cap);
+	}
+	*sz = s->frame_cap - s->frame_size;
+	return s->frame_buffer + s->frame_size;
+}
+
+/*
+ * 分帧模式下处理新读到的 n 字节：
+ *   - 把 frame_buffer 开头所有完整的包（连同包头）作为一条 SOCKET_FRAME 交出去，ud 为总字节数；
+ *   - 剩下的不完整部分另存，等下次读取；
+ *   - 包长超过 frame_max 时关闭连接。
+ */
+static int
+forward_frame_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, int n, struct socket_message * result) {
+	if (s->frame_body) {
+		s->frame_size += n;
+		if (s->frame_size < s->frame_body)
+			return -1;
+		if (s->redirect) {
+			result->id = s->id;
+			result->ud = s->frame_body;
+			result->data = s->frame_buffer;
+			result->opaque = s->redirect;
+			s->frame_buffer = NULL;
+			s->frame_size = 0;
+			s->frame_cap = 0;
+			s->frame_body = 0;
+			return SOCKET_REDIRECT_BODY;
+		}
+		// redirect 已经取消，补回包头照常交出
+		frame_unbody(s);
+		n = 0;
+	}
+	char * buffer = s->frame_buffer;
+	int header = s->frame_header;
+	int total = s->frame_size + n;
+	int pos = 0;
+	while (pos + header <= total) {
+		uint32_t len = frame_length(buffer + pos, header);
+		if (len > (uint32_t)s->frame_max) {
+			force_close(ss, s, l, result);
+			result->data = "packet too large";
+			return SOCKET_ERR;
+		}
+		if (pos + header + (int)len > total)
+			break;
+		pos += header + len;
+	}
+	if (pos == 0) {
+		s->frame_size = total;
+		return -1;
+	}
+	int rest = total - pos;
+	if (rest == 0) {
+		s->frame_buffer = NULL;
+		s->frame_cap = 0;
+	} else {
+		s->frame_buffer = MALLOC(rest);
+		s->frame_cap = rest;
+		memcpy(s->frame_buffer, buffer + pos, rest);
+	}
+	s->frame_size = rest;
+
+	result->id = s->id;
+	result->ud = pos;
+	result->data = buffer;
+	if (s->redirect) {
+		result->opaque = s->redirect;
+		return SOCKET_REDIRECT;
+	}
+	result->opaque = s->opaque;
+	return SOCKET_FRAME;
+}
+
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	int sz = s->p.size;
-	char * buffer = MALLOC(sz);
-	int n = (int)read(s->fd, buffer, sz);
+	char * buffer = s->frame_header ? frame_prepare(s, &sz) : MALLOC(sz);
+	int n = (int)(s->shm ? shm_read(s->shm, s->fd, buffer, sz) : read(s->fd, buffer, sz));
 	if (n<0) {
-		FREE(buffer);
+		if (!s->frame_header)
+			FREE(buffer);
 		switch(errno) {
 		case EINTR:
 		case AGAIN_WOULDBLOCK:
@@ -1525,7 +2640,8 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 		return -1;
 	}
 	if (n==0) {
-		FREE(buffer);
+		if (!s->frame_header)
+			FREE(buffer);
 		if (s->closing) {
 			// Rare case : if s->closing is true, reading event is disable, and SOCKET_CLOSE is raised.
 			if (nomore_sending_data(s)) {
@@ -1549,12 +2665,28 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 
 	if (halfclose_read(s)) {
 		// discard recv data (Rare case : if socket is HALFCLOSE_READ, reading event is disable.)
-		FREE(buffer);
+		if (!s->frame_header)
+			FREE(buffer);
 		return -1;
 	}
 
 	stat_read(ss,s,n);
 
+	if (s->frame_header) {
+		int size = s->p.size;
+		int type = forward_frame_tcp(ss, s, l, n, result);
+		if (type == SOCKET_REDIRECT_BODY)
+			return type;
+		if (n >= size) {
+			s->p.size *= 2;
+			if (type == SOCKET_FRAME || type == SOCKET_REDIRECT)
+				return SOCKET_MORE;
+		} else if (size > MIN_READ_BUFFER && n*2 < size) {
+			s->p.size /= 2;
+		}
+		return type;
+	}
+
 	result->opaque = s->opaque;
 	result->id = s->id;
 	result->ud = n;
@@ -1570,6 +2702,26 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 	return SOCKET_DATA;
 }
 
+// 暂停或正在关闭的共享内存 socket 只收门铃，不读数据
+static int
+forward_bell(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	if (shm_drain(s->shm, s->fd) < 0) {
+		return report_error(s, result, strerror(errno));
+	}
+	if (s->shm->eof) {
+		if (s->closing) {
+			// 对端已经关闭，剩下的数据发不出去了
+			force_close(ss, s, l, result);
+			return -1;
+		}
+		// 不再等门铃，恢复读之后再读到 EOF
+		if (sp_enable(ss->event_fd, s->fd, s, false, s->writing)) {
+			return report_error(s, result, "disable read failed");
+		}
+	}
+	return -1;
+}
+
 static int
 gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	int addrsz = 1;
@@ -1588,6 +2740,145 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
+#ifdef USE_MMSG
+
+static int
+udp_gro_size(struct msghdr *h, int n) {
+#ifdef UDP_GRO
+	struct cmsghdr *cm;
+	for (cm = CMSG_FIRSTHDR(h); cm; cm = CMSG_NXTHDR(h, cm)) {
+		if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+			int gso;
+			memcpy(&gso, CMSG_DATA(cm), sizeof(gso));
+			if (gso > 0)
+				return gso;
+		}
+	}
+#endif
+	return n;
+}
+
+static inline int
+udp_message_protocol(struct msghdr *h) {
+	return (h->msg_namelen == sizeof(struct sockaddr_in)) ? PROTOCOL_UDP : PROTOCOL_UDPv6;
+}
+
+static inline int
+udp_address_size(int protocol) {
+	return (protocol == PROTOCOL_UDP) ? 1+2+4 : 1+2+16;
+}
+
+/*
+ * forward_message_udp（recvmmsg 版本）：
+ *   - 一次 recvmmsg 最多读取 UDP_BATCH 个 datagram；开启 GRO 时按分段大小拆回原始 datagram。
+ *   - 只读到一个 datagram 时，仍按 SOCKET_UDP 的格式上报（payload + 地址）。
+ *   - 多个 datagram 打包成一条 SOCKET_UDP_BATCH 消息，ud 为总字节数，每个记录为
+ *     [int size][payload][address]，地址长度由 address[0] 的协议类型决定。
+ */
+static int
+forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	struct udp_recvbatch *b = ss->udpbatch;
+	if (b == NULL) {
+		b = ss->udpbatch = MALLOC(sizeof(*b));
+	}
+	int i;
+	for (i=0;i<UDP_BATCH;i++) {
+		struct msghdr *h = &b->msg[i].msg_hdr;
+		b->iov[i].iov_base = b->buffer[i];
+		b->iov[i].iov_len = MAX_UDP_PACKAGE;
+		h->msg_name = &b->sa[i];
+		h->msg_namelen = sizeof(b->sa[i]);
+		h->msg_iov = &b->iov[i];
+		h->msg_iovlen = 1;
+		h->msg_control = b->control[i];
+		h->msg_controllen = sizeof(b->control[i]);
+		h->msg_flags = 0;
+		b->msg[i].msg_len = 0;
+	}
+	int n = recvmmsg(s->fd, b->msg, UDP_BATCH, 0, NULL);
+	if (n<0) {
+		switch(errno) {
+		case EINTR:
+		case AGAIN_WOULDBLOCK:
+			return -1;
+		}
+		int error = errno;
+		// close when error
+		force_close(ss, s, l, result);
+		result->data = strerror(error);
+		return SOCKET_ERR;
+	}
+	if (n > 1 && !s->udp_gro) {
+		// 只有成批到达的 socket 才值得让内核合并分段，零星收包的 socket 保持原样
+		udp_enable_gro(s->fd);
+		s->udp_gro = true;
+	}
+	// 第一遍：统计有效 datagram 数量与打包后的总长度
+	int count = 0;
+	size_t total = 0;
+	int last = -1;
+	for (i=0;i<n;i++) {
+		struct msghdr *h = &b->msg[i].msg_hdr;
+		int sz = b->msg[i].msg_len;
+		stat_read(ss,s,sz);
+		int protocol = udp_message_protocol(h);
+		if (protocol != s->protocol) {
+			b->msg[i].msg_len = -1;	// drop it
+			continue;
+		}
+		int addrsz = udp_address_size(protocol);
+		int segment = udp_gro_size(h, sz);
+		int nseg = (sz == 0) ? 1 : (sz + segment - 1) / segment;
+		count += nseg;
+		total += nseg * (sizeof(int) + addrsz) + sz;
+		last = i;
+	}
+	if (count == 0)
+		return -1;
+
+	result->opaque = s->opaque;
+	result->id = s->id;
+
+	if (count == 1) {
+		struct msghdr *h = &b->msg[last].msg_hdr;
+		int sz = b->msg[last].msg_len;
+		uint8_t * data = MALLOC(sz + udp_address_size(s->protocol));
+		memcpy(data, b->buffer[last], sz);
+		gen_udp_address(s->protocol, h->msg_name, data + sz);
+		result->ud = sz;
+		result->data = (char *)data;
+		return SOCKET_UDP;
+	}
+
+	uint8_t * data = MALLOC(total);
+	uint8_t * ptr = data;
+	for (i=0;i<n;i++) {
+		if ((int)b->msg[i].msg_len < 0)
+			continue;
+		struct msghdr *h = &b->msg[i].msg_hdr;
+		int sz = b->msg[i].msg_len;
+		int segment = udp_gro_size(h, sz);
+		const uint8_t * src = b->buffer[i];
+		do {
+			int seg = sz < segment ? sz : segment;
+			memcpy(ptr, &seg, sizeof(int));
+			ptr += sizeof(int);
+			memcpy(ptr, src, seg);
+			ptr += seg;
+			ptr += gen_udp_address(s->protocol, h->msg_name, ptr);
+			src += seg;
+			sz -= seg;
+		} while (sz > 0);
+	}
+	assert(ptr == data + total);
+	result->ud = (int)total;
+	result->data = (char *)data;
+
+	return SOCKET_UDP_BATCH;
+}
+
+#else
+
 /*
  * forward_message_udp：
  *   - recvfrom 读取数据并保存到临时大缓冲 udpbuffer。
@@ -1635,6 +2926,8 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lo
 	return SOCKET_UDP;
 }
 
+#endif
+
 static int
 report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	int error;
@@ -1685,12 +2978,31 @@ getname(union sockaddr_all *u, char *buffer, size_t sz) {
 	}
 }
 
+/*
+ * accept_fd：
+ *   - Linux 下使用 accept4 一次性设置 SOCK_NONBLOCK|SOCK_CLOEXEC，省去额外的 fcntl 调用。
+ *   - 其它平台退回 accept + sp_nonblocking。
+ */
+static int
+accept_fd(int listen_fd, union sockaddr_all *u, socklen_t *len) {
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+	return accept4(listen_fd, &u->s, len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	int fd = accept(listen_fd, &u->s, len);
+	if (fd >= 0) {
+		sp_nonblocking(fd);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+#endif
+}
+
 // return 0 when failed, or -1 when file limit
 static int
 report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
 	union sockaddr_all u;
 	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);
+	int client_fd = accept_fd(s->fd, &u, &len);
 	if (client_fd < 0) {
 		if (errno == EMFILE || errno == ENFILE) {
 			result->opaque = s->opaque;
@@ -1718,7 +3030,6 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 		return 0;
 	}
 	socket_keepalive(client_fd);
-	sp_nonblocking(client_fd);
 	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
 	if (ns == NULL) {
 		close(client_fd);
@@ -1726,6 +3037,13 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	}
 	// accept new one connection
 	stat_read(ss,s,1);
+	// 新连接继承监听 socket 的水位设置
+	ns->wb_high = s->wb_high;
+	ns->wb_low = s->wb_low;
+	ns->wb_limit = s->wb_limit;
+	ns->wb_droplow = s->wb_droplow;
+	ns->frame_header = s->frame_header;
+	ns->frame_max = s->frame_max;
 
 	ATOM_STORE(&ns->type , SOCKET_TYPE_PACCEPT);
 	result->opaque = s->opaque;
@@ -1784,6 +3102,10 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		}
 		// 2. 检查是否需要等待新事件
 		if (ss->event_index == ss->event_n) {
+#ifdef USE_ZEROCOPY
+			if (ss->zc_orphan)
+				zerocopy_orphan_drain(ss);
+#endif
 			// 调用epoll_wait等待网络事件
 			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
 			ss->checkctrl = 1;
@@ -1816,8 +3138,17 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_LISTEN: {
 			int ok = report_accept(ss, s, result);
 			if (ok > 0) {
+				// 登录风暴时 backlog 中可能堆积大量连接，保留当前事件以便下次 poll 继续 accept，
+				// 直到 accept 返回 EAGAIN 或用完预算（避免饿死其它 socket）。
+				if (++ss->accept_count < ss->accept_budget) {
+					--ss->event_index;
+				} else {
+					ss->accept_count = 0;
+				}
 				return SOCKET_ACCEPT;
-			} if (ok < 0 ) {
+			}
+			ss->accept_count = 0;
+			if (ok < 0 ) {
 				return SOCKET_ERR;
 			}
 			// when ok == 0, retry
@@ -1827,23 +3158,48 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			skynet_error(NULL, "socket-server error: invalid socket");
 			break;
 		default:
+#ifdef USE_ZEROCOPY
+			if (s->zc_pending.head) {
+				// 完成通知随任意事件一起收，不只在 EPOLLERR 时
+				zerocopy_complete(ss, s);
+			}
+#endif
+			if (s->shm && e->write && s->reading && shm_readable(s->shm)) {
+				// 共享内存里有数据但没有门铃（见 shm_socket 、resume_socket），当作读事件
+				e->read = true;
+			}
 			// 处理读事件
 			if (e->read) {
 				int type;
-				if (s->protocol == PROTOCOL_TCP) {
+				if (s->shm && !s->reading) {
+					type = forward_bell(ss, s, &l, result);
+				} else if (s->protocol == PROTOCOL_TCP) {
 					type = forward_message_tcp(ss, s, &l, result);
 					if (type == SOCKET_MORE) {
 						--ss->event_index;
+						if (s->frame_header)
+							return s->redirect ? SOCKET_REDIRECT : SOCKET_FRAME;
 						return SOCKET_DATA;
 					}
+					if (s->shm && type != SOCKET_CLOSE && type != SOCKET_ERR && shm_readable(s->shm)) {
+						// 环里剩下的数据不会再有门铃，留着这个事件接着读
+						--ss->event_index;
+						if (type == -1)
+							break;
+						return type;
+					}
 				} else {
 					type = forward_message_udp(ss, s, &l, result);
-					if (type == SOCKET_UDP) {
+					if (type == SOCKET_UDP || type == SOCKET_UDP_BATCH) {
 						// try read again
 						--ss->event_index;
-						return SOCKET_UDP;
+						return type;
 					}
 				}
+				if (s->shm && type != SOCKET_CLOSE && type != SOCKET_ERR && !send_buffer_empty(s)) {
+					// 门铃也可能是对端读走了数据，等空间的写可以继续了
+					e->write = true;
+				}
 				if (e->write && type != SOCKET_CLOSE && type != SOCKET_ERR) {
 					// Try to dispatch write message next step if write flag set.
 					e->read = false;
@@ -1863,8 +3219,19 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			if (e->error) {
 				int error;
 				socklen_t len = sizeof(error);
+#ifdef USE_ZEROCOPY
+				// MSG_ZEROCOPY 的完成通知放在错误队列里，同样会触发 EPOLLERR
+				if (s->zc_state > 0)
+					zerocopy_complete(ss, s);
+#endif
 				int code = getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &error, &len);
 				const char * err = NULL;
+#ifdef USE_ZEROCOPY
+				if (s->zc_state > 0 && code == 0 && error == 0) {
+					// 只是完成通知（可能已在上面收走）
+					break;
+				}
+#endif
 				if (code < 0) {
 					err = strerror(errno);
 				} else if (error != 0) {
@@ -1961,7 +3328,7 @@ can_direct_write(struct socket *s, int id) {
 int
 socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	int id = buf->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (socket_invalid(s, id) || s->closing) {
 		free_buffer(ss, buf);
 		return -1;
@@ -1978,7 +3345,7 @@ socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 			send_object_init_from_sendbuffer(ss, &so, buf);
 			ssize_t n;
 			if (s->protocol == PROTOCOL_TCP) {
-				n = write(s->fd, so.buffer, so.sz);
+				n = socket_write(s, so.buffer, so.sz);
 			} else {
 				union sockaddr_all sa;
 				socklen_t sasz = udp_socket_address(s, s->p.udp_address, &sa);
@@ -2021,7 +3388,7 @@ socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 		socket_unlock(&l);
 	}
 
-	inc_sending_ref(s, id);
+	inc_sending_ref(ss, s, id);
 
 	struct request_package request;
 	request_init(&request);
@@ -2037,13 +3404,13 @@ int
 socket_server_send_lowpriority(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	int id = buf->id;
 
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		free_buffer(ss, buf);
 		return -1;
 	}
 
-	inc_sending_ref(s, id);
+	inc_sending_ref(ss, s, id);
 
 	struct request_package request;
 	request_init(&request);
@@ -2054,6 +3421,61 @@ socket_server_send_lowpriority(struct socket_server *ss, struct socket_sendbuffe
 	return 0;
 }
 
+// return -1 when error, 0 when success
+int
+socket_server_send_zerocopy(struct socket_server *ss, struct socket_sendbuffer *buf) {
+	int id = buf->id;
+
+	struct socket * s = get_socket(ss, id);
+	if (socket_invalid(s, id) || s->closing) {
+		free_buffer(ss, buf);
+		return -1;
+	}
+
+	inc_sending_ref(ss, s, id);
+
+	struct request_package request;
+	request_init(&request);
+	request.u.send.id = id;
+	request.u.send.buffer = clone_buffer(buf, &request.u.send.sz);
+
+	send_request(ss, &request, 'Z', sizeof(request.u.send));
+	return 0;
+}
+
+// return -1 when error, or the bytes will be sent
+int64_t
+socket_server_sendfile(struct socket_server *ss, int id, const char *filename, int64_t offset, int64_t sz) {
+	struct socket * s = get_socket(ss, id);
+	if (socket_invalid(s, id) || s->closing || offset < 0) {
+		return -1;
+	}
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || offset > st.st_size) {
+		close(fd);
+		return -1;
+	}
+	if (sz < 0 || sz > st.st_size - offset) {
+		sz = st.st_size - offset;
+	}
+
+	inc_sending_ref(ss, s, id);
+
+	struct request_package request;
+	request_init(&request);
+	request.u.sendfile.id = id;
+	request.u.sendfile.fd = fd;
+	request.u.sendfile.offset = offset;
+	request.u.sendfile.sz = sz;
+
+	send_request(ss, &request, 'F', sizeof(request.u.sendfile));
+	return sz;
+}
+
 void
 socket_server_exit(struct socket_server *ss) {
 	struct request_package request;
@@ -2142,6 +3564,8 @@ do_listen(const char * host, int port, int backlog) {
 		close(listen_fd);
 		return -1;
 	}
+	// report_accept drains the backlog until EAGAIN, so the listen fd must not block.
+	sp_nonblocking(listen_fd);
 	return listen_fd;
 }
 
@@ -2207,11 +3631,82 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+void
+socket_server_watermark(struct socket_server *ss, int id, int64_t high, int64_t low, int64_t limit, int droplow) {
+	struct request_package request;
+	request_init(&request);
+	request.u.watermark.id = id;
+	request.u.watermark.droplow = droplow;
+	request.u.watermark.high = high;
+	request.u.watermark.low = low;
+	request.u.watermark.limit = limit;
+	send_request(ss, &request, 'M', sizeof(request.u.watermark));
+}
+
+void
+socket_server_frame(struct socket_server *ss, int id, int header, int max) {
+	struct request_package request;
+	request_init(&request);
+	request.u.frame.id = id;
+	request.u.frame.header = header;
+	request.u.frame.max = max;
+	send_request(ss, &request, 'H', sizeof(request.u.frame));
+}
+
+void
+socket_server_redirect(struct socket_server *ss, int id, uintptr_t opaque) {
+	struct request_package request;
+	request_init(&request);
+	request.u.redirect.id = id;
+	request.u.redirect.opaque = opaque;
+	send_request(ss, &request, 'G', sizeof(request.u.redirect));
+}
+
+int
+socket_server_shm(struct socket_server *ss, int id, const char *name, size_t size, const void *greeting, size_t sz) {
+	struct socket *s = get_socket(ss, id);
+	if (socket_invalid(s, id) || s->protocol != PROTOCOL_TCP || strlen(name) >= SOCKET_SHM_NAME) {
+		return -1;
+	}
+	struct shm_link *link = size > 0 ? shm_create(name, size) : shm_open_link(name);
+	if (link == NULL) {
+		return -1;
+	}
+	// 之前的数据都发出去之后才切换，之后的数据都在切换之后发
+	inc_sending_ref(ss, s, id);
+
+	struct request_package request;
+	request_init(&request);
+	request.u.shm.id = id;
+	request.u.shm.link = link;
+	request.u.shm.greeting = NULL;
+	request.u.shm.sz = sz;
+	if (sz > 0) {
+		request.u.shm.greeting = MALLOC(sz);
+		memcpy(request.u.shm.greeting, greeting, sz);
+	}
+	send_request(ss, &request, 'Y', sizeof(request.u.shm));
+	return 0;
+}
+
+int
+socket_server_frame_header(struct socket_server *ss, int id) {
+	struct socket *s = get_socket(ss, id);
+	if (socket_invalid(s, id))
+		return 0;
+	return s->frame_header;
+}
+
 void
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
 }
 
+void
+socket_server_accept_budget(struct socket_server *ss, int budget) {
+	ss->accept_budget = budget > 0 ? budget : 1;
+}
+
 // UDP
 
 int
@@ -2340,7 +3835,7 @@ socket_server_udp_dial(struct socket_server *ss, uintptr_t opaque, const char* a
 int
 socket_server_udp_send(struct socket_server *ss, const struct socket_udp_address *addr, struct socket_sendbuffer *buf) {
 	int id = buf->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		free_buffer(ss, buf);
 		return -1;
@@ -2402,7 +3897,7 @@ socket_server_udp_send(struct socket_server *ss, const struct socket_udp_address
 
 int
 socket_server_udp_connect(struct socket_server *ss, int id, const char * addr, int port) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -2530,6 +4025,11 @@ query_info(struct socket *s, struct socket_info *si) {
 	si->rtime = s->stat.rtime;
 	si->wtime = s->stat.wtime;
 	si->wbuffer = s->wb_size;
+	si->whigh = s->wb_high;
+	si->wlow = s->wb_low;
+	si->wlimit = s->wb_limit;
+	si->wdrop = s->wb_drop;
+	si->wblocked = s->wb_blocked;
 	si->reading = s->reading;
 	si->writing = s->writing;
 
@@ -2540,8 +4040,9 @@ struct socket_info *
 socket_server_info(struct socket_server *ss) {
 	int i;
 	struct socket_info * si = NULL;
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket * s = &ss->slot[i];
+	int n = ATOM_LOAD(&ss->nseg) << SOCKET_SEGMENT_P;
+	for (i=0;i<n;i++) {
+		struct socket * s = socket_at(ss, i);
 		int id = s->id;
 		struct socket_info temp;
 		if (query_info(s, &temp) && s->id == id) {
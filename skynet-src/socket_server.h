@@ -13,6 +13,11 @@
 #define SOCKET_EXIT 5		/* 网络线程退出（socket_server_exit） */
 #define SOCKET_UDP 6		/* UDP 消息，data 末尾附带地址信息 */
 #define SOCKET_WARNING 7	/* 写缓冲告警：ud 为 KB，0 表示告警解除 */
+#define SOCKET_UDP_BATCH 10	/* 多个 UDP 消息：ud 为总字节数，记录格式为 [int size][payload][address] */
+#define SOCKET_WRITABLE 11	/* 发送队列水位变化：ud 为 0 表示越过高水位，1 表示回落到低水位 */
+#define SOCKET_FRAME 12		/* 分帧模式的数据：data 中是一个或多个完整的包（含包头），ud 为总字节数 */
+#define SOCKET_REDIRECT 13	/* 同 SOCKET_FRAME，但 opaque 为 socket_server_redirect 指定的目标 */
+#define SOCKET_REDIRECT_BODY 14	/* 交给 redirect 目标的一个大包：data 只含包体（不含包头），ud 为包长 */
 
 /* 内部专用的附加事件类型 */
 // Only for internal use
@@ -29,7 +34,7 @@ struct socket_message {
 };
 
 /* 核心接口：创建/释放 socket_server，并在网络线程内轮询事件 */
-struct socket_server * socket_server_create(uint64_t time);
+struct socket_server * socket_server_create(uint64_t time, int max_socket);
 void socket_server_release(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
@@ -44,6 +49,10 @@ void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
 // return -1 when error
 int socket_server_send(struct socket_server *, struct socket_sendbuffer *buffer);
 int socket_server_send_lowpriority(struct socket_server *, struct socket_sendbuffer *buffer);
+// send large buffer with MSG_ZEROCOPY (linux), the buffer is released after the kernel completes it
+int socket_server_send_zerocopy(struct socket_server *, struct socket_sendbuffer *buffer);
+// send sz bytes (sz < 0 means to the end) of file from offset by sendfile in socket thread, return -1 when error or the bytes will be sent
+int64_t socket_server_sendfile(struct socket_server *, int id, const char * filename, int64_t offset, int64_t sz);
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
@@ -81,6 +90,29 @@ struct socket_object_interface {
 // if you send package with type SOCKET_BUFFER_OBJECT, use soi.
 void socket_server_userobject(struct socket_server *, struct socket_object_interface *soi);
 
+// max connections accepted from one listen socket per ready event (default 16)
+void socket_server_accept_budget(struct socket_server *, int budget);
+
+// send buffer watermark, 0 for disable. Sockets accepted from a listen socket inherit its watermark.
+void socket_server_watermark(struct socket_server *, int id, int64_t high, int64_t low, int64_t limit, int droplow);
+
+// split tcp stream into packets in socket thread : header is 2 or 4 (big-endian length), 0 for disable.
+// max is the max size of one packet (0 for default). Sockets accepted from a listen socket inherit it.
+void socket_server_frame(struct socket_server *, int id, int header, int max);
+// framed packets of the socket are reported as SOCKET_REDIRECT to opaque instead of its owner, 0 for cancel.
+// other events (close, error, ...) still go to the owner.
+// If the socket is reading, it is paused and the owner gets SOCKET_OPEN "redirect" after the packets
+// already reported to it; the owner starts the socket again when it has handled them.
+void socket_server_redirect(struct socket_server *, int id, uintptr_t opaque);
+// frame header size of the socket, only call it in socket thread
+int socket_server_frame_header(struct socket_server *, int id);
+
+#define SOCKET_SHM_NAME 64
+// move the data of a tcp socket to shared memory rings (for processes on the same host), the connection only carries wakeups after it.
+// size > 0 : create the shared memory named name (unique, such as "/app.pid.id") with rings of size bytes ; size == 0 : open the one created by the peer.
+// greeting (optional) is written to the connection as is before switching. return -1 when error
+int socket_server_shm(struct socket_server *, int id, const char *name, size_t size, const void *greeting, size_t sz);
+
 struct socket_info * socket_server_info(struct socket_server *);
 
 #endif
@@ -0,0 +1,279 @@
+#ifndef socket_shm_h
+#define socket_shm_h
+
+/*
+ * 同机进程之间的共享内存传输（只由 socket_server.c 包含）：
+ *   - 一块 shm_open 的共享内存，每个方向一个单生产者单消费者的环形缓冲，数据不再经过内核。
+ *   - 原来的 TCP 连接保留，只传 1 字节的门铃：对端声明在等数据（wait_data）或等空间（wait_space）时才发，
+ *     所以忙的时候几乎没有系统调用；对端退出时照常在这条连接上读到 EOF。
+ *   - 创建者写 ring[0] 读 ring[1]，打开者相反。位置是不回绕的 size_t ，环大小为 2 的幂。
+ *   - 写只发生在持有直写锁时（网络线程或直写的工作线程），读只在网络线程，所以两端各只有一个线程。
+ */
+
+#include "atomic.h"
+#include "socket_server.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SHM_MAGIC 0x6d68736b	// "kshm"
+#define SHM_HEADER 4096			// 头部占一页，数据区从页边界开始
+#define SHM_MIN (64*1024)
+#define SHM_MAX (64*1024*1024)
+#define SHM_CACHELINE 64
+
+// 生产者和消费者各自修改的字段放在不同的 cache line
+struct shm_ring {
+	ATOM_SIZET head;	// 读到的位置，消费者修改
+	char pad1[SHM_CACHELINE - sizeof(ATOM_SIZET)];
+	ATOM_SIZET tail;	// 写到的位置，生产者修改
+	char pad2[SHM_CACHELINE - sizeof(ATOM_SIZET)];
+	ATOM_INT wait_data;	// 消费者读空后置 1 ，生产者写入后看到它就清掉并发门铃
+	char pad3[SHM_CACHELINE - sizeof(ATOM_INT)];
+	ATOM_INT wait_space;	// 生产者写满后置 1 ，消费者读走后看到它就清掉并发门铃
+	char pad4[SHM_CACHELINE - sizeof(ATOM_INT)];
+};
+
+struct shm_header {
+	uint32_t magic;
+	uint32_t size;		// 每个方向的环大小
+	char pad[SHM_CACHELINE - 8];
+	struct shm_ring ring[2];
+};
+
+struct shm_link {
+	struct shm_header *header;
+	size_t size;
+	struct shm_ring *in;
+	struct shm_ring *out;
+	uint8_t *rbuf;
+	uint8_t *wbuf;
+	bool eof;		// TCP 连接上读到了 EOF ，对端已经关闭
+	bool creator;	// 关闭时负责 shm_unlink（对端可能还没来得及打开）
+	char name[SOCKET_SHM_NAME];
+};
+
+static struct shm_link *
+shm_link_new(void *ptr, size_t size, bool creator, const char *name) {
+	struct shm_link *l = skynet_malloc(sizeof(*l));
+	l->header = ptr;
+	l->size = size;
+	l->in = &l->header->ring[creator ? 1 : 0];
+	l->out = &l->header->ring[creator ? 0 : 1];
+	uint8_t *data = (uint8_t *)ptr + SHM_HEADER;
+	l->rbuf = creator ? data + size : data;
+	l->wbuf = creator ? data : data + size;
+	l->eof = false;
+	l->creator = creator;
+	snprintf(l->name, sizeof(l->name), "%s", name);
+	return l;
+}
+
+// 创建共享内存，环大小取不小于 size 的 2 的幂
+static struct shm_link *
+shm_create(const char *name, size_t size) {
+	size_t sz = SHM_MIN;
+	while (sz < size && sz < SHM_MAX)
+		sz *= 2;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		// 名字由创建者保证唯一，留下来的只能是崩溃的进程没来得及删掉的
+		shm_unlink(name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+	if (fd < 0)
+		return NULL;
+	size_t total = SHM_HEADER + sz * 2;
+	void *ptr = MAP_FAILED;
+	if (ftruncate(fd, (off_t)total) == 0) {
+		ptr = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		shm_unlink(name);
+		return NULL;
+	}
+	struct shm_header *h = ptr;
+	h->magic = SHM_MAGIC;
+	h->size = (uint32_t)sz;
+	int i;
+	for (i=0;i<2;i++) {
+		ATOM_INIT(&h->ring[i].head, 0);
+		ATOM_INIT(&h->ring[i].tail, 0);
+		// 第一次写入一定发门铃，对端接上之前写进来的数据也不会漏掉
+		ATOM_INIT(&h->ring[i].wait_data, 1);
+		ATOM_INIT(&h->ring[i].wait_space, 0);
+	}
+	return shm_link_new(ptr, sz, true, name);
+}
+
+// 打开对端创建的共享内存，打开后名字就没用了，立即 unlink
+static struct shm_link *
+shm_open_link(const char *name) {
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return NULL;
+	shm_unlink(name);
+	struct stat st;
+	void *ptr = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > SHM_HEADER) {
+		ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (ptr == MAP_FAILED)
+		return NULL;
+	struct shm_header *h = ptr;
+	size_t sz = h->size;
+	if (h->magic != SHM_MAGIC || sz < SHM_MIN || (sz & (sz - 1)) != 0 || (size_t)st.st_size != SHM_HEADER + sz * 2) {
+		munmap(ptr, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return shm_link_new(ptr, sz, false, name);
+}
+
+static void
+shm_release(struct shm_link *l) {
+	munmap(l->header, SHM_HEADER + l->size * 2);
+	if (l->creator)
+		shm_unlink(l->name);
+	skynet_free(l);
+}
+
+static void
+shm_bell(int fd) {
+	char c = 0;
+	while (write(fd, &c, 1) < 0 && errno == EINTR);
+	// 其它错误不用管，对端关闭时读端会看到 EOF
+}
+
+// flag 为 1 时清掉它并发门铃：对端正在等
+static inline void
+shm_notify(ATOM_INT *flag, int fd) {
+	while (ATOM_LOAD(flag)) {
+		if (ATOM_CAS(flag, 1, 0)) {
+			shm_bell(fd);
+			return;
+		}
+	}
+}
+
+static inline bool
+shm_readable(struct shm_link *l) {
+	return ATOM_LOAD(&l->in->tail) != ATOM_LOAD(&l->in->head);
+}
+
+// 与 write 相同：返回写入的字节数，环满时返回 -1 且 errno 为 EAGAIN 。没写完时已经声明在等空间，对端读走数据后会发门铃
+static ssize_t
+shm_write(struct shm_link *l, int fd, const void *buffer, size_t sz) {
+	struct shm_ring *r = l->out;
+	size_t tail = ATOM_LOAD(&r->tail);
+	size_t written = 0;
+	while (written < sz) {
+		size_t space = l->size - (tail - ATOM_LOAD(&r->head));
+		if (space == 0) {
+			// 先声明在等空间再检查一次，消费者要么看到声明，要么我们看到它读走的空间
+			ATOM_STORE(&r->wait_space, 1);
+			space = l->size - (tail - ATOM_LOAD(&r->head));
+			if (space == 0)
+				break;
+			ATOM_STORE(&r->wait_space, 0);
+		}
+		if (space > sz - written)
+			space = sz - written;
+		size_t offset = tail & (l->size - 1);
+		size_t n = l->size - offset;
+		if (n > space)
+			n = space;
+		memcpy(l->wbuf + offset, (const char *)buffer + written, n);
+		memcpy(l->wbuf, (const char *)buffer + written + n, space - n);
+		written += space;
+		tail += space;
+		ATOM_STORE(&r->tail, tail);
+		shm_notify(&r->wait_data, fd);
+	}
+	if (written == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return (ssize_t)written;
+}
+
+// 收掉 TCP 连接上的门铃；读到 EOF 时记下来，出错返回 -1
+static int
+shm_drain(struct shm_link *l, int fd) {
+	char bell[64];
+	while (!l->eof) {
+		ssize_t n = read(fd, bell, sizeof(bell));
+		if (n == 0) {
+			l->eof = true;
+		} else if (n < 0) {
+			switch (errno) {
+			case EINTR:
+				continue;
+			case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+			case EWOULDBLOCK:
+#endif
+				return 0;
+			}
+			return -1;
+		} else if (n < (ssize_t)sizeof(bell)) {
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * 与 read 相同：返回读到的字节数；环空时返回 -1 且 errno 为 EAGAIN ；对端关闭且环已读空时返回 0 。
+ * 环读空时声明在等数据，之后的写入会发门铃；buffer 填满而环里还有数据时不会有门铃，调用者要自己再来读。
+ */
+static ssize_t
+shm_read(struct shm_link *l, int fd, void *buffer, size_t sz) {
+	if (shm_drain(l, fd) < 0)
+		return -1;
+	struct shm_ring *r = l->in;
+	size_t head = ATOM_LOAD(&r->head);
+	size_t got = 0;
+	for (;;) {
+		size_t avail = ATOM_LOAD(&r->tail) - head;
+		if (avail == 0) {
+			// 先声明在等数据再检查一次，生产者要么看到声明，要么我们看到它写的数据
+			ATOM_STORE(&r->wait_data, 1);
+			avail = ATOM_LOAD(&r->tail) - head;
+			if (avail == 0)
+				break;
+			ATOM_STORE(&r->wait_data, 0);
+		}
+		if (got == sz)
+			break;
+		if (avail > sz - got)
+			avail = sz - got;
+		size_t offset = head & (l->size - 1);
+		size_t n = l->size - offset;
+		if (n > avail)
+			n = avail;
+		memcpy((char *)buffer + got, l->rbuf + offset, n);
+		memcpy((char *)buffer + got + n, l->rbuf, avail - n);
+		got += avail;
+		head += avail;
+	}
+	if (got == 0) {
+		if (l->eof)
+			return 0;
+		errno = EAGAIN;
+		return -1;
+	}
+	ATOM_STORE(&r->head, head);
+	shm_notify(&r->wait_space, fd);
+	return (ssize_t)got;
+}
+
+#endif
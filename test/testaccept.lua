@@ -0,0 +1,52 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- accept rate benchmark : skynet testaccept [total] [concurrent]
+-- tune accept_budget in config to compare.
+local total, concurrent = ...
+total = tonumber(total) or 10000
+concurrent = tonumber(concurrent) or 200
+
+local PORT = 8003
+
+skynet.start(function()
+	local accepted = 0
+	local finish
+	local function done()
+		accepted = accepted + 1
+		if accepted == total then
+			skynet.wakeup(finish)
+		end
+	end
+	local lid = socket.listen("127.0.0.1", PORT, 4096)
+	socket.start(lid, function(id, addr)
+		socket.close_fd(id)
+		done()
+	end)
+
+	local start = skynet.now()
+	local count = 0
+	local failed = 0
+	local function dialer()
+		while count < total do
+			count = count + 1
+			local id = socket.open("127.0.0.1", PORT)
+			if id then
+				socket.close(id)
+			else
+				failed = failed + 1
+				done()
+			end
+		end
+	end
+	for i = 1, concurrent do
+		skynet.fork(dialer)
+	end
+	finish = coroutine.running()
+	skynet.wait(finish)
+	local ti = (skynet.now() - start) / 100
+	skynet.error(string.format("accept %d connections (%d failed) in %.2fs, %.0f/s",
+		total, failed, ti, total / math.max(ti, 0.01)))
+	socket.close(lid)
+	skynet.exit()
+end)
@@ -0,0 +1,126 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+local core = require "skynet.cluster.core"
+local socket = require "skynet.socket"
+
+-- cluster compression : the same calls over a plain link and a compressed link (__compress)
+-- usage : testclustercompress [calls per case]
+local mode = ...
+
+local PORT = 8016
+
+if mode == "echo" then
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, data)
+			if cmd == "echo" then
+				skynet.ret(skynet.pack(data))
+			elseif cmd == "size" then
+				skynet.ret(skynet.pack(#skynet.packstring(data)))
+			end
+		end)
+	end)
+	return
+end
+
+local CALLS = tonumber(mode) or 2000
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+-- a scene broadcast : many similar records, compresses well
+local function scene(n)
+	local list = {}
+	for i = 1, n do
+		list[i] = { id = i, name = "player" .. i, level = i % 100, pos = { x = i * 0.5, y = -i, z = 0 }, online = true }
+	end
+	return list
+end
+
+-- random bytes : does not shrink, must be sent as is
+local function noise(n)
+	local t = {}
+	for i = 1, n do
+		t[i] = string.char(math.random(0, 255))
+	end
+	return table.concat(t)
+end
+
+local function bench(node, name, data)
+	local start = skynet.hpc()
+	for i = 1, CALLS do
+		cluster.call(node, "@echo", "size", data)
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	skynet.error(string.format("%-8s %-6s %7d bytes : %8.1f calls/s", node, name, #skynet.packstring(data), CALLS / ti))
+end
+
+-- a compressed request whose rawsz can't come from its few compressed bytes : rejected, not allocated
+local function hostile()
+	local bad = string.pack("<BI4I4I4", 0x20, 1, 1, 0xffffffff) .. "\0\0\0\0"
+	assert(not pcall(core.unpackrequest, bad))
+	assert(core.unpackresponse(string.pack("<I4BI4", 1, 5, 0xffffffff) .. "\0\0\0\0") == nil)
+
+	local fd = socket.open("127.0.0.1", PORT)
+	for _, rawsz in ipairs { 0xffffffff, 0x100000 } do
+		socket.write(fd, string.pack(">s2", string.pack("<BI4I4I4", 0x20, 1, 1, rawsz) .. "\0\0\0\0"))
+		local sz = string.unpack(">I2", assert(socket.read(fd, 2)))
+		local session, ok = core.unpackresponse(assert(socket.read(fd, sz)))
+		assert(session == 1 and ok == false)
+	end
+	socket.close(fd)
+end
+
+skynet.start(function()
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	cluster.register("echo", echo)
+	cluster.open(PORT)
+	-- the compression of a node is fixed when it is first used
+	cluster.reload { plain = "127.0.0.1:" .. PORT }
+	cluster.call("plain", "@echo", "echo", "")
+	cluster.reload { plain = "127.0.0.1:" .. PORT, packed = "127.0.0.1:" .. PORT, __compress = 256 }
+
+	local cases = {
+		small = "hello",
+		scene = scene(100),
+		noise = noise(4096),
+		large = scene(100000),	-- > 8M raw, sent as multi part without compression
+	}
+	local before = core.compressstat()
+	for _, node in ipairs { "plain", "packed" } do
+		for name, data in pairs(cases) do
+			assert(equal(cluster.call(node, "@echo", "echo", data), data), name)
+		end
+		cluster.send(node, "@echo", "echo", cases.scene)
+	end
+	local stat = core.compressstat()
+	assert(stat.count > before.count and stat.ucount > before.ucount)
+	assert(stat.packed - before.packed < stat.raw - before.raw)
+	hostile()
+	skynet.error("clustercompress ok")
+
+	cases.large = nil
+	for _, name in ipairs { "small", "scene", "noise" } do
+		for _, node in ipairs { "plain", "packed" } do
+			bench(node, name, cases[name])
+		end
+	end
+	stat = core.compressstat()
+	skynet.error(string.format("compress %d messages : %d -> %d bytes (%.1f%%), %.1f us each; decompress %d messages, %.1f us each",
+		stat.count, stat.raw, stat.packed, stat.packed * 100 / stat.raw, stat.pack_time / stat.count / 1e3,
+		stat.ucount, stat.utime / math.max(stat.ucount, 1) / 1e3))
+	skynet.exit()
+end)
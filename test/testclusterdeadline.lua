@@ -0,0 +1,109 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+local socket = require "skynet.socket"
+local core = require "skynet.cluster.core"
+
+-- cluster.calltimeout : fail fast on the caller, drop expired requests on the callee
+-- usage : testclusterdeadline
+local mode = ...
+
+local PORT = 8018
+
+if mode == "echo" then
+	local hits = 0
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, data)
+			if cmd == "echo" then
+				skynet.ret(skynet.pack(data))
+			elseif cmd == "sleep" then
+				hits = hits + 1
+				skynet.sleep(data)
+				skynet.ret(skynet.pack(data))
+			elseif cmd == "hit" then
+				hits = hits + 1
+				skynet.ret(skynet.pack(hits))
+			elseif cmd == "hits" then
+				skynet.ret(skynet.pack(hits))
+				hits = 0
+			end
+		end)
+	end)
+	return
+end
+
+-- a v4 link without clustersender : request(address, cmd, timeout, clock, ...) returns ok, data
+local function v4_client()
+	local fd = assert(socket.open("127.0.0.1", PORT))
+	socket.write(fd, (core.packrequest(0, 1, skynet.pack(core.hello, 0, 4))))
+	local session, ok, data = core.unpackresponse(socket.read(fd, socket.header(socket.read(fd, 2))))
+	assert(session == 1 and ok and skynet.unpack(data) == 4)
+	session = 2
+	return fd, function(address, cmd, timeout, clock, ...)
+		local deadline = string.pack("<I4I4B", timeout, clock & 0xffffffff, 5)
+		socket.write(fd, string.pack(">s4", deadline))
+		local msg, sz = skynet.pack(cmd, ...)
+		local req, next_session = core.packrequest(address, session, msg, sz, 4)
+		session = next_session
+		socket.write(fd, req)
+		local _, ok, data = core.unpackresponse(socket.read(fd, socket.header(socket.read(fd, 4))))
+		if ok then
+			return skynet.unpack(data)
+		end
+		return ok, data
+	end
+end
+
+local function timeout(node, ti, ...)
+	local start = skynet.now()
+	local ok, err = pcall(cluster.calltimeout, node, ti, "@echo", ...)
+	assert(not ok and err:find "timeout", err)
+	return skynet.now() - start
+end
+
+skynet.start(function()
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	cluster.register("echo", echo)
+	cluster.open(PORT)
+	cluster.reload { db = "127.0.0.1:" .. PORT }
+
+	-- in time
+	assert(cluster.calltimeout("db", 100, "@echo", "echo", "hello") == "hello")
+	assert(cluster.calltimeout("db", 100, echo, "echo", "hello") == "hello")
+	-- already expired : not sent at all
+	timeout("db", 0, "hit")
+	assert(cluster.call("db", "@echo", "hits") == 0)
+
+	-- the callee is slow : the caller gives up in time, the late response is dropped
+	local ti = timeout("db", 10, "sleep", 100)
+	assert(ti >= 10 and ti < 50, ti)
+	local co = coroutine.running()
+	local n = 100
+	for i = 1, n do
+		skynet.fork(function()
+			timeout("db", 5, "sleep", 50)
+			n = n - 1
+			if n == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	skynet.sleep(150)
+	assert(cluster.call("db", "@echo", "hits") == 101)
+	assert(cluster.call("db", "@echo", "echo", "hello") == "hello")
+	skynet.error("local deadline ok")
+
+	-- the callee side : a raw v4 link with our own clock, so the delay on the way is exact
+	local fd, request = v4_client()
+	assert(request("@echo", "hits", 1000, skynet.now() * 10) == 0)	-- clock in ms
+	-- sent 500ms ago (by our clock) with 100ms left : expired on arrival, not executed
+	local ok, err = request("@echo", "hit", 100, skynet.now() * 10 - 500)
+	assert(not ok and err == "deadline exceeded", err)
+	-- in time on arrival but the callee answers late : the response is replaced by the error
+	ok, err = request("@echo", "sleep", 200, skynet.now() * 10, 50)
+	assert(not ok and err == "deadline exceeded", err)
+	assert(request("@echo", "hits", 1000, skynet.now() * 10) == 1)
+	socket.close(fd)
+	skynet.error("remote deadline ok")
+	skynet.exit()
+end)
@@ -0,0 +1,102 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+
+-- cluster connection pool : small calls mixed with large (1M) responses over 1..8 connections
+-- usage : testclusterpool [small calls] [large callers]
+local mode, small, large = ...
+
+local PORT = 8015
+local CONCURRENT = 16
+
+if mode == "echo" then
+	local big = string.rep("x", 1024 * 1024)
+	local last = {}
+	local disorder = 0
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, key, n)
+			if cmd == "small" then
+				skynet.ret(skynet.pack(key))
+			elseif cmd == "large" then
+				skynet.ret(skynet.pack(big))
+			elseif cmd == "order" then
+				-- push, must arrive in order for the same address
+				if n ~= (last[key] or 0) + 1 then
+					disorder = disorder + 1
+				end
+				last[key] = n
+			elseif cmd == "check" then
+				skynet.ret(skynet.pack(last[key], disorder))
+			end
+		end)
+	end)
+	return
+end
+
+local SMALL = tonumber(mode) or 20000
+local LARGE = tonumber(small) or 2
+
+local function bench(node, conns)
+	local latency = {}
+	local running = true
+	local large_count = 0
+	local co = coroutine.running()
+	local done = 0
+	local start = skynet.hpc()
+	for i = 1, LARGE do
+		skynet.fork(function()
+			while running do
+				assert(#cluster.call(node, "@echo", "large") == 1024 * 1024)
+				large_count = large_count + 1
+			end
+			done = done + 1
+			if done == LARGE + CONCURRENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	for i = 1, CONCURRENT do
+		skynet.fork(function()
+			for j = i, SMALL, CONCURRENT do
+				local t = skynet.hpc()
+				assert(cluster.call(node, "@echo", "small", j) == j)
+				latency[j] = skynet.hpc() - t
+			end
+			done = done + 1
+			if done == CONCURRENT then
+				running = false
+			end
+			if done == LARGE + CONCURRENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	table.sort(latency)
+	skynet.error(string.format("%d connections : %7.1f small calls/s, p50 %6.2f ms, p99 %6.2f ms, large %6.1f MB/s",
+		conns, SMALL / ti, latency[SMALL // 2] / 1e6, latency[SMALL * 99 // 100] / 1e6, large_count / ti))
+end
+
+skynet.start(function()
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	cluster.register("echo", echo)
+	cluster.open(PORT)
+
+	-- the pool size of a node is fixed when it is first used
+	for _, n in ipairs { 1, 2, 4, 8 } do
+		local node = "pool" .. n
+		cluster.reload { [node] = "127.0.0.1:" .. PORT, __connections = n }
+		-- sends to one address stay on one connection and keep their order
+		for i = 1, 1000 do
+			cluster.send(node, "@echo", "order", "a" .. n, i)
+			cluster.send(node, "@echo", "order", "b" .. n, i)
+		end
+		local last, disorder = cluster.call(node, "@echo", "check", "b" .. n)
+		assert(disorder == 0)
+		bench(node, n)
+		last, disorder = cluster.call(node, "@echo", "check", "b" .. n)
+		assert(last == 1000 and disorder == 0, disorder)
+	end
+	skynet.error("clusterpool ok")
+	skynet.exit()
+end)
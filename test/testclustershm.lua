@@ -0,0 +1,113 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+
+-- cluster over shared memory (__shm) compared with loopback tcp : a node calling itself, as testclusterv2
+-- usage : testclustershm [calls per latency case] [MB per throughput case]
+local mode, mb = ...
+
+local PORT = 8017
+local CONCURRENT = 16
+
+if mode == "echo" then
+	local last = 0
+	local disorder = 0
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, data)
+			if cmd == "echo" then
+				skynet.ret(skynet.pack(data))
+			elseif cmd == "size" then
+				skynet.ret(skynet.pack(#data))
+			elseif cmd == "order" then
+				-- push, must arrive in order
+				if data ~= last + 1 then
+					disorder = disorder + 1
+				end
+				last = data
+			elseif cmd == "check" then
+				skynet.ret(skynet.pack(last, disorder))
+				last = 0
+			end
+		end)
+	end)
+	return
+end
+
+local CALLS = tonumber(mode) or 10000
+local MB = tonumber(mb) or 64
+
+-- sequential calls : one request on the link at a time
+local function latency(node, size)
+	local payload = string.rep("x", size)
+	local t = {}
+	for i = 1, CALLS do
+		local start = skynet.hpc()
+		cluster.call(node, "@echo", "size", payload)
+		t[i] = skynet.hpc() - start
+	end
+	table.sort(t)
+	skynet.error(string.format("%-4s latency %7d bytes : p50 %6.1f us, p99 %6.1f us",
+		node, size, t[CALLS // 2] / 1e3, t[CALLS * 99 // 100] / 1e3))
+end
+
+local function throughput(node, size)
+	local payload = string.rep("x", size)
+	local loops = math.max(CONCURRENT, MB * 1024 * 1024 // math.max(size, 1024))
+	local done = 0
+	local co = coroutine.running()
+	local start = skynet.hpc()
+	for i = 1, CONCURRENT do
+		skynet.fork(function()
+			for j = i, loops, CONCURRENT do
+				assert(cluster.call(node, "@echo", "size", payload) == size)
+			end
+			done = done + 1
+			if done == CONCURRENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	skynet.error(string.format("%-4s throughput %7d bytes : %8.1f calls/s, %7.1f MB/s",
+		node, size, loops / ti, size * loops / ti / (1024 * 1024)))
+end
+
+skynet.start(function()
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	cluster.register("echo", echo)
+	cluster.open(PORT)
+	-- tiny : 64K rings, large messages wrap around and wait for space many times
+	cluster.reload {
+		tcp = "127.0.0.1:" .. PORT,
+		shm = "127.0.0.1:" .. PORT,
+		tiny = "127.0.0.1:" .. PORT,
+		__shm = { shm = true, tiny = 0x10000 },
+	}
+
+	-- correctness : small, single package and multi part (> 8M) messages in both directions
+	for _, node in ipairs { "tiny", "shm" } do
+		for _, size in ipairs { 0, 1024, 65535, 65536, 1024 * 1024, 10 * 1024 * 1024 + 1 } do
+			local data = string.rep("y", size)
+			assert(cluster.call(node, "@echo", "echo", data) == data, size)
+			assert(cluster.call(node, echo, "size", data) == size, size)
+		end
+		for i = 1, 10000 do
+			cluster.send(node, "@echo", "order", i)
+		end
+		local last, disorder = cluster.call(node, "@echo", "check")
+		assert(last == 10000 and disorder == 0, disorder)
+	end
+	skynet.error("clustershm ok")
+
+	for _, size in ipairs { 16, 1024, 65536 } do
+		for _, node in ipairs { "tcp", "shm" } do
+			latency(node, size)
+		end
+	end
+	for _, size in ipairs { 16, 1024, 65536, 1024 * 1024 } do
+		for _, node in ipairs { "tcp", "shm" } do
+			throughput(node, size)
+		end
+	end
+	skynet.exit()
+end)
@@ -0,0 +1,93 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+
+-- cluster throughput between two nodes in this process (a node calling itself through loopback)
+-- the connection negotiates v2 framing : 4 bytes header, split by the socket thread
+-- usage : testclusterv2 [MB per case] [concurrent calls]
+local mode, mb, concurrent = ...
+
+local PORT = 8014
+
+if mode == "echo" then
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, data)
+			if cmd == "size" then
+				skynet.ret(skynet.pack(#data))
+			elseif cmd == "echo" then
+				skynet.ret(skynet.pack(data))
+			else
+				-- push
+				skynet.error("push", #data)
+			end
+		end)
+	end)
+	return
+end
+
+local MB = tonumber(mode) or 32
+local CONCURRENT = tonumber(mb) or 8
+
+-- an old node only speaks v1 : query a name without the handshake
+local function v1_client(name)
+	local socket = require "skynet.socket"
+	local core = require "skynet.cluster.core"
+	local fd = assert(socket.open("127.0.0.1", PORT))
+	socket.write(fd, (core.packrequest(0, 1, skynet.pack(name))))
+	local sz = socket.header(socket.read(fd, 2))
+	local session, ok, data = core.unpackresponse(socket.read(fd, sz))
+	socket.close(fd)
+	assert(session == 1 and ok)
+	return skynet.unpack(data)
+end
+
+local function bench(size)
+	local payload = string.rep("x", size)
+	local loops = math.max(CONCURRENT, MB * 1024 * 1024 // math.max(size, 1024))
+	local done = 0
+	local co = coroutine.running()
+	local start = skynet.hpc()
+	for i = 1, CONCURRENT do
+		skynet.fork(function()
+			for j = i, loops, CONCURRENT do
+				assert(cluster.call("self", "@echo", "size", payload) == size)
+			end
+			done = done + 1
+			if done == CONCURRENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	skynet.error(string.format("%8d bytes x %5d : %.3f s, %7.1f MB/s, %8.1f calls/s",
+		size, loops, ti, size * loops / ti / (1024 * 1024), loops / ti))
+end
+
+local LARGE_MAX = 16 * 1024 * 1024
+
+skynet.start(function()
+	skynet.setenv("cluster_large_max", tostring(LARGE_MAX))
+	cluster.reload { self = "127.0.0.1:" .. PORT }
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	cluster.register("echo", echo)
+	cluster.open(PORT)
+
+	-- correctness : small, single package and multi part (> 8M) messages in both directions
+	for _, size in ipairs { 0, 1024, 0x8000, 65536, 4 * 1024 * 1024, 10 * 1024 * 1024 + 1 } do
+		local data = string.rep("y", size)
+		assert(cluster.call("self", "@echo", "echo", data) == data, size)
+		assert(cluster.call("self", echo, "size", data) == size, size)
+	end
+	cluster.send("self", "@echo", "push", string.rep("z", 10 * 1024 * 1024))
+	assert(v1_client("echo") == echo)
+	-- a request larger than cluster_large_max drops the connection, the next call reconnects
+	local ok = pcall(cluster.call, "self", "@echo", "size", string.rep("w", LARGE_MAX + 1))
+	assert(not ok)
+	assert(cluster.call("self", "@echo", "size", "after") == 5)
+	skynet.error("clusterv2 ok")
+
+	for _, size in ipairs { 16, 1024, 65536, 4 * 1024 * 1024 } do
+		bench(size)
+	end
+	skynet.exit()
+end)
@@ -0,0 +1,173 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.launch, skynet.name
+
+-- framing in socket thread (socket.frame) test : lua socket, service gate (netpack) and C gate
+local mode = ...
+
+local PORT = 8007
+local COUNT = 1000
+
+local function packets(header)
+	local fmt = header == 2 and ">s2" or ">s4"
+	local list = {}
+	local stream = {}
+	for i = 1, COUNT do
+		local sz = math.random(0, 2000)
+		if i % 100 == 0 then
+			sz = header == 2 and 65535 or 200000
+		end
+		local p = string.rep(string.char(i % 256), sz)
+		list[i] = p
+		stream[i] = string.pack(fmt, p)
+	end
+	return list, table.concat(stream)
+end
+
+-- send the stream in random slices
+local function send_stream(id, stream)
+	local pos = 1
+	while pos <= #stream do
+		local n = math.random(1, 8192)
+		socket.write(id, stream:sub(pos, pos + n - 1))
+		pos = pos + n
+		if math.random(4) == 1 then
+			skynet.sleep(0)
+		end
+	end
+end
+
+local function wait(f)
+	for i = 1, 1000 do
+		if f() then
+			return true
+		end
+		skynet.sleep(1)
+	end
+end
+
+local function test_socket()
+	local list, stream = packets(4)
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.frame(lid, 4, 1024 * 1024)
+	local done
+	local oversize
+	local midframe
+	socket.start(lid, function(id)
+		socket.start(id)
+		if midframe then
+			midframe(id)
+			return
+		end
+		if done then
+			-- oversize packet closes the connection
+			oversize = socket.read(id)
+			socket.close(id)
+			return
+		end
+		for i = 1, COUNT do
+			local sz = string.unpack(">I4", socket.read(id, 4))
+			local p = sz == 0 and "" or socket.read(id, sz)
+			assert(p == list[i], i)
+		end
+		socket.close(id)
+		done = true
+	end)
+	local c = socket.open("127.0.0.1", PORT)
+	send_stream(c, stream)
+	assert(wait(function() return done end))
+	socket.close(c)
+
+	c = socket.open("127.0.0.1", PORT)
+	socket.write(c, string.pack(">I4", 2 * 1024 * 1024) .. "xxxx")
+	assert(wait(function() return oversize ~= nil end))
+	assert(oversize == false)
+	socket.close(c)
+
+	-- the header size can't change in the middle of a packet
+	local sid
+	midframe = function(id)
+		sid = id
+	end
+	local body = string.rep("z", 300000)
+	local packet = string.pack(">s4", body)
+	c = socket.open("127.0.0.1", PORT)
+	socket.write(c, packet:sub(1, 1000))
+	assert(wait(function() return sid end))
+	skynet.sleep(10)
+	socket.frame(sid, 2, 1024)	-- ignored
+	socket.write(c, packet:sub(1001))
+	local sz = string.unpack(">I4", socket.read(sid, 4))
+	assert(socket.read(sid, sz) == body)
+	socket.close(sid)
+	socket.close(c)
+	socket.close(lid)
+	skynet.error("socket frame ok")
+end
+
+local function test_gate()
+	local list, stream = packets(2)
+	local recv = {}
+	local gate = skynet.newservice("gate")
+	skynet.dispatch("lua", function(_, _, cmd, subcmd, fd, msg)
+		assert(cmd == "socket")
+		if subcmd == "open" then
+			skynet.call(gate, "lua", "accept", fd)
+		elseif subcmd == "data" then
+			table.insert(recv, msg)
+		end
+	end)
+	skynet.call(gate, "lua", "open", { port = PORT + 1, maxclient = 16, frame = true, watchdog = skynet.self() })
+	local c = socket.open("127.0.0.1", PORT + 1)
+	send_stream(c, stream)
+	assert(wait(function() return #recv == COUNT end))
+	for i = 1, COUNT do
+		assert(recv[i] == list[i], i)
+	end
+	socket.close(c)
+	skynet.error("gate frame ok")
+end
+
+local function test_cgate()
+	local list, stream = packets(4)
+	local recv = {}
+	skynet.register_protocol {
+		name = "text",
+		id = skynet.PTYPE_TEXT,
+		pack = function(text) return text end,
+		unpack = skynet.tostring,
+		dispatch = function(_, _, msg)
+			skynet.ignoreret()	-- C gate uses fd as session
+			local fd, cmd, data = msg:match "^(%d+) (%a+) ?(.*)$"
+			if cmd == "data" then
+				table.insert(recv, data)
+			elseif cmd == "open" then
+				skynet.send(".cgate", "text", "start " .. fd)
+			end
+		end,
+	}
+	local gate = skynet.launch("gate", string.format("L %s 127.0.0.1:%d 0 16",
+		skynet.address(skynet.self()), PORT + 2))
+	skynet.name(".cgate", gate)
+	local c = socket.open("127.0.0.1", PORT + 2)
+	send_stream(c, stream)
+	assert(wait(function() return #recv == COUNT end))
+	for i = 1, COUNT do
+		assert(recv[i] == list[i], i)
+	end
+	socket.close(c)
+	skynet.error("cgate frame ok")
+end
+
+skynet.start(function()
+	if mode == nil or mode == "socket" then
+		test_socket()
+	end
+	if mode == nil or mode == "gate" then
+		test_gate()
+	end
+	if mode == nil or mode == "cgate" then
+		test_cgate()
+	end
+	skynet.exit()
+end)
@@ -0,0 +1,117 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.launch, skynet.name
+
+-- sharded C gate test and load harness : compare one gate with N shards
+-- usage : testgateshard [shards] [clients] [count]
+local SHARDS, CLIENTS, COUNT = ...
+SHARDS = tonumber(SHARDS) or 4
+CLIENTS = tonumber(CLIENTS) or 64
+COUNT = tonumber(COUNT) or 2000
+
+local PORT = 8010
+local PACKET = string.pack(">s2", string.rep("x", 100))
+
+local opened = {}
+local closed = {}
+local recv = 0
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, _, msg)
+		skynet.ignoreret()	-- C gate uses fd as session
+		local fd, cmd = msg:match "^(%d+) (%a+)"
+		fd = tonumber(fd)
+		if cmd == "open" then
+			opened[fd] = true
+			skynet.send(".cgate", "text", "start " .. fd)
+		elseif cmd == "close" then
+			closed[fd] = true
+		end
+	end,
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function() end,
+	dispatch = function()
+		skynet.ignoreret()
+		recv = recv + 1
+	end,
+}
+
+local function wait(f)
+	for i = 1, 3000 do
+		if f() then
+			return true
+		end
+		skynet.sleep(1)
+	end
+end
+
+local function count(t)
+	local n = 0
+	for _ in pairs(t) do
+		n = n + 1
+	end
+	return n
+end
+
+local function run(shards, port)
+	opened = {}
+	closed = {}
+	recv = 0
+	local gate = skynet.launch("gate", string.format("S %s 127.0.0.1:%d 0 %d %d",
+		skynet.address(skynet.self()), port, CLIENTS + 1, shards))
+	skynet.name(".cgate", gate)
+	skynet.send(gate, "text", "broker " .. skynet.address(skynet.self()))
+
+	local conns = {}
+	for i = 1, CLIENTS do
+		conns[i] = socket.open("127.0.0.1", port)
+	end
+	assert(wait(function() return count(opened) == CLIENTS end))
+
+	local batch = string.rep(PACKET, 100)
+	local start = skynet.now()
+	for i = 1, CLIENTS do
+		skynet.fork(function()
+			for j = 1, COUNT // 100 do
+				socket.write(conns[i], batch)
+				skynet.sleep(0)
+			end
+		end)
+	end
+	local total = CLIENTS * (COUNT // 100) * 100
+	assert(wait(function() return recv == total end), recv)
+	local ti = skynet.now() - start
+	skynet.error(string.format("shards %d : %d packets in %d cs", shards, total, ti))
+
+	-- kick from watchdog is routed to the owning shard
+	local fd = next(opened)
+	skynet.send(gate, "text", "kick " .. fd)
+	assert(wait(function() return closed[fd] end))
+	-- client close is reported by the shard
+	for i = 1, CLIENTS do
+		socket.close(conns[i])
+	end
+	assert(wait(function() return count(closed) == CLIENTS end))
+	-- slots are released, the front accepts new connections again
+	local c = socket.open("127.0.0.1", port)
+	assert(wait(function() return count(opened) == CLIENTS + 1 end))
+	socket.close(c)
+	assert(wait(function() return count(closed) == CLIENTS + 1 end))
+	skynet.kill(gate)
+	return ti
+end
+
+skynet.start(function()
+	local t1 = run(1, PORT)
+	local tn = run(SHARDS, PORT + 1)
+	skynet.error(string.format("gate shard ok : 1 gate %d cs, %d shards %d cs", t1, SHARDS, tn))
+	skynet.exit()
+end)
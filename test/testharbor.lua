@@ -0,0 +1,109 @@
+local skynet = require "skynet"
+local harbor = require "skynet.harbor"
+require "skynet.manager"	-- import skynet.register, skynet.abort
+
+-- harbor throughput between two local processes (messages go through service_harbor)
+-- usage : start two nodes with start = "testharbor"
+--   harbor 1 : examples/config (the standalone master)
+--   harbor 2 : the same config with harbor = 2, address = "127.0.0.1:2527" and without standalone
+-- harbor 1 serves the global name HARBORECHO, harbor 2 runs the test and stops both nodes
+local mode = ...
+
+local CALLS = 20000
+local SENDS = 50000
+local CONCURRENT = 16
+
+if mode == "echo" then
+	local last = 0
+	local disorder = 0
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, data)
+			if cmd == "echo" then
+				skynet.ret(skynet.pack(data))
+			elseif cmd == "size" then
+				skynet.ret(skynet.pack(#data))
+			elseif cmd == "order" then
+				-- push, must arrive in order
+				if data ~= last + 1 then
+					disorder = disorder + 1
+				end
+				last = data
+			elseif cmd == "check" then
+				skynet.ret(skynet.pack(last, disorder))
+				last = 0
+			elseif cmd == "exit" then
+				skynet.abort()
+			end
+		end)
+		skynet.register "HARBORECHO"
+	end)
+	return
+end
+
+local function calls(addr, size)
+	local payload = string.rep("x", size)
+	local done = 0
+	local co = coroutine.running()
+	local start = skynet.hpc()
+	for i = 1, CONCURRENT do
+		skynet.fork(function()
+			for j = i, CALLS, CONCURRENT do
+				assert(skynet.call(addr, "lua", "size", payload) == size)
+			end
+			done = done + 1
+			if done == CONCURRENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	skynet.error(string.format("call %6d bytes : %8.1f calls/s, %7.1f MB/s", size, CALLS / ti, CALLS * size / ti / (1024 * 1024)))
+end
+
+-- addr may be a global name : resolved by the name cache in skynet_sendname
+local function sends(addr)
+	local start = skynet.hpc()
+	for i = 1, SENDS do
+		skynet.send(addr, "lua", "order", i)
+	end
+	local last, disorder = skynet.call(addr, "lua", "check")
+	assert(last == SENDS and disorder == 0, disorder)
+	local ti = (skynet.hpc() - start) / 1e9
+	skynet.error(string.format("send to %-10s : %8.1f messages/s", type(addr) == "number" and skynet.address(addr) or addr, SENDS / ti))
+end
+
+skynet.start(function()
+	if tonumber(skynet.getenv "harbor") == 1 then
+		skynet.newservice(SERVICE_NAME, "echo")
+		return
+	end
+	local addr = harbor.queryname "HARBORECHO"
+
+	-- correctness : small, batched and large (compressed when harbor_compress is set) messages
+	for _, size in ipairs { 0, 100, 4096, 0x10000, 1024 * 1024, 5 * 1024 * 1024 } do
+		local data = string.rep("y", size)
+		assert(skynet.call(addr, "lua", "echo", data) == data, size)
+	end
+	for i = 1, 1000 do
+		skynet.send(addr, "lua", "order", i)
+	end
+	local last, disorder = skynet.call(addr, "lua", "check")
+	assert(last == 1000 and disorder == 0)
+	-- by name, mixed with sends by handle
+	for i = 1, 1000 do
+		skynet.send(i % 2 == 0 and addr or "HARBORECHO", "lua", "order", i)
+	end
+	last, disorder = skynet.call("HARBORECHO", "lua", "check")
+	assert(last == 1000 and disorder == 0)
+	skynet.error("harbor ok")
+
+	sends(addr)
+	sends "HARBORECHO"
+	for _, size in ipairs { 16, 1024, 65536 } do
+		calls(addr, size)
+	end
+	skynet.send(addr, "lua", "exit")
+	skynet.sleep(10)
+	skynet.abort()
+end)
@@ -0,0 +1,69 @@
+local skynet = require "skynet"
+
+-- async logger test, run with config :
+--	logger = "/tmp/testlogger/skynet.log"
+--	logbuffer = 64	-- KB, small enough to drop some lines in a burst
+--	logrotate_size = 1	-- MB
+local N = 100000
+local PAD = string.rep("x", 80)
+
+local function log_files(filename)
+	local dir, base = filename:match "^(.*)/([^/]+)$"
+	local files = {}
+	local f = io.popen("ls " .. dir)
+	for name in f:lines() do
+		if name == base or name:sub(1, #base + 1) == base .. "." then
+			table.insert(files, dir .. "/" .. name)
+		end
+	end
+	f:close()
+	return files
+end
+
+skynet.start(function()
+	local filename = skynet.getenv "logger"
+	if not filename or not skynet.getenv "logbuffer" then
+		skynet.error("testlogger needs logger and logbuffer in config")
+		skynet.exit()
+		return
+	end
+	local tag = "testlogger " .. skynet.now()
+	for i = 1, N do
+		skynet.error(tag, i, PAD)
+	end
+	skynet.sleep(200)
+
+	local count = 0
+	local dropped = 0
+	local last = 0
+	local files = log_files(filename)
+	table.sort(files, function(a, b)
+		-- rotated files first, the current file last
+		if a == filename then return false end
+		if b == filename then return true end
+		return a < b
+	end)
+	for _, name in ipairs(files) do
+		for line in io.lines(name) do
+			local i = line:match(tag .. " (%d+)")
+			if i then
+				i = tonumber(i)
+				assert(i > last, "out of order")
+				last = i
+				count = count + 1
+			end
+			local n = line:match "%[logger%] (%d+) messages dropped"
+			if n then
+				dropped = dropped + tonumber(n)
+			end
+		end
+	end
+	print(string.format("%d files, %d lines, %d dropped", #files, count, dropped))
+	-- dropped counts other services' lines too
+	assert(count <= N and count + dropped >= N)
+	if skynet.getenv "logrotate_size" then
+		assert(#files > 1)
+	end
+	skynet.error("logger ok")
+	skynet.exit()
+end)
@@ -0,0 +1,61 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- slot table growth : skynet testmaxsocket [count]
+-- set max_socket in config (eg. max_socket = 16384), 2*count sockets must fit in it.
+local count = ...
+count = tonumber(count) or 6000
+
+local PORT = 8005
+
+skynet.start(function()
+	local accepted = {}
+	local lid = socket.listen("127.0.0.1", PORT, 4096)
+	socket.start(lid, function(id, addr)
+		table.insert(accepted, id)
+	end)
+
+	local clients = {}
+	local failed = 0
+	for i = 1, count do
+		local id = socket.open("127.0.0.1", PORT)
+		if id then
+			table.insert(clients, id)
+		else
+			failed = failed + 1
+		end
+	end
+	while #accepted < #clients do
+		skynet.sleep(10)
+	end
+	local n = #socket.netstat()
+	skynet.error(string.format("open %d, failed %d, accepted %d, netstat %d",
+		#clients, failed, #accepted, n))
+
+	-- every id should still be unique after the table grows
+	local ids = {}
+	for _, id in ipairs(clients) do
+		assert(not ids[id])
+		ids[id] = true
+	end
+	for _, id in ipairs(accepted) do
+		assert(not ids[id])
+		ids[id] = true
+	end
+
+	for _, id in ipairs(clients) do
+		socket.close(id)
+	end
+	for _, id in ipairs(accepted) do
+		socket.close(id)
+	end
+	-- ids after closing should be valid too, and stale ids are rejected
+	local id = socket.open("127.0.0.1", PORT)
+	assert(id and not ids[id])
+	assert(not socket.invalid(id))
+	assert(socket.invalid(clients[1]))
+	socket.close(id)
+	socket.close(lid)
+	skynet.error("maxsocket ok")
+	skynet.exit()
+end)
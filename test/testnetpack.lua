@@ -0,0 +1,100 @@
+local skynet = require "skynet"
+local gateserver = require "snax.gateserver"
+local netpack = require "skynet.netpack"
+
+-- netpack benchmark : many connections sending small packets split at random positions
+-- usage : testnetpack [conns] [packets per connection]
+-- every connection uses two fds in this process, so 10000 connections need ulimit -n > 20000
+local mode, count = ...
+
+local PORT = 8013
+
+if mode == "server" then
+	local count = 0
+	local bad = 0
+	local handler = {}
+
+	function handler.connect(fd)
+		gateserver.openclient(fd)
+	end
+
+	function handler.message(fd, msg, sz)
+		local s = netpack.tostring(msg, sz)
+		if s ~= string.rep(string.char(sz % 256), sz) then
+			bad = bad + 1
+		end
+		count = count + 1
+	end
+
+	function handler.disconnect(fd)
+	end
+
+	function handler.command(cmd)
+		if cmd == "count" then
+			return count, bad
+		end
+	end
+
+	gateserver.start(handler)
+	return
+end
+
+local socket = require "skynet.socket"	-- gateserver registers the socket protocol itself
+
+local CONNS = tonumber(mode) or 4000
+local COUNT = tonumber(count) or 100
+
+-- one stream of COUNT small packets, cut into slices at random positions (1 byte slices included)
+local function slices()
+	local stream = {}
+	for i = 1, COUNT do
+		local sz = math.random(1, 200)
+		stream[i] = string.pack(">s2", string.rep(string.char(sz % 256), sz))
+	end
+	stream = table.concat(stream)
+	local list = {}
+	local pos = 1
+	while pos <= #stream do
+		local n = math.random(4) == 1 and 1 or math.random(1, 300)
+		table.insert(list, stream:sub(pos, pos + n - 1))
+		pos = pos + n
+	end
+	return list
+end
+
+skynet.start(function()
+	local gate = skynet.newservice(SERVICE_NAME, "server")
+	skynet.call(gate, "lua", "open", { port = PORT, maxclient = CONNS + 1 })
+
+	local conns = {}
+	for i = 1, CONNS do
+		conns[i] = assert(socket.open("127.0.0.1", PORT))
+	end
+	skynet.error(string.format("%d connections opened", CONNS))
+
+	local list = slices()
+	local start = skynet.now()
+	for _, s in ipairs(list) do
+		for i = 1, CONNS do
+			socket.write(conns[i], s)
+		end
+		skynet.sleep(0)
+	end
+	local total = CONNS * COUNT
+	local count, bad
+	for i = 1, 6000 do
+		count, bad = skynet.call(gate, "lua", "count")
+		if count == total then
+			break
+		end
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	skynet.error(string.format("%d packets (%d slices per connection) in %d cs", count, #list, ti))
+	assert(count == total and bad == 0, count)
+	for i = 1, CONNS do
+		socket.close(conns[i])
+	end
+	skynet.error("netpack ok")
+	skynet.exit()
+end)
@@ -0,0 +1,145 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.launch, skynet.name
+
+-- C gate forward mode : packets go from socket thread to agent directly (socket redirect)
+local PORT = 8012
+local COUNT = 10000
+
+local opened = {}
+local closed = {}
+local recv = {}
+local direct = {}	-- packets pushed by socket thread (source 0), not forwarded by gate
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, _, msg)
+		skynet.ignoreret()	-- C gate uses fd as session
+		local fd, cmd = msg:match "^(%d+) (%a+)"
+		fd = tonumber(fd)
+		if cmd == "open" then
+			table.insert(opened, fd)
+		elseif cmd == "close" then
+			closed[fd] = true
+		end
+	end,
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = skynet.tostring,
+	dispatch = function(session, source, msg)
+		skynet.ignoreret()
+		local fd = session
+		local list = recv[fd]
+		if not list then
+			list = {}
+			recv[fd] = list
+		end
+		table.insert(list, msg)
+		if source == 0 then
+			direct[fd] = (direct[fd] or 0) + 1
+		end
+	end,
+}
+
+local function wait(f)
+	for i = 1, 1000 do
+		if f() then
+			return true
+		end
+		skynet.sleep(1)
+	end
+end
+
+local function send(c)
+	local batch = {}
+	for i = 1, COUNT do
+		table.insert(batch, string.pack(">s2", tostring(i)))
+		if i % 500 == 0 then
+			socket.write(c, table.concat(batch))
+			batch = {}
+			skynet.sleep(0)
+		end
+	end
+end
+
+local function check(fd)
+	assert(wait(function() return recv[fd] and #recv[fd] == COUNT end), recv[fd] and #recv[fd])
+	for i = 1, COUNT do
+		assert(recv[fd][i] == tostring(i), i)
+	end
+end
+
+skynet.start(function()
+	local self = skynet.address(skynet.self())
+	local gate = skynet.launch("gate", string.format("S %s 127.0.0.1:%d 0 16", self, PORT))
+	skynet.name(".cgate", gate)
+
+	-- 1. forward before start : redirected in socket thread
+	local c = socket.open("127.0.0.1", PORT)
+	assert(wait(function() return #opened == 1 end))
+	local fd = opened[1]
+	skynet.send(gate, "text", string.format("forward %d %s 0", fd, self))
+	skynet.send(gate, "text", "start " .. fd)
+	send(c)
+	check(fd)
+	skynet.error("redirect ok")
+
+	-- 2. redirect after start : gate forwards first (a client address keeps it from redirecting),
+	-- then forward again without it while packets are still in flight to gate. order is kept.
+	local c2 = socket.open("127.0.0.1", PORT)
+	assert(wait(function() return #opened == 2 end))
+	local fd2 = opened[2]
+	skynet.send(gate, "text", string.format("forward %d %s %s", fd2, self, self))
+	skynet.send(gate, "text", "start " .. fd2)
+	local batch = {}
+	for i = 1, COUNT do
+		table.insert(batch, string.pack(">s2", tostring(i)))
+		if i % 500 == 0 then
+			socket.write(c2, table.concat(batch))
+			batch = {}
+			if i == 2000 then
+				skynet.send(gate, "text", string.format("forward %d %s 0", fd2, self))
+			else
+				skynet.sleep(0)
+			end
+		end
+	end
+	check(fd2)
+	assert(direct[fd2] and direct[fd2] > 0 and direct[fd2] < COUNT, direct[fd2])
+	skynet.error("forward after start ok")
+
+	-- 3. large packets are read into their own buffer and handed over as is, mixed with small ones
+	local c3 = socket.open("127.0.0.1", PORT)
+	assert(wait(function() return #opened == 3 end))
+	local fd3 = opened[3]
+	skynet.send(gate, "text", string.format("forward %d %s 0", fd3, self))
+	skynet.send(gate, "text", "start " .. fd3)
+	local expect = {}
+	for i = 1, 100 do
+		local pack = i % 3 == 0 and string.rep(string.char(i), 60000 + i) or tostring(i)
+		expect[i] = pack
+		socket.write(c3, string.pack(">s2", pack))
+	end
+	assert(wait(function() return recv[fd3] and #recv[fd3] == 100 end))
+	for i = 1, 100 do
+		assert(recv[fd3][i] == expect[i], i)
+	end
+	socket.close(c3)
+	skynet.error("large packet ok")
+
+	-- 4. close and kick still go through gate
+	socket.close(c)
+	assert(wait(function() return closed[fd] end))
+	skynet.send(gate, "text", "kick " .. fd2)
+	assert(wait(function() return closed[fd2] end))
+	socket.close(c2)
+	skynet.kill(gate)
+	skynet.error("gate redirect ok")
+	skynet.exit()
+end)
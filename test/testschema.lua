@@ -0,0 +1,174 @@
+local skynet = require "skynet"
+local schema = require "skynet.schema"
+
+-- schema pack test and benchmark : bytes and ns per message, schema vs dynamic seri
+-- usage : testschema [loops]
+local mode, loops = ...
+
+local S = schema.register [[
+Pos { x : number  y : number  z : number }
+Buff { id : integer  time : number }
+Player {
+	id : integer
+	name : string
+	level : integer
+	exp : integer
+	pos : Pos
+	bag : *integer
+	buffs : *Buff
+	online : boolean
+	extra : any
+}
+Node { value : integer  next : Node }
+]]
+
+local function player(i, meta)
+	local function m(t, name)
+		return meta and setmetatable(t, S[name]) or t
+	end
+	return m({
+		id = i,
+		name = "player" .. i,
+		level = i % 100,
+		exp = i * 1000003,
+		pos = m({ x = i * 0.5, y = -i + 0.5, z = 0.0 }, "Pos"),
+		bag = { 1001, 1002, 1003, 2001, 2002, -1, 65536, 1 << 40 },
+		buffs = { m({ id = 1, time = 3600.0 }, "Buff"), m({ id = 2, time = 120.5 }, "Buff") },
+		online = true,
+	}, "Player")
+end
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function size(...)
+	local msg, sz = skynet.pack(...)
+	skynet.trash(msg, sz)
+	return sz
+end
+
+local function correctness()
+	local p = player(1, true)
+	p.extra = { "any", { nested = true } }
+	local r = skynet.unpack(skynet.packstring(p))
+	assert(equal(r, p))
+	assert(getmetatable(r) == S.Player and getmetatable(r.pos) == S.Pos)
+	assert(size(p) < size(player(1)))
+	-- missing fields
+	local q = setmetatable({ id = 2 }, S.Player)
+	assert(equal(skynet.unpack(skynet.packstring(q)), q))
+	-- recursive schema
+	local list = setmetatable({ value = 1, next = setmetatable({ value = 2 }, S.Node) }, S.Node)
+	assert(equal(skynet.unpack(skynet.packstring(list)), list))
+	-- fallback to dynamic : extra key, wrong type, holes in array
+	local function fallback(t)
+		local sz = size(t)
+		local u = skynet.unpack(skynet.packstring(t))
+		assert(equal(u, t))
+		return sz
+	end
+	local t = player(3, true)
+	t.unknown = 1
+	fallback(t)
+	t = player(3, true)
+	t.level = "high"
+	fallback(t)
+	t = player(3, true)
+	t.bag[20] = 1
+	fallback(t)
+	t = player(3, true)
+	t.pos.w = 1
+	fallback(t)
+	-- another process may give the schema another id : it is found by the fingerprint
+	local str = skynet.packstring(q)
+	assert(str:byte(1) == 7 and str:byte(2) == 10)	-- TYPE_SCHEMA, id in one byte
+	local moved = str:sub(1, 2) .. string.char(str:byte(3) ~ 1) .. str:sub(4)
+	r = skynet.unpack(moved)
+	assert(equal(r, q) and getmetatable(r) == S.Player)
+	-- a schema not registered here (or with another layout) is refused
+	local unknown = str:sub(1, 3) .. string.char(str:byte(4) ~ 1) .. str:sub(5)
+	assert(not pcall(skynet.unpack, unknown))
+	-- same definition again gives the same id, a different one is an error
+	assert(schema.register "Pos { x : number  y : number  z : number }".Pos == S.Pos)
+	assert(not pcall(schema.register, "Pos { x : number }"))
+	assert(not pcall(schema.register, "Bad { x : unknown }"))
+end
+
+local LOOPS = tonumber(loops) or 20000
+
+local ROUNDS = 5
+
+-- best of several shorter rounds : a single round is easily disturbed by gc and other threads
+local function best(f)
+	local ti = math.huge
+	for _ = 1, ROUNDS do
+		skynet.yield()
+		collectgarbage()
+		local start = skynet.hpc()
+		f()
+		ti = math.min(ti, skynet.hpc() - start)
+	end
+	return ti / (LOOPS // ROUNDS)
+end
+
+local function bench(name, ...)
+	local args = table.pack(...)
+	local sz = size(...)
+	local pack_ti = best(function()
+		for i = 1, LOOPS // ROUNDS do
+			local m, s = skynet.pack(table.unpack(args, 1, args.n))
+			skynet.trash(m, s)
+		end
+	end)
+	local str = skynet.packstring(...)
+	local unpack_ti = best(function()
+		for i = 1, LOOPS // ROUNDS do
+			skynet.unpack(str)
+		end
+	end)
+	skynet.error(string.format("%-16s %5d bytes : pack %7.1f ns, unpack %7.1f ns", name, sz, pack_ti, unpack_ti))
+end
+
+if mode == "echo" then
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, p)
+			skynet.ret(skynet.pack(p))
+		end)
+	end)
+	return
+end
+
+skynet.start(function()
+	correctness()
+	-- between services : every service registers the same schemas
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	local p = player(5, true)
+	local r = skynet.call(echo, "lua", p)
+	assert(equal(r, p) and getmetatable(r) == S.Player)
+	skynet.error("schema ok")
+
+	bench("player dynamic", "update", player(1))
+	bench("player schema", "update", player(1, true))
+	local list, slist = {}, {}
+	for i = 1, 20 do
+		list[i] = player(i)
+		slist[i] = player(i, true)
+	end
+	bench("scene dynamic", "scene", list)
+	bench("scene schema", "scene", slist)
+	skynet.exit()
+end)
@@ -0,0 +1,38 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- socket.sendfile and socket.zwrite (MSG_ZEROCOPY) test
+local FILENAME = "lualib/skynet.lua"
+local PORT = 8004
+
+local function readfile(filename)
+	local f = assert(io.open(filename, "rb"))
+	local content = f:read "a"
+	f:close()
+	return content
+end
+
+skynet.start(function()
+	local content = readfile(FILENAME)
+	local big = string.rep("0123456789abcdef", 64 * 1024)	-- 1M
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id, addr)
+		socket.start(id)
+		assert(socket.sendfile(id, FILENAME) == #content)
+		assert(socket.sendfile(id, FILENAME, 10, 100) == 100)
+		socket.zwrite(id, big)
+		socket.write(id, "END")
+		assert(socket.sendfile(id, "not_exist_file") == false)
+		socket.close(id)
+	end)
+
+	local id = assert(socket.open("127.0.0.1", PORT))
+	assert(socket.read(id, #content) == content)
+	assert(socket.read(id, 100) == content:sub(11, 110))
+	assert(socket.read(id, #big) == big)
+	assert(socket.read(id, 3) == "END")
+	socket.close(id)
+	socket.close(lid)
+	print("sendfile ok")
+	skynet.exit()
+end)
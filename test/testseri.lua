@@ -0,0 +1,154 @@
+local skynet = require "skynet"
+
+-- lua-seri correctness and pack/unpack benchmark over realistic nested tables
+-- usage : testseri [loops]
+local LOOPS = tonumber((...)) or 100000
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function roundtrip(...)
+	local n = select("#", ...)
+	local msg, sz = skynet.pack(...)
+	local r = table.pack(skynet.unpack(msg, sz))
+	skynet.trash(msg, sz)
+	assert(r.n == n)
+	for i = 1, n do
+		assert(equal(r[i], (select(i, ...))), i)
+	end
+	local str = skynet.packstring(...)
+	assert(#str == sz)
+	r = table.pack(skynet.unpack(str))
+	assert(r.n == n)
+end
+
+local function player(i)
+	return {
+		id = i,
+		name = "player" .. i,
+		level = i % 100,
+		exp = i * 1000003,
+		pos = { x = i * 0.5, y = -i, z = 0 },
+		bag = { 1001, 1002, 1003, 2001, 2002, -1, 65536, 1 << 40 },
+		buffs = { { id = 1, time = 3600 }, { id = 2, time = 120.5 } },
+		online = true,
+	}
+end
+
+local CASES = {
+	small = function() return "login", 10086, true end,
+	player = function() return "update", player(1) end,
+	-- a scene broadcast, ~10KB
+	scene = function()
+		local list = {}
+		for i = 1, 40 do
+			list[i] = player(i)
+		end
+		return "scene", list
+	end,
+	-- a large binary blob, 64KB
+	blob = function() return "blob", string.rep("x", 65536) end,
+}
+
+local function correctness()
+	roundtrip()
+	roundtrip(nil, false, 0, -1, 255, 256, 65535, 65536, -65536, 1 << 31, math.mininteger, math.maxinteger, 3.14)
+	roundtrip("", string.rep("a", 31), string.rep("b", 32), string.rep("c", 0x10000))
+	for _, f in pairs(CASES) do
+		roundtrip(f())
+	end
+	local array = {}
+	for i = 1, 1000 do
+		array[i] = i
+	end
+	roundtrip(array, { [1] = 1, [3] = 3, x = { y = { z = {} } } })
+	-- larger than the per-thread buffer kept between packs
+	roundtrip(string.rep("d", 2 * 1024 * 1024), array)
+
+	-- pack inside __pairs : nested pack must not reuse the buffer in use
+	local inner
+	local meta = setmetatable({}, { __pairs = function(t)
+		inner = skynet.packstring("inner", player(2))
+		return next, { a = 1, b = "two" }, nil
+	end })
+	local msg, sz = skynet.pack(player(3), meta, player(4))
+	assert(equal({ skynet.unpack(msg, sz) }, { player(3), { a = 1, b = "two" }, player(4) }))
+	skynet.trash(msg, sz)
+	assert(equal({ skynet.unpack(inner) }, { "inner", player(2) }))
+
+	-- unpack key cache : many distinct keys, and tables of different sizes sharing the first key
+	local keys = {}
+	for i = 1, 2000 do
+		keys["key" .. i] = i
+	end
+	roundtrip(keys, keys)
+	for i = 1, 50 do
+		local t = { id = i }
+		for j = 1, i % 7 do
+			t["f" .. j] = j
+		end
+		roundtrip(t, player(i), t)
+	end
+
+	-- errors release the buffer
+	assert(not pcall(skynet.pack, "x", print))
+	local deep = {}
+	for i = 1, 40 do
+		deep = { deep }
+	end
+	assert(not pcall(skynet.pack, deep))
+	-- errors raised by metamethods unwind through pack
+	local badmeta = setmetatable({}, setmetatable({}, { __index = function() error "bad meta" end }))
+	assert(not pcall(skynet.pack, "x", { badmeta }))
+	assert(not pcall(skynet.packstring, badmeta))
+	local badpairs = setmetatable({}, { __pairs = function()
+		skynet.packstring(player(6))
+		error "bad pairs"
+	end })
+	assert(not pcall(skynet.pack, { badpairs }))
+	roundtrip(player(5))
+end
+
+local function bench(name, f)
+	local args = table.pack(f())
+	local msg, sz = skynet.pack(table.unpack(args, 1, args.n))
+	skynet.trash(msg, sz)
+	local loops = LOOPS // (1 + sz // 1024)	-- keep large cases short
+	local start = skynet.hpc()
+	for i = 1, loops do
+		local m, s = skynet.pack(table.unpack(args, 1, args.n))
+		skynet.trash(m, s)
+	end
+	local pack_ti = (skynet.hpc() - start) / loops
+	local str = skynet.packstring(table.unpack(args, 1, args.n))
+	start = skynet.hpc()
+	for i = 1, loops do
+		skynet.unpack(str)
+	end
+	local unpack_ti = (skynet.hpc() - start) / loops
+	skynet.error(string.format("%-8s %6d bytes : pack %7.1f ns, unpack %7.1f ns",
+		name, sz, pack_ti, unpack_ti))
+end
+
+skynet.start(function()
+	correctness()
+	skynet.error("seri ok")
+	for _, name in ipairs { "small", "player", "scene", "blob" } do
+		bench(name, CASES[name])
+	end
+	skynet.exit()
+end)
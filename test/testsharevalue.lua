@@ -0,0 +1,106 @@
+local skynet = require "skynet"
+local sharevalue = require "skynet.sharevalue"
+
+-- pass a large read only table between services : serialized call vs sharevalue token
+-- usage : testsharevalue [items] [calls]
+local mode, items, calls = ...
+
+if mode == "recv" then
+	local held = {}
+	local CMD = {}
+
+	local function check(t)
+		return #t.list, t.list[#t.list].name, t.config.version
+	end
+
+	function CMD.plain(t)
+		return check(t)
+	end
+
+	function CMD.open(token)
+		local t = sharevalue.open(token)
+		table.insert(held, t)
+		return check(t)
+	end
+
+	function CMD.read(token)
+		-- read one field and release at once, strings from t are invalid after release
+		local t = sharevalue.open(token)
+		local ok = t.list[1].name == "item1"
+		sharevalue.release(t)
+		return ok
+	end
+
+	function CMD.release()
+		for _, t in ipairs(held) do
+			sharevalue.release(t)
+		end
+		held = {}
+	end
+
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, ...)
+			skynet.ret(skynet.pack(CMD[cmd](...)))
+		end)
+	end)
+	return
+end
+
+local ITEMS = tonumber(mode) or 20000
+local CALLS = tonumber(items) or 20
+
+local function bigtable()
+	local list = {}
+	for i = 1, ITEMS do
+		list[i] = { id = i, name = "item" .. i, price = i * 0.5, tags = { "a", "b", i } }
+	end
+	return { list = list, config = { version = 3, enable = true } }
+end
+
+skynet.start(function()
+	local recv = skynet.newservice(SERVICE_NAME, "recv")
+	local data = bigtable()
+
+	-- correctness
+	local v = sharevalue.new(data)
+	local n, name, version = skynet.call(recv, "lua", "open", sharevalue.token(v))
+	assert(n == ITEMS and name == "item" .. ITEMS and version == 3)
+	-- sender releases first, receiver still holds it
+	sharevalue.release(v)
+	assert(sharevalue.count() == 1)
+	skynet.call(recv, "lua", "release")
+	assert(sharevalue.count() == 0)
+	-- one-shot token
+	assert(skynet.call(recv, "lua", "read", sharevalue.share(data)))
+	assert(sharevalue.count() == 0)
+	-- unsupported values
+	assert(not pcall(sharevalue.new, { print }))
+	local loop = {}
+	loop.self = loop
+	assert(not pcall(sharevalue.new, loop))
+	-- unused token
+	local token = sharevalue.share { 1, 2, 3 }
+	sharevalue.drop(token)
+	assert(sharevalue.count() == 0)
+	skynet.error("sharevalue ok")
+
+	local start = skynet.hpc()
+	for i = 1, CALLS do
+		assert(skynet.call(recv, "lua", "plain", data) == ITEMS)
+	end
+	local plain = (skynet.hpc() - start) / CALLS
+
+	start = skynet.hpc()
+	v = sharevalue.new(data)
+	local build = skynet.hpc() - start
+	for i = 1, CALLS do
+		assert(skynet.call(recv, "lua", "open", sharevalue.token(v)) == ITEMS)
+	end
+	local shared = (skynet.hpc() - start) / CALLS
+	skynet.error(string.format("%d items, %d bytes : plain call %.2f ms, sharevalue call %.2f ms (new %.2f ms)",
+		ITEMS, sharevalue.size(v), plain / 1e6, shared / 1e6, build / 1e6))
+	sharevalue.release(v)
+	skynet.call(recv, "lua", "release")
+	assert(sharevalue.count() == 0)
+	skynet.exit()
+end)
@@ -0,0 +1,88 @@
+local skynet = require "skynet"
+local slog = require "skynet.slog"
+local slogreader = require "skynet.slogreader"
+local schema = require "skynet.schema"
+
+-- structured log test, run with config :
+--	logbinary = "/tmp/testslog/skynet.slog"
+local N = 100000
+-- two formats with the same FNV-1a hash
+local COLLIDE1 = "collide 471608 %s"
+local COLLIDE2 = "collide 1418646 %s"
+assert(slog.hash(COLLIDE1) == slog.hash(COLLIDE2))
+
+local mode = ...
+if mode == "collide" then
+	local tag = table.concat({ select(2, ...) }, " ")
+	skynet.start(function()
+		slog.log(COLLIDE2, tag)
+		skynet.exit()
+	end)
+	return
+end
+
+skynet.start(function()
+	local filename = skynet.getenv "logbinary"
+	if not filename then
+		skynet.error("testslog needs logbinary in config")
+		skynet.exit()
+		return
+	end
+	local tag = "testslog " .. skynet.now()
+	local start = skynet.hpc()
+	for i = 1, N do
+		slog.log("%s %d %s %.1f %s", tag, i, "player", i / 2, i % 2 == 0)
+	end
+	local ti = skynet.hpc() - start
+	slog.log("%s table %s nil %s", tag, { 1, 2, x = "y" }, nil)
+	slog.log("%s mismatch %d", tag, "str")
+	-- schema packed values : the definitions go to the log before the first record using them
+	local S = schema.register [[
+		SlogPos { x : integer }
+		SlogBox { pos : SlogPos }
+		SlogBag { bag : *number }
+	]]
+	slog.log("%s schema %s %s", tag, setmetatable({ pos = setmetatable({ x = -3 }, S.SlogPos) }, S.SlogBox),
+		setmetatable({ bag = { 1.5, 2.5 } }, S.SlogBag))
+	-- id collisions : in this service, then between services (rewritten by logger)
+	slog.log(COLLIDE1, tag)
+	slog.log(COLLIDE2, tag)
+	skynet.newservice(SERVICE_NAME, "collide", tag)
+	skynet.sleep(200)	-- logger flushes once a second
+
+	local count = 0
+	local extra = {}
+	local extra_source = {}
+	local self = skynet.self()
+	for _, source, text in slogreader.records(filename) do
+		local i = text:match("^" .. tag .. " (%d+) ")
+		if i then
+			count = count + 1
+			i = tonumber(i)
+			assert(i == count, "out of order")
+			assert(source == self)
+			assert(text == string.format("%s %d player %.1f %s", tag, i, i / 2, i % 2 == 0), text)
+		elseif text:find(tag, 1, true) then
+			table.insert(extra, text)
+			table.insert(extra_source, source)
+		end
+	end
+	assert(count == N, count)
+	assert(extra[1] == tag .. " table {1,2,x=y} nil nil", extra[1])
+	assert(extra[2] == "%s mismatch %d " .. tag .. " str", extra[2])
+	assert(extra[3] == tag .. " schema {pos={x=-3}} {bag={1.5,2.5}}", extra[3])
+	assert(extra[4] == COLLIDE1:format(tag), extra[4])
+	assert(extra[5] == COLLIDE2:format(tag), extra[5])
+	-- the child sends COLLIDE2 with the plain hash id, which is COLLIDE1's in the file
+	assert(#extra == 6, #extra)
+	assert(extra[6] == COLLIDE2:format(tag) and extra_source[6] ~= self, extra[6])
+
+	start = skynet.hpc()
+	for i = 1, N do
+		skynet.error(string.format("%s %d %s %.1f %s", tag, i, "player", i / 2, i % 2 == 0))
+	end
+	local ti2 = skynet.hpc() - start
+	skynet.error(string.format("%d logs : slog %.1f ms, skynet.error %.1f ms", N, ti / 1e6, ti2 / 1e6))
+	skynet.error("slog ok")
+	skynet.exit()
+end)
@@ -0,0 +1,51 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- udp throughput benchmark : skynet testudpbatch [count] [size]
+-- the socket thread reads datagrams with recvmmsg and flushes queued datagrams with sendmmsg.
+local count, size = ...
+count = tonumber(count) or 200000
+size = tonumber(size) or 512
+
+local PORT = 8767
+
+skynet.start(function()
+	local recv = 0
+	local bytes = 0
+	local bad = 0
+	local finish = coroutine.running()
+	local payload = string.rep("x", size - 4)
+	local server = socket.udp(function(str, from)
+		recv = recv + 1
+		bytes = bytes + #str
+		if #str ~= size or str:sub(5) ~= payload then
+			bad = bad + 1
+		end
+		if recv == count then
+			skynet.wakeup(finish)
+		end
+	end, "127.0.0.1", PORT)
+
+	local client = socket.udp(function() end)
+	socket.udp_connect(client, "127.0.0.1", PORT)
+
+	local start = skynet.now()
+	skynet.fork(function()
+		for i = 1, count do
+			socket.write(client, string.pack(">I4", i) .. payload)
+			if i % 1000 == 0 then
+				-- leave the socket thread and the receiver some time, udp drops when the kernel buffer is full
+				skynet.sleep(0)
+			end
+		end
+		skynet.sleep(200)
+		skynet.wakeup(finish)
+	end)
+	skynet.wait(finish)
+	local ti = (skynet.now() - start) / 100
+	skynet.error(string.format("udp recv %d/%d datagrams (%d bad), %d bytes in %.2fs, %.0f/s",
+		recv, count, bad, bytes, ti, recv / math.max(ti, 0.01)))
+	socket.close(client)
+	socket.close(server)
+	skynet.exit()
+end)
@@ -0,0 +1,101 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- send buffer watermark test : high/low writable events, droplow and hard limit
+local PORT = 8006
+local CHUNK = string.rep("x", 256 * 1024)
+local KB = 1024
+local MB = 1024 * 1024
+
+local function netstat(id)
+	for _, info in ipairs(socket.netstat()) do
+		if info.id == id then
+			return info
+		end
+	end
+end
+
+local function wait(f)
+	for i = 1, 500 do
+		if f() then
+			return true
+		end
+		skynet.sleep(1)
+	end
+end
+
+skynet.start(function()
+	local events = {}
+	local conns = {}
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.watermark(lid, 1 * MB, 256 * KB, 64 * MB, true)
+	socket.start(lid, function(id, addr)
+		socket.start(id)
+		socket.onwritable(id, function(id, writable)
+			table.insert(events, writable)
+		end)
+		table.insert(conns, id)
+	end)
+
+	-- 1. high / low watermark and droplow
+	local c = socket.open("127.0.0.1", PORT)
+	socket.pause(c)
+	assert(wait(function() return #conns == 1 end))
+	local s = conns[1]
+	local sent = 0
+	while not socket.blocked(s) and sent < 256 * MB do
+		socket.write(s, CHUNK)
+		sent = sent + #CHUNK
+		skynet.sleep(0)
+	end
+	assert(socket.blocked(s) and events[1] == false)
+	socket.lwrite(s, CHUNK)	-- dropped
+	skynet.sleep(1)
+	local info = netstat(s)
+	skynet.error(string.format("blocked after %d K, wbuffer %d K, drop %d K",
+		sent // KB, info.wbuffer // KB, info.wdrop // KB))
+	assert(info.blocked and info.wdrop == #CHUNK and info.whigh == 1 * MB)
+	assert(#socket.read(c, sent) == sent)	-- read resumes the paused socket
+	assert(wait(function() return events[2] == true end))
+	assert(not socket.blocked(s))
+	socket.close(c)
+	socket.close(s)
+
+	-- 2. hard limit
+	socket.watermark(lid, 1 * MB, 256 * KB, 4 * MB)
+	c = socket.open("127.0.0.1", PORT)
+	socket.pause(c)
+	assert(wait(function() return #conns == 2 end))
+	s = conns[2]
+	for i = 1, 256 do
+		socket.write(s, CHUNK)
+		skynet.sleep(0)
+		if not netstat(s) then
+			break
+		end
+	end
+	assert(netstat(s) == nil)
+	skynet.error("closed by send buffer limit")
+	socket.close(c)
+	socket.close(s)
+
+	-- 3. the rest of a direct write (from this worker thread) counts too
+	socket.watermark(lid, 1 * MB, 256 * KB, 0)
+	c = socket.open("127.0.0.1", PORT)
+	socket.pause(c)
+	assert(wait(function() return #conns == 3 end))
+	s = conns[3]
+	local n = #events
+	local big = string.rep("y", 16 * MB)
+	socket.write(s, big)
+	assert(wait(function() return socket.blocked(s) end))
+	assert(events[n+1] == false)
+	assert(#socket.read(c, #big) == #big)
+	assert(wait(function() return events[n+2] == true end))
+	socket.close(c)
+	socket.close(s)
+	skynet.error("direct write watermark ok")
+	socket.close(lid)
+	skynet.error("watermark ok")
+	skynet.exit()
+end)